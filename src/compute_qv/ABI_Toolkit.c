@@ -29,10 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ABI_Toolkit.h"
-
-static char   *gFile = NULL;
-unsigned long  dirloc;
-unsigned long  tag_count;
+#include "util.h"
 
 unsigned long get_offset(unsigned char *cptr)
 {
@@ -51,46 +48,138 @@ unsigned long get_offset(unsigned char *cptr)
     return total;
 }
 
-ABIError ABI_Open(void *file, size_t size)
+#define DIR_ENTRY_SIZE 28
+
+/*
+ * A slot of the hash of the tag directory.  Only the low byte of the id
+ * of an entry is significant.
+ */
+struct _abi_dir_slot {
+    unsigned long  tag;         /* the 4 characters of the tag */
+    int            id;
+    char          *entry;       /* the directory entry, NULL if free */
+};
+
+static unsigned long dir_slot_hash(unsigned long tag, int id)
+{
+    return (tag * 31 + id) * 2654435761UL;
+}
+
+/*
+ * This function builds the hash of the tag directory of an open file, so
+ * that each tag is found with a single probe.  Where a tag and id occur
+ * more than once, the first entry is kept, like the linear search did.
+ * If memory is short, the handle is left without the hash and the
+ * directory is searched linearly.
+ */
+static void build_dir_index(ABIFile *abi)
+{
+    unsigned long i, h, mask;
+    unsigned long tag;
+    int id;
+    char *tagptr = abi->file + abi->dirloc;
+
+    for (abi->index_size = 16; abi->index_size < 2 * abi->tag_count; )
+        abi->index_size *= 2;
+    abi->index = (struct _abi_dir_slot *)
+        calloc(abi->index_size, sizeof(struct _abi_dir_slot));
+    if (abi->index == NULL)
+    {
+        abi->index_size = 0;
+        return;
+    }
+    mask = abi->index_size - 1;
+
+    for (i = 0; i < abi->tag_count; i++, tagptr += DIR_ENTRY_SIZE)
+    {
+        tag = get_offset((unsigned char *)tagptr);
+        id  = *((unsigned char *) tagptr + 7);
+        for (h = dir_slot_hash(tag, id) & mask; abi->index[h].entry != NULL;
+             h = (h + 1) & mask)
+        {
+            if ((abi->index[h].tag == tag) && (abi->index[h].id == id))
+                break;
+        }
+        if (abi->index[h].entry == NULL)
+        {
+            abi->index[h].tag   = tag;
+            abi->index[h].id    = id;
+            abi->index[h].entry = tagptr;
+        }
+    }
+}
+
+ABIError ABI_Open(ABIFile *abi, void *file, size_t size)
 {
     ABIError error = kNoError;
 
-    if (gFile != NULL)
+    if (abi->file != NULL)
         error = kFileAlreadyOpen;
     else
     {
-        gFile = (char *) file;
+        abi->file = (char *) file;
+        abi->index = NULL;
+        abi->index_size = 0;
 
-        dirloc = get_offset((unsigned char *)((unsigned char *)file + 26));
+        abi->dirloc =
+            get_offset((unsigned char *)((unsigned char *)file + 26));
 
-        if (dirloc > size || dirloc < 128)
+        if (abi->dirloc > size || abi->dirloc < 128)
             error = kBadCatalogLocation;
 
-        tag_count = get_offset((unsigned char *)((unsigned char *)file + 18));
+        abi->tag_count =
+            get_offset((unsigned char *)((unsigned char *)file + 18));
+
+        if (error == kNoError)
+        {
+            /* Ignore the entries which would lie past the end of the file */
+            if (abi->tag_count > (size - abi->dirloc) / DIR_ENTRY_SIZE)
+                abi->tag_count = (size - abi->dirloc) / DIR_ENTRY_SIZE;
+            build_dir_index(abi);
+        }
     }
     return error;
 }
 
-ABIError ABI_Close(void *file)
+ABIError ABI_Close(ABIFile *abi, void *file)
 {
     ABIError error = kNoError;
 
-    if (gFile != file)
+    if (abi->file != file)
         error = kFileNotOpen;
     else
-        gFile = NULL;
+    {
+        abi->file = NULL;
+        free(abi->index);
+        abi->index = NULL;
+        abi->index_size = 0;
+    }
 
     return error;
 }
 
-char *find_dir_entry(char *tag, int id)
+static char *find_dir_entry(ABIFile *abi, char *tag, int id)
 {
     int i;
     char curtag[4];
     int curid;
-    char *tagptr = gFile + dirloc;
+    char *tagptr = abi->file + abi->dirloc;
+    unsigned long h, key, mask;
+
+    if (abi->index != NULL)
+    {
+        key  = get_offset((unsigned char *)tag);
+        mask = abi->index_size - 1;
+        for (h = dir_slot_hash(key, id) & mask;
+             abi->index[h].entry != NULL; h = (h + 1) & mask)
+        {
+            if ((abi->index[h].tag == key) && (abi->index[h].id == id))
+                return abi->index[h].entry;
+        }
+        return NULL;
+    }
 
-    for (i = 0; i < (int)tag_count; i++)
+    for (i = 0; i < (int)abi->tag_count; i++)
     {
         curtag[0] = *tagptr;
         curtag[1] = *(tagptr + 1);
@@ -103,18 +192,18 @@ char *find_dir_entry(char *tag, int id)
             if (curid == id)
                 return tagptr;
         }
-        tagptr += 28;
+        tagptr += DIR_ENTRY_SIZE;
     }
     return NULL;
 }
 
-ABIError ABI_NumCalledBases(long *num_bases)
+ABIError ABI_NumCalledBases(ABIFile *abi, long *num_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *num_bases = 0;
-    location = find_dir_entry("PBAS", 2);
+    location = find_dir_entry(abi, "PBAS", 2);
     if (location)
     {
        *num_bases = get_offset((unsigned char *)(location + 12));
@@ -123,13 +212,13 @@ ABIError ABI_NumCalledBases(long *num_bases)
     return error;
 }
 
-ABIError ABI_NumEditedBases(long *num_bases)
+ABIError ABI_NumEditedBases(ABIFile *abi, long *num_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *num_bases = 0;
-    location = find_dir_entry("PBAS", 1);
+    location = find_dir_entry(abi, "PBAS", 1);
     if (location)
     {
        *num_bases = get_offset((unsigned char *)(location + 12));
@@ -138,13 +227,13 @@ ABIError ABI_NumEditedBases(long *num_bases)
     return error;
 }
 
-ABIError ABI_NumConsensusBases(long *num_bases)
+ABIError ABI_NumConsensusBases(ABIFile *abi, long *num_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *num_bases = 0;
-    location = find_dir_entry("aSEQ", 1);
+    location = find_dir_entry(abi, "aSEQ", 1);
     if (location)
     {
        *num_bases = get_offset((unsigned char *)(location + 12));
@@ -153,13 +242,13 @@ ABIError ABI_NumConsensusBases(long *num_bases)
     return error;
 }
 
-ABIError ABI_NumCalledPeakLocations(long *num_locs)
+ABIError ABI_NumCalledPeakLocations(ABIFile *abi, long *num_locs)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *num_locs = 0;
-    location = find_dir_entry("PLOC", 2);
+    location = find_dir_entry(abi, "PLOC", 2);
     if (location)
     {
        *num_locs = get_offset((unsigned char *)(location + 12));
@@ -168,13 +257,13 @@ ABIError ABI_NumCalledPeakLocations(long *num_locs)
     return error;
 }
 
-ABIError ABI_NumEditedPeakLocations(long *num_locs)
+ABIError ABI_NumEditedPeakLocations(ABIFile *abi, long *num_locs)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *num_locs = 0;
-    location = find_dir_entry("PLOC", 1);
+    location = find_dir_entry(abi, "PLOC", 1);
     if (location)
     {
        *num_locs = get_offset((unsigned char *)(location + 12));
@@ -183,12 +272,12 @@ ABIError ABI_NumEditedPeakLocations(long *num_locs)
     return error;
 }
 
-ABIError ABI_MobilityFile(long buffer_size, char *file_name, long *data_size)
+ABIError ABI_MobilityFile(ABIFile *abi, long buffer_size, char *file_name, long *data_size)
 {
     ABIError error = kDataNotFound;
     char *location;
 
-    location = find_dir_entry("PDMF", 2);
+    location = find_dir_entry(abi, "PDMF", 2);
     if (location)
     {
        *data_size = get_offset((unsigned char *)(location + 12));
@@ -198,14 +287,14 @@ ABIError ABI_MobilityFile(long buffer_size, char *file_name, long *data_size)
             fprintf(stderr, 
                 "Warning: Mobility file name will be truncated ");
             fprintf(stderr, "- need a larger buffer.\n");
-            memcpy(file_name, gFile + 
+            memcpy(file_name, abi->file + 
                 get_offset((unsigned char *)(location + 20)) + 1, 
                 buffer_size - 1);
             file_name[buffer_size] = '\0';
         }
         else
         {
-            memcpy(file_name, gFile + 
+            memcpy(file_name, abi->file + 
                 get_offset((unsigned char *)(location + 20)) + 1, *data_size-1);
 	    file_name[*data_size - 1] = '\0';
 	}
@@ -214,12 +303,12 @@ ABIError ABI_MobilityFile(long buffer_size, char *file_name, long *data_size)
     return error;
 }
 
-ABIError ABI_AnalysisVersion(long buffer_size, char *software, long *data_size)
+ABIError ABI_AnalysisVersion(ABIFile *abi, long buffer_size, char *software, long *data_size)
 {
     ABIError error = kDataNotFound;
     char *location;
 
-    location = find_dir_entry("SVER", 2);
+    location = find_dir_entry(abi, "SVER", 2);
     if (location)
     {
        *data_size = get_offset((unsigned char *)(location + 12));
@@ -228,13 +317,13 @@ ABIError ABI_AnalysisVersion(long buffer_size, char *software, long *data_size)
         {
             fprintf(stderr, "Warning: Analysis version will be truncated - ");
             fprintf(stderr, "need a larger buffer.\n");
-            memcpy(software, gFile + 
+            memcpy(software, abi->file + 
                 get_offset((unsigned char *)(location+20)) + 1, buffer_size-1);
             software[buffer_size] = '\0';
         }
         else
         {
-            memcpy(software, gFile + 
+            memcpy(software, abi->file + 
                 get_offset((unsigned char *)(location+20)) + 1, *data_size-1);
             software[*data_size - 1] = '\0';
         }
@@ -243,20 +332,20 @@ ABIError ABI_AnalysisVersion(long buffer_size, char *software, long *data_size)
     return error;
 }
 
-ABIError ABI_CalledBases(char *called_bases)
+ABIError ABI_CalledBases(ABIFile *abi, char *called_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
     unsigned long base_count;
     unsigned long base_start;
 
-    location = find_dir_entry("PBAS", 2);
+    location = find_dir_entry(abi, "PBAS", 2);
     if (location)
     {
         base_count = get_offset((unsigned char *)(location + 12));
         base_start = get_offset((unsigned char *)(location + 20));
 
-        memcpy(called_bases, gFile + base_start, base_count);
+        memcpy(called_bases, abi->file + base_start, base_count);
         /* called_bases[base_count] = '\0';*/
 
         error = kNoError;
@@ -264,20 +353,20 @@ ABIError ABI_CalledBases(char *called_bases)
     return error;
 }
 
-ABIError ABI_EditedBases(char *edited_bases)
+ABIError ABI_EditedBases(ABIFile *abi, char *edited_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
     unsigned long base_count;
     unsigned long base_start;
 
-    location = find_dir_entry("PBAS", 1);
+    location = find_dir_entry(abi, "PBAS", 1);
     if (location)
     {
         base_count = get_offset((unsigned char *)(location + 12));
         base_start = get_offset((unsigned char *)(location + 20));
 
-        memcpy(edited_bases, gFile + base_start, base_count);
+        memcpy(edited_bases, abi->file + base_start, base_count);
         /* edited_bases[base_count] = '\0';*/
 
 	error = kNoError;
@@ -285,20 +374,20 @@ ABIError ABI_EditedBases(char *edited_bases)
     return error;
 }
 
-ABIError ABI_ConsensusBases(char *cons_bases)
+ABIError ABI_ConsensusBases(ABIFile *abi, char *cons_bases)
 {
     ABIError error = kDataNotFound;
     char *location;
     unsigned long base_count;
     unsigned long base_start;
 
-    location = find_dir_entry("aSEQ", 1);
+    location = find_dir_entry(abi, "aSEQ", 1);
     if (location)
     {
         base_count = get_offset((unsigned char *)(location + 12));
         base_start = get_offset((unsigned char *)(location + 20));
 
-        memcpy(cons_bases, gFile + base_start, base_count);
+        memcpy(cons_bases, abi->file + base_start, base_count);
         /* cons_bases[base_count] = '\0';*/
 
         error = kNoError;
@@ -306,12 +395,12 @@ ABIError ABI_ConsensusBases(char *cons_bases)
     return error;
 }
 
-ABIError ABI_NumQualityValues(short *num_qvs)
+ABIError ABI_NumQualityValues(ABIFile *abi, short *num_qvs)
 {
     ABIError error = kDataNotFound;
     char *location;
 
-    location = find_dir_entry("PCON", 1);
+    location = find_dir_entry(abi, "PCON", 1);
     if (location)
     {
        *num_qvs = get_offset((unsigned char *)(location + 12));
@@ -320,27 +409,27 @@ ABIError ABI_NumQualityValues(short *num_qvs)
     return error;
 }
 
-ABIError ABI_BasecallerQualityValues(char *qv)
+ABIError ABI_BasecallerQualityValues(ABIFile *abi, char *qv)
 {
     ABIError error = kDataNotFound;
     char          *location;
     unsigned long  qv_count;
     unsigned long  qv_start;
 
-    location = find_dir_entry("PCON", 1);
+    location = find_dir_entry(abi, "PCON", 1);
     if (location)
     {
         qv_count = get_offset((unsigned char *)(location + 12));
         qv_start = get_offset((unsigned char *)(location + 20));
 
-        memcpy(qv, gFile + qv_start, qv_count);
+        memcpy(qv, abi->file + qv_start, qv_count);
 
         error = kNoError;
     }
     return error;
 }
 
-ABIError ABI_CalledPeakLocations(short *called_locs)
+ABIError ABI_CalledPeakLocations(ABIFile *abi, short *called_locs)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -348,7 +437,7 @@ ABIError ABI_CalledPeakLocations(short *called_locs)
     unsigned long peak_start;
     int i;
 
-    location = find_dir_entry("PLOC", 2);
+    location = find_dir_entry(abi, "PLOC", 2);
     if (location)
     {
         num_peaks = get_offset((unsigned char *)(location + 12));
@@ -357,9 +446,9 @@ ABIError ABI_CalledPeakLocations(short *called_locs)
         for (i = 0; i < (int)num_peaks; i++)
         {
             called_locs[i] = 
-               *((unsigned char *) (gFile + peak_start + (i * 2))) * 256;
+               *((unsigned char *) (abi->file + peak_start + (i * 2))) * 256;
             called_locs[i] += 
-               *((unsigned char *) (gFile + peak_start + (i * 2) + 1));
+               *((unsigned char *) (abi->file + peak_start + (i * 2) + 1));
         }
 
         error = kNoError;
@@ -367,7 +456,7 @@ ABIError ABI_CalledPeakLocations(short *called_locs)
     return error;
 }
 
-ABIError ABI_EditedPeakLocations(short *edited_locs)
+ABIError ABI_EditedPeakLocations(ABIFile *abi, short *edited_locs)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -375,7 +464,7 @@ ABIError ABI_EditedPeakLocations(short *edited_locs)
     unsigned long peak_start;
     int i;
 
-    location = find_dir_entry("PLOC", 1);
+    location = find_dir_entry(abi, "PLOC", 1);
     if (location)
     {
         num_peaks = get_offset((unsigned char *)(location + 12));
@@ -384,23 +473,23 @@ ABIError ABI_EditedPeakLocations(short *edited_locs)
         for (i = 0; i < (int)num_peaks; i++)
         {
             edited_locs[i] = 
-               *((unsigned char *) (gFile + peak_start + (i * 2))) * 256;
+               *((unsigned char *) (abi->file + peak_start + (i * 2))) * 256;
             edited_locs[i] += 
-               *((unsigned char *) (gFile + peak_start + (i * 2) + 1));
+               *((unsigned char *) (abi->file + peak_start + (i * 2) + 1));
         }
         error = kNoError;
     }
     return error;
 }
 
-ABIError ABI_DyeIndexToBase(short index, char *c)
+ABIError ABI_DyeIndexToBase(ABIFile *abi, short index, char *c)
 {
     ABIError error = kDataNotFound;
     char *location;
 
    *c = '\0';
 
-    location = find_dir_entry("FWO_", 1);
+    location = find_dir_entry(abi, "FWO_", 1);
     if (location)
     {
         if (index >= 1 && index <= 4)
@@ -412,7 +501,7 @@ ABIError ABI_DyeIndexToBase(short index, char *c)
     return error;
 }
 
-ABIError ABI_NumRawData(short lane, short dye, long *num_data_points)
+ABIError ABI_NumRawData(ABIFile *abi, short lane, short dye, long *num_data_points)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -420,7 +509,7 @@ ABIError ABI_NumRawData(short lane, short dye, long *num_data_points)
    *num_data_points = 0;
     lane =0;
 
-    location = find_dir_entry("DATA", dye <= 4 ? dye : 100 + dye);
+    location = find_dir_entry(abi, "DATA", dye <= 4 ? dye : 100 + dye);
     if (location)
     {
        *num_data_points = get_offset((unsigned char *)(location + 12));
@@ -429,7 +518,7 @@ ABIError ABI_NumRawData(short lane, short dye, long *num_data_points)
     return error;
 }
 
-ABIError ABI_NumAnalyzedData(short lane, short dye, long *num_data_points)
+ABIError ABI_NumAnalyzedData(ABIFile *abi, short lane, short dye, long *num_data_points)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -437,7 +526,7 @@ ABIError ABI_NumAnalyzedData(short lane, short dye, long *num_data_points)
    *num_data_points = 0;
     lane =0;
 
-    location = find_dir_entry("DATA", dye <= 4 ? dye + 8 : 200 + dye);
+    location = find_dir_entry(abi, "DATA", dye <= 4 ? dye + 8 : 200 + dye);
     if (location)
     {
        *num_data_points = get_offset((unsigned char *)(location + 12));
@@ -446,7 +535,7 @@ ABIError ABI_NumAnalyzedData(short lane, short dye, long *num_data_points)
     return error;
 }
 
-ABIError ABI_RawData(short lane, short dye, int *raw_array)
+ABIError ABI_RawData(ABIFile *abi, short lane, short dye, int *raw_array)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -456,7 +545,7 @@ ABIError ABI_RawData(short lane, short dye, int *raw_array)
 
     lane =0;
 
-    location = find_dir_entry("DATA", dye <= 4 ? dye : 100 + dye);
+    location = find_dir_entry(abi, "DATA", dye <= 4 ? dye : 100 + dye);
     if (location)
     {
         num_data = get_offset((unsigned char *)(location + 12));
@@ -465,16 +554,16 @@ ABIError ABI_RawData(short lane, short dye, int *raw_array)
         for (i = 0; i < (int)num_data; i++)
         {
             raw_array[i] =
-               *((unsigned char *) (gFile + data_start + (i * 2))) * 256;
+               *((unsigned char *) (abi->file + data_start + (i * 2))) * 256;
             raw_array[i] +=
-               *((unsigned char *) (gFile + data_start + (i * 2) + 1));
+               *((unsigned char *) (abi->file + data_start + (i * 2) + 1));
         }
         error = kNoError;
     }
     return error;
 }
 
-ABIError ABI_AnalyzedData(short lane, short dye, int *analyzed_array)
+ABIError ABI_AnalyzedData(ABIFile *abi, short lane, short dye, int *analyzed_array)
 {
     ABIError error = kDataNotFound;
     char *location;
@@ -484,7 +573,7 @@ ABIError ABI_AnalyzedData(short lane, short dye, int *analyzed_array)
 
     lane =0;
 
-    location = find_dir_entry("DATA", dye <= 4 ? dye + 8 : 200 + dye);
+    location = find_dir_entry(abi, "DATA", dye <= 4 ? dye + 8 : 200 + dye);
     if (location)
     {
         num_data = get_offset((unsigned char *)(location + 12));
@@ -493,9 +582,9 @@ ABIError ABI_AnalyzedData(short lane, short dye, int *analyzed_array)
         for (i = 0; i < (int)num_data; i++)
         {
 	    analyzed_array[i] = 
-               *((unsigned char *) (gFile + data_start + (i * 2))) * 256;
+               *((unsigned char *) (abi->file + data_start + (i * 2))) * 256;
 	    analyzed_array[i] += 
-               *((unsigned char *) (gFile + data_start + (i * 2) + 1));
+               *((unsigned char *) (abi->file + data_start + (i * 2) + 1));
 	}
 	error = kNoError;
     }
@@ -508,7 +597,7 @@ ABIError ABI_AnalyzedData(short lane, short dye, int *analyzed_array)
  */
 char *ABI_ErrorString(ABIError k)
 {
-    static char line[80];
+    static TT_THREAD_LOCAL char line[80];
 
     switch(k) {
         case kNoError:
@@ -526,9 +615,11 @@ char *ABI_ErrorString(ABIError k)
         case kFileAlreadyOpen:
             return "File has already been openned";
         case kWrongFileType:
-            return "Not an ABI, SCF or SFF file";
+            return "Not an ABI, SCF, ZTR or SFF file";
         case kBadCatalogLocation:
             return "Sample file corrupt - bad catalog location";
+        case kBadCompressedData:
+            return "Compressed sample file corrupt";
         default: 
             sprintf(line,"Unknown error code %d",k);
 
@@ -36,28 +36,41 @@ typedef short ABIError;
 #define kFileAlreadyOpen    -7
 #define kWrongFileType      -8
 #define kBadCatalogLocation -9
+#define kBadCompressedData  -10
+
+/*
+ * Handle for one open ABI file. Each reader owns its own handle, so that
+ * several files may be open at once in different threads.
+ */
+typedef struct _abi_file {
+    char          *file;       /* contents of the file, NULL if not open */
+    unsigned long  dirloc;     /* offset of the tag directory */
+    unsigned long  tag_count;  /* number of entries in the tag directory */
+    struct _abi_dir_slot *index;  /* hash of the directory by tag and id */
+    unsigned long  index_size; /* number of slots, a power of 2 */
+} ABIFile;
 
 char *ABI_ErrorString(ABIError);
 
-ABIError ABI_Open(void *, size_t);
-ABIError ABI_Close(void *);
+ABIError ABI_Open(ABIFile *, void *, size_t);
+ABIError ABI_Close(ABIFile *, void *);
 
-ABIError ABI_AnalyzedData(short, short, int *);
-ABIError ABI_AnalysisVersion(long, char *, long *);
-ABIError ABI_CalledBases(char *);
-ABIError ABI_CalledPeakLocations(short *);
-ABIError ABI_DyeIndexToBase(short, char *);
-ABIError ABI_EditedBases(char *);
-ABIError ABI_ConsensusBases(char *);
-ABIError ABI_EditedPeakLocations(short *);
-ABIError ABI_MobilityFile(long, char *, long *);
-ABIError ABI_NumAnalyzedData(short, short, long *);
-ABIError ABI_NumCalledBases(long *);
-ABIError ABI_NumCalledPeakLocations(long *);
-ABIError ABI_NumEditedBases(long *);
-ABIError ABI_NumConsensusBases(long *);   
-ABIError ABI_NumEditedPeakLocations(long *);
-ABIError ABI_NumRawData(short, short, long *);
-ABIError ABI_RawData(short, short, int *);
-ABIError ABI_NumQualityValues(short *num_qvs);
-ABIError ABI_BasecallerQualityValues(char *qv);
+ABIError ABI_AnalyzedData(ABIFile *, short, short, int *);
+ABIError ABI_AnalysisVersion(ABIFile *, long, char *, long *);
+ABIError ABI_CalledBases(ABIFile *, char *);
+ABIError ABI_CalledPeakLocations(ABIFile *, short *);
+ABIError ABI_DyeIndexToBase(ABIFile *, short, char *);
+ABIError ABI_EditedBases(ABIFile *, char *);
+ABIError ABI_ConsensusBases(ABIFile *, char *);
+ABIError ABI_EditedPeakLocations(ABIFile *, short *);
+ABIError ABI_MobilityFile(ABIFile *, long, char *, long *);
+ABIError ABI_NumAnalyzedData(ABIFile *, short, short, long *);
+ABIError ABI_NumCalledBases(ABIFile *, long *);
+ABIError ABI_NumCalledPeakLocations(ABIFile *, long *);
+ABIError ABI_NumEditedBases(ABIFile *, long *);
+ABIError ABI_NumConsensusBases(ABIFile *, long *);   
+ABIError ABI_NumEditedPeakLocations(ABIFile *, long *);
+ABIError ABI_NumRawData(ABIFile *, short, short, long *);
+ABIError ABI_RawData(ABIFile *, short, short, int *);
+ABIError ABI_NumQualityValues(ABIFile *, short *num_qvs);
+ABIError ABI_BasecallerQualityValues(ABIFile *, char *qv);
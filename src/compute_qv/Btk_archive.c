@@ -0,0 +1,816 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_archive.c
+ *
+ *  Archive of the per-read output files of a run (-archive).  Its layout,
+ *  with all the integers little-endian, is
+ *
+ *      8 bytes     "TTARCHV1"
+ *      entries     each of which is
+ *                      4 bytes     "TTAE"
+ *                      4 bytes     length of the name
+ *                      8 bytes     size of the data
+ *                      N bytes     name of the file, sans path
+ *                      N bytes     data, i.e. the contents of the file
+ *      index       4 bytes "TTAI" and 4 bytes number of entries, followed
+ *                  for each entry by
+ *                      4 bytes     length of the name
+ *                      8 bytes     offset of the data
+ *                      8 bytes     size of the data
+ *                      N bytes     name
+ *      trailer     8 bytes offset of the index, 8 bytes "TTAREND1"
+ *
+ *  The entries are only ever appended.  The index and the trailer are
+ *  written when the archive is closed, and are replaced by the new
+ *  entries when a resumed run appends to the archive.  The entries of an
+ *  archive with no index, e.g. that of a run which didn't complete, are
+ *  found by scanning the archive.  When there are several entries of the
+ *  same name, the last one is the one which is found.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_archive.h"
+
+#ifdef __WIN32
+#define archive_seek(fp, offset, whence) \
+    _fseeki64((fp), (__int64)(offset), (whence))
+#define archive_tell(fp) ((uint64_t)_ftelli64(fp))
+#else
+#define archive_seek(fp, offset, whence) \
+    fseeko((fp), (off_t)(offset), (whence))
+#define archive_tell(fp) ((uint64_t)ftello(fp))
+#endif
+
+#define ARCHIVE_MAGIC       "TTARCHV1"
+#define ARCHIVE_MAGIC_LEN   8
+#define ENTRY_MAGIC         "TTAE"
+#define ENTRY_HEADER_LEN    16
+#define INDEX_MAGIC         "TTAI"
+#define INDEX_HEADER_LEN    8
+#define INDEX_ENTRY_LEN     20
+#define TRAILER_MAGIC       "TTAREND1"
+#define TRAILER_LEN         16
+#define MAX_NAME_LEN        4096
+
+static void
+put_uint32(unsigned char *b, uint32_t v)
+{
+    b[0] = (unsigned char)v;
+    b[1] = (unsigned char)(v >> 8);
+    b[2] = (unsigned char)(v >> 16);
+    b[3] = (unsigned char)(v >> 24);
+}
+
+static void
+put_uint64(unsigned char *b, uint64_t v)
+{
+    put_uint32(b, (uint32_t)v);
+    put_uint32(b + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t
+get_uint32(const unsigned char *b)
+{
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16)
+        | ((uint32_t)b[3] << 24);
+}
+
+static uint64_t
+get_uint64(const unsigned char *b)
+{
+    return (uint64_t)get_uint32(b) | ((uint64_t)get_uint32(b + 4) << 32);
+}
+
+/*
+ * This function appends an entry to the in-memory index of an archive.
+ */
+static int
+add_entry(BtkArchive *archive, const char *name, uint32_t name_len,
+    uint64_t offset, uint64_t size)
+{
+    BtkArchiveEntry *entries, *e;
+
+    if (archive->num_entries == archive->max_entries) {
+        entries = REALLOC(archive->entries, BtkArchiveEntry,
+            archive->max_entries > 0 ? 2 * archive->max_entries : 1024);
+        if (entries == NULL) {
+            return ERROR;
+        }
+        archive->entries = entries;
+        archive->max_entries = archive->max_entries > 0 ?
+            2 * archive->max_entries : 1024;
+    }
+    e = &archive->entries[archive->num_entries];
+    if ((e->name = CALLOC(char, name_len + 1)) == NULL) {
+        return ERROR;
+    }
+    memcpy(e->name, name, name_len);
+    e->offset = offset;
+    e->size   = size;
+    archive->num_entries++;
+    FREE(archive->sorted);
+
+    return SUCCESS;
+}
+
+static void
+release_entries(BtkArchive *archive)
+{
+    int i;
+
+    for (i = 0; i < archive->num_entries; i++) {
+        FREE(archive->entries[i].name);
+    }
+    FREE(archive->entries);
+    FREE(archive->sorted);
+    archive->num_entries = 0;
+    archive->max_entries = 0;
+}
+
+/*
+ * This function reads the index of an archive of the specified size.
+ * Its synopsis is:
+ *
+ * result = read_index(archive, size)
+ *
+ *	result		is SUCCESS, or ERROR if the archive has no valid index
+ */
+static int
+read_index(BtkArchive *archive, uint64_t size)
+{
+    unsigned char b[INDEX_ENTRY_LEN];
+    char          name[MAX_NAME_LEN];
+    uint64_t      index_offset, offset, data_size;
+    uint32_t      i, num_entries, name_len;
+
+    if (size < ARCHIVE_MAGIC_LEN + INDEX_HEADER_LEN + TRAILER_LEN) {
+        return ERROR;
+    }
+    if ((archive_seek(archive->fp, size - TRAILER_LEN, SEEK_SET) != 0)
+        || (fread(b, 1, TRAILER_LEN, archive->fp) != TRAILER_LEN)
+        || (memcmp(b + 8, TRAILER_MAGIC, 8) != 0))
+    {
+        return ERROR;
+    }
+    index_offset = get_uint64(b);
+    if ((index_offset < ARCHIVE_MAGIC_LEN)
+        || (index_offset > size - TRAILER_LEN - INDEX_HEADER_LEN)
+        || (archive_seek(archive->fp, index_offset, SEEK_SET) != 0)
+        || (fread(b, 1, INDEX_HEADER_LEN, archive->fp) != INDEX_HEADER_LEN)
+        || (memcmp(b, INDEX_MAGIC, 4) != 0))
+    {
+        return ERROR;
+    }
+    num_entries = get_uint32(b + 4);
+
+    for (i = 0; i < num_entries; i++) {
+        if (fread(b, 1, INDEX_ENTRY_LEN, archive->fp) != INDEX_ENTRY_LEN) {
+            return ERROR;
+        }
+        name_len  = get_uint32(b);
+        offset    = get_uint64(b + 4);
+        data_size = get_uint64(b + 12);
+        if ((name_len >= MAX_NAME_LEN) || (offset > index_offset)
+            || (data_size > index_offset - offset)
+            || (fread(name, 1, name_len, archive->fp) != name_len)
+            || (add_entry(archive, name, name_len, offset, data_size)
+                != SUCCESS))
+        {
+            return ERROR;
+        }
+    }
+    archive->end = index_offset;
+
+    return SUCCESS;
+}
+
+/*
+ * This function finds the complete entries of an archive of the specified
+ * size by reading their headers, from the first one on.
+ */
+static int
+scan_entries(BtkArchive *archive, uint64_t size)
+{
+    unsigned char b[ENTRY_HEADER_LEN];
+    char          name[MAX_NAME_LEN];
+    uint64_t      pos = ARCHIVE_MAGIC_LEN, data_size;
+    uint32_t      name_len;
+
+    if (archive_seek(archive->fp, pos, SEEK_SET) != 0) {
+        return ERROR;
+    }
+    while (size - pos >= ENTRY_HEADER_LEN) {
+        if ((fread(b, 1, ENTRY_HEADER_LEN, archive->fp) != ENTRY_HEADER_LEN)
+            || (memcmp(b, ENTRY_MAGIC, 4) != 0))
+        {
+            break;
+        }
+        name_len  = get_uint32(b + 4);
+        data_size = get_uint64(b + 8);
+        if ((name_len >= MAX_NAME_LEN)
+            || (size - pos - ENTRY_HEADER_LEN < name_len)
+            || (size - pos - ENTRY_HEADER_LEN - name_len < data_size)
+            || (fread(name, 1, name_len, archive->fp) != name_len))
+        {
+            break;
+        }
+        pos += ENTRY_HEADER_LEN + name_len;
+        if (add_entry(archive, name, name_len, pos, data_size) != SUCCESS) {
+            return ERROR;
+        }
+        pos += data_size;
+        if (archive_seek(archive->fp, pos, SEEK_SET) != 0) {
+            return ERROR;
+        }
+    }
+    archive->end = pos;
+
+    return SUCCESS;
+}
+
+/********************************************************************************
+ * This function opens an archive.  Its synopsis is:
+ *
+ * result = Btk_archive_open(archive, file_name, mode, message)
+ *
+ * where
+ *	archive		is the address of the BtkArchive to be opened
+ *	file_name	is the name of the archive file
+ *	mode		is BTK_ARCHIVE_READ to read the archive,
+ *			BTK_ARCHIVE_APPEND to append entries to it (it is
+ *			created if it doesn't exist), or BTK_ARCHIVE_CREATE
+ *			to replace it with an empty archive
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_archive_open(BtkArchive *archive, char *file_name, int mode,
+    BtkMessage *message)
+{
+    char     magic[ARCHIVE_MAGIC_LEN];
+    uint64_t size;
+
+    memset(archive, 0, sizeof(BtkArchive));
+    archive->writable = (mode != BTK_ARCHIVE_READ);
+
+    if (mode == BTK_ARCHIVE_READ) {
+        archive->fp = fopen(file_name, "rb");
+    }
+    else if (mode == BTK_ARCHIVE_APPEND) {
+        if (((archive->fp = fopen(file_name, "r+b")) == NULL)
+            && (errno == ENOENT))
+        {
+            mode = BTK_ARCHIVE_CREATE;
+        }
+    }
+    if (mode == BTK_ARCHIVE_CREATE) {
+        archive->fp = fopen(file_name, "w+b");
+    }
+    if (archive->fp == NULL) {
+        sprintf(message->text, "%.200s: couldn't open: %s", file_name,
+            strerror(errno));
+        return ERROR;
+    }
+
+    if ((archive_seek(archive->fp, 0, SEEK_END) != 0)
+        || ((size = archive_tell(archive->fp)) == (uint64_t)-1))
+    {
+        sprintf(message->text, "%.200s: couldn't seek: %s", file_name,
+            strerror(errno));
+        goto error;
+    }
+
+    if (size == 0) {
+        if (!archive->writable
+            || (fwrite(ARCHIVE_MAGIC, 1, ARCHIVE_MAGIC_LEN, archive->fp)
+                != ARCHIVE_MAGIC_LEN))
+        {
+            sprintf(message->text, "%.200s: not a TraceTuner archive",
+                file_name);
+            goto error;
+        }
+        archive->end = ARCHIVE_MAGIC_LEN;
+        return SUCCESS;
+    }
+
+    rewind(archive->fp);
+    if ((size < ARCHIVE_MAGIC_LEN)
+        || (fread(magic, 1, ARCHIVE_MAGIC_LEN, archive->fp)
+            != ARCHIVE_MAGIC_LEN)
+        || (memcmp(magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) != 0))
+    {
+        sprintf(message->text, "%.200s: not a TraceTuner archive", file_name);
+        goto error;
+    }
+
+    if (read_index(archive, size) != SUCCESS) {
+        release_entries(archive);
+        if (scan_entries(archive, size) != SUCCESS) {
+            sprintf(message->text, "%.200s: couldn't read the entries",
+                file_name);
+            goto error;
+        }
+    }
+
+    if (archive->writable) {
+        /* The new entries replace the index, and any incomplete entry */
+#ifndef __WIN32
+        if (fflush(archive->fp) != 0
+            || ftruncate(fileno(archive->fp), (off_t)archive->end) != 0)
+        {
+            sprintf(message->text, "%.200s: couldn't truncate: %s",
+                file_name, strerror(errno));
+            goto error;
+        }
+#endif
+        if (archive_seek(archive->fp, archive->end, SEEK_SET) != 0) {
+            sprintf(message->text, "%.200s: couldn't seek: %s", file_name,
+                strerror(errno));
+            goto error;
+        }
+    }
+
+    return SUCCESS;
+
+error:
+    release_entries(archive);
+    (void)fclose(archive->fp);
+    archive->fp = NULL;
+    return ERROR;
+}
+
+/********************************************************************************
+ * This function appends an entry to an archive opened for writing.
+ * Its synopsis is:
+ *
+ * result = Btk_archive_add(archive, name, data, size)
+ *
+ * where
+ *	archive		is the address of the BtkArchive
+ *	name		is the name of the entry
+ *	data		is the address of the contents of the entry
+ *	size		is the size of the contents
+ *
+ *	result		is SUCCESS, or ERROR with errno set
+ ********************************************************************************
+ */
+int
+Btk_archive_add(BtkArchive *archive, char *name, const void *data,
+    uint64_t size)
+{
+    unsigned char b[ENTRY_HEADER_LEN];
+    uint32_t      name_len = (uint32_t)strlen(name);
+
+    if (name_len >= MAX_NAME_LEN) {
+        errno = ENAMETOOLONG;
+        return ERROR;
+    }
+    memcpy(b, ENTRY_MAGIC, 4);
+    put_uint32(b + 4, name_len);
+    put_uint64(b + 8, size);
+    if ((fwrite(b, 1, ENTRY_HEADER_LEN, archive->fp) != ENTRY_HEADER_LEN)
+        || (fwrite(name, 1, name_len, archive->fp) != name_len)
+        || ((size > 0) && (fwrite(data, 1, size, archive->fp) != size)))
+    {
+        return ERROR;
+    }
+    if (add_entry(archive, name, name_len,
+        archive->end + ENTRY_HEADER_LEN + name_len, size) != SUCCESS)
+    {
+        errno = ENOMEM;
+        return ERROR;
+    }
+    archive->end += ENTRY_HEADER_LEN + name_len + size;
+
+    return SUCCESS;
+}
+
+/********************************************************************************
+ * This function closes an archive, writing its index and trailer first if
+ * it was opened for writing.  Its synopsis is:
+ *
+ * result = Btk_archive_close(archive, message)
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_archive_close(BtkArchive *archive, BtkMessage *message)
+{
+    unsigned char    b[INDEX_ENTRY_LEN];
+    BtkArchiveEntry *e;
+    int              i, r = SUCCESS;
+    uint32_t         name_len;
+
+    if (archive->fp == NULL) {
+        return SUCCESS;
+    }
+
+    if (archive->writable) {
+        memcpy(b, INDEX_MAGIC, 4);
+        put_uint32(b + 4, (uint32_t)archive->num_entries);
+        if (fwrite(b, 1, INDEX_HEADER_LEN, archive->fp) != INDEX_HEADER_LEN) {
+            r = ERROR;
+        }
+        for (i = 0; (i < archive->num_entries) && (r == SUCCESS); i++) {
+            e = &archive->entries[i];
+            name_len = (uint32_t)strlen(e->name);
+            put_uint32(b, name_len);
+            put_uint64(b + 4, e->offset);
+            put_uint64(b + 12, e->size);
+            if ((fwrite(b, 1, INDEX_ENTRY_LEN, archive->fp) != INDEX_ENTRY_LEN)
+                || (fwrite(e->name, 1, name_len, archive->fp) != name_len))
+            {
+                r = ERROR;
+            }
+        }
+        put_uint64(b, archive->end);
+        memcpy(b + 8, TRAILER_MAGIC, 8);
+        if ((r == SUCCESS)
+            && (fwrite(b, 1, TRAILER_LEN, archive->fp) != TRAILER_LEN))
+        {
+            r = ERROR;
+        }
+    }
+
+    if ((fclose(archive->fp) != 0) || (r != SUCCESS)) {
+        sprintf(message->text, "couldn't write the archive: %s",
+            strerror(errno));
+        r = ERROR;
+    }
+    archive->fp = NULL;
+    release_entries(archive);
+
+    return r;
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const BtkArchiveEntry *ea = *(const BtkArchiveEntry **)a;
+    const BtkArchiveEntry *eb = *(const BtkArchiveEntry **)b;
+    int r = strcmp(ea->name, eb->name);
+
+    if (r != 0) {
+        return r;
+    }
+    return (ea < eb) ? -1 : (ea > eb);
+}
+
+/********************************************************************************
+ * This function looks up an entry of an archive by name.  Its synopsis is:
+ *
+ * i = Btk_archive_find(archive, name)
+ *
+ *	i		is the index of the last entry of this name in
+ *			archive->entries, or -1 if there is none
+ ********************************************************************************
+ */
+int
+Btk_archive_find(BtkArchive *archive, char *name)
+{
+    int i, lo, hi, mid;
+
+    if ((archive->sorted == NULL) && (archive->num_entries > 0)) {
+        archive->sorted = CALLOC(BtkArchiveEntry *, archive->num_entries);
+        if (archive->sorted == NULL) {
+            /* Fall back to a linear search */
+            for (i = archive->num_entries - 1; i >= 0; i--) {
+                if (strcmp(archive->entries[i].name, name) == 0) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        for (i = 0; i < archive->num_entries; i++) {
+            archive->sorted[i] = &archive->entries[i];
+        }
+        qsort(archive->sorted, archive->num_entries,
+            sizeof(BtkArchiveEntry *), compare_entries);
+    }
+
+    /* Find the first entry whose name follows name */
+    lo = 0;
+    hi = archive->num_entries;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (strcmp(archive->sorted[mid]->name, name) <= 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if ((lo > 0) && (strcmp(archive->sorted[lo - 1]->name, name) == 0)) {
+        return (int)(archive->sorted[lo - 1] - archive->entries);
+    }
+    return -1;
+}
+
+/********************************************************************************
+ * This function reads the contents of the specified entry of an archive
+ * into a buffer of archive->entries[i].size bytes.  Its synopsis is:
+ *
+ * result = Btk_archive_read(archive, i, buf)
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_archive_read(BtkArchive *archive, int i, void *buf)
+{
+    BtkArchiveEntry *e = &archive->entries[i];
+
+    if ((archive_seek(archive->fp, e->offset, SEEK_SET) != 0)
+        || (fread(buf, 1, e->size, archive->fp) != e->size))
+    {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/* Output archive of the run (-archive), if any, and the per-read output
+ * files being written into it, each as a memory stream
+ */
+typedef struct _output_stream {
+    FILE   *fp;
+    char   *data;
+    size_t  size;
+    char   *name;
+    struct _output_stream *next;
+} OutputStream;
+
+static BtkArchive    OutputArchive;
+static int           Archiving;
+static OutputStream *OutputStreams;
+
+/********************************************************************************
+ * This function makes the per-read output files of the run go to the
+ * specified archive.  Its synopsis is:
+ *
+ * result = Btk_open_output_archive(file_name, append, message)
+ *
+ * where
+ *	file_name	is the name of the archive
+ *	append		is whether to append to an existing archive rather
+ *			than replace it
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_open_output_archive(char *file_name, int append, BtkMessage *message)
+{
+#ifdef __WIN32
+    sprintf(message->text, "archive output is not supported on this platform");
+    return ERROR;
+#else
+    if (Btk_archive_open(&OutputArchive, file_name,
+        append ? BTK_ARCHIVE_APPEND : BTK_ARCHIVE_CREATE, message) != SUCCESS)
+    {
+        return ERROR;
+    }
+    Archiving = 1;
+    return SUCCESS;
+#endif
+}
+
+/********************************************************************************
+ * This function writes the buffered entries of the output archive, if any,
+ * to the file.  Its synopsis is:
+ *
+ * result = Btk_flush_output_archive()
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_flush_output_archive(void)
+{
+    if (!Archiving) {
+        return SUCCESS;
+    }
+    return (fflush(OutputArchive.fp) == 0) ? SUCCESS : ERROR;
+}
+
+/********************************************************************************
+ * This function completes and closes the output archive of the run, if
+ * any.  All the output files must have been closed.  Its synopsis is:
+ *
+ * result = Btk_close_output_archive(message)
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_close_output_archive(BtkMessage *message)
+{
+    if (!Archiving) {
+        return SUCCESS;
+    }
+    Archiving = 0;
+    return Btk_archive_close(&OutputArchive, message);
+}
+
+/********************************************************************************
+ * This function opens a per-read output file, which goes to the output
+ * archive, if any, under its name sans path.  Its synopsis is:
+ *
+ * fp = Btk_open_output(file_name, mode)
+ *
+ * where
+ *	file_name	is the name of the file
+ *	mode		is the fopen() mode to use if there is no archive
+ *
+ *	fp		is the stream, or NULL with errno set
+ *
+ * The stream must be closed with Btk_close_output().  It may be used by
+ * any thread.
+ ********************************************************************************
+ */
+FILE *
+Btk_open_output(char *file_name, char *mode)
+{
+#ifdef __WIN32
+    return fopen(file_name, mode);
+#else
+    OutputStream *os;
+    char         *name;
+
+    if (!Archiving) {
+        return fopen(file_name, mode);
+    }
+
+    if ((name = strrchr(file_name, '/')) != NULL) {
+        name++;
+    }
+    else {
+        name = file_name;
+    }
+
+    if ((os = CALLOC(OutputStream, 1)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (((os->name = CALLOC(char, strlen(name) + 1)) == NULL)
+        || ((os->fp = open_memstream(&os->data, &os->size)) == NULL))
+    {
+        FREE(os->name);
+        FREE(os);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(os->name, name);
+
+    /* The archive's stream lock also protects the list of streams */
+    flockfile(OutputArchive.fp);
+    os->next = OutputStreams;
+    OutputStreams = os;
+    funlockfile(OutputArchive.fp);
+
+    return os->fp;
+#endif
+}
+
+/********************************************************************************
+ * This function closes a per-read output file opened by Btk_open_output(),
+ * appending its contents to the output archive, if any.  Its synopsis is:
+ *
+ * result = Btk_close_output(fp)
+ *
+ *	result		is 0, or EOF with errno set
+ ********************************************************************************
+ */
+int
+Btk_close_output(FILE *fp)
+{
+#ifdef __WIN32
+    return fclose(fp);
+#else
+    OutputStream *os, **p;
+    int           r;
+
+    if (!Archiving) {
+        return fclose(fp);
+    }
+
+    flockfile(OutputArchive.fp);
+    for (p = &OutputStreams; (*p != NULL) && ((*p)->fp != fp);
+        p = &(*p)->next)
+    {
+        ;
+    }
+    if ((os = *p) == NULL) {
+        funlockfile(OutputArchive.fp);
+        return fclose(fp);
+    }
+    *p = os->next;
+
+    if (((r = fclose(fp)) == 0)
+        && (Btk_archive_add(&OutputArchive, os->name, os->data, os->size)
+            != SUCCESS))
+    {
+        r = EOF;
+    }
+    funlockfile(OutputArchive.fp);
+
+    free(os->data);
+    FREE(os->name);
+    FREE(os);
+    return r;
+#endif
+}
+
+/********************************************************************************
+ * This function writes a per-read output file whose whole contents are in
+ * memory: into the output archive, if any, or else with a single write.
+ * Its synopsis is:
+ *
+ * result = Btk_write_output(file_name, data, size)
+ *
+ *	result		is SUCCESS, or ERROR with errno set
+ ********************************************************************************
+ */
+int
+Btk_write_output(char *file_name, const void *data, size_t size)
+{
+#ifdef __WIN32
+    FILE *fp;
+
+    if ((fp = fopen(file_name, "wb")) == NULL) {
+        return ERROR;
+    }
+    if ((fwrite(data, 1, size, fp) != size) || (fclose(fp) != 0)) {
+        return ERROR;
+    }
+    return SUCCESS;
+#else
+    char    *name;
+    ssize_t  n;
+    size_t   done;
+    int      fd, r;
+
+    if (Archiving) {
+        if ((name = strrchr(file_name, '/')) != NULL) {
+            name++;
+        }
+        else {
+            name = file_name;
+        }
+        flockfile(OutputArchive.fp);
+        r = Btk_archive_add(&OutputArchive, name, data, size);
+        funlockfile(OutputArchive.fp);
+        return r;
+    }
+
+    if ((fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        return ERROR;
+    }
+    for (done = 0; done < size; done += (size_t)n) {
+        if ((n = write(fd, (const char *)data + done, size - done)) < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            (void)close(fd);
+            return ERROR;
+        }
+    }
+    return (close(fd) == 0) ? SUCCESS : ERROR;
+#endif
+}
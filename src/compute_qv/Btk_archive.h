@@ -0,0 +1,65 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_archive.h
+ *
+ *  Archive of the per-read output files (.phd.1, .qual, .scf, .tab, ...)
+ *  of a run, written as one append-only file instead of one file per
+ *  read and output type; see Btk_archive.c for the layout.  Needs
+ *  Btk_qv.h to be included first.
+ */
+
+#ifndef BTK_ARCHIVE_H_
+#define BTK_ARCHIVE_H_
+
+#define BTK_ARCHIVE_READ    0    /* open an archive for reading */
+#define BTK_ARCHIVE_APPEND  1    /* append to an archive, or create it */
+#define BTK_ARCHIVE_CREATE  2    /* create or replace an archive */
+
+typedef struct {
+    char     *name;             /* name of the file, sans path */
+    uint64_t  offset;           /* of the data in the archive */
+    uint64_t  size;             /* of the data */
+} BtkArchiveEntry;
+
+typedef struct {
+    FILE            *fp;
+    BtkArchiveEntry *entries;   /* in the order of the archive */
+    int              num_entries;
+    int              max_entries;
+    BtkArchiveEntry **sorted;   /* entries sorted by name, for lookups */
+    uint64_t         end;       /* offset following the last entry */
+    int              writable;
+} BtkArchive;
+
+int  Btk_archive_open(BtkArchive *, char *, int, BtkMessage *);
+int  Btk_archive_add(BtkArchive *, char *, const void *, uint64_t);
+int  Btk_archive_close(BtkArchive *, BtkMessage *);
+int  Btk_archive_find(BtkArchive *, char *);
+int  Btk_archive_read(BtkArchive *, int, void *);
+
+int   Btk_open_output_archive(char *, int, BtkMessage *);
+int   Btk_flush_output_archive(void);
+int   Btk_close_output_archive(BtkMessage *);
+FILE *Btk_open_output(char *, char *);
+int   Btk_close_output(FILE *);
+int   Btk_write_output(char *, const void *, size_t);
+
+#endif /* include guard */
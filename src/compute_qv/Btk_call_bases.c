@@ -451,7 +451,7 @@ output_spacing_curve(Data *data, Options *options)
         if ((i == 0) || (i % 20) != 0)
             continue;
 
-        curr_spacing1 = spacing_curve(i);
+        curr_spacing1 = spacing_curve(i, data);
         curr_spacing2 = get_spacing_from_good_region(base_index, data);
         curr_spacing = (curr_spacing1 + curr_spacing2)/2.;
 
@@ -486,7 +486,7 @@ output_spacing_curve(Data *data, Options *options)
         if ((i == 0) || (i % 20) != 0)
             continue;
 
-        curr_spacing1 = spacing_curve(i);
+        curr_spacing1 = spacing_curve(i, data);
         curr_spacing2 = get_spacing_from_good_region(base_index, data);
         curr_spacing = (curr_spacing1 + curr_spacing2)/2.;
 
@@ -2704,11 +2704,12 @@ get_spacing_from_good_region(int base_index, Data *data)
 
     if (base_index>=data->bases.length) {
         int ind = data->bases.length-1;
-        return spacing_curve(data->bases.called_peak_list[ind]->ipos);
+        return spacing_curve(data->bases.called_peak_list[ind]->ipos, data);
     }
 
     if (base_index <= MAX_SIZE_OF_SEARCH_REGION)
-        return spacing_curve(data->bases.called_peak_list[base_index]->ipos);
+        return spacing_curve(data->bases.called_peak_list[base_index]->ipos,
+            data);
 
     delta_spacing= 1;
     max_spacing  = 0;
@@ -2779,7 +2780,8 @@ get_spacing_from_good_region(int base_index, Data *data)
     if ((sum_spacings > 0.) && (j > 0))
         return sum_spacings/(double)j;
 
-    new_spacing = QVMAX(MIN_PEAK_SPACING, (int)spacing_curve(Pl[base_index]->ipos));
+    new_spacing = QVMAX(MIN_PEAK_SPACING,
+        (int)spacing_curve(Pl[base_index]->ipos, data));
 
     return new_spacing;
 }
@@ -3199,7 +3201,7 @@ call_peak_by_location_color_and_index(int location, int base_ind, int color,
     Data *data, BtkMessage *message, Options options)
 {
     int i = base_ind, jc = color, j, l, r, k;
-    static int peaks_added[4]={0,0,0,0};
+    int *peaks_added = data->context->peaks_added;
     ColorData *cd = &data->color_data[jc];
     char    base = color2base[jc];
     Peak peak = initialize_peak(), peak1 = initialize_peak(),
@@ -4964,7 +4966,7 @@ Btk_call_bases(Data *data, char *color2base, ReadInfo *read_info,
             if (base_index > data->bases.length) 
                 continue;
          
-            curr_spacing1 = spacing_curve(data->peak_list[i]->ipos);
+            curr_spacing1 = spacing_curve(data->peak_list[i]->ipos, data);
             curr_spacing2 = get_spacing_from_good_region(base_index, data);
          
             if (base_index < 500)       
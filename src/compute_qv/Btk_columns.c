@@ -0,0 +1,577 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_columns.c
+ *
+ *  Columnar binary file of the per-base results of a run (-bin).  Its
+ *  layout is
+ *
+ *      BtkColumnsHeader    magic, byte order, number of reads and bases,
+ *                          and the offset, number and size of the elements
+ *                          of each column
+ *      columns             in the order of BtkColumn, each starting at a
+ *                          multiple of BTK_COLUMNS_ALIGN bytes, with zero
+ *                          padding in between
+ *
+ *  All the numbers are in the byte order of the host which wrote the file,
+ *  as told by the byte_order field, so that the file may be mapped into
+ *  memory and its columns used in place.  A reader maps the whole file
+ *  and touches only the pages of the columns it uses.
+ *
+ *  While the run is in progress, the per-base columns are accumulated in
+ *  unlinked spool files next to the output file, and the offsets of the
+ *  reads in memory; the file is assembled from them when it is closed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_qv_data.h"
+#include "Btk_columns.h"
+
+#define COLUMN_BUF_LEN  4096    /* elements converted at a time */
+#define SPOOL_BUF_LEN   (256*1024)
+
+static const uint32_t ElemSizes[BTK_NUM_COLUMNS] = {
+    sizeof(uint64_t), sizeof(uint64_t), sizeof(char), sizeof(char),
+    sizeof(uint8_t), sizeof(int32_t), sizeof(float), sizeof(float),
+    sizeof(float), sizeof(float)
+};
+
+/* Columns file of the run being written, if any */
+static char      ColumnsFileName[BUFLEN];
+static FILE     *Spools[BTK_NUM_COLUMNS];   /* NAMES to PRES */
+static uint64_t *ReadOffsets;
+static uint64_t *NameOffsets;
+static uint64_t  NumReads;
+static uint64_t  MaxReads;
+static uint64_t  NumBases;
+static uint64_t  NamesSize;
+
+#define ALIGN_OFFSET(offset) \
+    (((offset) + BTK_COLUMNS_ALIGN - 1) / BTK_COLUMNS_ALIGN * BTK_COLUMNS_ALIGN)
+
+/*
+ * This function creates a temporary file in the directory of the columns
+ * file, which is deleted when it is closed.
+ */
+static FILE *
+open_spool(char *file_name)
+{
+#ifdef __WIN32
+    return tmpfile();
+#else
+    char  spool_name[BUFLEN + 8];
+    int   fd;
+    FILE *fp;
+
+    sprintf(spool_name, "%s.XXXXXX", file_name);
+    if ((fd = mkstemp(spool_name)) < 0) {
+        return NULL;
+    }
+    (void)unlink(spool_name);
+    if ((fp = fdopen(fd, "w+b")) == NULL) {
+        (void)close(fd);
+        return NULL;
+    }
+    (void)setvbuf(fp, NULL, _IOFBF, SPOOL_BUF_LEN);
+    return fp;
+#endif
+}
+
+static void
+close_spools(void)
+{
+    int i;
+
+    for (i = 0; i < BTK_NUM_COLUMNS; i++) {
+        if (Spools[i] != NULL) {
+            (void)fclose(Spools[i]);
+            Spools[i] = NULL;
+        }
+    }
+    FREE(ReadOffsets);
+    FREE(NameOffsets);
+    NumReads = MaxReads = NumBases = NamesSize = 0;
+    ColumnsFileName[0] = '\0';
+}
+
+/********************************************************************************
+ * This function starts the columns file of the run, which is written when
+ * it is closed.  Its synopsis is:
+ *
+ * result = Btk_open_columns_file(file_name, message)
+ *
+ * where
+ *	file_name	is the name of the file
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_open_columns_file(char *file_name, BtkMessage *message)
+{
+    int i;
+
+    (void)strncpy(ColumnsFileName, file_name, sizeof(ColumnsFileName) - 1);
+    for (i = BTK_COL_NAMES; i < BTK_NUM_COLUMNS; i++) {
+        if ((Spools[i] = open_spool(ColumnsFileName)) == NULL) {
+            sprintf(message->text, "%.200s: couldn't create a spool file: %s",
+                file_name, strerror(errno));
+            close_spools();
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+ * This function appends the n elements of an int or double array to the
+ * spool of a column, converted to the type of the column, or n NaNs if
+ * the array is NULL.
+ */
+static int
+spool_converted(FILE *fp, int column, int *ivals, double *dvals, int n)
+{
+    int32_t ibuf[COLUMN_BUF_LEN];
+    float   fbuf[COLUMN_BUF_LEN];
+    int     i, j, len;
+
+    for (i = 0; i < n; i += len) {
+        len = MIN2(COLUMN_BUF_LEN, n - i);
+        for (j = 0; j < len; j++) {
+            if (column == BTK_COL_LOCS) {
+                ibuf[j] = (int32_t)ivals[i + j];
+            }
+            else {
+                fbuf[j] = (dvals != NULL) ? (float)dvals[i + j] : (float)NAN;
+            }
+        }
+        if (fwrite((column == BTK_COL_LOCS) ? (void *)ibuf : (void *)fbuf,
+            ElemSizes[column], len, fp) != (size_t)len)
+        {
+            return ERROR;
+        }
+    }
+    return SUCCESS;
+}
+
+/********************************************************************************
+ * This function appends a read to the columns file of the run, if any.
+ * In a multi-threaded run, the calling thread must have the output turn.
+ * Its synopsis is:
+ *
+ * result = Btk_output_columns(read_name, num_bases, bases, quality_values,
+ *              peak_locs, params)
+ *
+ * where
+ *	read_name	is the name of the read
+ *	num_bases	is the number of bases of the read
+ *	bases		is the array of the called bases
+ *	quality_values	is the array of their quality values
+ *	peak_locs	is the array of their peak locations
+ *	params		is the address of the trace parameters of the bases,
+ *			which are output as NaNs if it is NULL or doesn't
+ *			have num_bases values
+ *
+ *	result		is SUCCESS, or ERROR with errno set
+ ********************************************************************************
+ */
+int
+Btk_output_columns(char *read_name, int num_bases, char *bases,
+    uint8_t *quality_values, int *peak_locs, TraceParameters *params)
+{
+    uint64_t *offsets, max_reads;
+    size_t    name_len = strlen(read_name) + 1;
+    int       known;
+
+    if (ColumnsFileName[0] == '\0') {
+        return SUCCESS;
+    }
+
+    if (NumReads + 2 > MaxReads) {
+        max_reads = (MaxReads > 0) ? 2 * MaxReads : 1024;
+        if ((offsets = REALLOC(ReadOffsets, uint64_t, max_reads)) == NULL) {
+            errno = ENOMEM;
+            return ERROR;
+        }
+        ReadOffsets = offsets;
+        if ((offsets = REALLOC(NameOffsets, uint64_t, max_reads)) == NULL) {
+            errno = ENOMEM;
+            return ERROR;
+        }
+        NameOffsets = offsets;
+        MaxReads = max_reads;
+    }
+
+    known = (params != NULL) && (params->length == num_bases)
+        && (params->phr3 != NULL) && (params->phr7 != NULL)
+        && (params->psr7 != NULL) && (params->pres != NULL);
+
+    if ((fwrite(read_name, 1, name_len, Spools[BTK_COL_NAMES]) != name_len)
+        || (fwrite(bases, 1, num_bases, Spools[BTK_COL_BASES])
+            != (size_t)num_bases)
+        || (fwrite(quality_values, 1, num_bases, Spools[BTK_COL_QVS])
+            != (size_t)num_bases)
+        || (spool_converted(Spools[BTK_COL_LOCS], BTK_COL_LOCS, peak_locs,
+            NULL, num_bases) != SUCCESS)
+        || (spool_converted(Spools[BTK_COL_PHR3], BTK_COL_PHR3, NULL,
+            known ? params->phr3 : NULL, num_bases) != SUCCESS)
+        || (spool_converted(Spools[BTK_COL_PHR7], BTK_COL_PHR7, NULL,
+            known ? params->phr7 : NULL, num_bases) != SUCCESS)
+        || (spool_converted(Spools[BTK_COL_PSR7], BTK_COL_PSR7, NULL,
+            known ? params->psr7 : NULL, num_bases) != SUCCESS)
+        || (spool_converted(Spools[BTK_COL_PRES], BTK_COL_PRES, NULL,
+            known ? params->pres : NULL, num_bases) != SUCCESS))
+    {
+        return ERROR;
+    }
+
+    ReadOffsets[NumReads] = NumBases;
+    NameOffsets[NumReads] = NamesSize;
+    NumReads++;
+    NumBases  += num_bases;
+    NamesSize += name_len;
+
+    return SUCCESS;
+}
+
+/*
+ * This function writes size bytes of data, followed by the zero padding
+ * up to the next column, to the columns file.
+ */
+static int
+write_column(FILE *out, const void *data, FILE *spool, uint64_t size)
+{
+    static const char zeros[BTK_COLUMNS_ALIGN];
+    char     buf[SPOOL_BUF_LEN / 4];
+    uint64_t done;
+    size_t   len;
+
+    if (data != NULL) {
+        if (fwrite(data, 1, size, out) != size) {
+            return ERROR;
+        }
+    }
+    else {
+        if (fflush(spool) != 0) {
+            return ERROR;
+        }
+        rewind(spool);
+        for (done = 0; done < size; done += len) {
+            len = (size_t)MIN2((uint64_t)sizeof(buf), size - done);
+            if ((fread(buf, 1, len, spool) != len)
+                || (fwrite(buf, 1, len, out) != len))
+            {
+                return ERROR;
+            }
+        }
+    }
+    len = (size_t)(ALIGN_OFFSET(size) - size);
+    return (fwrite(zeros, 1, len, out) == len) ? SUCCESS : ERROR;
+}
+
+/********************************************************************************
+ * This function writes the columns file of the run, if any, from the reads
+ * output so far.  Its synopsis is:
+ *
+ * result = Btk_close_columns_file(message)
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_close_columns_file(BtkMessage *message)
+{
+    BtkColumnsHeader header;
+    FILE            *out;
+    uint64_t         offset;
+    int              i, r = SUCCESS;
+
+    if (ColumnsFileName[0] == '\0') {
+        return SUCCESS;
+    }
+
+    /* The offset tables have an entry past the last read */
+    if (ReadOffsets == NULL) {
+        ReadOffsets = CALLOC(uint64_t, 1);
+        NameOffsets = CALLOC(uint64_t, 1);
+        if ((ReadOffsets == NULL) || (NameOffsets == NULL)) {
+            sprintf(message->text, "%.200s: out of memory", ColumnsFileName);
+            close_spools();
+            return ERROR;
+        }
+    }
+    ReadOffsets[NumReads] = NumBases;
+    NameOffsets[NumReads] = NamesSize;
+
+    (void)memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BTK_COLUMNS_MAGIC, sizeof(header.magic));
+    header.byte_order  = BTK_COLUMNS_BYTE_ORDER;
+    header.num_columns = BTK_NUM_COLUMNS;
+    header.num_reads   = NumReads;
+    header.num_bases   = NumBases;
+    offset = ALIGN_OFFSET(sizeof(header));
+    for (i = 0; i < BTK_NUM_COLUMNS; i++) {
+        header.columns[i].offset    = offset;
+        header.columns[i].elem_size = ElemSizes[i];
+        header.columns[i].count     = (i == BTK_COL_NAMES) ? NamesSize :
+            (i <= BTK_COL_NAME_OFFSETS) ? NumReads + 1 : NumBases;
+        offset += ALIGN_OFFSET(header.columns[i].count * ElemSizes[i]);
+    }
+
+    if ((out = fopen(ColumnsFileName, "wb")) == NULL) {
+        sprintf(message->text, "%.200s: couldn't open: %s", ColumnsFileName,
+            strerror(errno));
+        close_spools();
+        return ERROR;
+    }
+    (void)setvbuf(out, NULL, _IOFBF, SPOOL_BUF_LEN);
+    if (write_column(out, &header, NULL, sizeof(header)) != SUCCESS) {
+        r = ERROR;
+    }
+    for (i = 0; (i < BTK_NUM_COLUMNS) && (r == SUCCESS); i++) {
+        r = write_column(out,
+            (i == BTK_COL_READ_OFFSETS) ? (void *)ReadOffsets :
+            (i == BTK_COL_NAME_OFFSETS) ? (void *)NameOffsets : NULL,
+            Spools[i], header.columns[i].count * ElemSizes[i]);
+    }
+    if ((fclose(out) != 0) || (r != SUCCESS)) {
+        sprintf(message->text, "%.200s: couldn't write: %s", ColumnsFileName,
+            strerror(errno));
+        r = ERROR;
+    }
+    close_spools();
+
+    return r;
+}
+
+/********************************************************************************
+ * This function maps a columns file for reading.  Its synopsis is:
+ *
+ * result = Btk_columns_open(columns, file_name, message)
+ *
+ * where
+ *	columns		is the address of the BtkColumns to be opened
+ *	file_name	is the name of the file
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_columns_open(BtkColumns *columns, char *file_name, BtkMessage *message)
+{
+    BtkColumnsHeader *h;
+    FILE             *fp;
+    int               i;
+#ifndef __WIN32
+    int               fd;
+    struct stat       st;
+#endif
+
+    (void)memset(columns, 0, sizeof(BtkColumns));
+
+#ifndef __WIN32
+    if ((fd = open(file_name, O_RDONLY)) < 0) {
+        sprintf(message->text, "%.200s: couldn't open: %s", file_name,
+            strerror(errno));
+        return ERROR;
+    }
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)
+        && (st.st_size >= (off_t)sizeof(BtkColumnsHeader)))
+    {
+        columns->data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+            fd, 0);
+        if (columns->data != MAP_FAILED) {
+            columns->size   = (size_t)st.st_size;
+            columns->mapped = 1;
+        }
+        else {
+            columns->data = NULL;
+        }
+    }
+    (void)close(fd);
+#endif
+
+    if (columns->data == NULL) {
+        if ((fp = fopen(file_name, "rb")) == NULL) {
+            sprintf(message->text, "%.200s: couldn't open: %s", file_name,
+                strerror(errno));
+            return ERROR;
+        }
+        if ((fseek(fp, 0, SEEK_END) == 0) && (ftell(fp) > 0)) {
+            columns->size = (size_t)ftell(fp);
+            rewind(fp);
+            columns->data = malloc(columns->size);
+        }
+        if ((columns->data == NULL)
+            || (fread(columns->data, 1, columns->size, fp) != columns->size))
+        {
+            sprintf(message->text, "%.200s: couldn't read", file_name);
+            (void)fclose(fp);
+            Btk_columns_close(columns);
+            return ERROR;
+        }
+        (void)fclose(fp);
+    }
+
+    h = columns->header = (BtkColumnsHeader *)columns->data;
+    if ((columns->size < sizeof(BtkColumnsHeader))
+        || (memcmp(h->magic, BTK_COLUMNS_MAGIC, sizeof(h->magic)) != 0))
+    {
+        sprintf(message->text, "%.200s: not a TraceTuner columns file",
+            file_name);
+        Btk_columns_close(columns);
+        return ERROR;
+    }
+    if (h->byte_order != BTK_COLUMNS_BYTE_ORDER) {
+        sprintf(message->text, "%.200s: written with another byte order",
+            file_name);
+        Btk_columns_close(columns);
+        return ERROR;
+    }
+
+    /* Check that the columns are in the file, so that they may be used
+     * without further checks
+     */
+    for (i = 0; i < BTK_NUM_COLUMNS; i++) {
+        if ((h->num_columns != BTK_NUM_COLUMNS)
+            || (h->columns[i].elem_size != ElemSizes[i])
+            || (h->columns[i].offset % BTK_COLUMNS_ALIGN != 0)
+            || (h->columns[i].offset > columns->size)
+            || (h->columns[i].count > (columns->size - h->columns[i].offset)
+                / ElemSizes[i])
+            || (h->columns[i].count != ((i <= BTK_COL_NAME_OFFSETS) ?
+                h->num_reads + 1 : (i == BTK_COL_NAMES) ?
+                h->columns[i].count : h->num_bases)))
+        {
+            sprintf(message->text, "%.200s: corrupt columns file", file_name);
+            Btk_columns_close(columns);
+            return ERROR;
+        }
+    }
+    columns->num_reads    = h->num_reads;
+    columns->read_offsets = (const uint64_t *)((char *)columns->data +
+        h->columns[BTK_COL_READ_OFFSETS].offset);
+    columns->name_offsets = (const uint64_t *)((char *)columns->data +
+        h->columns[BTK_COL_NAME_OFFSETS].offset);
+    columns->names = (const char *)columns->data +
+        h->columns[BTK_COL_NAMES].offset;
+
+    return SUCCESS;
+}
+
+/********************************************************************************
+ * This function returns the address of a whole column of a columns file.
+ * Its synopsis is:
+ *
+ * data = Btk_columns_column(columns, column, count)
+ *
+ * where
+ *	count		is the address where the number of elements of the
+ *			column will be put
+ ********************************************************************************
+ */
+const void *
+Btk_columns_column(BtkColumns *columns, BtkColumn column, uint64_t *count)
+{
+    *count = columns->header->columns[column].count;
+    return (const char *)columns->data + columns->header->columns[column].offset;
+}
+
+/********************************************************************************
+ * This function returns the address of the elements of one read in a
+ * per-base column, or of its name in the NAMES column.  Its synopsis is:
+ *
+ * data = Btk_columns_read(columns, column, i, count)
+ *
+ * where
+ *	i		is the index of the read
+ *	count		is the address where the number of elements (the
+ *			length of the name) will be put
+ *
+ *	data		is NULL if there is no such read, or the offsets
+ *			of the read are inconsistent
+ ********************************************************************************
+ */
+const void *
+Btk_columns_read(BtkColumns *columns, BtkColumn column, uint64_t i,
+    uint64_t *count)
+{
+    const uint64_t *offsets;
+    uint64_t        limit;
+
+    if ((i >= columns->num_reads) || (column <= BTK_COL_NAME_OFFSETS)) {
+        return NULL;
+    }
+    offsets = (column == BTK_COL_NAMES) ? columns->name_offsets :
+        columns->read_offsets;
+    limit = columns->header->columns[column].count;
+    if ((offsets[i] > offsets[i + 1]) || (offsets[i + 1] > limit)) {
+        return NULL;
+    }
+    *count = offsets[i + 1] - offsets[i];
+    if (column == BTK_COL_NAMES) {
+        if ((*count == 0) || (columns->names[offsets[i + 1] - 1] != '\0')) {
+            return NULL;
+        }
+        (*count)--;
+    }
+    return (const char *)columns->data + columns->header->columns[column].offset
+        + offsets[i] * columns->header->columns[column].elem_size;
+}
+
+/********************************************************************************
+ * This function unmaps a columns file.  Its synopsis is:
+ *
+ * Btk_columns_close(columns)
+ ********************************************************************************
+ */
+void
+Btk_columns_close(BtkColumns *columns)
+{
+#ifndef __WIN32
+    if (columns->mapped) {
+        (void)munmap(columns->data, columns->size);
+    }
+    else
+#endif
+    {
+        free(columns->data);
+    }
+    (void)memset(columns, 0, sizeof(BtkColumns));
+}
@@ -0,0 +1,93 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_columns.h
+ *
+ *  Columnar binary file of the per-base results of a run (-bin): the
+ *  bases, quality values, peak locations and trace parameters of all the
+ *  reads, each stored as one contiguous array, plus a table of the reads.
+ *  See Btk_columns.c for the layout.  Needs Btk_qv.h and Btk_qv_data.h
+ *  to be included first.
+ */
+
+#ifndef BTK_COLUMNS_H_
+#define BTK_COLUMNS_H_
+
+#define BTK_COLUMNS_MAGIC       "TTCOLS01"
+#define BTK_COLUMNS_BYTE_ORDER  0x01020304
+#define BTK_COLUMNS_ALIGN       64      /* of each column in the file */
+
+/* Columns of the file, in the order of the file.  The elements of the
+ * per-base columns of read i are those from READ_OFFSETS[i] up to
+ * READ_OFFSETS[i+1]; the name of read i starts at NAMES[NAME_OFFSETS[i]].
+ */
+typedef enum {
+    BTK_COL_READ_OFFSETS,   /* uint64_t, num_reads + 1 */
+    BTK_COL_NAME_OFFSETS,   /* uint64_t, num_reads + 1 */
+    BTK_COL_NAMES,          /* char, NUL-terminated names of the reads */
+    BTK_COL_BASES,          /* char */
+    BTK_COL_QVS,            /* uint8_t */
+    BTK_COL_LOCS,           /* int32_t, peak locations */
+    BTK_COL_PHR3,           /* float, NaN where unknown */
+    BTK_COL_PHR7,           /* float */
+    BTK_COL_PSR7,           /* float */
+    BTK_COL_PRES,           /* float */
+    BTK_NUM_COLUMNS
+} BtkColumn;
+
+typedef struct {
+    uint64_t offset;        /* of the column in the file */
+    uint64_t count;         /* number of elements */
+    uint32_t elem_size;     /* size of an element */
+    uint32_t reserved;
+} BtkColumnInfo;
+
+typedef struct {
+    char          magic[8];     /* BTK_COLUMNS_MAGIC */
+    uint32_t      byte_order;   /* BTK_COLUMNS_BYTE_ORDER, as written */
+    uint32_t      num_columns;  /* BTK_NUM_COLUMNS */
+    uint64_t      num_reads;
+    uint64_t      num_bases;
+    BtkColumnInfo columns[BTK_NUM_COLUMNS];
+} BtkColumnsHeader;
+
+/* A columnar file mapped for reading */
+typedef struct {
+    void             *data;     /* contents of the file */
+    size_t            size;
+    int               mapped;   /* whether data is mapped from the file */
+    BtkColumnsHeader *header;
+    uint64_t          num_reads;
+    const uint64_t   *read_offsets;
+    const uint64_t   *name_offsets;
+    const char       *names;
+} BtkColumns;
+
+int  Btk_open_columns_file(char *, BtkMessage *);
+int  Btk_output_columns(char *, int, char *, uint8_t *, int *,
+         TraceParameters *);
+int  Btk_close_columns_file(BtkMessage *);
+
+int         Btk_columns_open(BtkColumns *, char *, BtkMessage *);
+const void *Btk_columns_column(BtkColumns *, BtkColumn, uint64_t *);
+const void *Btk_columns_read(BtkColumns *, BtkColumn, uint64_t, uint64_t *);
+void        Btk_columns_close(BtkColumns *);
+
+#endif /* include guard */
@@ -64,12 +64,18 @@ uint8_t
 get_quality_value(double phr3, double phr7, double psr7, double pres,
     BtkLookupTable *table)
 {
+    BtkQvGrid *grid;
     int i;
 
     if (table->num_lut_entries < 1) {
         return 0;
     }
 
+    if ((grid = Btk_qv_grid(table)) != NULL) {
+        return Btk_qv_grid_lookup(grid, phr3, phr7, psr7, pres);
+    }
+
+    /* The table is too large to be compiled: scan it */
     for (i = 0; i < table->num_lut_entries; i++) {
         if ((phr3 <= table->tpar[(int)table->entries[i].phr3i].phr3t) &&
             (phr7 <= table->tpar[(int)table->entries[i].phr7i].phr7t) &&
@@ -86,14 +92,24 @@ get_quality_value(double phr3, double phr7, double psr7, double pres,
 
 /*******************************************************************************
  * Function: assign_quality
+ * Purpose: assign the quality values of all the bases of a read from the
+ *          arrays of their trace parameters, params[0..3]
  *******************************************************************************
  */
 int
 assign_quality(int num_called_bases, uint8_t *quality_values, 
     double **params, Options *options, BtkLookupTable *table)
 {
+    BtkQvGrid *grid;
     int i;
 
+    if ((table->num_lut_entries > 0) && ((grid = Btk_qv_grid(table)) != NULL))
+    {
+        Btk_qv_grid_lookup_read(grid, num_called_bases, params,
+            quality_values);
+        return SUCCESS;
+    }
+
     /* Calculate the quality values and output the results */
     for (i = 0; i < num_called_bases; i++) {
 	quality_values[i] = get_quality_value(
@@ -114,8 +130,8 @@ Btk_compute_qv(int *num_called_bases, char **called_bases,
 #if USE_CONTEXT_TABLE
                ContextTable *ctable,
 #endif
-               uint8_t **quality_values, Options options, BtkMessage *message, 
-               Results *results)
+               uint8_t **quality_values, Options options,
+               BtkReadContext *context, BtkMessage *message, Results *results)
 {
     int           i, r;
     double       *params[NUM_PARAMS]; 
@@ -145,7 +161,8 @@ Btk_compute_qv(int *num_called_bases, char **called_bases,
         if (Btk_compute_tpars_Sanger(num_called_bases, called_bases, called_peak_locs, 
             num_datapoints, chromatogram, color2base, NUM_PARAMS,
             &params[0], &params[1], &params[2], &params[3], &iheight, &iheight2,
-            &ave_iheight, &read_info, table, ctable, options, message, results) 
+            &ave_iheight, &read_info, table, ctable, options, context, message,
+            results) 
             != SUCCESS) 
         {
                 goto error;
@@ -162,6 +179,17 @@ Btk_compute_qv(int *num_called_bases, char **called_bases,
             }
 
         } 
+
+        if (context->keep_trace_params) {
+            context->trace_params.length = *num_called_bases;
+            context->trace_params.phr3   = params[0];
+            context->trace_params.phr7   = params[1];
+            context->trace_params.psr7   = params[2];
+            context->trace_params.pres   = params[3];
+            for (i = 0; i < NUM_PARAMS; i++) {
+                params[i] = NULL;
+            }
+        }
     }
   
     if (options.het || options.mix) 
@@ -178,7 +206,7 @@ Btk_compute_qv(int *num_called_bases, char **called_bases,
         if (Btk_get_mixed_bases(num_called_bases, called_bases, 
             called_peak_locs, *num_datapoints, chromatogram, 
             color2base, quality_values, &read_info, table, ctable, 
-            options, message, results) != SUCCESS)
+            options, context, message, results) != SUCCESS)
         {
             goto error;
         }
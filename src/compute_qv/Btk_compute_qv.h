@@ -48,6 +48,7 @@ extern int Btk_compute_qv(
 #endif
     uint8_t **,        /* pointer to output array of quality values */
     Options,           /* options structure: includes file_name, nocall, etc. */
+    BtkReadContext *,  /* state of the read being processed */
     BtkMessage *,      /* error code and descriptive text */
     Results *
 );
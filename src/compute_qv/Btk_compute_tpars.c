@@ -66,7 +66,6 @@
 #define STORE_IS_RESOLVED            0
 #define STORE_CASE                   0
 
-extern unsigned int max_colordata_value;
 
 /*******************************************************************************
  * Function: colordata_release
@@ -211,11 +210,13 @@ trace_parameters_create(TraceParameters *tp, int length, BtkMessage *message)
  */
 int
 data_create(Data *data, int length_cd, int length_bs, char *color2base, 
-    BtkMessage *message)
+    BtkReadContext *context, BtkMessage *message)
 {
     int i, r;
     (void)memset(data, 0, sizeof(data));
 
+    data->context = context;
+
     data->length = 0; 
     for (i = 0; i < NUM_COLORS; i++) {
         if ((r = colordata_create(&data->color_data[i], length_cd, i, 
@@ -382,7 +383,7 @@ colordata_populate(int num_datapoints, int **chromatogram, char *color2base,
 {
     int i, j, max_value;
 
-    max_colordata_value = 0;
+    data->context->max_colordata_value = 0;
 
     for (j = 0; j < NUM_COLORS; j++) {
         data->color_data[j].base = color2base[j];
@@ -409,8 +410,8 @@ colordata_populate(int num_datapoints, int **chromatogram, char *color2base,
 
         data->color_data[j].max_value = max_value;
 
-        if (max_value > (int)max_colordata_value)
-            max_colordata_value = max_value;
+        if (max_value > data->context->max_colordata_value)
+            data->context->max_colordata_value = max_value;
     }
 
     return SUCCESS;
@@ -711,13 +712,15 @@ Btk_compute_tpars_Sanger(int *num_bases, char **bases, int **peak_locs,
     double **params0, double **params1, double **params2, double **params3,  
     double **iheight, double **iheight2, double **ave_iheight, 
     ReadInfo *read_info, BtkLookupTable *table, ContextTable *ctable,
-    Options options, BtkMessage *message, Results *results )
+    Options options, BtkReadContext *context, BtkMessage *message,
+    Results *results )
 {
     int      i;
     Data     data; 
     double  *params[4] = {NULL, NULL, NULL, NULL}; 
     clock_t  start_clock = clock(), curr_clock;
     int     *quality_values = NULL;
+    uint8_t *read_qvs;
     char    *orig_bases = "";
 
     if (SHOW_INPUT_OPTIONS)
@@ -741,7 +744,7 @@ Btk_compute_tpars_Sanger(int *num_bases, char **bases, int **peak_locs,
     }
 
     if (data_create(&data, *num_datapoints, *num_bases, 
-        color2base, message) != SUCCESS)
+        color2base, context, message) != SUCCESS)
     {
         sprintf(message->text, "Error calling data_create\n");
         return ERROR;
@@ -1041,12 +1044,19 @@ Btk_compute_tpars_Sanger(int *num_bases, char **bases, int **peak_locs,
                 goto error;
             }
 
+            /* Assign all the QVs at once, then widen them */
+            if ((read_qvs = CALLOC(uint8_t, data.bases.length)) == NULL) {
+                sprintf(message->text, "insufficient memory at file=%s,line=%d\n",
+                    __FILE__, __LINE__);
+                goto error;
+            }
+            (void)assign_quality(data.bases.length, read_qvs, params,
+                &options, table);
             for (i=0; i<data.bases.length; i++)
             {
-                quality_values[i] = get_quality_value(params[0][i],
-                                params[1][i], params[2][i],
-                                params[3][i], table);
+                quality_values[i] = read_qvs[i];
             }
+            FREE(read_qvs);
             if (Btk_process_indels(options.file_name, num_datapoints, 
                 chromatogram, color2base, quality_values, &data, read_info, 
                 ctable, options, message) != SUCCESS)
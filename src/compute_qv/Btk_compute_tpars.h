@@ -40,7 +40,8 @@ extern void data_release(Data *data);
 extern int  colordata_create(ColorData *, int, int, char *, BtkMessage *);
 extern int bases_create(TT_Bases *, int, BtkMessage *);
 extern int trace_parameters_create(TraceParameters *, int, BtkMessage *);
-extern int data_create(Data *, int, int, char *, BtkMessage *);
+extern int data_create(Data *, int, int, char *, BtkReadContext *,
+    BtkMessage *);
 extern int bases_populate(int *, char **, int, int **, Data *, Options *,
     BtkMessage *);
 extern int colordata_populate(int, int **, char *, Data *, BtkMessage *);
@@ -74,6 +75,7 @@ Btk_compute_tpars_Sanger(
     BtkLookupTable *,   /* pointer to a lookup table */
     ContextTable * ,    /* pointer to a context table */ 
     Options options,    /* structure including file_name, nocall, etc. */
+    BtkReadContext *,   /* state of the read being processed */
     BtkMessage *,	/* error code and descriptive text */
     Results *           /* statistical results used by train (not ttuner) */
 );
@@ -27,6 +27,8 @@
  *  Btk_default_table.c  $Revision: 1.8 $
  */
 
+#include <string.h>
+
 #include "Btk_lookup_table.h"
 
 static TraceParamEntry DefaultParam3700pop5Entries[] = {
@@ -7714,7 +7716,7 @@ static BtkLookupTable DefaultTable3700pop5 = {
 BtkLookupTable *  
 Btk_get_3700pop5_table(void) 
 { 
-    return &DefaultTable3700pop5; 
+    return Btk_compile_lookup_table(&DefaultTable3700pop5);
 }
 
 
@@ -22041,7 +22043,7 @@ static BtkLookupTable DefaultTable3700pop6 = {
 BtkLookupTable *  
 Btk_get_3700pop6_table(void) 
 { 
-    return &DefaultTable3700pop6; 
+    return Btk_compile_lookup_table(&DefaultTable3700pop6);
 }
 
 
@@ -24732,7 +24734,7 @@ static BtkLookupTable DefaultTable3100pop6 = {
 BtkLookupTable *  
 Btk_get_3100pop6_table(void) 
 { 
-    return &DefaultTable3100pop6; 
+    return Btk_compile_lookup_table(&DefaultTable3100pop6);
 }
 
 static TraceParamEntry DefaultParam3730pop7Entries[] = {
@@ -33102,7 +33104,7 @@ static BtkLookupTable DefaultTable3730pop7 = {
 BtkLookupTable *
 Btk_get_3730pop7_table(void)
 {
-    return &DefaultTable3730pop7;
+    return Btk_compile_lookup_table(&DefaultTable3730pop7);
 }
 
 static TraceParamEntry DefaultParamMegaBACEEntries[] = {
@@ -40524,7 +40526,47 @@ static BtkLookupTable DefaultTableMegaBACE = {
 BtkLookupTable *
 Btk_get_mbace_table(void)
 {
-    return &DefaultTableMegaBACE;
+    return Btk_compile_lookup_table(&DefaultTableMegaBACE);
 }
 
+/*
+ * This function tells whether the specified table is one of the built-in
+ * tables, which are never freed.
+ */
+int
+Btk_is_default_table(BtkLookupTable *table)
+{
+    return (table == &DefaultTable3730pop7) ||
+           (table == &DefaultTable3700pop5) ||
+           (table == &DefaultTable3700pop6) ||
+           (table == &DefaultTable3100pop6) ||
+           (table == &DefaultTableMegaBACE);
+}
 
+/*
+ * This function returns the built-in table of the specified name, one of
+ * "3700pop5", "3700pop6", "3100pop6", "3730pop7" and "mbace", without
+ * compiling it, or NULL if there is none.  Its synopsis is:
+ *
+ * table = Btk_find_default_table(name)
+ */
+BtkLookupTable *
+Btk_find_default_table(const char *name)
+{
+    if (strcmp(name, "3700pop5") == 0) {
+        return &DefaultTable3700pop5;
+    }
+    if (strcmp(name, "3700pop6") == 0) {
+        return &DefaultTable3700pop6;
+    }
+    if (strcmp(name, "3100pop6") == 0) {
+        return &DefaultTable3100pop6;
+    }
+    if (strcmp(name, "3730pop7") == 0) {
+        return &DefaultTable3730pop7;
+    }
+    if (strcmp(name, "mbace") == 0) {
+        return &DefaultTableMegaBACE;
+    }
+    return NULL;
+}
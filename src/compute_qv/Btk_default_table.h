@@ -50,3 +50,9 @@ Btk_get_ABI_KB_recalln_table(void);
 
 extern BtkLookupTable *
 Btk_get_mbace_table(void);
+
+extern int
+Btk_is_default_table(BtkLookupTable *);
+
+extern BtkLookupTable *
+Btk_find_default_table(const char *);
@@ -76,7 +76,6 @@
 #define USE_BEST_BASE_POS  0
 #define WINDOW_7 7
 
-extern unsigned int max_colordata_value;
 
 /*******************************************************************************
  * Function: get_mixed_base_position
@@ -387,7 +386,7 @@ find_alternative_peaks(Data *data, int i, int *found_peak_ind,
     double min_peak_height, Options *options, BtkMessage *message) 
 {
     int        j, jc, k, pind, pos[3]; 
-    static int left_bound=0, right_bound=0;
+    int        left_bound, right_bound;
     double     iheight = data->bases.called_peak_list[i]->iheight,
                ave_spacing;
     Peak       peak;
@@ -501,11 +500,11 @@ find_alternative_peaks(Data *data, int i, int *found_peak_ind,
                 (i>0) &&
                 (i<data->bases.length-1) &&
                  ( can_insert_base(data, i-1, i+1, 1,
-                   spacing_curve(data->bases.called_peak_list[i]->ipos) *
+                   spacing_curve(data->bases.called_peak_list[i]->ipos, data) *
                    BASE_MERGE_FACTOR, -1., options) ||
                   ((i<data->bases.length-2) &&
                    can_insert_base(data, i, i+2, 1,
-                   spacing_curve(data->bases.called_peak_list[i+1]->ipos) *
+                   spacing_curve(data->bases.called_peak_list[i+1]->ipos, data) *
                    BASE_MERGE_FACTOR, -1., options))))
                 continue;
 
@@ -1201,8 +1200,8 @@ int
 Btk_get_mixed_bases(int *num_bases, char **bases, int **peak_locs, 
     int num_datapoints, int **chromatogram, char *color2base, 
     uint8_t **quality_values, ReadInfo *read_info, BtkLookupTable *table, 
-    ContextTable *ctable, Options options, BtkMessage *message, 
-    Results *results)
+    ContextTable *ctable, Options options, BtkReadContext *context,
+    BtkMessage *message, Results *results)
 {
     int      i, num2, renorm;
     int     *data_peak_ind1=NULL, *data_peak_ind2=NULL; /* for .poly file */
@@ -1213,7 +1212,8 @@ Btk_get_mixed_bases(int *num_bases, char **bases, int **peak_locs,
     if (SHOW_INPUT_OPTIONS)
         show_input_options(&options);
 
-    if (data_create(&data, num_datapoints, *num_bases, color2base, message)
+    if (data_create(&data, num_datapoints, *num_bases, color2base, context,
+        message)
 	!= SUCCESS)
     {
         sprintf(message->text, "Error calling data_create\n");
@@ -49,6 +49,7 @@ Btk_get_mixed_bases(
     BtkLookupTable *,   /* pointer to a lookup table */
     ContextTable * ,    /* pointer to a context table */ 
     Options options,    /* structure including file_name, nocall, etc. */
+    BtkReadContext *,   /* state of the read being processed */
     BtkMessage *,	/* error code and descriptive text */
     Results *           /* statistical results used by train (not ttuner) */
 );
@@ -26,14 +26,96 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 #include "Btk_qv.h"
+#include "util.h"
 #include "Btk_lookup_table.h"
 #include "Btk_default_table.h"
 #include "Btk_atod.h"
+#include "context_table.h"
+#include "Btk_table_registry.h"
 
 #define MAXLINE	(1000)
 #define CHUNK	(1000)
 #define MAX_NUM_TPAR_THRESHOLDS	(100)
+#define QV_BATCH	(256)	/* bases per batch of Btk_qv_grid_lookup_read() */
+
+/* The batch kernel is compiled for several instruction sets, and the one
+ * for the CPU is selected when the program is loaded
+ */
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 6) \
+    && defined(__x86_64__) && defined(__linux__)
+#define QV_TARGET_CLONES \
+    __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define QV_TARGET_CLONES
+#endif
+
+/* The threshold of trace parameter k of entry e of a table */
+#define ENTRY_THRESHOLD(table, e, k) \
+    ((k) == 0 ? (table)->tpar[(int)(table)->entries[e].phr3i].phr3t : \
+     (k) == 1 ? (table)->tpar[(int)(table)->entries[e].phr7i].phr7t : \
+     (k) == 2 ? (table)->tpar[(int)(table)->entries[e].psr7i].psr7t : \
+                (table)->tpar[(int)(table)->entries[e].presi].prest)
+
+/*
+ * Binary lookup table file, written by Btk_write_lookup_table_binary() in
+ * the byte order of the host.  A header is followed by the sections, each
+ * an array starting at a multiple of BTK_LUT_ALIGN bytes in the file: the
+ * trace parameter thresholds, the entries, then the compiled grid of
+ * Btk_compile_lookup_table(), if any.  Btk_read_lookup_table() maps the
+ * file and uses the sections where they are, without parsing.
+ */
+#define BTK_LUT_MAGIC       "TTLUTB01"
+#define BTK_LUT_BYTE_ORDER  0x01020304
+#define BTK_LUT_ALIGN       64
+
+#define ALIGN_LUT_OFFSET(offset) \
+    (((offset) + BTK_LUT_ALIGN - 1) / BTK_LUT_ALIGN * BTK_LUT_ALIGN)
+
+typedef enum {
+    LUT_SEC_TPAR,       /* TraceParamEntry, num_tpar_entries */
+    LUT_SEC_ENTRIES,    /* BtkLookupEntry, num_lut_entries */
+    LUT_SEC_PHR3,       /* double, grid thresholds of each parameter */
+    LUT_SEC_PHR7,
+    LUT_SEC_PSR7,
+    LUT_SEC_PRES,
+    LUT_SEC_QVAL,       /* char, grid cells */
+    LUT_NUM_SECTIONS
+} LutSectionId;
+
+typedef struct {
+    uint64_t offset;    /* of the section in the file */
+    uint64_t count;     /* number of elements */
+    uint32_t elem_size; /* size of an element */
+    uint32_t reserved;
+} LutSection;
+
+typedef struct {
+    char       magic[8];        /* BTK_LUT_MAGIC */
+    uint32_t   byte_order;      /* BTK_LUT_BYTE_ORDER, as written */
+    uint32_t   num_sections;    /* LUT_NUM_SECTIONS */
+    char       version[16];     /* TT_VERSION */
+    int32_t    num_bins[4];     /* of the grid, 0 if it has none */
+    int32_t    default_qval;    /* of the grid */
+    int32_t    reserved;
+    LutSection sections[LUT_NUM_SECTIONS];
+} LutFileHeader;
+
+static const uint32_t LutElemSizes[LUT_NUM_SECTIONS] = {
+    sizeof(TraceParamEntry), sizeof(BtkLookupEntry), sizeof(double),
+    sizeof(double), sizeof(double), sizeof(double), sizeof(char)
+};
+
+static BtkLookupTable *read_binary_lookup_table(char *);
 
 // --------------------------------------------------------------------
 /*
@@ -64,6 +146,14 @@ Btk_read_lookup_table(char *path)
     if ((fp = fopen(path, "r")) == NULL) {
 	return(table);
     }
+    if ((fread(linebuf, 1, sizeof(BTK_LUT_MAGIC) - 1, fp)
+        == sizeof(BTK_LUT_MAGIC) - 1)
+        && (memcmp(linebuf, BTK_LUT_MAGIC, sizeof(BTK_LUT_MAGIC) - 1) == 0))
+    {
+        (void)fclose(fp);
+        return(read_binary_lookup_table(path));
+    }
+    rewind(fp);
 
     table = CALLOC(BtkLookupTable, 1);
     size = CHUNK;
@@ -176,7 +266,7 @@ Btk_read_lookup_table(char *path)
     table->entries = REALLOC(table->entries,  BtkLookupEntry,
 			     table->num_lut_entries);
 
-    return(table);
+    return(Btk_compile_lookup_table(table));
 
 error_return:
     (void)fclose(fp);
@@ -187,6 +277,684 @@ error_return:
 }
 
 
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static void
+free_qv_grid(BtkQvGrid *grid)
+{
+    int k;
+
+    if (grid == NULL) {
+        return;
+    }
+    if (!grid->borrowed) {
+        for (k = 0; k < 4; k++) {
+            FREE(grid->thresholds[k]);
+        }
+        FREE(grid->qval);
+    }
+    FREE(grid);
+}
+
+/*
+ * This function returns the bin of the specified value in an ascending
+ * array of n thresholds: the index of the first threshold which is >= the
+ * value, or n if there is none.
+ */
+static int
+threshold_bin(const double *thresholds, int n, double value)
+{
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (value <= thresholds[mid]) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/*
+ * This function compiles a lookup table into a BtkQvGrid.  An entry
+ * matches all the cells whose bins are at most those of its thresholds, a
+ * box at the origin of the grid.  The first entry matching a cell is thus
+ * the smallest index of the entries whose box corners are at or above the
+ * cell along every parameter: a suffix minimum of the corners along each
+ * of the four axes in turn.  Its synopsis is:
+ *
+ * grid = compile_qv_grid(table)
+ *
+ *	grid	is the new grid, or NULL if the table is empty, if the grid
+ *		would have more than BTK_QV_GRID_MAX_CELLS cells, or if out
+ *		of memory
+ */
+static BtkQvGrid *
+compile_qv_grid(BtkLookupTable *table)
+{
+    BtkQvGrid *grid;
+    int       *first = NULL, e, k, n, num_entries = table->num_lut_entries;
+    long       num_cells = 1, c, i, j, outer, s;
+
+    if (num_entries < 1) {
+        return NULL;
+    }
+    if ((grid = CALLOC(BtkQvGrid, 1)) == NULL) {
+        return NULL;
+    }
+    grid->default_qval = table->entries[num_entries - 1].qval;
+
+    /* The distinct thresholds of each parameter */
+    for (k = 0; k < 4; k++) {
+        if ((grid->thresholds[k] = CALLOC(double, num_entries)) == NULL) {
+            goto error;
+        }
+        for (e = 0; e < num_entries; e++) {
+            grid->thresholds[k][e] = ENTRY_THRESHOLD(table, e, k);
+        }
+        qsort(grid->thresholds[k], num_entries, sizeof(double),
+            compare_doubles);
+        for (e = 1, n = 1; e < num_entries; e++) {
+            if (grid->thresholds[k][e] != grid->thresholds[k][n - 1]) {
+                grid->thresholds[k][n++] = grid->thresholds[k][e];
+            }
+        }
+        grid->num_bins[k] = n;
+        if (num_cells > BTK_QV_GRID_MAX_CELLS / n) {
+            goto error;
+        }
+        num_cells *= n;
+    }
+    for (k = 3, s = 1; k >= 0; k--) {
+        grid->stride[k] = s;
+        s *= grid->num_bins[k];
+    }
+
+    /* The first entry at each corner */
+    if ((first = CALLOC(int, num_cells)) == NULL) {
+        goto error;
+    }
+    for (c = 0; c < num_cells; c++) {
+        first[c] = num_entries;
+    }
+    for (e = num_entries - 1; e >= 0; e--) {
+        for (k = 0, c = 0; k < 4; k++) {
+            c += grid->stride[k] * threshold_bin(grid->thresholds[k],
+                grid->num_bins[k], ENTRY_THRESHOLD(table, e, k));
+        }
+        first[c] = e;
+    }
+
+    /* Suffix minimum along each axis */
+    for (k = 0; k < 4; k++) {
+        s = grid->stride[k];
+        n = grid->num_bins[k];
+        for (outer = 0; outer < num_cells; outer += s * n) {
+            for (j = n - 2; j >= 0; j--) {
+                int *cell = first + outer + j * s;
+
+                for (i = 0; i < s; i++) {
+                    if (cell[i + s] < cell[i]) {
+                        cell[i] = cell[i + s];
+                    }
+                }
+            }
+        }
+    }
+
+    if ((grid->qval = CALLOC(char, num_cells)) == NULL) {
+        goto error;
+    }
+    for (c = 0; c < num_cells; c++) {
+        grid->qval[c] = (first[c] < num_entries) ?
+            table->entries[first[c]].qval : grid->default_qval;
+    }
+    FREE(first);
+    return grid;
+
+error:
+    FREE(first);
+    free_qv_grid(grid);
+    return NULL;
+}
+
+/*
+ * This function compiles the specified lookup table into a dense grid of
+ * quality values, unless it has been already, so that get_quality_value()
+ * finds the QV of a base with a binary search per trace parameter rather
+ * than a scan of the whole table.  The QVs are the same either way.
+ * Several threads may compile the same table at once: the grid of only
+ * one of them is kept.  Its synopsis is:
+ *
+ * table = Btk_compile_lookup_table(table)
+ *
+ *	table	is the table, which is still usable without a grid if it
+ *		can't be compiled
+ */
+BtkLookupTable *
+Btk_compile_lookup_table(BtkLookupTable *table)
+{
+    BtkQvGrid *grid;
+
+    if ((table == NULL) || (Btk_qv_grid(table) != NULL)) {
+        return table;
+    }
+    if ((grid = compile_qv_grid(table)) == NULL) {
+        return table;
+    }
+#ifdef __GNUC__
+    {
+        BtkQvGrid *none = NULL;
+
+        if (!__atomic_compare_exchange_n(&table->grid, &none, grid, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+            free_qv_grid(grid);
+        }
+    }
+#else
+    table->grid = grid;
+#endif
+    return table;
+}
+
+/*
+ * This function returns the compiled grid of the specified lookup table,
+ * or NULL if it has none.
+ */
+BtkQvGrid *
+Btk_qv_grid(BtkLookupTable *table)
+{
+#ifdef __GNUC__
+    return __atomic_load_n(&table->grid, __ATOMIC_ACQUIRE);
+#else
+    return table->grid;
+#endif
+}
+
+/*
+ * This function returns the quality value which the specified grid gives
+ * to a base with the specified trace parameters.  Its synopsis is:
+ *
+ * qv = Btk_qv_grid_lookup(grid, phr3, phr7, psr7, pres)
+ */
+unsigned char
+Btk_qv_grid_lookup(BtkQvGrid *grid, double phr3, double phr7, double psr7,
+    double pres)
+{
+    double values[4];
+    long   c = 0;
+    int    k, b;
+
+    values[0] = phr3;
+    values[1] = phr7;
+    values[2] = psr7;
+    values[3] = pres;
+    for (k = 0; k < 4; k++) {
+        b = threshold_bin(grid->thresholds[k], grid->num_bins[k], values[k]);
+        if (b == grid->num_bins[k]) {
+            /* Above all the thresholds, or NaN: no entry matches */
+            return (unsigned char)grid->default_qval;
+        }
+        c += grid->stride[k] * b;
+    }
+    return (unsigned char)grid->qval[c];
+}
+
+/*
+ * This function computes the cells of the grid of a batch of at most
+ * QV_BATCH bases, or -1 for the bases which no entry matches.  The bin
+ * of a value along a parameter is the number of thresholds, less the
+ * number of thresholds >= the value; these are counted with one
+ * comparison of all the bases per threshold, which compilers vectorize.
+ */
+static void QV_TARGET_CLONES
+qv_grid_cells(const BtkQvGrid *grid, int n, double **values, int *cells)
+{
+    int           count[QV_BATCH];
+    int           i, j, k, num_bins, stride;
+    const double *x;
+    double        t;
+
+    for (i = 0; i < n; i++) {
+        cells[i] = 0;
+    }
+    for (k = 0; k < 4; k++) {
+        x = values[k];
+        num_bins = grid->num_bins[k];
+        stride = (int)grid->stride[k];
+        for (i = 0; i < n; i++) {
+            count[i] = 0;
+        }
+        for (j = 0; j < num_bins; j++) {
+            t = grid->thresholds[k][j];
+            for (i = 0; i < n; i++) {
+                count[i] += (x[i] <= t);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            /* No threshold >= the value: above them all, or NaN */
+            cells[i] = ((count[i] == 0) || (cells[i] < 0)) ? -1 :
+                cells[i] + stride * (num_bins - count[i]);
+        }
+    }
+}
+
+/*
+ * This function assigns quality values to all the bases of a read at once,
+ * the same as Btk_qv_grid_lookup() would one at a time.  Its synopsis is:
+ *
+ * Btk_qv_grid_lookup_read(grid, num_bases, params, quality_values)
+ *
+ * where
+ *	params		is the address of the arrays of the phr3, phr7, psr7
+ *			and pres trace parameters of the bases, in that order;
+ *			any further arrays are ignored
+ *	quality_values	is the address of the array of the QVs of the bases
+ */
+void
+Btk_qv_grid_lookup_read(BtkQvGrid *grid, int num_bases, double **params,
+    unsigned char *quality_values)
+{
+    double *values[4];
+    int     cells[QV_BATCH];
+    int     i, k, n, start;
+
+    for (start = 0; start < num_bases; start += n) {
+        n = (num_bases - start < QV_BATCH) ? num_bases - start : QV_BATCH;
+        for (k = 0; k < 4; k++) {
+            values[k] = params[k] + start;
+        }
+        qv_grid_cells(grid, n, values, cells);
+        for (i = 0; i < n; i++) {
+            quality_values[start + i] = (unsigned char)((cells[i] < 0) ?
+                grid->default_qval : grid->qval[cells[i]]);
+        }
+    }
+}
+
+/*
+ * This function releases the contents of a binary lookup table: unmaps
+ * them if they are mapped, frees them otherwise.
+ */
+static void
+release_table_data(void *data, long size, int mapped)
+{
+#ifndef __WIN32
+    if (mapped) {
+        (void)munmap(data, (size_t)size);
+        return;
+    }
+#endif
+    free(data);
+}
+
+/*
+ * This function makes a lookup table of the contents of a binary lookup
+ * table, after checking them.  The tpar thresholds, the entries and the
+ * grid of the table are those of the contents.  If they have no grid, one
+ * is compiled.  Its synopsis is:
+ *
+ * table = Btk_map_lookup_table(data, size, mapped, message)
+ *
+ * where
+ *	data	is the address of the contents, as written by
+ *		Btk_write_lookup_table_binary()
+ *	size	is their size
+ *	mapped	is whether they are mapped, so that they are unmapped
+ *		rather than freed when the table is destroyed
+ *	message	is the address of a BtkMessage where information about an
+ *		error will be put, if any
+ *
+ *	table	is the table, which owns the contents, or NULL if they are
+ *		not those of a table of this version of TraceTuner or if out
+ *		of memory
+ */
+BtkLookupTable *
+Btk_map_lookup_table(void *data, long size, int mapped, BtkMessage *message)
+{
+    BtkLookupTable *table;
+    BtkQvGrid      *grid;
+    LutFileHeader  *h = (LutFileHeader *)data;
+    LutSection     *sec;
+    char           *base = (char *)data;
+    int             e, i, k;
+    long            s;
+    uint64_t        num_cells = 1;
+
+    if ((size < (long)sizeof(LutFileHeader))
+        || (memcmp(h->magic, BTK_LUT_MAGIC, sizeof(h->magic)) != 0)
+        || (h->num_sections != LUT_NUM_SECTIONS))
+    {
+        goto corrupt;
+    }
+    if (h->byte_order != BTK_LUT_BYTE_ORDER) {
+        sprintf(message->text, "written with another byte order");
+        return NULL;
+    }
+    if ((memchr(h->version, '\0', sizeof(h->version)) == NULL)
+        || (strncmp(h->version, TT_VERSION, 6) != 0))
+    {
+        sprintf(message->text,
+            "version %.16s does not match the ttuner version %s",
+            h->version, TT_VERSION);
+        return NULL;
+    }
+
+    /* Check that the sections are in the contents */
+    for (i = 0; i < LUT_NUM_SECTIONS; i++) {
+        sec = &h->sections[i];
+        if ((sec->elem_size != LutElemSizes[i])
+            || (sec->offset % BTK_LUT_ALIGN != 0)
+            || (sec->offset > (uint64_t)size)
+            || (sec->count > ((uint64_t)size - sec->offset)
+                / LutElemSizes[i])
+            || (sec->count > INT_MAX))
+        {
+            goto corrupt;
+        }
+    }
+
+    /* Without a grid, the thresholds of the entries are looked up when the
+     * grid is compiled or the table is searched.  A grid saved from a table
+     * is used as is, even if some entries of the table are out of range,
+     * as in the built-in MegaBACE table
+     */
+    if (h->num_bins[0] == 0) {
+        const BtkLookupEntry *entries = (const BtkLookupEntry *)(base +
+            h->sections[LUT_SEC_ENTRIES].offset);
+        int num_tpar_entries = (int)h->sections[LUT_SEC_TPAR].count;
+
+        for (i = LUT_SEC_PHR3; i <= LUT_SEC_QVAL; i++) {
+            if (h->sections[i].count != 0) {
+                goto corrupt;
+            }
+        }
+        for (e = 0; e < (int)h->sections[LUT_SEC_ENTRIES].count; e++) {
+            const BtkLookupEntry *entry = &entries[e];
+
+            if ((entry->phr3i < 0) || (entry->phr3i >= num_tpar_entries)
+             || (entry->phr7i < 0) || (entry->phr7i >= num_tpar_entries)
+             || (entry->psr7i < 0) || (entry->psr7i >= num_tpar_entries)
+             || (entry->presi < 0) || (entry->presi >= num_tpar_entries))
+            {
+                goto corrupt;
+            }
+        }
+    }
+
+    /* Otherwise the grid, with ascending thresholds */
+    else {
+        for (k = 0; k < 4; k++) {
+            const double *thresholds;
+
+            sec = &h->sections[LUT_SEC_PHR3 + k];
+            if ((h->num_bins[k] < 1)
+                || (sec->count != (uint64_t)h->num_bins[k])
+                || (num_cells > BTK_QV_GRID_MAX_CELLS
+                    / (uint64_t)h->num_bins[k]))
+            {
+                goto corrupt;
+            }
+            num_cells *= h->num_bins[k];
+            thresholds = (const double *)(base + sec->offset);
+            for (i = 1; i < h->num_bins[k]; i++) {
+                if (!(thresholds[i - 1] < thresholds[i])) {
+                    goto corrupt;
+                }
+            }
+        }
+        if (h->sections[LUT_SEC_QVAL].count != num_cells) {
+            goto corrupt;
+        }
+    }
+
+    if ((table = CALLOC(BtkLookupTable, 1)) == NULL) {
+        sprintf(message->text, "out of memory");
+        return NULL;
+    }
+    table->num_tpar_entries = (int)h->sections[LUT_SEC_TPAR].count;
+    table->tpar = (TraceParamEntry *)(base + h->sections[LUT_SEC_TPAR].offset);
+    table->num_lut_entries = (int)h->sections[LUT_SEC_ENTRIES].count;
+    table->entries = (BtkLookupEntry *)(base +
+        h->sections[LUT_SEC_ENTRIES].offset);
+    if (h->num_bins[0] == 0) {
+        table->data   = data;
+        table->size   = size;
+        table->mapped = mapped;
+        return(Btk_compile_lookup_table(table));
+    }
+
+    if ((grid = CALLOC(BtkQvGrid, 1)) == NULL) {
+        sprintf(message->text, "out of memory");
+        FREE(table);
+        return NULL;
+    }
+    for (k = 0; k < 4; k++) {
+        grid->num_bins[k]   = h->num_bins[k];
+        grid->thresholds[k] = (double *)(base +
+            h->sections[LUT_SEC_PHR3 + k].offset);
+    }
+    for (k = 3, s = 1; k >= 0; k--) {
+        grid->stride[k] = s;
+        s *= grid->num_bins[k];
+    }
+    grid->qval         = base + h->sections[LUT_SEC_QVAL].offset;
+    grid->default_qval = (char)h->default_qval;
+    grid->borrowed     = 1;
+    table->grid        = grid;
+    table->data        = data;
+    table->size        = size;
+    table->mapped      = mapped;
+    return table;
+
+corrupt:
+    sprintf(message->text, "corrupt");
+    return NULL;
+}
+
+/*
+ * This function reads a binary lookup table file, mapping it if possible.
+ * Its synopsis is:
+ *
+ * table = read_binary_lookup_table(path)
+ *
+ *	table	is the table, or NULL if the file couldn't be read or is
+ *		corrupt
+ */
+static BtkLookupTable *
+read_binary_lookup_table(char *path)
+{
+    BtkLookupTable *table;
+    BtkMessage      message;
+    FILE           *fp;
+    void           *data = NULL;
+    long            size = 0;
+    int             mapped = 0;
+#ifndef __WIN32
+    int             fd;
+    struct stat     st;
+
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+        if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)
+            && (st.st_size >= (off_t)sizeof(LutFileHeader)))
+        {
+            data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd,
+                0);
+            if (data != MAP_FAILED) {
+                size   = (long)st.st_size;
+                mapped = 1;
+            }
+            else {
+                data = NULL;
+            }
+        }
+        (void)close(fd);
+    }
+#endif
+
+    if (data == NULL) {
+        if ((fp = fopen(path, "rb")) == NULL) {
+            return NULL;
+        }
+        if ((fseek(fp, 0, SEEK_END) == 0) && (ftell(fp) > 0)) {
+            size = ftell(fp);
+            rewind(fp);
+            data = malloc((size_t)size);
+        }
+        if ((data == NULL)
+            || (fread(data, 1, (size_t)size, fp) != (size_t)size))
+        {
+            (void)fclose(fp);
+            FREE(data);
+            return NULL;
+        }
+        (void)fclose(fp);
+    }
+
+    if ((table = Btk_map_lookup_table(data, size, mapped, &message))
+        == NULL)
+    {
+        fprintf(stderr, "\nLookup table %s: %s\n", path, message.text);
+        release_table_data(data, size, mapped);
+    }
+    return table;
+}
+
+/*
+ * This function makes the contents of a binary lookup table file of the
+ * specified table, with its grid.  A table which has none is compiled for
+ * the contents only, so that a built-in table may be saved, or shared by
+ * Btk_table_registry.c, without compiling it in place.  Its synopsis is:
+ *
+ * data = Btk_lookup_table_image(table, size)
+ *
+ * where
+ *	table	is the lookup table
+ *	size	is the address where the size of the contents is put
+ *
+ *	data	is the address of the contents, to be freed by the caller,
+ *		or NULL if out of memory
+ */
+void *
+Btk_lookup_table_image(BtkLookupTable *table, long *size)
+{
+    LutFileHeader *h;
+    BtkQvGrid     *grid, *compiled = NULL;
+    const void    *sections[LUT_NUM_SECTIONS];
+    char          *data = NULL;
+    uint64_t       offset;
+    int            i, k;
+
+    if ((grid = Btk_qv_grid(table)) == NULL) {
+        grid = compiled = compile_qv_grid(table);
+    }
+    for (i = 0; i < LUT_NUM_SECTIONS; i++) {
+        sections[i] = NULL;
+    }
+    sections[LUT_SEC_TPAR]    = table->tpar;
+    sections[LUT_SEC_ENTRIES] = table->entries;
+    for (k = 0; (grid != NULL) && (k < 4); k++) {
+        sections[LUT_SEC_PHR3 + k] = grid->thresholds[k];
+    }
+    if (grid != NULL) {
+        sections[LUT_SEC_QVAL] = grid->qval;
+    }
+
+    /* The header, with the sections one after the other */
+    if ((h = (LutFileHeader *)calloc(1, sizeof(LutFileHeader))) == NULL) {
+        goto done;
+    }
+    (void)memcpy(h->magic, BTK_LUT_MAGIC, sizeof(h->magic));
+    h->byte_order   = BTK_LUT_BYTE_ORDER;
+    h->num_sections = LUT_NUM_SECTIONS;
+    (void)strncpy(h->version, TT_VERSION, sizeof(h->version) - 1);
+    for (i = 0; i < LUT_NUM_SECTIONS; i++) {
+        h->sections[i].elem_size = LutElemSizes[i];
+    }
+    h->sections[LUT_SEC_TPAR].count    = table->num_tpar_entries;
+    h->sections[LUT_SEC_ENTRIES].count = table->num_lut_entries;
+    if (grid != NULL) {
+        for (k = 0; k < 4; k++) {
+            h->num_bins[k] = grid->num_bins[k];
+            h->sections[LUT_SEC_PHR3 + k].count = grid->num_bins[k];
+        }
+        h->default_qval = grid->default_qval;
+        h->sections[LUT_SEC_QVAL].count =
+            (uint64_t)grid->stride[0] * grid->num_bins[0];
+    }
+    offset = ALIGN_LUT_OFFSET(sizeof(LutFileHeader));
+    for (i = 0; i < LUT_NUM_SECTIONS; i++) {
+        h->sections[i].offset = offset;
+        offset = ALIGN_LUT_OFFSET(offset +
+            h->sections[i].count * h->sections[i].elem_size);
+    }
+
+    /* The sections end with the padding of the last one, so that all of
+     * them, even the empty ones, are in the contents
+     */
+    if ((data = (char *)calloc(1, (size_t)offset)) == NULL) {
+        goto done;
+    }
+    for (i = 0; i < LUT_NUM_SECTIONS; i++) {
+        if (h->sections[i].count > 0) {
+            (void)memcpy(data + h->sections[i].offset, sections[i],
+                h->sections[i].count * h->sections[i].elem_size);
+        }
+    }
+    (void)memcpy(data, h, sizeof(LutFileHeader));
+    *size = (long)offset;
+
+done:
+    FREE(h);
+    free_qv_grid(compiled);
+    return data;
+}
+
+/*
+ * This function writes a lookup table to a binary file, which
+ * Btk_read_lookup_table() maps rather than parses.  Its synopsis is:
+ *
+ * result = Btk_write_lookup_table_binary(table, path)
+ *
+ * where
+ *	table	is the lookup table
+ *	path	is the name of the file to be written
+ *
+ *	result	is SUCCESS or ERROR, with errno set
+ */
+int
+Btk_write_lookup_table_binary(BtkLookupTable *table, char *path)
+{
+    FILE *fp;
+    void *data;
+    long  size;
+
+    if ((data = Btk_lookup_table_image(table, &size)) == NULL) {
+        return ERROR;
+    }
+    if ((fp = fopen(path, "wb")) == NULL) {
+        free(data);
+        return ERROR;
+    }
+    if (fwrite(data, 1, (size_t)size, fp) != (size_t)size) {
+        (void)fclose(fp);
+        free(data);
+        return ERROR;
+    }
+    free(data);
+    return (fclose(fp) == 0) ? SUCCESS : ERROR;
+}
+
 /*
  * This function reclaims the storage taken up by a lookup table previously
  * returned by Btk_read_lookup_table().  Its synopsis is:
@@ -200,14 +968,17 @@ error_return:
 void
 Btk_destroy_lookup_table(BtkLookupTable *table)
 {
-    if (table == NULL)                     {  return;  }
-    if (table == Btk_get_3730pop7_table()) {  return;  }
-    if (table == Btk_get_3700pop5_table()) {  return;  }
-    if (table == Btk_get_3700pop6_table()) {  return;  }
-    if (table == Btk_get_3100pop6_table()) {  return;  }
-    if (table == Btk_get_mbace_table())    {  return;  }
+    if ((table == NULL) || Btk_is_default_table(table)) {
+        return;
+    }
 
-    FREE(table->entries);
-    FREE(table->tpar);
+    free_qv_grid(table->grid);
+    if (table->data != NULL) {
+        release_table_data(table->data, table->size, table->mapped);
+    }
+    else {
+        FREE(table->entries);
+        FREE(table->tpar);
+    }
     FREE(table);
 }
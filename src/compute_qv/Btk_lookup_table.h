@@ -38,13 +38,45 @@ typedef struct _trace_param_threshold_entry {
     double prest;    /* peak resolution     threshold */
 } TraceParamEntry;
 
+/*
+ * The lookup table compiled into a dense 4-D grid of quality values.  Along
+ * each trace parameter, bin j holds the values above threshold j-1 and up
+ * to threshold j of the distinct thresholds of that parameter, in
+ * ascending order.  Each cell holds the QV of the first entry of the table
+ * which the values of the cell satisfy, so that the QV of a base is that
+ * of its cell.
+ */
+#define BTK_QV_GRID_MAX_CELLS   (1 << 24)
+
+typedef struct _btk_qv_grid {
+    int     num_bins[4];    /* distinct thresholds of each parameter */
+    double *thresholds[4];  /* the thresholds, in ascending order */
+    long    stride[4];      /* of each parameter in cells */
+    char   *qval;           /* quality value of each cell */
+    char    default_qval;   /* when no entry matches */
+    int     borrowed;       /* thresholds and qval are in a mapped file */
+} BtkQvGrid;
+
 typedef struct _btk_quality_lookup_table {
     int              num_tpar_entries;
     TraceParamEntry *tpar;
 	int              num_lut_entries;
 	BtkLookupEntry  *entries;
+    BtkQvGrid       *grid;      /* set by Btk_compile_lookup_table() */
+    void            *data;      /* binary table file, which tpar, entries
+                                 * and the grid point into, if any */
+    long             size;
+    int              mapped;    /* whether data is mapped from the file */
 } BtkLookupTable;
 
 
 extern BtkLookupTable *Btk_read_lookup_table(char * /*path*/);
+extern BtkLookupTable *Btk_compile_lookup_table(BtkLookupTable * /*table*/);
+extern BtkQvGrid *Btk_qv_grid(BtkLookupTable * /*table*/);
+extern unsigned char Btk_qv_grid_lookup(BtkQvGrid * /*grid*/, double, double,
+    double, double);
+extern void Btk_qv_grid_lookup_read(BtkQvGrid * /*grid*/, int, double **,
+    unsigned char *);
+extern int Btk_write_lookup_table_binary(BtkLookupTable * /*table*/,
+    char * /*path*/);
 extern void Btk_destroy_lookup_table(BtkLookupTable * /*table*/);
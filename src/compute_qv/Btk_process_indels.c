@@ -2613,7 +2613,7 @@ Btk_process_indels(char *path, int *num_datapoints, int **chromatogram,
             quality_values, long_bases_len, long_data_len,
             long_chromatogram[0], long_chromatogram[1],
             long_chromatogram[2], long_chromatogram[3],
-            color2base, options.chemistry) == ERROR)
+            color2base, options.chemistry, data->context) == ERROR)
         {
             fprintf(stderr, "Error producing long SCF file\n");
             goto error;
@@ -2627,7 +2627,7 @@ Btk_process_indels(char *path, int *num_datapoints, int **chromatogram,
             data->length - indsize_scans[0],
             short_chromatogram[0], short_chromatogram[1],      
             short_chromatogram[2], short_chromatogram[3],      
-            color2base, options.chemistry) == ERROR)
+            color2base, options.chemistry, data->context) == ERROR)
         {
             fprintf(stderr, "Error producing short SCF file\n");
             goto error;
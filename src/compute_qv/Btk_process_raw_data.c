@@ -68,7 +68,6 @@
 #define DEBUG  0
 #define DEBUG0 0
 #define DEBUG_CURTIS 0
-#define DEFAULT_NUM_WINDOWS 40
 #define DEFAULT_SPACING 12
 #define DPRINT(x) fprintf(stderr, #x " = %g\n", (float)(x)) // for debugging
 #define ERROR -1
@@ -98,17 +97,6 @@
 #define SQRT_ENVELOPE_ASYMPTOTE 0.5
 #define SWAP(a,b) tempr=(a);(a)=(b);(b)=tempr
 
-/* Crude estimate of peak spacing */
-static int    num_windows = DEFAULT_NUM_WINDOWS;
-static int    isweet;
-static double crude_spacing_estimate = 8.0;
-static float  mobs_model_coeff[POLYFIT_DEGREE + 1];
-static float  spac_model_coeff[POLYFIT_DEGREE + 1];
-static float  spac_mod_val[DEFAULT_NUM_WINDOWS];
-static float  spac_mod_pos[DEFAULT_NUM_WINDOWS];
-static float  norm_mod_val[NUM_COLORS][DEFAULT_NUM_WINDOWS];
-static float  norm_mod_pos[DEFAULT_NUM_WINDOWS];
-
 static void 
 bubble(int *data, int num_data)
 
@@ -1109,7 +1097,8 @@ estimate_spacing_variation_of_shifted_peaks(Peak *dp[], int num_DPs,
     int   *min_color0,  int *min_color1, Data * data, Options *options,
     BtkMessage *message)
 {
-    int    hist_spacings_len = INT_DBL(5.0 * crude_spacing_estimate);
+    SignalModel *model = &data->context->model;
+    int    hist_spacings_len = INT_DBL(5.0 * model->crude_spacing_estimate);
 
     /* Tolerance for ratio of maximum weight to total weight */
     int      i, spacing, color;
@@ -1478,8 +1467,9 @@ sliding_window5_average(float *y, int num_data)
  * Comments:
  */
 double
-spacing_curve(int scan)
+spacing_curve(int scan, Data *data)
 {
+    SignalModel *model = &data->context->model;
     int   i;
     float powers[POLYFIT_DEGREE + 1];
     double r = -1;
@@ -1487,30 +1477,31 @@ spacing_curve(int scan)
     if (POLY_SPAC_MODEL_APPROX > 0) {
         fpoly(scan, powers-1, POLYFIT_DEGREE + 1);    /* offset for NR */
         for ( i=0; i < POLYFIT_DEGREE + 1; i++)
-            r += spac_model_coeff[i] * powers[i];
+            r += model->spac_model_coeff[i] * powers[i];
     }
     else
     {
 #if 0
         fprintf(stderr, 
             "In spacing_curve: scan=%d num_windows=%d spac_mod_pos0=%f spac_mod_pos_last=%f\n",
-            scan, num_windows, spac_mod_pos[0], spac_mod_pos[num_windows - 1]);
+            scan, model->num_windows, model->spac_mod_pos[0],
+            model->spac_mod_pos[model->num_windows - 1]);
 #endif
-        if (scan <= spac_mod_pos[0])
-            r = spac_mod_val[0];
-        else if (scan >= spac_mod_pos[num_windows - 1])
-            r = spac_mod_val[num_windows - 1];
+        if (scan <= model->spac_mod_pos[0])
+            r = model->spac_mod_val[0];
+        else if (scan >= model->spac_mod_pos[model->num_windows - 1])
+            r = model->spac_mod_val[model->num_windows - 1];
         else 
         {
-            for (i=0; i< num_windows - 1; i++)
+            for (i=0; i< model->num_windows - 1; i++)
             {
-                if (((float)scan >= spac_mod_pos[i  ]) &&
-                   ((float)scan <  spac_mod_pos[i+1]))
+                if (((float)scan >= model->spac_mod_pos[i  ]) &&
+                   ((float)scan <  model->spac_mod_pos[i+1]))
                 {
-                   r = spac_mod_val[i] +
-                      (spac_mod_val[i+1] - spac_mod_val[i]) *
-                      ((float)scan       - spac_mod_pos[i]) /
-                      (spac_mod_pos[i+1] - spac_mod_pos[i]);
+                   r = model->spac_mod_val[i] +
+                      (model->spac_mod_val[i+1] - model->spac_mod_val[i]) *
+                      ((float)scan       - model->spac_mod_pos[i]) /
+                      (model->spac_mod_pos[i+1] - model->spac_mod_pos[i]);
                 }
             }
         }
@@ -1526,6 +1517,7 @@ static void
 output_spacing_curve(float *x, float *y, int num_points, int degree, 
     int win_size, Data *data)
 {
+    SignalModel *model = &data->context->model;
     int   i, j;
     char filename[MAXPATHLEN];
     float *powers, *z;
@@ -1552,9 +1544,9 @@ output_spacing_curve(float *x, float *y, int num_points, int degree,
     for (i=0; i<num_points; i++) {
         z[i] = 0.;
         for (j=0; j<degree; j++) {
-            z[i] += spac_model_coeff[j] * pow(x[i], j);
+            z[i] += model->spac_model_coeff[j] * pow(x[i], j);
         }
-        z[i] = spacing_curve(x[i]);
+        z[i] = spacing_curve(x[i], data);
         if (z[i] >0) 
             fprintf(fp, "%d %f\n", i, z[i]);
     }
@@ -1563,7 +1555,7 @@ output_spacing_curve(float *x, float *y, int num_points, int degree,
     /* Output sliding window avarage approximation of spacing curve */
     fprintf(fp, "\ncolor = %d\n", 5);      /* violet */
     for (i=0; i<num_points; i++) {
-        z[i] = spacing_curve(x[i]);
+        z[i] = spacing_curve(x[i], data);
     }
     (void)sliding_window5_average(z, num_points);
     for (i=0; i<num_points; i++) {
@@ -1646,26 +1638,28 @@ output_new_spacing_curve(float *x, float *y, int num_points)
  * Comments:
  */
 double
-normalization_curve(int scan, int color)
+normalization_curve(int scan, int color, Data *data)
 {
+    SignalModel *model = &data->context->model;
     int   i;
     double r = -1;
 
-    if (scan <= norm_mod_pos[0])
-        r = norm_mod_val[color][0];
-    else if (scan >= norm_mod_pos[num_windows - 1])
-        r = norm_mod_val[color][num_windows - 1];
+    if (scan <= model->norm_mod_pos[0])
+        r = model->norm_mod_val[color][0];
+    else if (scan >= model->norm_mod_pos[model->num_windows - 1])
+        r = model->norm_mod_val[color][model->num_windows - 1];
     else
     {
-        for (i=0; i< num_windows - 1; i++)
+        for (i=0; i< model->num_windows - 1; i++)
         {
-            if (((float)scan >= norm_mod_pos[i  ]) &&
-               ((float)scan <  norm_mod_pos[i+1]))
+            if (((float)scan >= model->norm_mod_pos[i  ]) &&
+               ((float)scan <  model->norm_mod_pos[i+1]))
             {
-               r = norm_mod_val[color][i] +
-                  (norm_mod_val[color][i+1] - norm_mod_val[color][i]) *
-                  ((float)scan       - norm_mod_pos[i]) /
-                  (norm_mod_pos[i+1] - norm_mod_pos[i]);
+               r = model->norm_mod_val[color][i] +
+                  (model->norm_mod_val[color][i+1] -
+                   model->norm_mod_val[color][i]) *
+                  ((float)scan       - model->norm_mod_pos[i]) /
+                  (model->norm_mod_pos[i+1] - model->norm_mod_pos[i]);
             }
         }
     }
@@ -1706,11 +1700,12 @@ find_optimal_shift_in_a_window(Data *data, int ind_win, int win_beg, int win_end
     int *best_min_pos, int *best_max_pos, float *shift_err, 
     int *best_min_color0, int *best_min_color1, Options *options, BtkMessage *message)
 {
+    SignalModel *model = &data->context->model;
     const double shiftIncDefault		= 0.5;
     const double shiftMaxDefault		= 1.5;
     const double minRelatChannelWgt     = MIN_RELATIVE_CHANNEL_WEIGHT;
                  /* minimum total color height as fraction of total height */
-    const int	 hist_spacings_len = INT_DBL(2.5*crude_spacing_estimate);
+    const int	 hist_spacings_len = INT_DBL(2.5*model->crude_spacing_estimate);
 		 /* length of hist_spacings; maximum spacing in histogram + 1 */
     const double minErr = 0.2;
 
@@ -1733,10 +1728,10 @@ find_optimal_shift_in_a_window(Data *data, int ind_win, int win_beg, int win_end
         shiftMax = shiftMaxDefault;
 
     /* Set absolute parameters */
-    shift_inc = qv_round(shiftInc * crude_spacing_estimate);
+    shift_inc = qv_round(shiftInc * model->crude_spacing_estimate);
     if ( shift_inc < 1 ) 
         shift_inc = 1;
-    shift_max = qv_round(shiftMax * crude_spacing_estimate);
+    shift_max = qv_round(shiftMax * model->crude_spacing_estimate);
 
     /* Check for a good signal in each channel */
     tot_wgt = 0;
@@ -1836,8 +1831,8 @@ find_optimal_shift_in_a_window(Data *data, int ind_win, int win_beg, int win_end
               "        std_dev=%f best_std_dev=%f \n",  std_dev, best_std_dev);
 #endif 
                         if ((mean_spacing > DBL_EPSILON) &&
-                            (mean_spacing > crude_spacing_estimate-1.) &&
-                            (mean_spacing < crude_spacing_estimate+1.) &&
+                            (mean_spacing > model->crude_spacing_estimate-1.) &&
+                            (mean_spacing < model->crude_spacing_estimate+1.) &&
                             ( (spacing_var  < *best_spacing_var) 
                               ||
                              ((spacing_var == *best_spacing_var) &&
@@ -1968,6 +1963,7 @@ static int
 make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS], 
     Options *options, BtkMessage *message)
 {
+    SignalModel *model = &data->context->model;
     Peak	**peaks = data->peak_list; /* shortcut to peak_list */
     const int	  num_peaks = data->peak_list_len;
     const double  maxShiftMax        = MAX_SHIFT_MAX;
@@ -2094,14 +2090,14 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
         if (min_var * ONE_MINUS > spac_var[i]) {
             min_var = spac_var[i];
             i0 = i;
-            crude_spacing_estimate = spacing[i0];
+            model->crude_spacing_estimate = spacing[i0];
         }
         if (max_var < spac_var[i] * ONE_MINUS ) {
             max_var = spac_var[i];
             j = i;
         }
     }
-    isweet = i0;
+    model->isweet = i0;
 
     if (MONITOR > 1) {
         if ( (fp = fopen("tt_rel_spac_var", "w")) != NULL ) {
@@ -2440,10 +2436,10 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
         if (options->Verbose > 1)
             fprintf(stderr, "Warning: Poor mobility shift estimates.\n"
 	    "    No shift corrections applied.\n"
-	    "    Using constant default spacing of %f\n", crude_spacing_estimate);
-        spac_model_coeff[0] = crude_spacing_estimate;
+	    "    Using constant default spacing of %f\n", model->crude_spacing_estimate);
+        model->spac_model_coeff[0] = model->crude_spacing_estimate;
         for ( i=1; i < POLYFIT_DEGREE + 1; i++ ) 
-            spac_model_coeff[i] = 0;
+            model->spac_model_coeff[i] = 0;
     }
     else {
 	/* Fit mob. shifts with polynomial models */
@@ -2473,13 +2469,13 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
 
 #if POLY_MOB_SHIFT_APPROX
             /* Approximate mobility shift curve with polynomial */
-            polyfit(x, y[color], var, ngood+1, mobs_model_coeff, 
+            polyfit(x, y[color], var, ngood+1, model->mobs_model_coeff, 
                 POLYFIT_DEGREE + 1);
             for (i=0; i < POLYFIT_DEGREE + 1; i++) 
-                a[color][i] = mobs_model_coeff[i];
+                a[color][i] = model->mobs_model_coeff[i];
 #endif
             if (options->xgr) {
-                output_mobility_curve(x, y[color], ngood+1, mobs_model_coeff, 
+                output_mobility_curve(x, y[color], ngood+1, model->mobs_model_coeff, 
                     POLYFIT_DEGREE + 1, color);
             }
 
@@ -2490,8 +2486,8 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
             if ( options->Verbose > 2 )
 	        printf("fitted polynomial coeff's for color %d: "
 	           "%10.3g %10.3g %10.3g\n",
-	           color, mobs_model_coeff[0], 
-                   mobs_model_coeff[1], mobs_model_coeff[2]);
+	           color, model->mobs_model_coeff[0], 
+                   model->mobs_model_coeff[1], model->mobs_model_coeff[2]);
 #endif
         }
 
@@ -2580,48 +2576,48 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
  	/* Calculate the spoacing curve 
          * num_wins is local variable, and num_windows = global
          */
-        num_windows = num_wins; 
-        spac_mod_pos[i0] = data_beg + win_size* i0/2 + win_size/2;
-        spac_mod_val[i0] = spacing[i0];
-        for ( i=i0+1; i < num_windows; i++ )
+        model->num_windows = num_wins; 
+        model->spac_mod_pos[i0] = data_beg + win_size* i0/2 + win_size/2;
+        model->spac_mod_val[i0] = spacing[i0];
+        for ( i=i0+1; i < model->num_windows; i++ )
         {
-            spac_mod_pos[i] = data_beg + win_size* i/2 + win_size/2;
-            spac_mod_val[i] = spacing[i];
-            if (spac_mod_val[i] < spac_mod_val[i-1])
-                spac_mod_val[i] = spac_mod_val[i-1];
+            model->spac_mod_pos[i] = data_beg + win_size* i/2 + win_size/2;
+            model->spac_mod_val[i] = spacing[i];
+            if (model->spac_mod_val[i] < model->spac_mod_val[i-1])
+                model->spac_mod_val[i] = model->spac_mod_val[i-1];
 
             if ((spacing[i] <= 0) || isnan(spacing[i])) {
-                spac_mod_val[i] = spac_mod_val[i-1];
+                model->spac_mod_val[i] = model->spac_mod_val[i-1];
             }
             var[i] = spac_var[i];
         }
         for ( i=i0-1; i >=0; i--)
         {
-            spac_mod_pos[i] = data_beg + win_size* i/2 + win_size/2; 
-            spac_mod_val[i] = spacing[i];
+            model->spac_mod_pos[i] = data_beg + win_size* i/2 + win_size/2; 
+            model->spac_mod_val[i] = spacing[i];
             if ((spacing[i] <= 0) || isnan(spacing[i])) {
-                spac_mod_val[i] = spac_mod_val[i+1];
+                model->spac_mod_val[i] = model->spac_mod_val[i+1];
             } 
             var[i] = spac_var[i];
         }
 #if 0
         fprintf(stderr, "i0=%d data_beg=%d data_end=%d num_windows=%d\n", 
-            i0, data_beg, data_end, num_windows);
+            i0, data_beg, data_end, model->num_windows);
         fprintf(stderr, "spac_mod_pos=\n");
-        for ( i=0; i < num_windows; i++ )
-            fprintf(stderr, "%f ", spac_mod_pos[i]);
+        for ( i=0; i < model->num_windows; i++ )
+            fprintf(stderr, "%f ", model->spac_mod_pos[i]);
         fprintf(stderr, "\n");
         fprintf(stderr, "spacing=\n");
-        for ( i=0; i < num_windows; i++ )
+        for ( i=0; i < model->num_windows; i++ )
             fprintf(stderr, "%f ", spacing[i]);
         fprintf(stderr, "spac_mod_val=\n");
         fprintf(stderr, "\n");
-        for ( i=0; i < num_windows; i++ )
-            fprintf(stderr, "%f ", spac_mod_val[i]);
+        for ( i=0; i < model->num_windows; i++ )
+            fprintf(stderr, "%f ", model->spac_mod_val[i]);
         fprintf(stderr, "\n");
 #endif
 
-        sliding_window5_average(spac_mod_val, num_windows);
+        sliding_window5_average(model->spac_mod_val, model->num_windows);
 
 //      polyfit(spac_mod_pos, spac_mod_val, var, num_windows, spac_model_coeff, 
 //          POLYFIT_DEGREE + 1);
@@ -2629,13 +2625,14 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
         if (options->Verbose > 2) {
             fprintf(stderr, "Spacing model coeff:\n");
             for ( i=0; i < POLYFIT_DEGREE; i++ ) {
-                fprintf(stderr, "c[%d]=%f ", i, spac_model_coeff[i]);
+                fprintf(stderr, "c[%d]=%f ", i, model->spac_model_coeff[i]);
             }
             fprintf(stderr, "\n");
         }
 
         if (options->xgr) {
-            output_spacing_curve(spac_mod_pos, spac_mod_val, num_windows, 
+            output_spacing_curve(model->spac_mod_pos, model->spac_mod_val,
+                model->num_windows, 
                 POLYFIT_DEGREE + 1, win_size, data);
         }
 
@@ -2677,7 +2674,7 @@ make_DP_mobility_shifts(Data *data, int shift_flag[NUM_COLORS],
             for ( i=0; i < num_wins; i++ )
 	        fprintf(fp, "%7d %6.2f %6.2f %6.2f\n", 
                     win_size*(i-1)/2+win_size/2, spacing[i],
-		    spac_var[i], spacing_curve(INT_FLT(win_size*(i-1)/2+win_size/2)));
+		    spac_var[i], spacing_curve(INT_FLT(win_size*(i-1)/2+win_size/2), data));
             fclose(fp);
         }
     }
@@ -2799,8 +2796,9 @@ last_base_pos(int *num_datapoints, int *data_end, int **chromatogram)
  *****************************************************************************
  */
 static void
-output_normalization_curves()
+output_normalization_curves(Data *data)
 {
+    SignalModel *model = &data->context->model;
     int   i;
     FILE *fp;
 
@@ -2811,29 +2809,29 @@ output_normalization_curves()
 
     /* Output computed normalization factor for 0th color */
     fprintf(fp, "\ncolor = %d\n", 4);       /* green  */
-    for (i=0; i<num_windows; i++) {
-        fprintf(fp, "%d %f\n", i, norm_mod_val[0][i]);
+    for (i=0; i<model->num_windows; i++) {
+        fprintf(fp, "%d %f\n", i, model->norm_mod_val[0][i]);
     }
     fprintf(fp, "next\n");
 
     /* Output computed normalization factor for 1st  color */
     fprintf(fp, "\ncolor = %d\n", 9);       /* cyan   */
-    for (i=0; i<num_windows; i++) {
-        fprintf(fp, "%d %f\n", i, norm_mod_val[1][i]);
+    for (i=0; i<model->num_windows; i++) {
+        fprintf(fp, "%d %f\n", i, model->norm_mod_val[1][i]);
     }
     fprintf(fp, "next\n");
 
     /* Output computed normalization factor for 2nd  color */
     fprintf(fp, "\ncolor = %d\n", 7);       /* yellow */
-    for (i=0; i<num_windows; i++) {
-        fprintf(fp, "%d %f\n", i, norm_mod_val[2][i]);
+    for (i=0; i<model->num_windows; i++) {
+        fprintf(fp, "%d %f\n", i, model->norm_mod_val[2][i]);
     }
     fprintf(fp, "next\n");
 
     /* Output computed normalization factor for 3rd  color */
     fprintf(fp, "\ncolor = %d\n", 2);       /* red    */
-    for (i=0; i<num_windows; i++) {
-        fprintf(fp, "%d %f\n", i, norm_mod_val[3][i]);
+    for (i=0; i<model->num_windows; i++) {
+        fprintf(fp, "%d %f\n", i, model->norm_mod_val[3][i]);
     }
     fprintf(fp, "next\n");
     fclose(fp);
@@ -2895,6 +2893,7 @@ output_log_norm_curve(float *ave_int[NUM_COLORS], float *sum_ints[NUM_COLORS],
 static int
 normalize_signals(Data *data, Options *options, BtkMessage *message)
 {
+    SignalModel *model = &data->context->model;
     int    i, j, m, num_wins, win_size, win_beg, win_end, num_factors;
     int    shift[NUM_COLORS]       = {0, 0, 0, 0};
     float  norm_factor[NUM_COLORS] = {0., 0., 0., 0.};
@@ -2909,7 +2908,7 @@ normalize_signals(Data *data, Options *options, BtkMessage *message)
         win_size = MIN_WIN_SIZE;
         num_wins = 2 * (data->pos_data_end - data->pos_data_beg) / win_size;
     }
-    num_windows = num_wins;
+    model->num_windows = num_wins;
     for (i=0; i< NUM_COLORS; i++) {
         sum_ints[i]  = CALLOC(float, num_wins);
         ave_int[i]   = CALLOC(float, num_wins);
@@ -2922,7 +2921,7 @@ normalize_signals(Data *data, Options *options, BtkMessage *message)
         win_beg =  data->pos_data_beg + win_size*m/2;
         win_end =  (win_beg + win_size  < data->pos_data_end) ?
                    (win_beg + win_size) : data->pos_data_end;
-        norm_mod_pos[m] = (win_beg + win_end) / 2;
+        model->norm_mod_pos[m] = (win_beg + win_end) / 2;
 
         for (i=0; i< NUM_COLORS; i++) 
         {
@@ -2972,7 +2971,7 @@ normalize_signals(Data *data, Options *options, BtkMessage *message)
         average_peak_height /= (num_factors>0) ? (float)num_factors : 1;
 
         for (i=0; i< NUM_COLORS; i++) {
-            norm_mod_val[i][m] = (norm_factor[i] > 0) ? 
+            model->norm_mod_val[i][m] = (norm_factor[i] > 0) ? 
                 (average_peak_height / norm_factor[i]) : 1.;
         }
     }
@@ -2981,16 +2980,16 @@ normalize_signals(Data *data, Options *options, BtkMessage *message)
 
     /* Output normalization curves */
     for (i=0; i< NUM_COLORS; i++) {
-        sliding_window5_average(norm_mod_val[i], num_windows);
+        sliding_window5_average(model->norm_mod_val[i], model->num_windows);
     }
 
     if (options->xgr)
-        output_normalization_curves();
+        output_normalization_curves(data);
 
     /* Apply normalization model to data */
     for (i=0; i< NUM_COLORS; i++) {
         for (j=0; j<data->color_data[i].length; j++) {
-            data->color_data[i].data[j] *= normalization_curve(j, i);
+            data->color_data[i].data[j] *= normalization_curve(j, i, data);
         }
 
         /* Update peak heights upon normalization of data */
@@ -3722,6 +3721,7 @@ respace_chromatograms(int **chromatogram, int *num_data,
     int alloc_chromat_len, Data *data, Options *options,
     BtkMessage *message)
 {
+    SignalModel *model = &data->context->model;
     int     i, j, k, init_num_data = *num_data;
     int     scan=0, new_scan=0, new_last_scan=0;
     int    *new_chromatogram[NUM_COLORS];
@@ -3751,7 +3751,7 @@ respace_chromatograms(int **chromatogram, int *num_data,
 #endif
 
     /* Initialize */
-    spacing  = spacing_curve(scan);
+    spacing  = spacing_curve(scan, data);
     new_spacing = DEFAULT_SPACING;
     last_pos = 0.;
    *num_data = 0;
@@ -3764,7 +3764,7 @@ respace_chromatograms(int **chromatogram, int *num_data,
            (*num_data + new_spacing < alloc_chromat_len))
     {
 
-        spacing  = spacing_curve(scan);
+        spacing  = spacing_curve(scan, data);
 
 
 //      if (scan + spacing > init_num_data) {
@@ -3777,7 +3777,7 @@ respace_chromatograms(int **chromatogram, int *num_data,
 
 #if 0
         fprintf(stderr, "scan = %d spacing=%f new_spacing=%f last_pos=%f\n",
-            scan, spacing_curve(scan), new_spacing, last_pos);
+            scan, spacing_curve(scan, data), new_spacing, last_pos);
 #endif
         for (j=new_scan; j<new_scan+new_spacing; j++)
         {
@@ -3967,31 +3967,32 @@ respace_chromatograms(int **chromatogram, int *num_data,
             FREE(dp);
         }
 
-        num_windows = num_wins;
+        model->num_windows = num_wins;
 #if 0
-        fprintf(stderr, "num_windows=%d spacing=\n", num_windows);
+        fprintf(stderr, "num_windows=%d spacing=\n", model->num_windows);
 #endif
-        i0 = isweet;
-        spac_mod_val[i0] = mean_spacing[i0];
-        for ( i=i0+1; i < num_windows; i++ )
+        i0 = model->isweet;
+        model->spac_mod_val[i0] = mean_spacing[i0];
+        for ( i=i0+1; i < model->num_windows; i++ )
         {
-            spac_mod_val[i] = mean_spacing[i];
+            model->spac_mod_val[i] = mean_spacing[i];
             if ((mean_spacing[i] <= 0) || isnan(mean_spacing[i])) {
-                spac_mod_val[i] = spac_mod_val[i-1];
+                model->spac_mod_val[i] = model->spac_mod_val[i-1];
             }
         }
         for ( i=i0-1; i >=0; i--)
         {
-            spac_mod_val[i] = mean_spacing[i];
+            model->spac_mod_val[i] = mean_spacing[i];
             if ((mean_spacing[i] <= 0) || isnan(mean_spacing[i])) {
-                spac_mod_val[i] = spac_mod_val[i+1];
+                model->spac_mod_val[i] = model->spac_mod_val[i+1];
             }
         }
 
-        sliding_window5_average(spac_mod_val, num_windows);
+        sliding_window5_average(model->spac_mod_val, model->num_windows);
 
         if (options->xgr) {
-            output_new_spacing_curve(spac_mod_pos, spac_mod_val, num_windows);   
+            output_new_spacing_curve(model->spac_mod_pos, model->spac_mod_val,
+                model->num_windows);   
         }
 
         FREE(mean_spacing);
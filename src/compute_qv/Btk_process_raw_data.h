@@ -20,7 +20,6 @@
  *************************************************************************/
 
 #define DEFAULT_PEAK_SPACING 12
-#define POLYFIT_DEGREE 5
 #define NUM_MULTICOMP_ITER 16
 
 extern int get_peak_spacing(Data *, Options *, BtkMessage *);
@@ -32,4 +31,4 @@ extern void output_chromatogram(char *, char *, int *, int *, int *, int *,
     int, Data *);
 extern int multicomponent(int **, int, Options *, BtkMessage *);
 extern int prebaseline(int, int **, Options *, BtkMessage *);
-extern double spacing_curve(int);
+extern double spacing_curve(int, Data *);
@@ -46,6 +46,8 @@
 /*#define RESOLUTION_FACTOR 0.00001*/
 #define MERGE_PEAKS 0
 #define MAX_NAME_LENGTH 256
+#define POLYFIT_DEGREE 5
+#define DEFAULT_NUM_WINDOWS 40
 
 extern double Erf(double);
 extern double F(double);
@@ -144,6 +146,40 @@ typedef struct {
     double *psr7;		/* peak distance (or spacing) ratio */
 } TraceParameters;
 
+/* Peak spacing and signal normalization models of a read, as fitted
+ * in windows along the trace while processing raw data
+ */
+typedef struct {
+    int    num_windows;         /* number of windows used by the models */
+    int    isweet;              /* index of window with the best spacing */
+    double crude_spacing_estimate;  /* crude estimate of peak spacing */
+    float  mobs_model_coeff[POLYFIT_DEGREE + 1];
+    float  spac_model_coeff[POLYFIT_DEGREE + 1];
+    float  spac_mod_val[DEFAULT_NUM_WINDOWS];
+    float  spac_mod_pos[DEFAULT_NUM_WINDOWS];
+    float  norm_mod_val[NUM_COLORS][DEFAULT_NUM_WINDOWS];
+    float  norm_mod_pos[DEFAULT_NUM_WINDOWS];
+} SignalModel;
+
+/* State private to the processing of a single read. Every read being
+ * processed has its own context, so that several reads may be processed
+ * at the same time in different threads; the context must be initialized
+ * with Btk_init_read_context() before each read.
+ */
+typedef struct {
+    char        status_code[MAX_NAME_LENGTH]; /* status of the read */
+    int         left_trim_point;
+    int         right_trim_point;
+    int         peaks_added[NUM_COLORS];  /* peaks added by the base caller */
+    int         max_colordata_value;      /* max. signal over all traces */
+    SignalModel model;
+    int         keep_trace_params;  /* whether Btk_compute_qv() is to hand
+                                     * the trace parameters of the called
+                                     * bases over in trace_params, which
+                                     * the caller then frees */
+    TraceParameters trace_params;
+} BtkReadContext;
+
 typedef struct {
     TT_Bases      bases;
     ColorData  color_data[NUM_COLORS];	/* chromatograms */
@@ -156,6 +192,7 @@ typedef struct {
     int        pos_data_end;            /* used when processing raw data */
     TraceParameters trace_parameters;
     char       chemistry[MAX_NAME_LENGTH];
+    BtkReadContext *context;            /* state of the read being processed */
 } Data;
 
 typedef struct {
@@ -219,4 +256,6 @@ typedef enum {
 
 extern void
 exit_message(Options *, int);
+extern void
+Btk_init_read_context(BtkReadContext *);
 #endif
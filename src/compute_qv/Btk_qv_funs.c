@@ -29,6 +29,7 @@
 #include <stdio.h>
 
 #include "Btk_qv.h"
+#include "util.h"
 #include "Btk_qv_data.h"
 #include "Btk_qv_funs.h"  
 
@@ -177,9 +178,9 @@ static double
 exp2_table( double x )
 {
     static double 
-        factor = EXP2_TABLE_SIZE/EXP2_MAX_X,
-        table[EXP2_TABLE_SIZE];
-    static int initialized=0;
+        factor = EXP2_TABLE_SIZE/EXP2_MAX_X;
+    static TT_THREAD_LOCAL double table[EXP2_TABLE_SIZE];
+    static TT_THREAD_LOCAL int initialized=0;
     int i;
     if( !initialized ) {
         double del = 1.0/factor;
@@ -48,9 +48,11 @@
 
 #include "ABI_Toolkit.h"
 #include "SCF_Toolkit.h"
+#include "ZTR_Toolkit.h"
 #include "SFF_Toolkit.h"
 #include "FileHandler.h"
 #include "Btk_qv.h"
+#include "Btk_archive.h"
 #include "Btk_qv_data.h"
 #include "util.h"
 #include "Btk_match_data.h" 
@@ -72,8 +74,6 @@
 #define SHOW_SUBSTITUTIONS           0
 #define USE_DEFAULT_CHEMISTRY        0
 
-unsigned int max_colordata_value;
-
 void
 exit_message(Options *op, int errlevel)
 {
@@ -83,6 +83,23 @@ exit_message(Options *op, int errlevel)
     exit(errlevel);
 }
 
+/*
+ * This function resets the per-read state of a BtkReadContext before
+ * a new read is processed.  Its synopsis is:
+ *
+ * Btk_init_read_context(context)
+ *
+ * where
+ *	context	is the address of the BtkReadContext to be initialized
+ */
+void
+Btk_init_read_context(BtkReadContext *context)
+{
+    (void)memset(context, 0, sizeof(BtkReadContext));
+    context->model.num_windows = DEFAULT_NUM_WINDOWS;
+    context->model.crude_spacing_estimate = 8.0;
+}
+
 /********************************************************************************
  * This function prints as formatted an error message as it can.  Its
  * synopsis is:
@@ -111,6 +128,271 @@ error(char *label, char *msg, int err)
         fprintf(stderr, "%s: %s: %d\n", label, msg, err);
 }
 
+/* Multi-files (multi-FASTA, multi-qual, multi-FASTQ, tt.* files) written
+ * during the run.  Each one is opened at its first use, stays open until
+ * Btk_close_multi_files() and is written through a large buffer.
+ */
+#define MULTI_FILE_BUFSIZE (1 << 20)
+
+typedef struct {
+    char *name;
+    FILE *fp;
+    char *buf;
+} MultiFile;
+
+static MultiFile *MultiFiles;
+static int        NumMultiFiles;
+
+/********************************************************************************
+ * This function returns the stream of the specified multi-file, opening it
+ * in append mode on first use.  Its synopsis is:
+ *
+ * fp = Btk_open_multi_file(file_name)
+ *
+ * where
+ *	file_name	is the name of the multi-file
+ *
+ *	fp		is the stream, or NULL if the file couldn't be opened
+ *			(errno is set)
+ *
+ * The stream must not be closed by the caller.  In a multi-threaded run,
+ * the calling thread must have the output turn.
+ ********************************************************************************
+ */
+FILE *
+Btk_open_multi_file(char *file_name)
+{
+    int        i;
+    FILE      *fp;
+    MultiFile *mf;
+
+    for (i = 0; i < NumMultiFiles; i++) {
+        if (strcmp(MultiFiles[i].name, file_name) == 0) {
+            return MultiFiles[i].fp;
+        }
+    }
+
+    if ((fp = fopen(file_name, "a")) == NULL) {
+        return NULL;
+    }
+
+    mf = REALLOC(MultiFiles, MultiFile, NumMultiFiles + 1);
+    if (mf == NULL) {
+        (void)fclose(fp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    MultiFiles = mf;
+    mf = &MultiFiles[NumMultiFiles];
+    mf->fp   = fp;
+    mf->name = strdup(file_name);
+    mf->buf  = CALLOC(char, MULTI_FILE_BUFSIZE);
+    if ((mf->buf != NULL)
+        && (setvbuf(fp, mf->buf, _IOFBF, MULTI_FILE_BUFSIZE) != 0))
+    {
+        FREE(mf->buf);
+    }
+    if (mf->name == NULL) {
+        (void)fclose(fp);
+        FREE(mf->buf);
+        errno = ENOMEM;
+        return NULL;
+    }
+    NumMultiFiles++;
+
+    return fp;
+}
+
+/********************************************************************************
+ * This function writes the buffered output of all the open multi-files to
+ * their files.  Its synopsis is:
+ *
+ * success = Btk_flush_multi_files()
+ *
+ *	success		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_flush_multi_files(void)
+{
+    int i, r = SUCCESS;
+
+    for (i = 0; i < NumMultiFiles; i++) {
+        if (fflush(MultiFiles[i].fp) == EOF) {
+            error(MultiFiles[i].name, "couldn't write", errno);
+            r = ERROR;
+        }
+    }
+    return r;
+}
+
+/********************************************************************************
+ * This function flushes and closes all the open multi-files.  Its synopsis
+ * is:
+ *
+ * success = Btk_close_multi_files()
+ *
+ *	success		is SUCCESS or ERROR
+ ********************************************************************************
+ */
+int
+Btk_close_multi_files(void)
+{
+    int i, r = SUCCESS;
+
+    for (i = 0; i < NumMultiFiles; i++) {
+        if (fclose(MultiFiles[i].fp) == EOF) {
+            error(MultiFiles[i].name, "couldn't write", errno);
+            r = ERROR;
+        }
+        FREE(MultiFiles[i].buf);
+        FREE(MultiFiles[i].name);
+    }
+    FREE(MultiFiles);
+    NumMultiFiles = 0;
+    return r;
+}
+
+/* "00" to "99", so that the decimal digits are produced two at a time */
+static const char DigitPairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* Longest text of an int, sign included */
+#define INT_TEXT_LEN 11
+
+/********************************************************************************
+ * This function writes the decimal text of an integer into a buffer,
+ * right-justified in a field of at least the specified width, as
+ * sprintf(buf, "%*d", width, value) does.  Its synopsis is:
+ *
+ * end = format_int(buf, value, width)
+ *
+ * where
+ *	buf		is the address at which to write the text; room for
+ *			MAX2(width, INT_TEXT_LEN) characters is needed
+ *	value		is the integer
+ *	width		is the minimum width of the field
+ *
+ *	end		is the address following the text (which is not
+ *			null-terminated)
+ ********************************************************************************
+ */
+static char *
+format_int(char *buf, int value, int width)
+{
+    char     digits[INT_TEXT_LEN], *d = digits + INT_TEXT_LEN;
+    unsigned u = (value < 0) ? 0U - (unsigned)value : (unsigned)value;
+    int      len;
+
+    while (u >= 100) {
+        d -= 2;
+        memcpy(d, &DigitPairs[2 * (u % 100)], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        d -= 2;
+        memcpy(d, &DigitPairs[2 * u], 2);
+    }
+    else {
+        *--d = (char)('0' + u);
+    }
+    if (value < 0) {
+        *--d = '-';
+    }
+
+    len = (int)(digits + INT_TEXT_LEN - d);
+    while (width-- > len) {
+        *buf++ = ' ';
+    }
+    memcpy(buf, d, len);
+    return buf + len;
+}
+
+/********************************************************************************
+ * This function formats a column of values, such as locations, into a
+ * buffer, as a sequence of fprintf(out, fmt, value[i]) calls would, where
+ * fmt is " %<width>d" or "%<width>d " depending on leading_space, with a
+ * newline after each per_line values and after the last value.  Its
+ * synopsis is:
+ *
+ * len = format_column(buf, values, num_values, width,
+ *                     per_line, leading_space)
+ *
+ * where
+ *	buf		is the buffer, of at least
+ *			COLUMN_TEXT_LEN(num_values, width) characters
+ *	values		is an array of num_values values
+ *	num_values	is the number of values
+ *	width		is the minimum width of each value
+ *	per_line	is the number of values on each line
+ *	leading_space	is whether the separating space precedes (1) or
+ *			follows (0) each value
+ *
+ *	len		is the number of characters written in buf
+ ********************************************************************************
+ */
+#define COLUMN_TEXT_LEN(n, width) \
+    ((size_t)(n) * (MAX2(width, INT_TEXT_LEN) + 2) + 1)
+
+#define QUAL_PER_LINE	17	/* values per line of the .qual files */
+#define MULTI_QUAL_PER_LINE	20	/* of the -o tt.qual file */
+#define MULTI_LOCS_PER_LINE	15	/* of the -o tt.pos file */
+
+/* Longest "base qv location" line of a .phd.1 file */
+#define PHD_LINE_LEN		(2 * INT_TEXT_LEN + 4)
+#define PHD_LINES_PER_WRITE	64
+
+static int
+format_column(char *buf, int *values, int num_values,
+    int width, int per_line, int leading_space)
+{
+    int   i;
+    char *p = buf;
+
+    for (i = 0; i < num_values; i++) {
+        if (leading_space) {
+            *p++ = ' ';
+        }
+        p = format_int(p, values[i], width);
+        if (!leading_space) {
+            *p++ = ' ';
+        }
+        if ((i % per_line == per_line - 1) || (i == num_values - 1)) {
+            *p++ = '\n';
+        }
+    }
+    return (int)(p - buf);
+}
+
+/* Quality values widened to int at a time by format_qv_column */
+#define QV_COLUMN_CHUNK	64
+
+/*
+ * This function formats a column of quality values with format_column(),
+ * which it passes a line of values at a time; per_line must not exceed
+ * QV_COLUMN_CHUNK.
+ */
+static int
+format_qv_column(char *buf, uint8_t *quality_values, int num_values,
+    int width, int per_line, int leading_space)
+{
+    int values[QV_COLUMN_CHUNK], i, j, n, len = 0;
+
+    for (i = 0; i < num_values; i += n) {
+        n = MIN2(per_line, num_values - i);
+        for (j = 0; j < n; j++) {
+            values[j] = quality_values[i + j];
+        }
+        len += format_column(buf + len, values, n, width, per_line,
+            leading_space);
+    }
+    return len;
+}
+
 
 /* ------------------------------------------------------------------- */
 /* Reads a single FastA formatted entry from a file.
@@ -216,8 +498,8 @@ read_fasta(char* file_name, Contig* contig, BtkMessage *message)
  *******************************************************************************
  */
 static int
-read_abi_nums(int *num_called_bases, int use_edited_bases, int *num_datapoints,
-Options *options)
+read_abi_nums(ABIFile *abi, int *num_called_bases, int use_edited_bases,
+int *num_datapoints, Options *options)
 {
     ABIError   r;
     int        j;
@@ -229,12 +511,12 @@ Options *options)
     if (options->inp_phd == 0) {
         /* Read the number of called bases */
         if (use_edited_bases) {
-            if ((r = ABI_NumEditedBases(&num_bases)) != kNoError) {
+            if ((r = ABI_NumEditedBases(abi, &num_bases)) != kNoError) {
                 return r;
             }
         }
         else {
-            if ((r = ABI_NumCalledBases(&num_bases)) != kNoError) {
+            if ((r = ABI_NumCalledBases(abi, &num_bases)) != kNoError) {
                 return r;
             }
         }
@@ -242,12 +524,12 @@ Options *options)
 
         /* Read the number of called peak locations */
         if (use_edited_bases) {
-            if ((r = ABI_NumEditedPeakLocations(&num_peaks)) != kNoError) {
+            if ((r = ABI_NumEditedPeakLocations(abi, &num_peaks)) != kNoError) {
                 return r;
             }
         }
         else {
-            if ((r = ABI_NumCalledPeakLocations(&num_peaks)) != kNoError) {
+            if ((r = ABI_NumCalledPeakLocations(abi, &num_peaks)) != kNoError) {
                 return r;
             }
         }
@@ -263,7 +545,7 @@ Options *options)
         dye_number = j + 1;
 
         /* Read the number of data points for this color */
-        r = ABI_NumAnalyzedData(0, dye_number, &num_points);
+        r = ABI_NumAnalyzedData(abi, 0, dye_number, &num_points);
         if (r != kNoError) {
             return r;
         }
@@ -280,13 +562,14 @@ Options *options)
  ********************************************************************************
  */
 static int
-read_scf_nums(int *num_called_bases, int *num_datapoints, Options *options)
+read_scf_nums(SCFFile *scf, int *num_called_bases, int *num_datapoints,
+    Options *options)
 {
      long num_bases;
      long num_points;
 
      if (options->inp_phd == 0) {
-         SCF_NumBases(&num_bases);
+         SCF_NumBases(scf, &num_bases);
 
         /*  We skip the cross-checking of number of bases vs. number
          *  of peak locations that the corresponding ABI routine does,
@@ -297,12 +580,39 @@ read_scf_nums(int *num_called_bases, int *num_datapoints, Options *options)
        *num_called_bases = num_bases;
     }
 
-    SCF_NumAnalyzedData(&num_points);
+    SCF_NumAnalyzedData(scf, &num_points);
    *num_datapoints = num_points;
 
     return SUCCESS;
 }
 
+/********************************************************************************
+ * Function: read_ztr_nums
+ ********************************************************************************
+ */
+static int
+read_ztr_nums(ZTRFile *ztr, int *num_called_bases, int *num_datapoints,
+    Options *options)
+{
+     ABIError r;
+     long num_bases;
+     long num_points;
+
+     if (options->inp_phd == 0) {
+         if ((r = ZTR_NumBases(ztr, &num_bases)) != kNoError) {
+             return r;
+         }
+        *num_called_bases = num_bases;
+     }
+
+     if ((r = ZTR_NumAnalyzedData(ztr, &num_points)) != kNoError) {
+         return r;
+     }
+    *num_datapoints = num_points;
+
+     return SUCCESS;
+}
+
 /****************************************************************************
  * Function: read_abi_bases_locs_and_quality_values
  * Purpose: read the array of ABI called bases and array of their locations
@@ -311,6 +621,7 @@ read_scf_nums(int *num_called_bases, int *num_datapoints, Options *options)
  */
 static int
 read_abi_bases_locs_and_quality_values(
+    ABIFile *abi,
     int   num_bases,
     char *called_bases,
     int   use_edited_bases,
@@ -326,12 +637,12 @@ read_abi_bases_locs_and_quality_values(
 
     /* Read the called or edited bases */
     if (use_edited_bases) {
-        if ((r = ABI_EditedBases(called_bases)) != kNoError) {
+        if ((r = ABI_EditedBases(abi, called_bases)) != kNoError) {
             return r;
         }
     }
     else {
-        if ((r = ABI_CalledBases(called_bases)) != kNoError) {
+        if ((r = ABI_CalledBases(abi, called_bases)) != kNoError) {
             return r;
         }
     }
@@ -344,12 +655,12 @@ read_abi_bases_locs_and_quality_values(
      * and FREE the auxiliary array
      */
     if (use_edited_bases) {
-        if ((r = ABI_EditedPeakLocations(peak_locs)) != kNoError) {
+        if ((r = ABI_EditedPeakLocations(abi, peak_locs)) != kNoError) {
             goto error;
         }
     }
     else {
-        if ((r = ABI_CalledPeakLocations(peak_locs)) != kNoError) {
+        if ((r = ABI_CalledPeakLocations(abi, peak_locs)) != kNoError) {
             goto error;
         }
     }
@@ -360,7 +671,7 @@ read_abi_bases_locs_and_quality_values(
     /* Read original quality values */
     num_orig_qvs = 0;
     r = kNoError;
-    if (((r = ABI_NumQualityValues(&num_orig_qvs)) != kNoError) ||
+    if (((r = ABI_NumQualityValues(abi, &num_orig_qvs)) != kNoError) ||
         ((r == kNoError) && (num_orig_qvs == 0)))
     {
         num_orig_qvs = 0;
@@ -369,7 +680,7 @@ read_abi_bases_locs_and_quality_values(
     if ((int)num_orig_qvs == num_bases)
     {
         orig_qv = CALLOC(char, num_bases);
-        if ((r = ABI_BasecallerQualityValues(orig_qv)) != kNoError) {
+        if ((r = ABI_BasecallerQualityValues(abi, orig_qv)) != kNoError) {
             goto error;
         }
         for (i = 0; i < num_bases; i++) {
@@ -405,6 +716,7 @@ error:
  */
 static int
 read_scf_bases_and_locs(
+    SCFFile *scf,
     int   num_bases,
     char *called_bases,
     int  *called_locs,
@@ -413,12 +725,12 @@ read_scf_bases_and_locs(
      short     *peak_locs;
      int        i;
 
-     SCF_Bases(called_bases);
+     SCF_Bases(scf, called_bases);
 
      peak_locs = CALLOC(short, num_bases);
      MEM_ERROR(peak_locs);
 
-     SCF_PeakLocations(peak_locs);
+     SCF_PeakLocations(scf, peak_locs);
 
      for (i = 0; i < num_bases; i++)
           called_locs[i] = peak_locs[i];
@@ -433,18 +745,42 @@ read_scf_bases_and_locs(
      return kMemoryFull;
 }
 
+/********************************************************************************
+ * Function: read_ztr_bases_locs_and_quality_values
+ ********************************************************************************
+ */
+static int
+read_ztr_bases_locs_and_quality_values(
+    ZTRFile *ztr,
+    char *called_bases,
+    int  *called_locs,
+    uint8_t *quality_values)
+{
+     ABIError r;
+
+     if (((r = ZTR_Bases(ztr, called_bases)) != kNoError) ||
+         ((r = ZTR_PeakLocations(ztr, called_locs)) != kNoError)) {
+         return r;
+     }
+
+     /* Original quality values are optional */
+     (void)ZTR_QualityValues(ztr, quality_values);
+
+     return SUCCESS;
+}
+
 /******************************************************************************
  * Function: read_consensus_from_sample_file
  ******************************************************************************
  */
 int
-read_consensus_from_sample_file(char **consensus_seq, int verbose)
+read_consensus_from_sample_file(ABIFile *abi, char **consensus_seq, int verbose)
 {
     ABIError   r;
     long cons_len;
 
     /* Read the number of bases in consensus sequence*/
-    if ((r = ABI_NumConsensusBases(&cons_len)) != kNoError) {
+    if ((r = ABI_NumConsensusBases(abi, &cons_len)) != kNoError) {
         return r;
     }
 
@@ -453,7 +789,7 @@ read_consensus_from_sample_file(char **consensus_seq, int verbose)
 #endif
 
     *consensus_seq = CALLOC(char, cons_len + 1);
-    if ((r = ABI_ConsensusBases(*consensus_seq)) != kNoError) {
+    if ((r = ABI_ConsensusBases(abi, *consensus_seq)) != kNoError) {
         return r;
     }
 
@@ -469,46 +805,34 @@ read_consensus_from_sample_file(char **consensus_seq, int verbose)
  */
 static int
 read_abi_color_data(
+    ABIFile *abi,
     int   num_values,
     int **chromatogram,
     char *color2base,
     BtkMessage *message)
 {
-    int  *analyzed_data;
     short dye_number;
     char  base;
-    int   i, j;
+    int   j;
     ABIError r;
 
-    analyzed_data = CALLOC(int, num_values);
-    MEM_ERROR(analyzed_data);
-
     for (j = 0; j < NUM_COLORS; j++) {
         dye_number = j + 1;
 
         /* Which base corresponds to the selected dye number? */
-        if ((r = ABI_DyeIndexToBase(dye_number, &base)) != kNoError) {
-            FREE(analyzed_data);
+        if ((r = ABI_DyeIndexToBase(abi, dye_number, &base)) != kNoError) {
             return r;
         }
         color2base[j] = base;
 
-        /* Read the chromatograms and free the auxiliary array */
-        r = ABI_AnalyzedData(0, dye_number, analyzed_data);
+        /* Read the chromatogram straight from the file */
+        r = ABI_AnalyzedData(abi, 0, dye_number, chromatogram[j]);
         if (r != kNoError) {
-            FREE(analyzed_data);
             return r;
         }
-        for (i = 0; i < num_values; i++) {
-            chromatogram[j][i] = analyzed_data[i];
-        }
     }
 
-    FREE(analyzed_data);
     return SUCCESS;
-error:
-    FREE(analyzed_data);
-    return ERROR;
 }
 
 /********************************************************************************
@@ -516,17 +840,34 @@ error:
  ********************************************************************************
  */
 static int
-read_scf_color_data(int num_values,
+read_scf_color_data(SCFFile *scf,
+                    int num_values,
                     int **chromatogram,
                     char *color2base,
                     BtkMessage *message)
 {
-     int  *analyzed_data;
-     short dye_number;
-     int   i;
+     color2base[0] = 'A';
+     color2base[1] = 'C';
+     color2base[2] = 'G';
+     color2base[3] = 'T';
+
+     /* Read the chromatograms straight from the file */
+     SCF_AllAnalyzedData(scf, chromatogram);
+
+     return SUCCESS;
+}
 
-     analyzed_data = CALLOC(int, num_values);
-     MEM_ERROR(analyzed_data);
+/********************************************************************************
+ * Function: read_ztr_color_data
+ ********************************************************************************
+ */
+static int
+read_ztr_color_data(ZTRFile *ztr,
+                    int **chromatogram,
+                    char *color2base)
+{
+     ABIError r;
+     short dye_number;
 
      color2base[0] = 'A';
      color2base[1] = 'C';
@@ -535,18 +876,13 @@ read_scf_color_data(int num_values,
 
      for (dye_number = 0; dye_number < NUM_COLORS; dye_number++)
      {
-          SCF_AnalyzedData(dye_number, analyzed_data);
-
-          for (i = 0; i < num_values; i++)
-               chromatogram[dye_number][i] = analyzed_data[i];
+          if ((r = ZTR_AnalyzedData(ztr, dye_number, chromatogram[dye_number]))
+              != kNoError) {
+              return r;
+          }
      }
 
-     FREE(analyzed_data);
-
      return SUCCESS;
-
- error:
-     return kMemoryFull;
 }
 
 /*
@@ -556,7 +892,7 @@ read_scf_color_data(int num_values,
  * result = Btk_read_sample_file(file_name, num_bases, called_bases,
  *	called_locs, num_values, avals, cvals,
  *	gvals, tvals, call_method, chemistry,
- *	options, message, verbose)
+ *	context, file_type, options, message)
  *
  * where
  *	file_name	is the name (path) of the sample file
@@ -581,6 +917,9 @@ read_scf_color_data(int num_values,
  *			the method used to call the bases will be put
  *	chemistry	is an optional address where a string that describes
  *			the chemistry used (primer or terminator) will be put
+ *	context		is the address of the BtkReadContext of the read;
+ *			its status_code is set if the file cannot be read
+ *	file_type	is the address where the type of the file will be put
  *	message		is the address of a BtkMessage where information about
  *			an error will be put, if any
  *	verbose		is whether to write status messages to stderr, and
@@ -606,7 +945,7 @@ Btk_read_sample_file(
     int       **tvals,
     char      **call_method,
     char      **chemistry,
-    char       *status_code,
+    BtkReadContext *context,
     int        *fileType,
     Options     options,
     BtkMessage *message)
@@ -614,13 +953,10 @@ Btk_read_sample_file(
     char *seq_name;
     int   i, r=0;
     int  *chromatogram[NUM_COLORS] = {NULL, NULL, NULL, NULL};
-    void *p;
-    long  fileSize, n;
+    TraceFile tf;
+    long  n;
     char  color2base[5];
-    unsigned char magic[2];
-    FILE *fp;
     char  tempFileName[MAX_FILE_NAME_LENGTH] = "";
-    char  command[2048];
     char  phd_file_name[1000];
 
     for (i = 0; i < NUM_COLORS; i++) {
@@ -628,6 +964,7 @@ Btk_read_sample_file(
     }
    *called_bases = NULL;
    *called_locs  = NULL;
+    tf.data = NULL;
 
     /* Set seq_name to just the name of the file, no leading path. */
 
@@ -642,111 +979,20 @@ Btk_read_sample_file(
         seq_name = file_name;
     }
 
-    if ((fp = fopen(file_name, "r")) == NULL)
-    {
-        sprintf(message->text,
-                "could not open file for reading, errno = %d", errno);
-        return ERROR;
-    }
-    fread(magic, 1, 2, fp);
-    fclose(fp);
-
-#ifdef __WIN32
-    if (magic[0] == 0x1f && magic[1] == 0x8b)   /* gzipped file */
-    {
-        sprintf(tempFileName, "TTUNERQQ.TMP");
-
-        sprintf(command, "gzip -d -f -c %s > TTUNERQQ.TMP", file_name);
-
-        if (system(command) != 0)
-        {
-            sprintf(message->text,
-                    "gunzip command failed on file %s, errno = %d", file_name,
-                    errno);
-            return ERROR;
-        }
-    }
-    else if (magic[0] == 0x1f && magic[1] == 0x9d)   /* UNIX compressed file */
-    {
-        if (seq_name[strlen(seq_name) - 2] != '.' ||
-            seq_name[strlen(seq_name) - 1] != 'Z')
-        {
-            sprintf(message->text,
-                    "cannot uncompress file %s, name must end in .Z",
-                    file_name);
-            return ERROR;
-        }
-
-        sprintf(tempFileName, "TTUNERQQ.TMP");
-
-        sprintf(command, "gzip -d -f -c %s > TTUNERQQ.TMP", file_name);
-
-        if (system(command) != 0)
-        {
-            sprintf(message->text,
-                    "gunzip command failed on file %s, errno = %d", file_name,
-                    errno);
-            return ERROR;
-        }
-    }
-#else
-    if (magic[0] == 0x1f && magic[1] == 0x8b)   /* gzipped file */
-    {
-        sprintf(tempFileName, "/tmp/%s", seq_name);
-        if (seq_name[strlen(seq_name) - 3] == '.' &&
-            seq_name[strlen(seq_name) - 2] == 'g' &&
-            seq_name[strlen(seq_name) - 1] == 'z')
-            tempFileName[strlen(tempFileName) - 3] = '\0';
-
-        sprintf(command, "gunzip -f -c %s > %s", file_name, tempFileName);
-        if (system(command) != 0)
-        {
-            sprintf(message->text,
-                    "gunzip command failed on file %s, errno = %d", file_name,
-                    errno);
-            return ERROR;
-        }
-    }
-    else if (magic[0] == 0x1f && magic[1] == 0x9d)   /* UNIX compressed file */
-    {
-        if (seq_name[strlen(seq_name) - 2] != '.' ||
-            seq_name[strlen(seq_name) - 1] != 'Z')
-        {
-            sprintf(message->text,
-                    "cannot uncompress file %s, name must end in .Z",
-                    file_name);
-            return ERROR;
-        }
-
-        sprintf(tempFileName, "/tmp/%s", seq_name);
-                tempFileName[strlen(tempFileName) - 2] = '\0';
-
-        sprintf(command, "uncompress -f -c %s > %s", file_name, tempFileName);
-        if (system(command) != 0)
-        {
-            sprintf(message->text,
-                    "gunzip command failed on file %s, errno = %d", file_name,
-                    errno);
-            return ERROR;
-        }
-    }
-#endif
-
-    if ((r = F_Open(tempFileName[0] != '\0' ? tempFileName : file_name,
-                    &p, &fileSize, fileType)) != kNoError) {
+    /* Compressed (.gz, .Z) files are decompressed in memory */
+    r = F_Open(file_name, &tf);
+   *fileType = tf.type;
+    if (r != kNoError) {
         sprintf(message->text, "Error opening file: %s", 
                   ABI_ErrorString((ABIError)r));
         goto error;
     }
 
-    if (tempFileName[0] != '\0')
-        unlink(tempFileName);
-
     if (*fileType == ABI)
     {
-         if ((r = read_abi_nums(num_bases, use_edited_bases, num_values,
+         if ((r = read_abi_nums(&tf.abi, num_bases, use_edited_bases, num_values,
              &options)) != kNoError) {
-              strcpy(status_code, "ABIFILE_FAILURE");
+              strcpy(context->status_code, "ABIFILE_FAILURE");
               sprintf(message->text, "Error reading file: %s",
                       ABI_ErrorString((ABIError)r));
               goto error;
@@ -754,16 +1000,27 @@ Btk_read_sample_file(
     }
     else if (*fileType == SCF)
     {
-         if ((r = read_scf_nums(num_bases, num_values, &options))
+         if ((r = read_scf_nums(&tf.scf, num_bases, num_values, &options))
+             != kNoError) {
+             strcpy(context->status_code, "ABIFILE_FAILURE");
+             sprintf(message->text, "Error reading file: %s",
+                 ABI_ErrorString((ABIError)r));
+             goto error;
+         }
+    }
+    else if (*fileType == ZTR)
+    {
+         if ((r = read_ztr_nums(&tf.ztr, num_bases, num_values, &options))
              != kNoError) {
-             strcpy(status_code, "ABIFILE_FAILURE");
+             strcpy(context->status_code, "ABIFILE_FAILURE");
              sprintf(message->text, "Error reading file: %s",
                  ABI_ErrorString((ABIError)r));
              goto error;
          }
     }
     else {
-        return kWrongFileType;
+        r = kWrongFileType;
+        goto error;
     }
 
     if ((options.Verbose > 1) && (*fileType == ABI && use_edited_bases) &&
@@ -788,12 +1045,13 @@ Btk_read_sample_file(
 
     if ((*fileType == ABI) && (options.inp_phd == 0))
     {
-         if ((r = read_abi_bases_locs_and_quality_values(*num_bases,
+         if ((r = read_abi_bases_locs_and_quality_values(&tf.abi,
+                *num_bases,
                 *called_bases, use_edited_bases, *called_locs,
                 *quality_values, message))
              != SUCCESS)
          {
-              strcpy(status_code, "ABIFILE_FAILURE");
+              strcpy(context->status_code, "ABIFILE_FAILURE");
               sprintf(message->text, "Error reading file: %s",
                       ABI_ErrorString((ABIError)r));
               goto error;
@@ -801,11 +1059,23 @@ Btk_read_sample_file(
     }
     else if ((*fileType == SCF) && (options.inp_phd == 0))
     {
-         if ((r = read_scf_bases_and_locs(*num_bases, *called_bases,
+         if ((r = read_scf_bases_and_locs(&tf.scf, *num_bases, *called_bases,
             *called_locs, message))
              != SUCCESS)
          {
-              strcpy(status_code, "ABIFILE_FAILURE");
+              strcpy(context->status_code, "ABIFILE_FAILURE");
+              sprintf(message->text, "Error reading file: %s",
+                      ABI_ErrorString((ABIError)r));
+              goto error;
+         }
+    }
+    else if ((*fileType == ZTR) && (options.inp_phd == 0))
+    {
+         if ((r = read_ztr_bases_locs_and_quality_values(&tf.ztr,
+            *called_bases, *called_locs, *quality_values))
+             != SUCCESS)
+         {
+              strcpy(context->status_code, "ABIFILE_FAILURE");
               sprintf(message->text, "Error reading file: %s",
                       ABI_ErrorString((ABIError)r));
               goto error;
@@ -820,11 +1090,11 @@ Btk_read_sample_file(
 
     if (*fileType == ABI)
     {
-         if ((r = read_abi_color_data(*num_values, chromatogram, color2base,
+         if ((r = read_abi_color_data(&tf.abi, *num_values, chromatogram, color2base,
                                       message))
              != SUCCESS)
          {
-             strcpy(status_code, "ABIFILE_FAILURE");
+             strcpy(context->status_code, "ABIFILE_FAILURE");
              sprintf(message->text, "Error reading file: %s",
                  ABI_ErrorString((ABIError)r));
              goto error;
@@ -832,11 +1102,22 @@ Btk_read_sample_file(
     }
     else if (*fileType == SCF)
     {
-         if ((r = read_scf_color_data(*num_values, chromatogram, color2base,
+         if ((r = read_scf_color_data(&tf.scf, *num_values, chromatogram, color2base,
                                       message))
              != SUCCESS)
          {
-              strcpy(status_code, "ABIFILE_FAILURE");
+              strcpy(context->status_code, "ABIFILE_FAILURE");
+              sprintf(message->text, "Error reading file: %s",
+                      ABI_ErrorString((ABIError)r));
+              goto error;
+         }
+    }
+    else if (*fileType == ZTR)
+    {
+         if ((r = read_ztr_color_data(&tf.ztr, chromatogram, color2base))
+             != SUCCESS)
+         {
+              strcpy(context->status_code, "ABIFILE_FAILURE");
               sprintf(message->text, "Error reading file: %s",
                       ABI_ErrorString((ABIError)r));
               goto error;
@@ -859,7 +1140,7 @@ Btk_read_sample_file(
           */
          if (*fileType == ABI)
          {
-              if ((r = ABI_AnalysisVersion(BTKMESSAGE_LENGTH,
+              if ((r = ABI_AnalysisVersion(&tf.abi, BTKMESSAGE_LENGTH,
                                            *call_method, &n))
                   != kNoError)
               {
@@ -880,7 +1161,20 @@ Btk_read_sample_file(
           */
          if (*fileType == ABI)
          {
-              if ((r = ABI_MobilityFile(BTKMESSAGE_LENGTH, *chemistry, &n))
+              if ((r = ABI_MobilityFile(&tf.abi, BTKMESSAGE_LENGTH,
+                   *chemistry, &n))
+                  != kNoError)
+              {
+                   FREE(*chemistry);
+              } else {
+                   (*chemistry)[n] = '\0';
+              }
+         }
+         else if (*fileType == ZTR)
+         {
+              /* ZTR keeps the mobility file name as the dye primer */
+              if ((r = ZTR_TextValue(&tf.ztr, "DYEP", BTKMESSAGE_LENGTH,
+                   *chemistry, &n))
                   != kNoError)
               {
                    FREE(*chemistry);
@@ -890,8 +1184,7 @@ Btk_read_sample_file(
          }
     }
 
-    F_Close(p, *fileType);
-    p = NULL;
+    F_Close(&tf);
 
     /* If -ipd <dir> option is used, read original bases and
      * locations from phd file, rather than from sample file
@@ -915,51 +1208,25 @@ Btk_read_sample_file(
             options.inp_phd_dir, tempFileName);
 #endif
        *num_bases = -1;
-        if ((*num_bases = get_phd_num_bases(phd_file_name, message)) < 0)
+        /* At most MAX_BASES_LEN bases are taken from the phd file */
+        if (Btk_load_phd_file(phd_file_name, called_bases, quality_values,
+            called_locs, num_bases, MAX_BASES_LEN,
+            message) != SUCCESS)
         {
             fprintf(stderr,"%s", "PHREDFILE_FAILURE");
-            sprintf(status_code, "%s", "PHREDFILE_FAILURE");
+            sprintf(context->status_code, "%s", "PHREDFILE_FAILURE");
             sprintf(message->text, "Could not read phd file: %s\n",
                 phd_file_name);
             FREE(*call_method);
             return ERROR;
         }
 
-        if (*num_bases > MAX_NUM_BASES)
+        if ((*num_bases > 0) && (options.Verbose > 1)
+            && (options.inp_phd > 0))
         {
-            *num_bases = MAX_NUM_BASES;
-        }
-
-        if (*num_bases > 0) {
-           *called_bases = CALLOC(char, *num_bases);
-            MEM_ERROR(called_bases);
-
-           *called_locs = CALLOC(int, *num_bases);
-            MEM_ERROR(called_locs);
-
-           *quality_values = CALLOC(uint8_t, *num_bases);
-            MEM_ERROR(quality_values);
-
-            if (Btk_read_phd_file(phd_file_name, *called_bases, *quality_values,
-               *called_locs, num_bases, message) != SUCCESS)
-            {
-                sprintf(status_code, "%s", "PHREDFILE_FAILURE");
-                FREE(called_bases);
-                FREE(called_locs);
-                FREE(quality_values);
-                FREE(*call_method);
-                sprintf(message->text, "Could not read phd file: %s\n",
-                    phd_file_name);
-                return ERROR;
-            }
-#if 0
-            fprintf(stderr, "options.Verbose=%d options.inp_phd =%d\n",
-               options.Verbose, options.inp_phd);
-#endif
-            if ((options.Verbose > 1) && (options.inp_phd > 0))
-            fprintf(stderr,
-               "Reading original bases and locations from phd file: %s\n",
-               phd_file_name);
+            fprintf(stderr,
+               "Reading original bases and locations from phd file: %s\n",
+               phd_file_name);
         }
     }
 
@@ -1044,9 +1311,8 @@ Btk_read_sample_file(
          Btk_release_file_data(*called_bases, *called_locs, *quality_values,
              chromatogram, call_method, (chemistry != NULL) ? chemistry : NULL);
     }
-    if (p != NULL) {
-         F_Close(p, *fileType);
-         p = NULL;
+    if (tf.data != NULL) {
+         F_Close(&tf);
     }
     return r;
 }
@@ -1178,8 +1444,9 @@ Btk_output_quality_values(
     int right_trim_point,
     int verbose)
 {
-    int i;
+    int i, len;
     char *seq_name, qual_file_name[MAXPATHLEN];
+    char line[COLUMN_TEXT_LEN(QUAL_PER_LINE, 2)];
     FILE *qv_out = NULL, *dir_out = NULL, *multi_out = NULL;
 
     /* Use the name of the sample file, sans path, as the sequence name */
@@ -1200,7 +1467,7 @@ Btk_output_quality_values(
 #else
         sprintf(qual_file_name, "%s/%s.qual", path, seq_name);
 #endif
-        if ((dir_out = fopen(qual_file_name, "w")) == NULL) {
+        if ((dir_out = Btk_open_output(qual_file_name, "w")) == NULL) {
             error(qual_file_name, "couldn't open", errno);
             return ERROR;
         }
@@ -1209,16 +1476,18 @@ Btk_output_quality_values(
     if (QualType & NAME_FILES) {
         sprintf(qual_file_name, "%s.qual", seq_name);
 
-        if ((qv_out = fopen(qual_file_name, "w")) == NULL) {
+        if ((qv_out = Btk_open_output(qual_file_name, "w")) == NULL) {
             error(qual_file_name, "couldn't open", errno);
             return ERROR;
         }
     }
 
     if (QualType & NAME_MULTI) {
-        if ((multi_out = fopen(multiqualFileName, "a")) == NULL) {
+        if ((multi_out = Btk_open_multi_file(multiqualFileName)) == NULL) {
             error(multiqualFileName, "couldn't open", errno);
-            fclose(qv_out);
+            if (qv_out) {
+                Btk_close_output(qv_out);
+            }
             return ERROR;
         }
     }
@@ -1241,42 +1510,30 @@ Btk_output_quality_values(
                 right_trim_point - left_trim_point + 1);
     }
 
-    for (i = 0; i < num_values; i++) {
-        if (qv_out) {
-            fprintf(qv_out, " %2d", quality_values[i]);
+    /* Format each line of 17 values once, for all the outputs */
+    for (i = 0; i < num_values; i += QUAL_PER_LINE) {
+        len = format_qv_column(line, &quality_values[i],
+            MIN2(QUAL_PER_LINE, num_values - i), 2, QUAL_PER_LINE, 1);
 
-            if ((i % 17 == 16) || (i == num_values - 1)) {
-                putc('\n', qv_out);
-            }
+        if (qv_out) {
+            (void)fwrite(line, 1, len, qv_out);
         }
 
         if (dir_out) {
-            fprintf(dir_out, " %2d", quality_values[i]);
-
-            if ((i % 17 == 16) || (i == num_values - 1)) {
-                putc('\n', dir_out);
-            }
+            (void)fwrite(line, 1, len, dir_out);
         }
 
         if (multi_out) {
-            fprintf(multi_out, " %2d", quality_values[i]);
-
-            if ((i % 17 == 16) || (i == num_values - 1)) {
-                putc('\n', multi_out);
-            }
+            (void)fwrite(line, 1, len, multi_out);
         }
     }
 
     if (qv_out) {
-        fclose(qv_out);
+        Btk_close_output(qv_out);
     }
 
     if (dir_out) {
-        fclose(dir_out);
-    }
-
-    if (multi_out) {
-        fclose(multi_out);
+        Btk_close_output(dir_out);
     }
 
     return SUCCESS;
@@ -1405,7 +1662,7 @@ release(Contig *consensus, Contig *consensusrc, Contig *fragment,
 #else
 				sprintf(fastq_file_name, "%s/%s.fastq", path, seq_name);
 #endif
-				if ((dir_out = fopen(fastq_file_name, "w")) == NULL) {
+				if ((dir_out = Btk_open_output(fastq_file_name, "w")) == NULL) {
 					error(fastq_file_name, "couldn't open", errno);
 					return ERROR;
 				}
@@ -1413,16 +1670,18 @@ release(Contig *consensus, Contig *consensusrc, Contig *fragment,
 
 			if (FastqType & NAME_FILES) {
 				sprintf(fastq_file_name, "%s.fastq", seq_name);
-				if ((fastq_out = fopen(fastq_file_name, "w")) == NULL) {
+				if ((fastq_out = Btk_open_output(fastq_file_name, "w")) == NULL) {
 					error(fastq_file_name, "couldn't open", errno);
 					return ERROR;
 				}
 			}
 
 			if (FastqType & NAME_MULTI) {
-				if ((multi_out = fopen(multifastqFileName, "a")) == NULL) {
+				if ((multi_out = Btk_open_multi_file(multifastqFileName)) == NULL) {
 					error(multifastqFileName, "couldn't open", errno);
-					fclose(fastq_out);
+					if (fastq_out) {
+						Btk_close_output(fastq_out);
+					}
 					return ERROR;
 				}
 			}
@@ -1446,40 +1705,132 @@ release(Contig *consensus, Contig *consensusrc, Contig *fragment,
 			}
 
 			if (fastq_out) {
-				fclose(fastq_out);
+				Btk_close_output(fastq_out);
 			}
 
 			if (dir_out) {
-				fclose(dir_out);
-			}
-
-			if (multi_out) {
-				fclose(multi_out);
+				Btk_close_output(dir_out);
 			}
 
 			return SUCCESS;
 		}
 
+/********************************************************************************
+ * This function builds the consensus contigs, their k-tuple lookup tables
+ * and the alignment parameters used by Btk_output_tal_file.  The index is
+ * built once per run and only read afterwards, so that all the reads, in
+ * any thread, can share it.  Its synopsis is:
+ *
+ * success = Btk_create_tal_index(index, consensus_seq,
+ *	 Match, MisMatch, Insertion, Deletion, message);
+ *
+ * where
+ *	index		is the address of the BtkTalIndex to be built
+ *	consensus_seq	is an array of consensus sequence
+ *	Match		the Match premium used for the alignment
+ *	MisMatch	the MisMatch penalty used for the alignment
+ *	Insertion	the Insertion penalty used for the alignment
+ *	Deletion	the Deletion penalty used for the alignment
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	success		is SUCCESS or ERROR
+ *
+ * The index must be released with Btk_release_tal_index(), whether or not
+ * it could be built.
+ ********************************************************************************
+ */
+int
+Btk_create_tal_index(
+    BtkTalIndex *index,
+    char *consensus_seq,
+    int  Match,
+    int  MisMatch,
+    int  Insertion,
+    int  Deletion,
+    BtkMessage *message)
+{
+    uint8_t *qv;
+
+    memset(index, 0, sizeof(BtkTalIndex));
+    index->Match     = Match;
+    index->MisMatch  = MisMatch;
+    index->Insertion = Insertion;
+    index->Deletion  = Deletion;
+
+    if (set_alignment_parameters(&index->align_pars, Match, MisMatch,
+            Insertion, Deletion, message) == ERROR) {
+        return ERROR;
+    }
+
+    if (set_alignment_parameters_IUB(&index->align_pars_IUB, Match, MisMatch,
+            Insertion, Deletion, message) == ERROR) {
+        return ERROR;
+    }
+
+    qv = CALLOC(uint8_t, strlen(consensus_seq));
+    MEM_ERROR(qv);
+    if (contig_create(&index->consensus, consensus_seq,
+            strlen(consensus_seq), qv, message) == ERROR) {
+        FREE(qv);
+        return ERROR;
+    }
+    FREE(qv);
+
+    /* Create reverse complement of consensus. */
+    if (contig_get_reverse_comp(&index->consensusrc, &index->consensus,
+            message) == ERROR) {
+        return ERROR;
+    }
+
+    /* Btk_compute_match would build the lookup tables on first use */
+    if ((contig_make_fasta_lookup_table(&index->consensus, KTUP, message)
+            == ERROR) ||
+        (contig_make_fasta_lookup_table(&index->consensusrc, KTUP, message)
+            == ERROR)) {
+        return ERROR;
+    }
+
+    index->ready = 1;
+    return SUCCESS;
+
+error:
+    return ERROR;
+}
+
+/********************************************************************************
+ * This function releases the resources held by a BtkTalIndex.  Releasing
+ * an index which has already been released does nothing.
+ ********************************************************************************
+ */
+void
+Btk_release_tal_index(BtkTalIndex *index)
+{
+    BtkMessage message;
+
+    (void)release(&index->consensus, &index->consensusrc, NULL, NULL,
+        NULL, NULL, &index->align_pars, &index->align_pars_IUB, &message);
+    index->ready = 0;
+}
+
 /********************************************************************************
  * This function writes out a ".tal" file.
  * Its synopsis is:
  *
  * success = Btk_output_tal_file(file_name, path,
- *       consensus_name, consensus_seq, called_bases, num_bases,
- *	 Match, MisMatch, Insertion, Deletion, RepeatFraction, verbose);
+ *       consensus_name, index, called_bases, num_bases,
+ *	 RepeatFraction, verbose);
  *
  * where
  *	file_name	is the name of the sample file
  *	path		is the path name of the directory in which to write
  *			the .qual file, if any (NULL means current dir)
  *	consensus_name	is the name of consensus file
- *	consensus_seq	is an array of consensus sequence
+ *	index		is the address of the BtkTalIndex of the consensus,
+ *			built by Btk_create_tal_index(), or NULL if there
+ *			is no consensus
  *	called_bases	is an array of base calls
  *	num_called_bases  is the number of elements in the called_bases
- *	Match		the Match premium used for the alignment
- *	MisMatch	the MisMatch penalty used for the alignment
- *	Insertion	the Insertion penalty used for the alignment
- *	Deletion	the Deletion penalty used for the alignment
  *	RepeatFraction	the RepeatFraction parameter used for the alignment
  *	verbose		is whether to write status messages to stderr, and
  *			how verbosely
@@ -1492,23 +1843,16 @@ Btk_output_tal_file(
     char *file_name,
     char *path,
     char *consensus_name,
-    char *consensus_seq,
+    BtkTalIndex *index,
     char *called_bases,
     int   num_called_bases,
-    int  Match,
-    int  MisMatch,
-    int  Insertion,
-    int  Deletion,
     float  RepeatFraction,
     int  verbose)
 {
     char *seq_name, tal_file_name[MAXPATHLEN];
     FILE *tal_out;
     int  alignment_size, count_del, count_ins, count_sub, ismatch, i;
-    Align_params    align_pars, align_pars_IUB;
     BtkMessage message;
-    Contig          consensus;
-    Contig          consensusrc;
     Contig          fragment;
     Range           align_range;
     Range           clear_range;
@@ -1518,7 +1862,7 @@ Btk_output_tal_file(
     int             num_align;
     uint8_t        *qv;
 
-    if (consensus_seq == NULL) {
+    if ((index == NULL) || !index->ready) {
         fprintf(stderr, 
                 "No consensus sequence specified; .tal file not produced\n");
         return SUCCESS;
@@ -1552,7 +1896,7 @@ Btk_output_tal_file(
 	(void)sprintf(tal_file_name, "%s.tal", seq_name);
     }
 
-    if ((tal_out = fopen(tal_file_name, "w")) == NULL) {
+    if ((tal_out = Btk_open_output(tal_file_name, "w")) == NULL) {
 	error(tal_file_name, "couldn't open", errno);
 	return ERROR;
     }
@@ -1561,38 +1905,10 @@ Btk_output_tal_file(
 	(void)fprintf(stderr, "Computing alignment \n");
     }
 
-    /* Set alignment parameters globally. */
-    if (set_alignment_parameters(&align_pars, Match, MisMatch, Insertion,
-            Deletion, &message ) == ERROR) {
-        fprintf(stderr, message.text);
-        goto error;
-    }
-
-    if (set_alignment_parameters_IUB(&align_pars_IUB, Match, MisMatch,
-            Insertion, Deletion, &message ) == ERROR ) {
-        fprintf(stderr, message.text);
-        goto error;
-    }	
-
     align_init(&best_alignment, &message);
     align_init(&vector_start, &message);
     align_init(&vector_end, &message);    
-    qv = CALLOC(uint8_t, strlen(consensus_seq));
-
-    if (contig_create(&consensus, consensus_seq, 
-		      strlen(consensus_seq), qv, &message)
-		== ERROR) {
-	fprintf(stderr, "can't create contig\n");
-	goto error;
-    }
-
-    /* Create reverse complement of consensus. */
-    if (contig_get_reverse_comp(&consensusrc, &consensus, 
-             &message)==ERROR ) {
-        fprintf(stderr, message.text);
-        goto error;
-    }
-    FREE(qv); 
+    contig_init(&fragment, &message);
 
     qv = CALLOC(uint8_t, num_called_bases);
     if (contig_create(&fragment, called_bases, num_called_bases, qv, &message)
@@ -1602,8 +1918,9 @@ Btk_output_tal_file(
      }
     FREE(qv);
 
-    if (Btk_compute_match(&align_pars, &align_pars_IUB, &consensus,
-	      &consensusrc, &fragment, &num_align,
+    /* The consensus and its lookup tables are shared, read-only */
+    if (Btk_compute_match(&index->align_pars, &index->align_pars_IUB,
+	      &index->consensus, &index->consensusrc, &fragment, &num_align,
 	      &align_range, RepeatFraction,
 	      &best_alignment, NULL, &vector_start,
 	      &vector_end, &clear_range, 0, &message) == ERROR) {
@@ -1624,10 +1941,10 @@ Btk_output_tal_file(
     }
     (void)fprintf(tal_out, "#SOFTWARE_VERSION: %s\n", TT_VERSION);
     (void)fprintf(tal_out, "#\n");
-    (void)fprintf(tal_out, "#Match = %d\n",Match);
-    (void)fprintf(tal_out, "#MisMatch = %d\n",MisMatch);
-    (void)fprintf(tal_out, "#Insertion = %d\n",Insertion);
-    (void)fprintf(tal_out, "#Deletion = %d\n",Deletion);
+    (void)fprintf(tal_out, "#Match = %d\n",index->Match);
+    (void)fprintf(tal_out, "#MisMatch = %d\n",index->MisMatch);
+    (void)fprintf(tal_out, "#Insertion = %d\n",index->Insertion);
+    (void)fprintf(tal_out, "#Deletion = %d\n",index->Deletion);
     (void)fprintf(tal_out, "#RepeatFraction = %f\n",RepeatFraction);
 
     if (num_align == 0) {
@@ -1682,17 +1999,15 @@ Btk_output_tal_file(
 	}
     }
 
-    (void)fclose(tal_out);
-    release(&consensus, &consensusrc, &fragment, &best_alignment,
-	    &vector_start, &vector_end,
-	    &align_pars, &align_pars_IUB, &message);
+    (void)Btk_close_output(tal_out);
+    release(NULL, NULL, &fragment, &best_alignment,
+	    &vector_start, &vector_end, NULL, NULL, &message);
     return SUCCESS;
 
 error:
-    (void)fclose(tal_out);
-    release(&consensus, &consensusrc, &fragment, &best_alignment,
-	    &vector_start, &vector_end,
-	    &align_pars, &align_pars_IUB, &message);
+    (void)Btk_close_output(tal_out);
+    release(NULL, NULL, &fragment, &best_alignment,
+	    &vector_start, &vector_end, NULL, NULL, &message);
     return ERROR;
 }
 
@@ -1761,7 +2076,7 @@ Btk_output_hpr_file(
         /* put it in the current dir */
         (void)sprintf(hpr_file_name, "%s.hpr", seq_name);
     }
-    if ((hpr_out = fopen(hpr_file_name, "w")) == NULL) {
+    if ((hpr_out = Btk_open_output(hpr_file_name, "w")) == NULL) {
         error(hpr_file_name, "couldn't open", errno);
         return ERROR;
     }
@@ -1795,7 +2110,7 @@ Btk_output_hpr_file(
             num_homopolymer_bases++;
     }
 
-    (void)fclose(hpr_out);
+    (void)Btk_close_output(hpr_out);
     return SUCCESS;
 }
 
@@ -1845,6 +2160,7 @@ Btk_output_phd_file(
     int verbose)
 {
     char *seq_name, phd_file_name[MAXPATHLEN];
+    char text[PHD_LINES_PER_WRITE * PHD_LINE_LEN], *p;
     FILE *phd_out;
     int qv_max, i;
     time_t current;
@@ -1877,7 +2193,7 @@ Btk_output_phd_file(
 	(void)sprintf(phd_file_name, "%s.phd.1", seq_name);
     }
 
-    if ((phd_out = fopen(phd_file_name, "w")) == NULL) {
+    if ((phd_out = Btk_open_output(phd_file_name, "w")) == NULL) {
 	error(phd_file_name, "couldn't open", errno);
 	return ERROR;
     }
@@ -1931,17 +2247,27 @@ Btk_output_phd_file(
     (void)fprintf(phd_out, "END_COMMENT\n\n");
     (void)fprintf(phd_out, "BEGIN_DNA\n");
 
-    /* Output the called bases, their quality values, and locations */
+    /* Output the called bases, their quality values, and locations,
+     * as "%c %d %d\n", a block of lines at a time */
+    p = text;
     for (i = 0; i < num_bases; i++) {
-        (void)fprintf(phd_out, "%c %d %d\n", tolower((int)called_bases[i]),
-			quality_values[i], called_locs[i]);
+        *p++ = (char)tolower((int)called_bases[i]);
+        *p++ = ' ';
+        p = format_int(p, quality_values[i], 0);
+        *p++ = ' ';
+        p = format_int(p, called_locs[i], 0);
+        *p++ = '\n';
+        if ((p > text + sizeof(text) - PHD_LINE_LEN) || (i == num_bases - 1)) {
+            (void)fwrite(text, 1, p - text, phd_out);
+            p = text;
+        }
     }
 
     /* Create footer */
     (void)fprintf(phd_out, "END_DNA\n\n");
     (void)fprintf(phd_out, "END_SEQUENCE\n");
 
-    (void)fclose(phd_out);
+    (void)Btk_close_output(phd_out);
     return SUCCESS;
 }
 
@@ -1952,27 +2278,29 @@ output_four_multi_fasta_files(char *multiseqsFileName,
     int num_bases, char *called_bases, uint8_t *quality_values, int *called_locs, 
     double frac_QV20_with_shoulders, char *status_code, Options options)
 {
-    int i, j;
+    int i, j, len;
     char *seq_name, ttuner_name[BUFLEN];
+    char line[COLUMN_TEXT_LEN(MAX2(MULTI_QUAL_PER_LINE, MULTI_LOCS_PER_LINE),
+        5)];
     FILE *seqs_out = NULL, *qual_out = NULL, 
          *locs_out = NULL, *stat_out = NULL;
 
-    if ((seqs_out = fopen(multiseqsFileName, "a")) == NULL) {
+    if ((seqs_out = Btk_open_multi_file(multiseqsFileName)) == NULL) {
         error(multiseqsFileName, "couldn't open", errno);
         return ERROR;
     }
     
-    if ((qual_out = fopen(multiqualFileName, "a")) == NULL) {
+    if ((qual_out = Btk_open_multi_file(multiqualFileName)) == NULL) {
         error(multiqualFileName, "couldn't open", errno);
         return ERROR;
     }
 
-    if ((locs_out = fopen(multilocsFileName, "a")) == NULL) {
+    if ((locs_out = Btk_open_multi_file(multilocsFileName)) == NULL) {
         error(multilocsFileName, "couldn't open", errno);
         return ERROR;
     }
 
-    if ((stat_out = fopen(multistatFileName, "a")) == NULL) {
+    if ((stat_out = Btk_open_multi_file(multistatFileName)) == NULL) {
         error(multistatFileName, "couldn't open", errno);
         return ERROR;
     }
@@ -2007,11 +2335,11 @@ output_four_multi_fasta_files(char *multiseqsFileName,
     fprintf(qual_out, ">%s \n", seq_name);
     if (strcmp(status_code, "TT_SUCCESS") == 0)
     {
-        for (i = 0; i < num_bases; i++) {
-            fprintf(qual_out, "%2d ", quality_values[i]);
-            if ((i%20 == 19) || (i == num_bases - 1)) {
-                fprintf(qual_out, "\n");               
-            }
+        for (i = 0; i < num_bases; i += MULTI_QUAL_PER_LINE) {
+            len = format_qv_column(line, &quality_values[i],
+                MIN2(MULTI_QUAL_PER_LINE, num_bases - i), 2,
+                MULTI_QUAL_PER_LINE, 0);
+            (void)fwrite(line, 1, len, qual_out);
         }
     }
     else
@@ -2020,12 +2348,11 @@ output_four_multi_fasta_files(char *multiseqsFileName,
     fprintf(locs_out, ">%s \n", seq_name);
     if (strcmp(status_code, "TT_SUCCESS") == 0)
     {
-        for (i = 0; i < num_bases; i++) {
-            fprintf(locs_out, "%5d ", called_locs[i]);
-
-            if ((i%15 == 14) || (i == num_bases - 1)) {
-                fprintf(locs_out, "\n");
-            }
+        for (i = 0; i < num_bases; i += MULTI_LOCS_PER_LINE) {
+            len = format_column(line, &called_locs[i],
+                MIN2(MULTI_LOCS_PER_LINE, num_bases - i), 5,
+                MULTI_LOCS_PER_LINE, 0);
+            (void)fwrite(line, 1, len, locs_out);
         }
     }
     else
@@ -2033,12 +2360,7 @@ output_four_multi_fasta_files(char *multiseqsFileName,
     strcpy(ttuner_name, TT_VERSION + 3);
     fprintf(stat_out, ">%s ttuner%s %s %3.2f\n", seq_name, ttuner_name, 
         status_code, frac_QV20_with_shoulders);
-    
-    fclose(seqs_out);
-    fclose(qual_out);
-    fclose(locs_out);
-    fclose(stat_out);
- 
+
     return SUCCESS;
 }
 
@@ -2095,7 +2417,7 @@ Btk_output_fasta_file(
 #else
         sprintf(fasta_file_name, "%s/%s.seq", path, seq_name);
 #endif
-        if ((dir_out = fopen(fasta_file_name, "w")) == NULL) {
+        if ((dir_out = Btk_open_output(fasta_file_name, "w")) == NULL) {
             error(fasta_file_name, "couldn't open", errno);
             return ERROR;
         }
@@ -2104,16 +2426,18 @@ Btk_output_fasta_file(
     if (FastaType & NAME_FILES) {
         sprintf(fasta_file_name, "%s.seq", seq_name);
 
-        if ((fasta_out = fopen(fasta_file_name, "w")) == NULL) {
+        if ((fasta_out = Btk_open_output(fasta_file_name, "w")) == NULL) {
             error(fasta_file_name, "couldn't open", errno);
             return ERROR;
         }
     }
 
     if (FastaType & NAME_MULTI) {
-        if ((multi_out = fopen(multiseqFileName, "a")) == NULL) {
+        if ((multi_out = Btk_open_multi_file(multiseqFileName)) == NULL) {
             error(multiseqFileName, "couldn't open", errno);
-            fclose(fasta_out);
+            if (fasta_out) {
+                Btk_close_output(fasta_out);
+            }
             return ERROR;
         }
     }
@@ -2164,15 +2488,11 @@ Btk_output_fasta_file(
     }
 
     if (fasta_out) {
-        fclose(fasta_out);
+        Btk_close_output(fasta_out);
     }
 
     if (dir_out) {
-        fclose(dir_out);
-    }
-
-    if (multi_out) {
-        fclose(multi_out);
+        Btk_close_output(dir_out);
     }
 
     return SUCCESS;
@@ -2232,7 +2552,7 @@ Btk_output_tip_file( Data *data, char *color2base, Options options)
 #endif
 
     /* Open the TIP file */
-    if ((tip_out = fopen(tip_file_name, "w")) == NULL) {
+    if ((tip_out = Btk_open_output(tip_file_name, "w")) == NULL) {
         error(tip_file_name, "couldn't open", errno);
         return ERROR;
     }
@@ -2283,6 +2603,7 @@ Btk_output_tip_file( Data *data, char *color2base, Options options)
         }
         (void)fprintf(tip_out, "\n");
     }
+    (void)Btk_close_output(tip_out);
     FREE(y);
     return SUCCESS;
 }
@@ -2352,7 +2673,7 @@ Btk_output_tab_file(int num2, AltBase *altbases,
 #endif
 
     /* Open the ABC file */
-    if ((tab_out = fopen(tab_file_name, "w")) == NULL) {
+    if ((tab_out = Btk_open_output(tab_file_name, "w")) == NULL) {
         error(tab_file_name, "couldn't open", errno);
         return ERROR;
     }
@@ -2386,289 +2707,184 @@ Btk_output_tab_file(int num2, AltBase *altbases,
         }
     }
 
-    (void)fclose(tab_out);
+    (void)Btk_close_output(tab_out);
     return SUCCESS;
 
 }
 
 
-/********************************************************************************
- * Function: delta_out_samples1
- ********************************************************************************
- */
-void
-delta_out_samples1(unsigned char samples[], int num_samples)
-{
-    int i;
-    unsigned char p_delta = 0, p_sample;
+/* Sizes of the records of an SCF file */
+#define SCF_HEADER_SIZE 128
+#define SCF_BASE_SIZE   12
 
-    for (i = 0; i < num_samples; i++)
-    {
-        p_sample = samples[i];
-        samples[i] = samples[i] - p_delta;
-        p_delta = p_sample;
-    }
-
-    for (p_delta = 0, i = 0; i < num_samples; i++)
-    {
-        p_sample = samples[i];
-        samples[i] = samples[i] - p_delta;
-        p_delta = p_sample;
-    }
-}
+/* Big-endian stores into an SCF image */
+#define PUT_BE16(p, v) \
+    ((p)[0] = (unsigned char)((v) >> 8), (p)[1] = (unsigned char)(v))
+#define PUT_BE32(p, v) \
+    ((p)[0] = (unsigned char)((v) >> 24), (p)[1] = (unsigned char)((v) >> 16), \
+     (p)[2] = (unsigned char)((v) >> 8),  (p)[3] = (unsigned char)(v))
 
 /********************************************************************************
- * Function: delta_out_samples2
+ * This function puts the samples of one trace into an SCF v3 image as
+ * second-order differences, i.e. x[i] - 2*x[i-1] + x[i-2] modulo the
+ * sample size, which is what two passes of first-order differences give.
+ * Every difference depends on the input only, so that the loops are
+ * vectorized.  Its synopsis is:
+ *
+ * delta_out_samples(out, trace, num_samples, sample_size)
+ *
+ * where
+ *	out		is the address of the samples of the trace in the image
+ *	trace		is the array of the samples
+ *	num_samples	is the number of samples
+ *	sample_size	is the size of a sample in bytes, 1 or 2
  ********************************************************************************
  */
-void
-delta_out_samples2(unsigned short samples[], int num_samples)
+static void
+delta_out_samples(unsigned char *out, const int *trace, int num_samples,
+    int sample_size)
 {
     int i;
-    unsigned short p_delta = 0, p_sample;
-
-    for (i = 0; i < num_samples; i++)
-    {
-        p_sample = samples[i];
-        samples[i] = samples[i] - p_delta;
-        p_delta = p_sample;
-    }
+    unsigned int d;
 
-    for (p_delta = 0, i = 0; i < num_samples; i++)
-    {
-        p_sample = samples[i];
-        samples[i] = samples[i] - p_delta;
-        p_delta = p_sample;
+    if (num_samples <= 0) {
+        return;
     }
-}
-
-/********************************************************************************
- * Function: write_sample1
- ********************************************************************************
- */
-static int
-write_sample1(FILE *fp, TT_Samples1 *sample)
-{
-    if (writeuchar(fp, sample->sample_A) != SUCCESS) return ERROR;
-    if (writeuchar(fp, sample->sample_C) != SUCCESS) return ERROR;
-    if (writeuchar(fp, sample->sample_G) != SUCCESS) return ERROR;
-    if (writeuchar(fp, sample->sample_T) != SUCCESS) return ERROR;
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_sample2
- ********************************************************************************
- */
-static int
-write_sample2(FILE *fp, TT_Samples2 *sample)
-{
-    if (writeushort(fp, sample->sample_A) != SUCCESS) return ERROR;
-    if (writeushort(fp, sample->sample_C) != SUCCESS) return ERROR;
-    if (writeushort(fp, sample->sample_G) != SUCCESS) return ERROR;
-    if (writeushort(fp, sample->sample_T) != SUCCESS) return ERROR;
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_samples31
- ********************************************************************************
- */
-static int
-write_samples31(FILE *fp, TT_Samples1 *samples, int num_samples)
-{
-    int i, base;
-    unsigned char *samples_out;
-
-    samples_out = (unsigned char *) malloc(num_samples * sizeof(unsigned char));
-    if (samples_out == NULL) return ERROR;
-
-    for (base = 0; base < 4; base++)
-    {
-        for (i = 0; i < num_samples; i++)
-            switch (base)
-            {
-                case 0:
-                    samples_out[i] = samples[i].sample_A;
-                    break;
-                case 1:
-                    samples_out[i] = samples[i].sample_C;
-                    break;
-                case 2:
-                    samples_out[i] = samples[i].sample_G;
-                    break;
-                case 3:
-                    samples_out[i] = samples[i].sample_T;
-                    break;
-            }
-
-        delta_out_samples1(samples_out, num_samples);
-        if (num_samples != (int)fwrite(samples_out, 1, num_samples, fp))
-        {
-            FREE(samples_out);
-
-            return ERROR;
+    if (sample_size == 1) {
+        out[0] = (unsigned char)trace[0];
+        if (num_samples > 1) {
+            out[1] = (unsigned char)(trace[1] - 2 * trace[0]);
+        }
+        for (i = 2; i < num_samples; i++) {
+            out[i] = (unsigned char)(trace[i] - 2 * trace[i - 1]
+                + trace[i - 2]);
         }
+        return;
+    }
+    d = (unsigned int)trace[0];
+    PUT_BE16(out, d);
+    if (num_samples > 1) {
+        d = (unsigned int)(trace[1] - 2 * trace[0]);
+        PUT_BE16(out + 2, d);
+    }
+    for (i = 2; i < num_samples; i++) {
+        d = (unsigned int)(trace[i] - 2 * trace[i - 1] + trace[i - 2]);
+        out[2 * i]     = (unsigned char)(d >> 8);
+        out[2 * i + 1] = (unsigned char)d;
     }
-
-    FREE(samples_out);
-
-    return SUCCESS;
 }
 
 /********************************************************************************
- * Function: write_samples32
+ * This function builds the image of an SCF file, v2 or v3, in one buffer.
+ * Its synopsis is:
+ *
+ * image = build_scf_image(scf_version, called_bases, called_peak_locs,
+ *             quality_values, num_called_bases, num_datapoints,
+ *             chromatogram, sample_size, comments, image_size)
+ *
+ * where
+ *	chromatogram	is the array of the 4 traces, in the order A, C, G, T
+ *	sample_size	is the size of a sample in bytes, 1 or 2
+ *	comments	is the NUL-terminated text of the comments section
+ *	image_size	is the address where the size of the image will be put
+ *
+ *	image		is the malloc'ed image, or NULL if there is not enough
+ *			memory
  ********************************************************************************
  */
-static int
-write_samples32(FILE *fp, TT_Samples2 *samples, int num_samples)
+static unsigned char *
+build_scf_image(int scf_version, char *called_bases, int *called_peak_locs,
+    uint8_t *quality_values, int num_called_bases, int num_datapoints,
+    int *chromatogram[NUM_COLORS], int sample_size, char *comments,
+    size_t *image_size)
 {
-    int i, base;
-    unsigned short *samples_out;
-
-    samples_out = (unsigned short *) malloc(num_samples * sizeof(unsigned short));
-    if (samples_out == NULL) return ERROR;
-
-    for (base = 0; base < 4; base++)
-    {
-        for (i = 0; i < num_samples; i++)
-            switch (base)
-            {
-                case 0:
-                    samples_out[i] = (&samples[i])->sample_A;
-                    break;
-                case 1:
-                    samples_out[i] = (&samples[i])->sample_C;
-                    break;
-                case 2:
-                    samples_out[i] = (&samples[i])->sample_G;
-                    break;
-                case 3:
-                    samples_out[i] = (&samples[i])->sample_T;
-                    break;
+    unsigned char *image, *p, *prob;
+    unsigned int   samples_offset, bases_offset, comments_offset;
+    unsigned int   comments_size, v;
+    int            i, j;
+
+    samples_offset  = SCF_HEADER_SIZE;
+    bases_offset    = samples_offset + NUM_COLORS * sample_size * num_datapoints;
+    comments_offset = bases_offset + SCF_BASE_SIZE * num_called_bases;
+    comments_size   = (unsigned int)strlen(comments) + 1;
+    *image_size     = comments_offset + comments_size;
+
+    if ((image = CALLOC(unsigned char, *image_size)) == NULL) {
+        return NULL;
+    }
+
+    /* Header; the fields not set are 0 */
+    p = image;
+    PUT_BE32(p,      (unsigned int)TT_SCF_MAGIC);
+    PUT_BE32(p + 4,  (unsigned int)num_datapoints);
+    PUT_BE32(p + 8,  samples_offset);
+    PUT_BE32(p + 12, (unsigned int)num_called_bases);
+    PUT_BE32(p + 24, bases_offset);
+    PUT_BE32(p + 28, comments_size);
+    PUT_BE32(p + 32, comments_offset);
+    memcpy(p + 36, (scf_version == 2) ? "2.00" : "3.00", 4);
+    PUT_BE32(p + 40, (unsigned int)sample_size);
+
+    /* Samples: interleaved A, C, G, T in v2, one trace after the other and
+     * delta encoded in v3
+     */
+    p = image + samples_offset;
+    if (scf_version == 2) {
+        for (j = 0; j < NUM_COLORS; j++) {
+            const int *trace = chromatogram[j];
+
+            if (sample_size == 1) {
+                for (i = 0; i < num_datapoints; i++) {
+                    p[NUM_COLORS * i + j] = (unsigned char)trace[i];
+                }
             }
-
-        delta_out_samples2(samples_out, num_samples);
-
-        for (i = 0; i < num_samples; i++)
-            if (writeushort(fp, samples_out[i]) != SUCCESS)
-            {
-                FREE(samples_out);
-
-                return ERROR;
+            else {
+                for (i = 0; i < num_datapoints; i++) {
+                    v = (unsigned int)trace[i];
+                    p[2 * (NUM_COLORS * i + j)]     = (unsigned char)(v >> 8);
+                    p[2 * (NUM_COLORS * i + j) + 1] = (unsigned char)v;
+                }
             }
+        }
     }
-
-    FREE(samples_out);
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_base
- ********************************************************************************
- */
-static int
-write_base(FILE *fp, SCF_Bases_Rec *base)
-{
-    if (writeuint(fp, base->peak_index) != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->prob_A)    != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->prob_C)    != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->prob_G)    != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->prob_T)    != SUCCESS) return ERROR;
-    if (writeuchar(fp, (unsigned char) base->base) != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->spare[0])  != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->spare[1])  != SUCCESS) return ERROR;
-    if (writeuchar(fp, base->spare[2])  != SUCCESS) return ERROR;
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_bases3
- ********************************************************************************
- */
-static int
-write_bases3(FILE *fp, SCF_Bases_Rec *bases, int num_bases)
-{
-    int i;
-    unsigned char *buf1;
-
-    buf1 = (unsigned char *) malloc(8 * num_bases);
-    if (buf1 == NULL) return ERROR;
-
-    for (i = 0; i < num_bases; i++)
-        if (writeuint(fp, (&bases[i])->peak_index) != SUCCESS) return ERROR;
-
-    for (i = 0; i < num_bases; i++)
-    {
-        buf1[i] = (&bases[i])->prob_A;
-        buf1[i + num_bases] = (&bases[i])->prob_C;
-        buf1[i + 2 * num_bases] = (&bases[i])->prob_G;
-        buf1[i + 3 * num_bases] = (&bases[i])->prob_T;
-        buf1[i + 4 * num_bases] = (&bases[i])->base;
-        buf1[i + 5 * num_bases] = (&bases[i])->spare[0];
-        buf1[i + 6 * num_bases] = (&bases[i])->spare[1];
-        buf1[i + 7 * num_bases] = (&bases[i])->spare[2];
+    else {
+        for (j = 0; j < NUM_COLORS; j++) {
+            delta_out_samples(p + j * sample_size * num_datapoints,
+                chromatogram[j], num_datapoints, sample_size);
+        }
     }
 
-    if (8 * num_bases != (int)(fwrite(buf1, 1, 8 * num_bases, fp)))
-    {
-        FREE(buf1);
-
-        return ERROR;
+    /* Bases: 12-byte records in v2, one field after the other in v3.  The
+     * quality value of a base is its probability of being the called base.
+     */
+    p = image + bases_offset;
+    for (i = 0; i < num_called_bases; i++) {
+        v = (unsigned int)called_peak_locs[i];
+        if (scf_version == 2) {
+            PUT_BE32(p + SCF_BASE_SIZE * i, v);
+            p[SCF_BASE_SIZE * i + 8] = (unsigned char)called_bases[i];
+        }
+        else {
+            PUT_BE32(p + 4 * i, v);
+            p[8 * num_called_bases + i] = (unsigned char)called_bases[i];
+        }
+    }
+    for (i = 0; i < num_called_bases; i++) {
+        switch (called_bases[i]) {
+        case 'A': case 'a': j = 0; break;
+        case 'C': case 'c': j = 1; break;
+        case 'G': case 'g': j = 2; break;
+        case 'T': case 't': j = 3; break;
+        default:            continue;
+        }
+        prob = (scf_version == 2) ? p + SCF_BASE_SIZE * i + 4 + j :
+            p + 4 * num_called_bases + j * num_called_bases + i;
+        *prob = quality_values[i];
     }
 
-    FREE(buf1);
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_scf_comments
- ********************************************************************************
- */
-static int
-write_scf_comments(FILE *fp, char *comments, size_t comments_size)
-{
-    if (fwrite(comments, comments_size, 1, fp) != 1) return ERROR;
-
-    return SUCCESS;
-}
-
-/********************************************************************************
- * Function: write_scf_header
- ********************************************************************************
- */
-static int
-write_scf_header(FILE *fp, SCF_Header *header)
-{
-    int i;
-
-    if (writeuint(fp, header->magic_number)     != SUCCESS) return ERROR;
-    if (writeuint(fp, header->samples)          != SUCCESS) return ERROR;
-    if (writeuint(fp, header->samples_offset)   != SUCCESS) return ERROR;
-    if (writeuint(fp, header->bases)            != SUCCESS) return ERROR;
-    if (writeuint(fp, header->bases_left_clip)  != SUCCESS) return ERROR;
-    if (writeuint(fp, header->bases_right_clip) != SUCCESS) return ERROR;
-    if (writeuint(fp, header->bases_offset)     != SUCCESS) return ERROR;
-    if (writeuint(fp, header->comments_size)    != SUCCESS) return ERROR;
-    if (writeuint(fp, header->comments_offset)  != SUCCESS) return ERROR;
-
-    if (fwrite(header->version, sizeof(header->version), 1, fp) != 1) return ERROR;
-
-    if (writeuint(fp, header->sample_size)      != SUCCESS) return ERROR;
-    if (writeuint(fp, header->code_set)         != SUCCESS) return ERROR;
-    if (writeuint(fp, header->private_size)     != SUCCESS) return ERROR;
-    if (writeuint(fp, header->private_offset)   != SUCCESS) return ERROR;
-
-    for (i = 0; i < 18; i++)
-        if (writeuint(fp, header->spare[i]) != SUCCESS)
-            return ERROR;
+    memcpy(image + comments_offset, comments, comments_size);
 
-    return SUCCESS;
+    return image;
 }
 
 /********************************************************************************
@@ -2689,14 +2905,15 @@ output_scf_file(
     int  *chromatogram2,
     int  *chromatogram3,
     char *color2base,
-    char *chemistry)
+    char *chemistry,
+    BtkReadContext *context)
 {
     char *seq_name, scf_file_name[MAXPATHLEN], *suffix = NULL;
-    FILE *scf_out;
     char comments[2048];
-    SCF_Header header;
-    SCF_Bases_Rec base;
-    int i, scf_version = 2;
+    int  *chromatogram[NUM_COLORS];
+    unsigned char *image;
+    size_t image_size;
+    int scf_version = 2;
 
 #ifdef __WIN32
     if ((seq_name = strrchr(path, '\\')) != NULL)
@@ -2725,227 +2942,193 @@ output_scf_file(
     else
         sprintf(scf_file_name, "%s.scf", seq_name);
 
-    if ((scf_out = fopen(scf_file_name, "wb")) == NULL) {
-        error(scf_file_name, "couldn't open", errno);
+    sprintf(comments, "DYEP=%s\nCONV=%s", chemistry, TT_VERSION);
+
+    chromatogram[0] = chromatogram0;
+    chromatogram[1] = chromatogram1;
+    chromatogram[2] = chromatogram2;
+    chromatogram[3] = chromatogram3;
+    image = build_scf_image(scf_version, called_bases, called_peak_locs,
+        quality_values, num_called_bases, num_datapoints, chromatogram,
+        (context->max_colordata_value < 256) ? 1 : 2, comments, &image_size);
+    if (image == NULL) {
+        error(scf_file_name, "couldn't allocate the SCF image", ENOMEM);
         return ERROR;
     }
 
-    sprintf(comments, "DYEP=%s\nCONV=%s", chemistry, TT_VERSION);
+    if (Btk_write_output(scf_file_name, image, image_size) != SUCCESS) {
+        error(scf_file_name, "couldn't write", errno);
+        FREE(image);
+        return ERROR;
+    }
+    FREE(image);
 
-    header.magic_number      = TT_SCF_MAGIC;
-    header.samples           = num_datapoints;
-    header.samples_offset    = (unsigned int) sizeof(SCF_Header);
-    header.bases             = num_called_bases;
-    header.bases_left_clip   = 0;
-    header.bases_right_clip  = 0;
-    header.sample_size       = (max_colordata_value < 256) ? 1 : 2;
-    header.bases_offset      = (unsigned int) (header.samples_offset + header.samples
-                               * ((header.sample_size == 2) ? 8 : 4));
-    header.comments_size     = (unsigned int) strlen(comments) + 1;
-    header.comments_offset   = (unsigned int) (header.bases_offset + header.bases
-                               * sizeof(SCF_Bases_Rec));
-    strncpy(header.version, (scf_version == 2) ? "2.00" : "3.00", 4);
-    header.code_set          = 0;
-    header.private_size      = 0;
-    header.private_offset    = 0;
-
-    for (i = 0; i < 18; i++)
-        header.spare[i] = 0;
-
-    if (write_scf_header(scf_out, &header) != SUCCESS) return ERROR;
-
-    if (max_colordata_value < 256)
-    {
-        TT_Samples1 sample, *samples;
+    return SUCCESS;
+}
 
-        if (scf_version == 2)
-        {
-            for (i = 0; i < (int)header.samples; i++)
-            {
-                sample.sample_A = (unsigned char) chromatogram0[i];
-                sample.sample_C = (unsigned char) chromatogram1[i];
-                sample.sample_G = (unsigned char) chromatogram2[i];
-                sample.sample_T = (unsigned char) chromatogram3[i];
 
-                if (write_sample1(scf_out, &sample) != SUCCESS) return ERROR;
-            }
-        }
-        else
-        {
-            samples = (TT_Samples1 *) malloc(header.samples * sizeof(TT_Samples1));
-            if (samples == NULL) return ERROR;
 
-            for (i = 0; i < (int)header.samples; i++)
-            {
-                samples[i].sample_A = (unsigned char) chromatogram0[i];
-                samples[i].sample_C = (unsigned char) chromatogram1[i];
-                samples[i].sample_G = (unsigned char) chromatogram2[i];
-                samples[i].sample_T = (unsigned char) chromatogram3[i];
-            }
 
-            if (write_samples31(scf_out, samples, header.samples) != SUCCESS)
-                return ERROR;
+/*
+ * This function reads the whole of a text file into a newly allocated,
+ * NUL-terminated buffer, whose length it returns in *size.  It returns
+ * NULL if the file can't be read.
+ */
+static char *
+read_text_file(char *file_name, size_t *size)
+{
+    FILE *fp;
+    char *text = NULL;
+    long  len;
 
-            FREE(samples);
-        }
+    if ((fp = fopen(file_name, "rb")) == NULL) {
+        return NULL;
     }
-    else
+    if ((fseek(fp, 0, SEEK_END) == 0) && ((len = ftell(fp)) >= 0)
+        && (fseek(fp, 0, SEEK_SET) == 0)
+        && ((text = CALLOC(char, len + 1)) != NULL))
     {
-        TT_Samples2 sample, *samples;
-
-        if (scf_version == 2)
-        {
-            for (i = 0; i < (int)header.samples; i++)
-            {
-                sample.sample_A = (unsigned short) chromatogram0[i];
-                sample.sample_C = (unsigned short) chromatogram1[i];
-                sample.sample_G = (unsigned short) chromatogram2[i];
-                sample.sample_T = (unsigned short) chromatogram3[i];
-
-                if (write_sample2(scf_out, &sample) != SUCCESS) return ERROR;
-            }
+        if (fread(text, 1, (size_t)len, fp) != (size_t)len) {
+            FREE(text);
         }
-        else
-        {
-            samples = (TT_Samples2 *) malloc(header.samples * sizeof(TT_Samples2));
-            if (samples == NULL) return ERROR;
-
-            for (i = 0; i < (int)header.samples; i++)
-            {
-                samples[i].sample_A = (unsigned short) chromatogram0[i];
-                samples[i].sample_C = (unsigned short) chromatogram1[i];
-                samples[i].sample_G = (unsigned short) chromatogram2[i];
-                samples[i].sample_T = (unsigned short) chromatogram3[i];
-            }
-
-            if (write_samples32(scf_out, samples, header.samples) != SUCCESS) return ERROR;
-
-            FREE(samples);
+        else {
+            *size = (size_t)len;
         }
     }
+    (void)fclose(fp);
+    return text;
+}
 
-    if (scf_version == 2)
-    {
-        for (i = 0; i < (int)header.bases; i++)
-        {
-            base.peak_index = called_peak_locs[i];
-            base.base = called_bases[i];
-            base.spare[0] = 0;
-            base.spare[1] = 0;
-            base.spare[2] = 0;
-            base.prob_A = 0;
-            base.prob_C = 0;
-            base.prob_G = 0;
-            base.prob_T = 0;
-
-            switch(base.base)
-            {
-                case 'A':
-                case 'a':
-                    base.prob_A = quality_values[i];
-                    break;
-                case 'C':
-                case 'c':
-                    base.prob_C = quality_values[i];
-                    break;
-                case 'G':
-                case 'g':
-                    base.prob_G = quality_values[i];
-                    break;
-                case 'T':
-                case 't':
-                    base.prob_T = quality_values[i];
-                    break;
-            }
+/*
+ * This function parses a decimal int at *p, after any blanks, within the
+ * line which ends at eol, as "%d" would.  If there is none, *value is
+ * left as it was.  *p is advanced past what was read.
+ */
+static void
+parse_phd_int(char **p, char *eol, int *value)
+{
+    char *s = *p;
+    int   v = 0, neg = 0;
 
-            if (write_base(scf_out, &base) != SUCCESS) return ERROR;
-        }
+    while ((s < eol) && isspace((unsigned char)*s)) {
+        s++;
     }
-    else
-    {
-        SCF_Bases_Rec *bases;
-
-        bases = (SCF_Bases_Rec *) malloc(header.bases * sizeof(SCF_Bases_Rec));
-        if (bases == NULL) return ERROR;
+    if ((s < eol) && ((*s == '-') || (*s == '+'))) {
+        neg = (*s++ == '-');
+    }
+    if ((s >= eol) || !isdigit((unsigned char)*s)) {
+        return;
+    }
+    while ((s < eol) && isdigit((unsigned char)*s)) {
+        v = 10 * v + (*s++ - '0');
+    }
+   *value = neg ? -v : v;
+   *p = s;
+}
 
-        for (i = 0; i < (int)header.bases; i++)
+/*
+ * This function parses the lines "<base> <qv> <location>" of a .phd file,
+ * between the lines BEGIN_DNA and END_DNA, into the arrays of bases,
+ * quality values and locations, in a single pass over the contents of
+ * the file.  The arrays hold *capacity elements; if grow is set they are
+ * reallocated as needed, up to max_bases elements.  Its synopsis is:
+ *
+ * num_bases = parse_phd_dna(text, size, called_bases, qualities,
+ *                           called_locs, capacity, grow, max_bases)
+ *
+ *	num_bases	is the number of bases read, or ERROR if out of memory
+ */
+static int
+parse_phd_dna(char *text, size_t size, char **called_bases,
+    uint8_t **qualities, int **called_locs, int *capacity, int grow,
+    int max_bases)
+{
+    char *p = text, *end = text + size, *eol, *s, *bases;
+    uint8_t *qvs;
+    int  *locs, n;
+    int   num_bases = 0, in_dna = 0, qv = 0, pos = 0;
+
+    for ( ; p < end; p = eol + 1) {
+        if ((eol = memchr(p, '\n', (size_t)(end - p))) == NULL) {
+            eol = end;
+        }
+        if (!in_dna) {
+            in_dna = (eol < end) && (eol - p == 9)
+                && (strncmp(p, "BEGIN_DNA", 9) == 0);
+            continue;
+        }
+        if (((eol < end) && (eol - p == 7) && (strncmp(p, "END_DNA", 7) == 0))
+            || (num_bases >= max_bases))
         {
-            bases[i].peak_index = called_peak_locs[i];
-            bases[i].base = called_bases[i];
-            bases[i].spare[0] = 0;
-            bases[i].spare[1] = 0;
-            bases[i].spare[2] = 0;
-            bases[i].prob_A = 0;
-            bases[i].prob_C = 0;
-            bases[i].prob_G = 0;
-            bases[i].prob_T = 0;
-
-            switch(bases[i].base)
-            {
-                case 'A':
-                case 'a':
-                    bases[i].prob_A = quality_values[i];
-                    break;
-                case 'C':
-                case 'c':
-                    bases[i].prob_C = quality_values[i];
-                    break;
-                case 'G':
-                case 'g':
-                    bases[i].prob_G = quality_values[i];
-                    break;
-                case 'T':
-                case 't':
-                    bases[i].prob_T = quality_values[i];
-                    break;
-            }
+            break;
         }
-
-        if (write_bases3(scf_out, bases, header.bases) != SUCCESS) return ERROR;
+        if (num_bases >= *capacity) {
+            if (!grow) {
+                break;
+            }
+            n = (*capacity > 0) ? 2 * *capacity : 1024;
+            if (n > max_bases) {
+                n = max_bases;
+            }
+            if ((bases = REALLOC(*called_bases, char, n)) == NULL) {
+                return ERROR;
+            }
+           *called_bases = bases;
+            if ((qvs = REALLOC(*qualities, uint8_t, n)) == NULL) {
+                return ERROR;
+            }
+           *qualities = qvs;
+            if ((locs = REALLOC(*called_locs, int, n)) == NULL) {
+                return ERROR;
+            }
+           *called_locs = locs;
+           *capacity = n;
+        }
+        s = p + 1;
+        parse_phd_int(&s, eol, &qv);
+        parse_phd_int(&s, eol, &pos);
+        (*called_bases)[num_bases] = (p < eol) ?
+            (char)toupper((unsigned char)*p) : '\0';   /* always use upper */
+        (*qualities)[num_bases] = (uint8_t)qv;
+        (*called_locs)[num_bases] = pos;
+        num_bases++;
     }
-
-    if (write_scf_comments(scf_out, comments, (size_t) header.comments_size) != SUCCESS)
-        return ERROR;
-
-    fclose(scf_out);
-
-    return SUCCESS;
+    return num_bases;
 }
 
-
-
-
 /* *****************************************************************************
- * File: get_phd_num_bases
+ * File: Btk_load_phd_file
  * Purpose: read called bases, their locations and quality values from .phd.1
- *          file
+ *          file into newly allocated arrays, in a single pass over the file
  *******************************************************************************/
 
 int
-get_phd_num_bases(char *phd_file_name, BtkMessage *message)
+Btk_load_phd_file(char *phd_file_name, char **called_bases,
+    uint8_t **qualities, int **called_locs, int *num_bases, int max_bases,
+    BtkMessage *message)
 {
-    FILE *phd_inp;
-    int   num_bases, qv, pos;
-    char  c, buffer[BUFLEN];
+    char  *text;
+    size_t size = 0;
+    int    capacity = 0;
 
-    if ((phd_inp = fopen(phd_file_name, "r")) == NULL) {
+   *called_bases = NULL;
+   *qualities    = NULL;
+   *called_locs  = NULL;
+    if ((text = read_text_file(phd_file_name, &size)) == NULL) {
         return ERROR;
     }
-
-    while ( ( fgets(buffer, BUFLEN, phd_inp) != NULL)
-            && (strcmp(buffer, "BEGIN_DNA\n")!= 0 ) ) {
-    }
-
-    num_bases=0;
-    while ((fgets(buffer, BUFLEN, phd_inp) != NULL) && 
-           (strcmp(buffer, "END_DNA\n")!= 0 ) && 
-           (num_bases < MAX_BASES_LEN) ) {
-        sscanf( buffer, "%c %d %d\n", &c, &qv, &pos );
-        if(islower((int)c)) c=toupper((int)c); /* always use upper */
-        num_bases++;
+   *num_bases = parse_phd_dna(text, size, called_bases, qualities,
+        called_locs, &capacity, 1, max_bases);
+    FREE(text);
+    if (*num_bases < 0) {
+        FREE(*called_bases);
+        FREE(*qualities);
+        FREE(*called_locs);
+        sprintf(message->text, "insufficient memory at file=%s,line=%d\n",
+            __FILE__, __LINE__);
+        return ERROR;
     }
-    fclose(phd_inp);
-    return num_bases;
+    return SUCCESS;
 }
 
 /* *****************************************************************************
@@ -2958,35 +3141,17 @@ int
 Btk_read_phd_file(char *phd_file_name, char *called_bases, uint8_t *qualities,
     int *called_locs, int *num_bases, BtkMessage *message)
 {
-    FILE *phd_inp;
-    int   i;
-    char  buffer[BUFLEN];
-    char  c;
-    int   qv, pos;
+    char  *text;
+    size_t size = 0;
 
-    if ((phd_inp = fopen(phd_file_name, "r")) == NULL) {
+    if ((text = read_text_file(phd_file_name, &size)) == NULL) {
         fprintf(stderr, "Can not open input phd file %s\n",
         phd_file_name);
         return ERROR;
     }
-
-    while ( ( fgets(buffer, BUFLEN, phd_inp) != NULL)
-            && (strcmp(buffer, "BEGIN_DNA\n")!= 0 ) ) {
-    }
-
-    i=0;
-    while ( ( fgets(buffer, BUFLEN, phd_inp) != NULL)
-            && (strcmp(buffer, "END_DNA\n")!= 0 ) && (i < *num_bases) ) {
-        sscanf( buffer, "%c %d %d\n", &c, &qv, &pos );
-        if(islower((int)c)) c=toupper((int)c); /* always use upper */
-        called_bases[i]=c;
-        qualities[i]=qv;
-        called_locs[i]=pos;
-        i++;
-    }
-    *num_bases=i;
-
-    (void)fclose(phd_inp);
+   *num_bases = parse_phd_dna(text, size, &called_bases, &qualities,
+        &called_locs, num_bases, 0, *num_bases);
+    FREE(text);
     return SUCCESS;
 }
 
@@ -3070,7 +3235,7 @@ Btk_output_poly_file(Data *data, Options *options, BtkMessage *message)
             options->poly_dir, seq_name);
 #endif
 
-    if ((poly_out=fopen(poly_name,"w"))== NULL) {
+    if ((poly_out=Btk_open_output(poly_name,"w"))== NULL) {
         sprintf(message->text, "Unable to open POLY file '%s'\n",
         poly_name);
         return ERROR;
@@ -3169,7 +3334,7 @@ Btk_output_poly_file(Data *data, Options *options, BtkMessage *message)
 
     }
 
-    fclose(poly_out);
+    Btk_close_output(poly_out);
     return SUCCESS;
 }
 
@@ -3212,7 +3377,7 @@ Btk_output_poly_file_old(Data *data, int *data_peak_ind1, int *data_peak_ind2,
             options->poly_dir, seq_name);
 #endif
  
-    if ((poly_out=fopen(poly_name,"w"))== NULL) {
+    if ((poly_out=Btk_open_output(poly_name,"w"))== NULL) {
         sprintf(message->text, "Unable to open POLY file '%s'\n", 
         poly_name);
         return ERROR;
@@ -3271,6 +3436,6 @@ Btk_output_poly_file_old(Data *data, int *data_peak_ind1, int *data_peak_ind2,
         }
     }
     
-    fclose(poly_out);
+    Btk_close_output(poly_out);
     return SUCCESS;
 }
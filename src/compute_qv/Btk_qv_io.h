@@ -32,8 +32,28 @@
 #define NAME_FILEOFFILES 4   /* input will come from a file with one filename per line */
 #define NAME_MULTI 8
 
+struct _abi_file;            /* ABIFile, see ABI_Toolkit.h */
+
+/*
+ * Consensus side of the .tal alignment: the consensus and its reverse
+ * complement, with their k-tuple lookup tables, and the scoring matrices.
+ * Built once per run by Btk_create_tal_index and only read afterwards,
+ * so one index is shared by all the reads and all the worker threads.
+ */
+typedef struct {
+    int          ready;          /* non-zero once fully built */
+    Contig       consensus;
+    Contig       consensusrc;
+    Align_params align_pars;
+    Align_params align_pars_IUB;
+    int          Match;
+    int          MisMatch;
+    int          Insertion;
+    int          Deletion;
+} BtkTalIndex;
+
 extern int 
-read_consensus_from_sample_file(char **, int);
+read_consensus_from_sample_file(struct _abi_file *, char **, int);
 
 extern int
 read_sequence_from_fasta(char *, char **, BtkMessage *);
@@ -59,7 +79,7 @@ Btk_read_sample_file(
     int   **tvals,
     char  **call_method,
     char  **chemistry,
-    char   *status_code,
+    BtkReadContext *context,
     int    *file_type,
     Options options,
     BtkMessage *message);
@@ -94,15 +114,24 @@ Btk_output_tal_file(
     char *file_name,
     char *path,
     char *consensus_name,
-    char *consensus_seq,
+    BtkTalIndex *index,
     char *called_bases,
     int   num_called_bases,
+    float  RepeatFraction,
+    int  verbose);
+
+extern int
+Btk_create_tal_index(
+    BtkTalIndex *index,
+    char *consensus_seq,
     int  Match,
     int  MisMatch,
     int  Insertion,
     int  Deletion,
-    float  RepeatFraction,
-    int  verbose);
+    BtkMessage *message);
+
+extern void
+Btk_release_tal_index(BtkTalIndex *index);
 
 extern int
 Btk_output_hpr_file(
@@ -183,11 +212,16 @@ output_scf_file(
     int *chromatogram2,
     int *chromatogram3,
     char *color2base,
-    char *chemistry);
+    char *chemistry,
+    BtkReadContext *context);
 
 extern int
-get_phd_num_bases(
-    char *file_name, 
+Btk_load_phd_file(char *full_name,
+    char **called_bases,
+    uint8_t  **quality_values,
+    int **called_locs,
+    int  *num_bases,
+    int   max_bases,
     BtkMessage *message);
 
 extern int
@@ -204,6 +238,15 @@ Btk_output_poly_file(
     Options *, 
     BtkMessage *);
 
+extern FILE *
+Btk_open_multi_file(char *);
+
+extern int
+Btk_flush_multi_files(void);
+
+extern int
+Btk_close_multi_files(void);
+
 extern int
 output_four_multi_fasta_files(char *, char *, char *, char *,
     int , char *, uint8_t *, int *, double, char *, Options );
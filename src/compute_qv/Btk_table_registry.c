@@ -0,0 +1,504 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_table_registry.c
+ *
+ *  Registry of the lookup and context tables of a run.  Each table, be it
+ *  built-in, read with -t or LOOKUP_TABLE, or read with -ct, is loaded at
+ *  most once, under a lock, however many worker threads ask for it, and
+ *  all of them share the same copy, which is never modified once it is
+ *  registered.  The tables are released with Btk_release_tables() when all
+ *  the threads are done.
+ *
+ *  With Btk_share_tables() (-share_tables), the lookup tables are also
+ *  shared between the ttuner processes of a host, which is useful when
+ *  many of them run at once, e.g. one per shard.  The first process which
+ *  needs a table publishes it, with its compiled grid, in a POSIX shared
+ *  memory segment in the format of a binary lookup table, and the others
+ *  map the segment rather than read and compile the table themselves.
+ *  The name of a segment is
+ *
+ *      /ttuner-<uid>-<version>-<key>
+ *
+ *  where the key is the name and a hash of the contents of a built-in
+ *  table, or the device, inode, size and modification time of a table
+ *  file, so that a modified table file gets a segment of its own.  The
+ *  magic number of a segment is written last, so that one which is still
+ *  being published, or whose publisher died, is seen as corrupt: the
+ *  process then reads a private copy of the table, as it does when the
+ *  segment can't be created.  The segments outlive the processes, like
+ *  files in /dev/shm where Linux keeps them, and may be removed when no
+ *  ttuner is running with
+ *
+ *      rm /dev/shm/ttuner-*
+ *
+ *  Binary table files are not published, since all the processes which
+ *  map them share their pages already, and neither are context tables.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_qv_data.h"
+#include "Btk_lookup_table.h"
+#include "Btk_default_table.h"
+#include "context_table.h"
+#include "Btk_table_registry.h"
+
+#define BTK_SEGMENT_MAGIC_SIZE  8   /* bytes of "TTLUTB01", written last */
+
+typedef enum {
+    REG_BUILTIN,                    /* built-in lookup table */
+    REG_LOOKUP,                     /* lookup table file */
+    REG_CONTEXT                     /* context table file */
+} RegisteredKind;
+
+typedef struct _registered_table {
+    RegisteredKind  kind;
+    char           *name;           /* of the built-in table, or path */
+    BtkLookupTable *table;
+    ContextTable   *ctable;
+    struct _registered_table *next;
+} RegisteredTable;
+
+static const struct {
+    int              type;          /* TABLETYPE */
+    char            *name;          /* for Btk_find_default_table() */
+    BtkLookupTable *(*get)(void);
+} BuiltinTables[] = {
+    { ABI3700pop5, "3700pop5", Btk_get_3700pop5_table },
+    { ABI3700pop6, "3700pop6", Btk_get_3700pop6_table },
+    { ABI3100,     "3100pop6", Btk_get_3100pop6_table },
+    { ABI3730pop7, "3730pop7", Btk_get_3730pop7_table },
+    { MegaBACE,    "mbace",    Btk_get_mbace_table    }
+};
+
+static pthread_mutex_t  RegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static RegisteredTable *Registry = NULL;
+static int              ShareTables = 0;
+
+/*
+ * This function makes the lookup tables which are registered from now on
+ * shared between processes, or not.
+ */
+void
+Btk_share_tables(int share)
+{
+    ShareTables = share;
+}
+
+/*
+ * This function returns the registered table of the specified kind and
+ * name, or NULL if there is none.  The registry must be locked.
+ */
+static RegisteredTable *
+find_table(RegisteredKind kind, const char *name)
+{
+    RegisteredTable *reg;
+
+    for (reg = Registry; reg != NULL; reg = reg->next) {
+        if ((reg->kind == kind) && (strcmp(reg->name, name) == 0)) {
+            return reg;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * This function registers a table.  A table which can't be registered,
+ * if out of memory, is still usable, but is never released.  The
+ * registry must be locked.
+ */
+static void
+add_table(RegisteredKind kind, const char *name, BtkLookupTable *table,
+    ContextTable *ctable)
+{
+    RegisteredTable *reg;
+
+    if ((reg = CALLOC(RegisteredTable, 1)) == NULL) {
+        return;
+    }
+    if ((reg->name = (char *)malloc(strlen(name) + 1)) == NULL) {
+        FREE(reg);
+        return;
+    }
+    (void)strcpy(reg->name, name);
+    reg->kind   = kind;
+    reg->table  = table;
+    reg->ctable = ctable;
+    reg->next   = Registry;
+    Registry    = reg;
+}
+
+#ifndef __WIN32
+/*
+ * This function makes the name of the shared memory segment of the
+ * table of the specified key.  Its synopsis is:
+ *
+ * segment_name(name, size, key)
+ */
+static void
+segment_name(char *name, size_t size, const char *key)
+{
+    char *s;
+
+    (void)snprintf(name, size, "/ttuner-%lu-%s-%s",
+        (unsigned long)geteuid(), TT_VERSION, key);
+    for (s = name + 1; *s != '\0'; s++) {
+        if (!isalnum((unsigned char)*s) && (*s != '.') && (*s != '_')) {
+            *s = '-';
+        }
+    }
+}
+
+/*
+ * This function adds the specified bytes to a 64-bit FNV-1a hash, and
+ * returns the new hash.
+ */
+static uint64_t
+hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * This function maps the lookup table published in the specified shared
+ * memory segment.  Its synopsis is:
+ *
+ * table = attach_segment(name)
+ *
+ *	table	is the table, or NULL if the segment doesn't exist, isn't
+ *		owned by the user or doesn't hold a table, yet
+ */
+static BtkLookupTable *
+attach_segment(const char *name)
+{
+    BtkLookupTable *table;
+    BtkMessage      message;
+    struct stat     st;
+    void           *data;
+    int             fd;
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        return NULL;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_uid != geteuid())
+        || (st.st_size <= 0))
+    {
+        (void)close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    (void)close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    if ((table = Btk_map_lookup_table(data, (long)st.st_size, 1, &message))
+        == NULL)
+    {
+        (void)munmap(data, (size_t)st.st_size);
+    }
+    return table;
+}
+
+/*
+ * This function writes the specified bytes at the specified offset of a
+ * file.  Its synopsis is:
+ *
+ * result = write_at(fd, data, size, offset)
+ *
+ *	result	is SUCCESS or ERROR
+ */
+static int
+write_at(int fd, const char *data, size_t size, off_t offset)
+{
+    ssize_t n;
+
+    while (size > 0) {
+        if ((n = pwrite(fd, data, size, offset)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR;
+        }
+        data   += n;
+        size   -= (size_t)n;
+        offset += n;
+    }
+    return SUCCESS;
+}
+
+/*
+ * This function publishes the specified lookup table in a new shared
+ * memory segment of the specified name, and maps the segment, or maps
+ * the segment of the name if another process published it first.  Its
+ * synopsis is:
+ *
+ * shared = publish_segment(name, table)
+ *
+ *	shared	is the table mapped from the segment, or NULL if it couldn't
+ *		be published or mapped
+ */
+static BtkLookupTable *
+publish_segment(const char *name, BtkLookupTable *table)
+{
+    BtkLookupTable *shared = NULL;
+    char           *data;
+    long            size;
+    int             fd;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        return (errno == EEXIST) ? attach_segment(name) : NULL;
+    }
+    if ((data = (char *)Btk_lookup_table_image(table, &size)) == NULL) {
+        goto error;
+    }
+
+    /* The magic number, with which the contents begin, last */
+    if ((ftruncate(fd, (off_t)size) != 0)
+        || (write_at(fd, data + BTK_SEGMENT_MAGIC_SIZE,
+            (size_t)size - BTK_SEGMENT_MAGIC_SIZE,
+            (off_t)BTK_SEGMENT_MAGIC_SIZE) != SUCCESS)
+        || (write_at(fd, data, BTK_SEGMENT_MAGIC_SIZE, 0) != SUCCESS))
+    {
+        goto error;
+    }
+    free(data);
+    (void)close(fd);
+    if ((shared = attach_segment(name)) == NULL) {
+        (void)shm_unlink(name);
+    }
+    return shared;
+
+error:
+    FREE(data);
+    (void)close(fd);
+    (void)shm_unlink(name);
+    return NULL;
+}
+
+/*
+ * This function returns the built-in lookup table of the specified name
+ * shared between processes, publishing it if needed, or NULL if it can't
+ * be shared.
+ */
+static BtkLookupTable *
+share_builtin_table(char *name)
+{
+    BtkLookupTable *table = Btk_find_default_table(name);
+    uint64_t        hash = 14695981039346656037ULL;
+    char            key[64], segment[256];
+
+    hash = hash_bytes(hash, table->tpar,
+        table->num_tpar_entries * sizeof(TraceParamEntry));
+    hash = hash_bytes(hash, table->entries,
+        table->num_lut_entries * sizeof(BtkLookupEntry));
+    (void)sprintf(key, "%s-%016llx", name, (unsigned long long)hash);
+    segment_name(segment, sizeof(segment), key);
+    return publish_segment(segment, table);
+}
+
+/*
+ * This function returns the key of the shared memory segment of the
+ * specified lookup table file, which changes when the file does.  Its
+ * synopsis is:
+ *
+ * result = file_segment_name(path, segment, size)
+ *
+ *	result	is SUCCESS, or ERROR if the file can't be stat'ed
+ */
+static int
+file_segment_name(char *path, char *segment, size_t size)
+{
+    struct stat st;
+    char        key[128];
+
+    if (stat(path, &st) != 0) {
+        return ERROR;
+    }
+    (void)sprintf(key, "f%llx-%llx-%llx-%llx",
+        (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+        (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    segment_name(segment, size, key);
+    return SUCCESS;
+}
+#endif /* !__WIN32 */
+
+/*
+ * This function returns the built-in lookup table of the specified type,
+ * loading it if it is the first time it is asked for.  Its synopsis is:
+ *
+ * table = Btk_registry_builtin_table(type)
+ *
+ * where
+ *	type	is the TABLETYPE of the table, e.g. ABI3730pop7
+ *
+ *	table	is the table, or NULL if there is none of the type
+ */
+BtkLookupTable *
+Btk_registry_builtin_table(int type)
+{
+    RegisteredTable *reg;
+    BtkLookupTable  *table = NULL;
+    int              i, n = sizeof(BuiltinTables) / sizeof(BuiltinTables[0]);
+
+    for (i = 0; (i < n) && (BuiltinTables[i].type != type); i++)
+        ;
+    if (i == n) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&RegistryLock);
+    if ((reg = find_table(REG_BUILTIN, BuiltinTables[i].name)) != NULL) {
+        table = reg->table;
+    }
+    else {
+#ifndef __WIN32
+        if (ShareTables) {
+            table = share_builtin_table(BuiltinTables[i].name);
+        }
+#endif
+        if (table == NULL) {
+            table = BuiltinTables[i].get();
+        }
+        add_table(REG_BUILTIN, BuiltinTables[i].name, table, NULL);
+    }
+    pthread_mutex_unlock(&RegistryLock);
+    return table;
+}
+
+/*
+ * This function returns the lookup table of the specified file, reading
+ * it with Btk_read_lookup_table() if it is the first time it is asked
+ * for.  Its synopsis is:
+ *
+ * table = Btk_registry_lookup_table(path)
+ *
+ *	table	is the table, or NULL if it couldn't be read
+ */
+BtkLookupTable *
+Btk_registry_lookup_table(char *path)
+{
+    RegisteredTable *reg;
+    BtkLookupTable  *table = NULL;
+#ifndef __WIN32
+    BtkLookupTable  *shared;
+    char             segment[256];
+    int              named = 0;
+#endif
+
+    pthread_mutex_lock(&RegistryLock);
+    if ((reg = find_table(REG_LOOKUP, path)) != NULL) {
+        table = reg->table;
+        goto done;
+    }
+#ifndef __WIN32
+    if (ShareTables) {
+        named = (file_segment_name(path, segment, sizeof(segment))
+            == SUCCESS);
+        if (named) {
+            table = attach_segment(segment);
+        }
+    }
+#endif
+    if ((table == NULL) && ((table = Btk_read_lookup_table(path)) == NULL)) {
+        goto done;
+    }
+#ifndef __WIN32
+    if (named && !table->mapped
+        && ((shared = publish_segment(segment, table)) != NULL))
+    {
+        Btk_destroy_lookup_table(table);
+        table = shared;
+    }
+#endif
+    add_table(REG_LOOKUP, path, table, NULL);
+
+done:
+    pthread_mutex_unlock(&RegistryLock);
+    return table;
+}
+
+/*
+ * This function returns the context table of the specified file, reading
+ * it with read_context_table() if it is the first time it is asked for.
+ * Its synopsis is:
+ *
+ * ctable = Btk_registry_context_table(path)
+ *
+ *	ctable	is the table, or NULL if it couldn't be read
+ */
+ContextTable *
+Btk_registry_context_table(char *path)
+{
+    RegisteredTable *reg;
+    ContextTable    *ctable;
+
+    pthread_mutex_lock(&RegistryLock);
+    if ((reg = find_table(REG_CONTEXT, path)) != NULL) {
+        ctable = reg->ctable;
+    }
+    else if ((ctable = read_context_table(path)) != NULL) {
+        add_table(REG_CONTEXT, path, NULL, ctable);
+    }
+    pthread_mutex_unlock(&RegistryLock);
+    return ctable;
+}
+
+/*
+ * This function releases all the registered tables, once no thread uses
+ * them any longer.  The shared memory segments are left for the other
+ * processes.
+ */
+void
+Btk_release_tables(void)
+{
+    RegisteredTable *reg;
+
+    pthread_mutex_lock(&RegistryLock);
+    while ((reg = Registry) != NULL) {
+        Registry = reg->next;
+        Btk_destroy_lookup_table(reg->table);
+        destroy_context_table(reg->ctable);
+        FREE(reg->name);
+        FREE(reg);
+    }
+    pthread_mutex_unlock(&RegistryLock);
+}
@@ -0,0 +1,42 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  Btk_table_registry.h
+ *
+ *  Registry of the lookup and context tables of a run, which loads each
+ *  table at most once and hands out the same read-only copy to all the
+ *  threads which use it; see Btk_table_registry.c.  Needs Btk_qv.h,
+ *  Btk_lookup_table.h and context_table.h to be included first.
+ */
+
+#ifndef BTK_TABLE_REGISTRY_H_
+#define BTK_TABLE_REGISTRY_H_
+
+void            Btk_share_tables(int);
+BtkLookupTable *Btk_registry_builtin_table(int);
+BtkLookupTable *Btk_registry_lookup_table(char *);
+ContextTable   *Btk_registry_context_table(char *);
+void            Btk_release_tables(void);
+
+/* The contents of binary lookup tables, in Btk_lookup_table.c */
+void           *Btk_lookup_table_image(BtkLookupTable *, long *);
+BtkLookupTable *Btk_map_lookup_table(void *, long, int, BtkMessage *);
+
+#endif /* include guard */
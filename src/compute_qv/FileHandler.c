@@ -28,28 +28,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <zlib.h>
+#ifndef __WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 #include "ABI_Toolkit.h"
 #include "SCF_Toolkit.h"
+#include "ZTR_Toolkit.h"
 #include "SFF_Toolkit.h"
 #include "FileHandler.h"
 #include "Btk_qv.h"
 
-ABIError F_Open(char *file_name, void **ptr, long *file_size, int *file_type)
+#define LZW_BLOCK_MODE   0x80   /* whether code 256 clears the table */
+#define LZW_BITS_MASK    0x1f
+#define LZW_INIT_BITS    9
+#define LZW_MAX_BITS     16
+#define LZW_CLEAR        256
+
+/*
+ * This function reads the whole of a file into tf->data.  Where possible
+ * the file is mapped rather than read, so that the toolkits parse the
+ * pages of the page cache without a copy.  The mapping is private, so
+ * the file is never modified.
+ */
+static ABIError
+read_trace_file(char *file_name, TraceFile *tf)
 {
-    ABIError error = kNoError;
-    FILE          *stream;
-    size_t         size;
+    ABIError     error = kNoError;
+    FILE        *stream;
+    size_t       size = 0;
+#ifndef __WIN32
+    int          fd;
+    struct stat  st;
+    void        *data;
 
-   *ptr = NULL;
-   *file_size = size = 0;
+    if ((fd = open(file_name, O_RDONLY)) < 0)
+        return kCantOpenFile;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return kFileError;
+    }
+    if (S_ISREG(st.st_mode) && (st.st_size > 0))
+    {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            close(fd);
+            tf->data   = data;
+            tf->size   = (long)st.st_size;
+            tf->mapped = 1;
+            return kNoError;
+        }
+    }
+    close(fd);
+#endif
 
     stream = fopen(file_name, "rb");
     if (stream == NULL)
-        error = kCantOpenFile;
+        return kCantOpenFile;
 
-    if (error == kNoError)
-        error = fseek(stream, 0, SEEK_END) ? kFileError : kNoError;
+    error = fseek(stream, 0, SEEK_END) ? kFileError : kNoError;
 
     if (error == kNoError)
         size = ftell(stream);
@@ -59,14 +104,281 @@ ABIError F_Open(char *file_name, void **ptr, long *file_size, int *file_type)
 
     if (error == kNoError)
     {
-       *file_size = size;
-       *ptr = malloc(size);
-        if (*ptr == NULL)
+        tf->data = malloc(size);
+        if (tf->data == NULL)
             error = kMemoryFull;
     }
 
     if (error == kNoError)
-        error = size != fread(*ptr, 1, size, stream) ? kFileError : kNoError;
+        error = size != fread(tf->data, 1, size, stream) ? kFileError : kNoError;
+
+    tf->size = size;
+    fclose(stream);
+    return error;
+}
+
+/*
+ * This function frees or unmaps the contents of a trace file.
+ */
+static void
+release_trace_data(TraceFile *tf)
+{
+#ifndef __WIN32
+    if (tf->mapped)
+        munmap(tf->data, (size_t)tf->size);
+    else
+#endif
+        free(tf->data);
+    tf->data   = NULL;
+    tf->mapped = 0;
+}
+
+/*
+ * This function decompresses the gzip (or zlib) compressed contents of
+ * a file into a newly malloc'ed buffer.  The gzip trailer gives the size of the
+ * last member, which is used as the initial size of the output buffer.  The
+ * members of a file with several are decompressed one after the other.
+ */
+static ABIError
+gunzip_data(void **ptr, size_t *size)
+{
+    unsigned char *in = (unsigned char *)*ptr, *out, *p;
+    size_t         out_size;
+    z_stream       zs;
+    int            r;
+
+    out_size = (*size >= 4) ? ((size_t)in[*size - 4]      |
+                               (size_t)in[*size - 3] << 8 |
+                               (size_t)in[*size - 2] << 16 |
+                               (size_t)in[*size - 1] << 24) + 1 : 0;
+    if ((out_size < *size) || (out_size > 64 * *size + 1024))
+        out_size = 4 * *size + 1024;
+    if ((out = malloc(out_size)) == NULL)
+        return kMemoryFull;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 32) != Z_OK)     /* detect gzip or zlib */
+    {
+        free(out);
+        return kMemoryFull;
+    }
+    zs.next_in   = in;
+    zs.avail_in  = *size;
+    zs.next_out  = out;
+    zs.avail_out = out_size;
+
+    for (;;)
+    {
+        r = inflate(&zs, Z_NO_FLUSH);
+        if ((r == Z_STREAM_END) && (zs.avail_in > 0) && (zs.next_in[0] == 0x1f))
+        {
+            /* Concatenated gzip members; inflateReset() clears total_out,
+             * so the size of the output is that of all the members up to
+             * next_out
+             */
+            r = inflateReset(&zs);
+            continue;
+        }
+        if (r == Z_STREAM_END)
+            break;
+        if ((r != Z_OK) && (r != Z_BUF_ERROR))
+            break;
+        if (zs.avail_out > 0)       /* truncated input */
+        {
+            r = Z_DATA_ERROR;
+            break;
+        }
+        if ((p = realloc(out, 2 * out_size)) == NULL)
+        {
+            r = Z_MEM_ERROR;
+            break;
+        }
+        out = p;
+        zs.next_out  = out + out_size;
+        zs.avail_out = out_size;
+        out_size *= 2;
+    }
+    inflateEnd(&zs);
+
+    if (r != Z_STREAM_END)
+    {
+        free(out);
+        return (r == Z_MEM_ERROR) ? kMemoryFull : kBadCompressedData;
+    }
+    *ptr  = out;
+    *size = (size_t)(zs.next_out - out);
+    return kNoError;
+}
+
+/*
+ * This function decompresses the contents of a file compressed by the
+ * Unix compress utility (LZW, .Z) into a newly malloc'ed buffer.  The codes are
+ * written in groups of 8; whenever the code size changes or the table is
+ * cleared, the rest of the current group is padding.
+ */
+static ABIError
+uncompress_data(void **ptr, size_t *size)
+{
+    unsigned char  *in = (unsigned char *)*ptr, *out = NULL, *p;
+    unsigned char  *suffix = NULL, *stack = NULL;
+    unsigned short *prefix = NULL;
+    size_t          out_size, out_len = 0, pos, end;
+    long            code, incode, oldcode = -1, free_ent, maxcode, maxmaxcode;
+    int             n_bits = LZW_INIT_BITS, maxbits, block_mode, finchar = 0;
+    int             num_codes = 0, sp;
+    ABIError        error = kBadCompressedData;
+
+    if (*size < 3)
+        return kBadCompressedData;
+    maxbits    = in[2] & LZW_BITS_MASK;
+    block_mode = in[2] & LZW_BLOCK_MODE;
+    if ((maxbits < LZW_INIT_BITS) || (maxbits > LZW_MAX_BITS))
+        return kBadCompressedData;
+    maxmaxcode = 1L << maxbits;
+    maxcode    = (1L << n_bits) - 1;
+    free_ent   = block_mode ? LZW_CLEAR + 1 : LZW_CLEAR;
+
+    out_size = 4 * *size + 1024;
+    out    = malloc(out_size);
+    prefix = malloc(maxmaxcode * sizeof(unsigned short));
+    suffix = malloc(maxmaxcode);
+    stack  = malloc(maxmaxcode);
+    if ((out == NULL) || (prefix == NULL) || (suffix == NULL) || (stack == NULL))
+    {
+        error = kMemoryFull;
+        goto done;
+    }
+    for (code = 0; code < 256; code++)
+    {
+        prefix[code] = 0;
+        suffix[code] = (unsigned char)code;
+    }
+
+    pos = 3 * 8;
+    end = *size * 8;
+    while (pos + n_bits <= end)
+    {
+        if (free_ent > maxcode)
+        {
+            /* Skip the rest of the group and widen the codes */
+            pos += ((8 - num_codes % 8) % 8) * n_bits;
+            num_codes = 0;
+            n_bits++;
+            maxcode = (n_bits == maxbits) ? maxmaxcode : (1L << n_bits) - 1;
+            continue;
+        }
+
+        /* Read the next n_bits bits, least significant first */
+        code = (in[pos >> 3] | (in[(pos >> 3) + 1] << 8) |
+                (((pos >> 3) + 2 < *size) ? in[(pos >> 3) + 2] << 16 : 0));
+        code = (code >> (pos & 7)) & ((1L << n_bits) - 1);
+        pos += n_bits;
+        num_codes++;
+
+        if (oldcode == -1)
+        {
+            if (code >= 256)
+                goto done;
+            finchar = oldcode = code;
+            out[out_len++] = (unsigned char)finchar;
+            continue;
+        }
+
+        if ((code == LZW_CLEAR) && block_mode)
+        {
+            pos += ((8 - num_codes % 8) % 8) * n_bits;
+            num_codes = 0;
+            n_bits   = LZW_INIT_BITS;
+            maxcode  = (1L << n_bits) - 1;
+            free_ent = LZW_CLEAR;
+            continue;
+        }
+
+        incode = code;
+        sp = 0;
+        if (code >= free_ent)
+        {
+            if (code > free_ent)
+                goto done;
+            stack[sp++] = (unsigned char)finchar;
+            code = oldcode;
+        }
+        while (code >= 256)
+        {
+            stack[sp++] = suffix[code];
+            code = prefix[code];
+        }
+        finchar = code;
+        stack[sp++] = (unsigned char)finchar;
+
+        if (out_len + sp > out_size)
+        {
+            if ((p = realloc(out, 2 * out_size + sp)) == NULL)
+            {
+                error = kMemoryFull;
+                goto done;
+            }
+            out = p;
+            out_size = 2 * out_size + sp;
+        }
+        while (sp > 0)
+            out[out_len++] = stack[--sp];
+
+        if (free_ent < maxmaxcode)
+        {
+            prefix[free_ent] = (unsigned short)oldcode;
+            suffix[free_ent] = (unsigned char)finchar;
+            free_ent++;
+        }
+        oldcode = incode;
+    }
+
+    *ptr  = out;
+    *size = out_len;
+    out   = NULL;
+    error = kNoError;
+
+done:
+    free(out);
+    free(prefix);
+    free(suffix);
+    free(stack);
+    return error;
+}
+
+/*
+ * This function maps or reads the whole of a trace file and opens it
+ * with the toolkit of its type.  Files compressed with gzip or compress
+ * are decompressed in memory.
+ */
+ABIError F_Open(char *file_name, TraceFile *tf)
+{
+    ABIError error = kNoError;
+    size_t         size;
+    void         **ptr = &tf->data;
+    int           *file_type = &tf->type;
+    void          *data;
+
+    memset(tf, 0, sizeof(TraceFile));
+
+    error = read_trace_file(file_name, tf);
+    size  = tf->size;
+
+    if ((error == kNoError) && (size >= 2) &&
+        (((unsigned char *)*ptr)[0] == 0x1f))
+    {
+        data = *ptr;
+        if (((unsigned char *)*ptr)[1] == 0x8b)         /* gzip */
+            error = gunzip_data(&data, &size);
+        else if (((unsigned char *)*ptr)[1] == 0x9d)    /* compress */
+            error = uncompress_data(&data, &size);
+        if (data != *ptr)
+        {
+            release_trace_data(tf);
+            tf->data = data;
+            tf->size = size;
+        }
+    }
 
     if (error == kNoError)
     {
@@ -87,11 +399,11 @@ ABIError F_Open(char *file_name, void **ptr, long *file_size, int *file_type)
     if (error == kNoError)
     {
         if (*file_type == ABI)
-            error = ABI_Open(*ptr, size);
+            error = ABI_Open(&tf->abi, *ptr, size);
         else if (*file_type == SCF)
-            error = SCF_Open(*ptr, size);
+            error = SCF_Open(&tf->scf, *ptr, size);
         else if (*file_type == ZTR)
-            error = kNoError;              
+            error = ZTR_Open(&tf->ztr, *ptr, size);
         else if (*file_type == SFF)
             error = kNoError;   
         else 
@@ -102,22 +414,21 @@ ABIError F_Open(char *file_name, void **ptr, long *file_size, int *file_type)
         }
     }
 
-    if (stream != NULL)
-        fclose(stream);
-
      return error;
 }
 
-ABIError F_Close(void *ptr, int file_type)
+ABIError F_Close(TraceFile *tf)
 {
      ABIError error;
 
-     if (file_type == ABI)
-	  error = ABI_Close(ptr);
+     if (tf->type == ABI)
+	  error = ABI_Close(&tf->abi, tf->data);
+     else if (tf->type == ZTR)
+	  error = ZTR_Close(&tf->ztr, tf->data);
      else
-	  error = SCF_Close(ptr);
+	  error = SCF_Close(&tf->scf, tf->data);
 
-     free(ptr);
+     release_trace_data(tf);
 
      return error;
 }
@@ -24,5 +24,20 @@
  * 1.5 2003/11/06 18:18:44
  */
 
-ABIError F_Open(char *, void **, long *, int *);
-ABIError F_Close(void *, int);
+/*
+ * An open trace file: its contents, mapped or read into memory, plus the
+ * handle of whichever toolkit reads it.  Needs ABI_Toolkit.h, SCF_Toolkit.h
+ * and ZTR_Toolkit.h to be included first.
+ */
+typedef struct {
+    void    *data;             /* contents of the file */
+    long     size;             /* size of the file in bytes */
+    int      mapped;           /* whether data is mapped from the file */
+    int      type;             /* ABI, SCF, ... */
+    ABIFile  abi;
+    SCFFile  scf;
+    ZTRFile  ztr;
+} TraceFile;
+
+ABIError F_Open(char *, TraceFile *);
+ABIError F_Close(TraceFile *);
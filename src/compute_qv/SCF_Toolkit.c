@@ -33,67 +33,69 @@
 
 extern unsigned long get_offset(unsigned char *);
 
-static char *gFile = NULL;
+#define SCF_HEADER_SIZE 128
+#define SCF_NUM_DYES      4
+#define SCF_BASE_SIZE    12     /* per base in either layout */
 
-void SCF_NumBases(long *num_bases)
+void SCF_NumBases(SCFFile *scf, long *num_bases)
 {
-     *num_bases = get_offset((unsigned char *) (gFile + 12));
+     *num_bases = get_offset((unsigned char *) (scf->file + 12));
 }
 
-void SCF_Bases(char *edited_bases)
+void SCF_Bases(SCFFile *scf, char *edited_bases)
 {
      long num_bases, i;
      unsigned long bases_offset;
      char scf_version_string[5];
      double scf_version_number;
 
-     SCF_SCFVersion(scf_version_string);
+     SCF_SCFVersion(scf, scf_version_string);
      scf_version_number = atof(scf_version_string);
 
-     SCF_NumBases(&num_bases);
-     bases_offset = get_offset((unsigned char *) (gFile + 24));
+     SCF_NumBases(scf, &num_bases);
+     bases_offset = get_offset((unsigned char *) (scf->file + 24));
 
      if (scf_version_number < 2.9)
 	  for (i = 0; i < num_bases; i++)
-	       edited_bases[i] = *(gFile + bases_offset + (i * 12) + 8);
+	       edited_bases[i] = *(scf->file + bases_offset + (i * 12) + 8);
      else
      {
 	  bases_offset += (num_bases * 8);
 
 	  for (i = 0; i < num_bases; i++)
-	       edited_bases[i] = *(gFile + bases_offset + i);
+	       edited_bases[i] = *(scf->file + bases_offset + i);
      }
 }
 
-void SCF_PeakLocations(short *edited_locs)
+void SCF_PeakLocations(SCFFile *scf, short *edited_locs)
 {
      long num_bases, i;
      unsigned long bases_offset;
      char scf_version_string[5];
      double scf_version_number;
 
-     SCF_SCFVersion(scf_version_string);
+     SCF_SCFVersion(scf, scf_version_string);
      scf_version_number = atof(scf_version_string);
 
-     SCF_NumBases(&num_bases);
-     bases_offset = get_offset((unsigned char *) (gFile + 24));
+     SCF_NumBases(scf, &num_bases);
+     bases_offset = get_offset((unsigned char *) (scf->file + 24));
 
      if (scf_version_number < 2.9)
 	  for (i = 0; i < num_bases; i++)
 	       edited_locs[i] = (short) get_offset((unsigned char *) 
-					(gFile + bases_offset + (i * 12)));
+					(scf->file + bases_offset + (i * 12)));
      else
 	  for (i = 0; i < num_bases; i++)
 	       edited_locs[i] = (short) get_offset((unsigned char *) 
-					(gFile + bases_offset + (i * 4)));
+					(scf->file + bases_offset + (i * 4)));
 }
 
-void SCF_NumAnalyzedData(long *num_data_points)
+void SCF_NumAnalyzedData(SCFFile *scf, long *num_data_points)
 {
-     *num_data_points = get_offset((unsigned char *) (gFile + 4));
+     *num_data_points = get_offset((unsigned char *) (scf->file + 4));
 }
 
-void SCF_AnalyzedData(short dye, int *analyzed_array)
+void SCF_AnalyzedData(SCFFile *scf, short dye, int *analyzed_array)
 {
      long num_data_points, i;
      unsigned long samples_offset;
@@ -103,25 +105,25 @@ void SCF_AnalyzedData(short dye, int *analyzed_array)
      unsigned char *buf1;
      unsigned short *buf2;
 
-     SCF_SCFVersion(scf_version_string);
+     SCF_SCFVersion(scf, scf_version_string);
      scf_version_number = atof(scf_version_string);
 
-     SCF_NumAnalyzedData(&num_data_points);
+     SCF_NumAnalyzedData(scf, &num_data_points);
 
-     samples_offset = get_offset((unsigned char *) (gFile + 8));
-     sample_size = get_offset((unsigned char *) (gFile + 40));
+     samples_offset = get_offset((unsigned char *) (scf->file + 8));
+     sample_size = get_offset((unsigned char *) (scf->file + 40));
 
      if (scf_version_number < 2.9) {
 	  for (i = 0; i < num_data_points; i++)
 	       if (sample_size == 1)
-		    analyzed_array[i] = *((unsigned char *) gFile + 
+		    analyzed_array[i] = *((unsigned char *) scf->file + 
 					  samples_offset + (i * 4) + dye);
 	       else 
 	       {
-		    analyzed_array[i] = *((unsigned char *) gFile + 
+		    analyzed_array[i] = *((unsigned char *) scf->file + 
 					  samples_offset +
 					  (i * 8) + (dye * 2)) * 256;
-		    analyzed_array[i] += *((unsigned char *) gFile + 
+		    analyzed_array[i] += *((unsigned char *) scf->file + 
 					   samples_offset +
 					   (i * 8) + (dye * 2) + 1);
 	       }
@@ -132,7 +134,7 @@ void SCF_AnalyzedData(short dye, int *analyzed_array)
 	       buf1 = (unsigned char *) malloc(num_data_points * 
 					       sizeof(unsigned char));
 
-	       memcpy(buf1, ((unsigned char *) gFile + 
+	       memcpy(buf1, ((unsigned char *) scf->file + 
 			     samples_offset + (dye * num_data_points)),
 		      num_data_points);
 
@@ -150,10 +152,10 @@ void SCF_AnalyzedData(short dye, int *analyzed_array)
 
 	       for (i = 0; i < num_data_points; i++)
 	       {
-		    buf2[i] = *((unsigned char *) gFile + 
+		    buf2[i] = *((unsigned char *) scf->file + 
 				samples_offset + (dye * num_data_points * 2)
 				+ (i * 2)) * 256;
-		    buf2[i] += *((unsigned char *) gFile + 
+		    buf2[i] += *((unsigned char *) scf->file + 
 				 samples_offset + (dye * num_data_points * 2)
 				 + (i * 2) + 1);
 	       }
@@ -168,6 +170,73 @@ void SCF_AnalyzedData(short dye, int *analyzed_array)
      }
 }
 
+/*
+ * This function reads the traces of all four dyes of an SCF file into the
+ * arrays analyzed_arrays[0..3], in the order A, C, G, T.  Its synopsis is:
+ *
+ * SCF_AllAnalyzedData(scf, analyzed_arrays)
+ *
+ * In version 3 files, each trace is stored contiguously, big-endian and
+ * delta-encoded twice.  The samples are converted to int straight into the
+ * arrays, a pass per trace which compilers vectorize, and then the two
+ * prefix sums are undone in a single pass over the four traces at once,
+ * whose four dependency chains are independent.  The sums are done modulo
+ * the sample size, as in delta_samples1 and delta_samples2.
+ */
+void SCF_AllAnalyzedData(SCFFile *scf, int **analyzed_arrays)
+{
+     long num_data_points, i;
+     unsigned long samples_offset;
+     unsigned long sample_size;
+     unsigned int mask, s1[SCF_NUM_DYES], s2[SCF_NUM_DYES];
+     char scf_version_string[5];
+     const unsigned char *p;
+     int dye;
+
+     SCF_SCFVersion(scf, scf_version_string);
+     if (atof(scf_version_string) < 2.9)
+     {
+	  for (dye = 0; dye < SCF_NUM_DYES; dye++)
+	       SCF_AnalyzedData(scf, (short) dye, analyzed_arrays[dye]);
+	  return;
+     }
+
+     SCF_NumAnalyzedData(scf, &num_data_points);
+     samples_offset = get_offset((unsigned char *) (scf->file + 8));
+     sample_size = get_offset((unsigned char *) (scf->file + 40));
+
+     for (dye = 0; dye < SCF_NUM_DYES; dye++)
+     {
+	  int *a = analyzed_arrays[dye];
+
+	  if (sample_size == 1)
+	  {
+	       p = (unsigned char *) scf->file + samples_offset
+		    + dye * num_data_points;
+	       for (i = 0; i < num_data_points; i++)
+		    a[i] = p[i];
+	  }
+	  else
+	  {
+	       p = (unsigned char *) scf->file + samples_offset
+		    + dye * num_data_points * 2;
+	       for (i = 0; i < num_data_points; i++)
+		    a[i] = (p[2 * i] << 8) | p[2 * i + 1];
+	  }
+     }
+
+     mask = (sample_size == 1) ? 0xff : 0xffff;
+     for (dye = 0; dye < SCF_NUM_DYES; dye++)
+	  s1[dye] = s2[dye] = 0;
+     for (i = 0; i < num_data_points; i++)
+	  for (dye = 0; dye < SCF_NUM_DYES; dye++)
+	  {
+	       s1[dye] += (unsigned int) analyzed_arrays[dye][i];
+	       s2[dye] += s1[dye];
+	       analyzed_arrays[dye][i] = (int) (s2[dye] & mask);
+	  }
+}
+
 void delta_samples1(unsigned char samples[], long num_samples)
 {
      long i;
@@ -208,36 +277,62 @@ void delta_samples2(unsigned short samples[], long num_samples)
      }
 }
 
-void SCF_SCFVersion(char *scf_version_string)
+void SCF_SCFVersion(SCFFile *scf, char *scf_version_string)
 {
      int i;
 
      for (i = 0; i < 4; i++)
-	  scf_version_string[i] = *((char *) gFile + 36 + i);
+	  scf_version_string[i] = *((char *) scf->file + 36 + i);
 
      scf_version_string[4] = '\0';
 }
 
-ABIError SCF_Open(void *file, size_t size)
+/*
+ * This function opens an SCF file held in memory, after checking that the
+ * samples and the bases which its header describes lie within the file,
+ * so that the other functions can read them without further checks.
+ */
+ABIError SCF_Open(SCFFile *scf, void *file, size_t size)
 {
-     ABIError error = kNoError;
-
-     if (gFile != NULL)
-	  error = kFileAlreadyOpen;
-     else
-	  gFile = (char *) file;
-
-     return error;
+     unsigned char *p = (unsigned char *) file;
+     unsigned long num_samples, samples_offset, sample_size;
+     unsigned long num_bases, bases_offset, width;
+
+     if (scf->file != NULL)
+	  return kFileAlreadyOpen;
+     if (size < SCF_HEADER_SIZE)
+	  return kFileError;
+
+     num_samples = get_offset(p + 4);
+     samples_offset = get_offset(p + 8);
+     num_bases = get_offset(p + 12);
+     bases_offset = get_offset(p + 24);
+     sample_size = get_offset(p + 40);
+     width = SCF_NUM_DYES * ((sample_size == 1) ? 1 : 2);
+
+     if ((samples_offset > size)
+	 || (num_samples > (size - samples_offset) / width)
+	 || (bases_offset > size)
+	 || (num_bases > (size - bases_offset) / SCF_BASE_SIZE))
+	  return kFileError;
+
+     scf->file = (char *) file;
+     scf->size = size;
+
+     return kNoError;
 }
 
-ABIError SCF_Close(void *file)
+ABIError SCF_Close(SCFFile *scf, void *file)
 {
      ABIError error = kNoError;
 
-     if (gFile != file)
+     if (scf->file != file)
 	  error = kFileNotOpen;
      else
-	  gFile = NULL;
+     {
+	  scf->file = NULL;
+	  scf->size = 0;
+     }
 
      return error;
 }
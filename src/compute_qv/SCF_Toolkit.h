@@ -23,16 +23,25 @@
  * 2.3 2003/11/06 18:18:45
  */
 
-ABIError SCF_Open(void *, size_t);
-ABIError SCF_Close(void *);
-
-
-void SCF_NumAnalyzedData(long *);
-void SCF_NumBases(long *);
-void SCF_Bases(char *);
-void SCF_PeakLocations(short *);
-void SCF_AnalyzedData(short, int *);
-void SCF_SCFVersion(char *);
+/*
+ * Handle for one open SCF file; see ABIFile in ABI_Toolkit.h.
+ */
+typedef struct {
+    char *file;                /* contents of the file, NULL if not open */
+    size_t size;               /* of the file in bytes */
+} SCFFile;
+
+ABIError SCF_Open(SCFFile *, void *, size_t);
+ABIError SCF_Close(SCFFile *, void *);
+
+
+void SCF_NumAnalyzedData(SCFFile *, long *);
+void SCF_NumBases(SCFFile *, long *);
+void SCF_Bases(SCFFile *, char *);
+void SCF_PeakLocations(SCFFile *, short *);
+void SCF_AnalyzedData(SCFFile *, short, int *);
+void SCF_AllAnalyzedData(SCFFile *, int **);
+void SCF_SCFVersion(SCFFile *, char *);
 
 void delta_samples1(unsigned char *, long);
 void delta_samples2(unsigned short *, long);
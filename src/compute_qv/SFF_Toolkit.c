@@ -32,7 +32,7 @@
 #include "SFF_Toolkit.h"
 #include "util.h"
 
-inline
+static inline
 uint64_t
 uint64Swap(uint64_t x) {
   x = ((x >>  8) & 0x00ff00ff00ff00ffLLU) | ((x <<  8) & 0xff00ff00ff00ff00LLU);
@@ -41,7 +41,7 @@ uint64Swap(uint64_t x) {
   return(x);
 }
 
-inline
+static inline
 uint32_t
 uint32Swap(uint32_t x) {
   x = ((x >>  8) & 0x00ff00ff) | ((x <<  8) & 0xff00ff00);
@@ -49,13 +49,38 @@ uint32Swap(uint32_t x) {
   return(x);
 }
 
-inline
+static inline
 uint16_t
 uint16Swap(uint16_t x) {
   x = ((x >>  8) & 0x000000ff) | ((x <<  8) & 0x0000ff00);
   return(x);
 }
 
+//  Swaps a whole array in place.  The loop has no dependencies between
+//  iterations, so the compiler turns it into vector byte shuffles.
+//
+static
+void
+uint16SwapArray(uint16_t *x, uint32_t n) {
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    x[i] = (uint16_t)((x[i] >> 8) | (x[i] << 8));
+}
+
+static inline
+uint32_t
+getBE16(unsigned char *b) {
+  return(((uint32_t)b[0] << 8) | (uint32_t)b[1]);
+}
+
+static inline
+uint32_t
+getBE32(unsigned char *b) {
+  return(((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+         ((uint32_t)b[2] <<  8) |  (uint32_t)b[3]);
+}
+
 off_t
 TT_ftell(FILE *stream) {
   off_t  pos = 0;
@@ -198,7 +223,6 @@ void
 readsff_read(FILE *sff, sffHeader *h, sffRead *r) 
 {
   int i;
-  unsigned char b[2];
 
   TT_safeRead(sff, r, "readsff_read_1", 16, 1);
 
@@ -214,8 +238,10 @@ readsff_read(FILE *sff, sffHeader *h, sffRead *r)
 
   //  Can you say UGLY?  Hey, it's a lot better than what I originally came up with.
 
+  //  The name is padded to an even length to keep the flowgram aligned.
+  //
   uint32_t ss[6];
-  ss[0] = (r->name_length + 1)          * sizeof(char);
+  ss[0] = (r->name_length + 2) / 2 * 2  * sizeof(char);
   ss[1] = (h->number_of_flows_per_read) * sizeof(uint16_t) + ss[0];
   ss[2] = (r->number_of_bases)          * sizeof(uint8_t)  + ss[1];
   ss[3] = (r->number_of_bases + 1)      * sizeof(char)     + ss[2];
@@ -246,10 +272,11 @@ readsff_read(FILE *sff, sffHeader *h, sffRead *r)
     TT_safeRead(sff, &junk, "readsff_read_3", sizeof(char), padding_length);
   }
 
-  for (i=0; i < h->number_of_flows_per_read; i++) {
-      fread(b, 1, 2, sff);
-      r->flowgram_values[i] = (uint32_t) b[0] * 256 + (uint32_t) b[1];
-  }
+  //  The flowgram is big-endian, like the rest of the file.
+  //
+  TT_safeRead(sff, r->flowgram_values, "readsff_read_4", sizeof(uint16_t), h->number_of_flows_per_read);
+  if (h->swap_endianess)
+    uint16SwapArray(r->flowgram_values, h->number_of_flows_per_read);
 
   TT_safeRead(sff, r->flow_index_per_base, "readsff_read_5", sizeof(uint8_t),  r->number_of_bases);
 
@@ -327,3 +354,112 @@ TT_fseek(FILE *stream, off_t offset, int whence)
     assert(TT_ftell(stream) == offset);
 }
 
+
+static
+int
+compareOffsets(const void *a, const void *b) {
+  uint64_t  x = *(const uint64_t *)a;
+  uint64_t  y = *(const uint64_t *)b;
+
+  return((x < y) ? -1 : (x > y));
+}
+
+//  Reads the read offsets from the index of the file, if it has a Roche
+//  index (".mft", the XML manifest and then the sorted index, or ".srt",
+//  just the sorted index).  Each entry of the sorted index is the read
+//  name, a 0 byte, the offset as 4 base-255 digits, most significant
+//  first, and a 255 byte.  The entries are sorted by name, so the offsets
+//  are sorted back into file order.
+//
+static
+int
+readsff_index_offsets(FILE *sff, sffHeader *h, uint64_t *offsets) {
+  unsigned char *buf, *p, *end;
+  uint32_t       magic, start, n = 0;
+
+  if (h->index_length < 16)
+    return(ERROR);
+
+  buf = CALLOC(unsigned char, h->index_length);
+  if (buf == NULL)
+    return(ERROR);
+
+  TT_fseek(sff, h->index_offset, SEEK_SET);
+  if (TT_safeRead(sff, buf, "readsff_index", sizeof(char), h->index_length) != h->index_length) {
+    FREE(buf);
+    return(ERROR);
+  }
+
+  magic = getBE32(buf);
+  if (magic == MANIFEST_INDEX_MAGIC_NUMBER)
+    start = 16 + getBE32(buf + 8);
+  else if (magic == SORT_INDEX_MAGIC_NUMBER)
+    start = 12;
+  else
+    start = h->index_length;
+
+  for (p = buf + start; (p < buf + h->index_length) && (n < h->number_of_reads); p = end + 1) {
+    end = memchr(p, 0xff, buf + h->index_length - p);
+    if ((end == NULL) || (end - p < 6) || (end[-5] != 0))
+      break;
+    offsets[n++] = (((uint64_t)end[-4] * 255 + end[-3]) * 255 + end[-2]) * 255 + end[-1];
+  }
+  FREE(buf);
+
+  if (n != h->number_of_reads)
+    return(ERROR);
+
+  qsort(offsets, n, sizeof(uint64_t), compareOffsets);
+
+  for (n = 0; n < h->number_of_reads; n++)
+    if ((offsets[n] < h->header_length) ||
+        ((n > 0) && (offsets[n] <= offsets[n-1])))
+      return(ERROR);
+
+  return(SUCCESS);
+}
+
+//  Finds the read offsets by walking the file from read header to read
+//  header.
+//
+static
+int
+readsff_scan_offsets(FILE *sff, sffHeader *h, uint64_t *offsets) {
+  unsigned char  b[16];
+  uint64_t       pos = h->header_length;
+  uint64_t       data_length;
+  uint32_t       i;
+
+  for (i = 0; i < h->number_of_reads; i++) {
+    if ((h->index_length > 0) && (pos == h->index_offset))
+      pos += h->index_length;
+
+    TT_fseek(sff, pos, SEEK_SET);
+    if (TT_safeRead(sff, b, "readsff_scan", sizeof(char), 16) != 16)
+      return(ERROR);
+
+    offsets[i] = pos;
+
+    data_length = (uint64_t)h->number_of_flows_per_read * sizeof(uint16_t) +
+                  (uint64_t)getBE32(b + 4) * 3;
+    pos += getBE16(b) + data_length + (8 - data_length % 8) % 8;
+  }
+
+  return(SUCCESS);
+}
+
+//  Fills offsets[] with the file offset of each of the h->number_of_reads
+//  reads, in file order, so that the reads can be read in any order or by
+//  several threads.  The index is used if the file has one; otherwise the
+//  offsets are found in one pass over the read headers.  The position of
+//  the file is left undefined.
+//
+int
+readsff_read_offsets(FILE *sff, sffHeader *h, uint64_t *offsets) {
+
+  if ((h->index_length > 0) &&
+      (readsff_index_offsets(sff, h, offsets) == SUCCESS))
+    return(SUCCESS);
+
+  return(readsff_scan_offsets(sff, h, offsets));
+}
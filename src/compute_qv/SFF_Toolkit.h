@@ -110,3 +110,6 @@ typedef struct {
 extern void readsff_manifest(FILE *sff, sffHeader *h, sffManifest *m);
 extern int  readsff_header(FILE *sff, sffHeader *h, sffManifest *m);
 extern void readsff_read(FILE *sff, sffHeader *h, sffRead *r);
+extern int  readsff_read_offsets(FILE *sff, sffHeader *h, uint64_t *offsets);
+extern off_t TT_ftell(FILE *stream);
+extern void TT_fseek(FILE *stream, off_t offset, int whence);
@@ -0,0 +1,648 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  ZTR_Toolkit.c
+ *
+ *  Reader for the ZTR trace format (versions 1.1 to 1.3).  A ZTR file is
+ *  a 10 byte header followed by chunks, each of which is
+ *
+ *      4 bytes     chunk type, e.g. "SMP4", "BASE", "BPOS", "CNF4"
+ *      4 bytes     meta-data length (big-endian)
+ *      N bytes     meta-data
+ *      4 bytes     data length (big-endian)
+ *      N bytes     data
+ *
+ *  The first byte of the data gives its format.  Format 0 is raw data;
+ *  any other format decodes to data which again starts with a format
+ *  byte, so that the data of a chunk is decoded until it is raw.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "ABI_Toolkit.h"    /* So ZTR_Toolkit will know what ABIError is. */
+#include "ZTR_Toolkit.h"
+#include "util.h"
+
+extern unsigned long get_offset(unsigned char *);
+
+#define ZTR_HEADER_SIZE     10
+#define ZTR_MAX_FORMATS     16  /* most formats applied to one chunk */
+
+#define ZTR_FORM_RAW         0
+#define ZTR_FORM_RLE         1
+#define ZTR_FORM_ZLIB        2
+#define ZTR_FORM_DELTA1     64
+#define ZTR_FORM_DELTA2     65
+#define ZTR_FORM_DELTA4     66
+#define ZTR_FORM_16TO8      70
+#define ZTR_FORM_32TO8      71
+#define ZTR_FORM_FOLLOW1    72
+
+static const unsigned char ztr_magic[8] =
+    {0xae, 'Z', 'T', 'R', '\r', '\n', 0x1a, '\n'};
+
+static unsigned long
+get_le_offset(unsigned char *p)
+{
+    return (unsigned long)p[0]         | ((unsigned long)p[1] << 8) |
+          ((unsigned long)p[2] << 16)  | ((unsigned long)p[3] << 24);
+}
+
+/*
+ * Run-length encoding.  Bytes 1-4 are the decoded length (little-endian)
+ * and byte 5 is the guard.  The guard followed by a count of 0 is the
+ * guard itself, otherwise the guard, count and value is the value
+ * repeated count times.
+ */
+static ABIError
+ztr_unrle(unsigned char *in, unsigned long in_len,
+          unsigned char **out, unsigned long *out_len)
+{
+    unsigned long i, j, n;
+    unsigned char guard;
+
+    if (in_len < 6)
+        return kBadCompressedData;
+
+    n = get_le_offset(in + 1);
+    guard = in[5];
+    if ((*out = (unsigned char *)malloc(n + 1)) == NULL)
+        return kMemoryFull;
+
+    for (i = 6, j = 0; j < n; )
+    {
+        if (i >= in_len)
+            goto error;
+        if (in[i] != guard)
+        {
+            (*out)[j++] = in[i++];
+        }
+        else if ((i + 1 < in_len) && (in[i + 1] == 0))
+        {
+            (*out)[j++] = guard;
+            i += 2;
+        }
+        else
+        {
+            if ((i + 2 >= in_len) || (in[i + 1] > n - j))
+                goto error;
+            memset(*out + j, in[i + 2], in[i + 1]);
+            j += in[i + 1];
+            i += 3;
+        }
+    }
+   *out_len = n;
+    return kNoError;
+
+error:
+    free(*out);
+    return kBadCompressedData;
+}
+
+/*
+ * zlib compression.  Bytes 1-4 are the decoded length (little-endian),
+ * followed by a zlib stream.
+ */
+static ABIError
+ztr_unzlib(unsigned char *in, unsigned long in_len,
+           unsigned char **out, unsigned long *out_len)
+{
+    uLongf n;
+
+    if (in_len < 5)
+        return kBadCompressedData;
+
+    n = get_le_offset(in + 1);
+    if ((*out = (unsigned char *)malloc(n + 1)) == NULL)
+        return kMemoryFull;
+
+   *out_len = n;
+    if ((uncompress(*out, &n, in + 5, in_len - 5) != Z_OK) || (n != *out_len))
+    {
+        free(*out);
+        return kBadCompressedData;
+    }
+    return kNoError;
+}
+
+/*
+ * Delta encoding of 1, 2 or 4 byte big-endian values.  Byte 1 is the
+ * level, 1 to 3, i.e. how many times the values were differenced; the
+ * values follow from byte 2 (1 and 2 byte values) or byte 4 (4 byte
+ * values).  Each level is undone by a running sum.
+ */
+static ABIError
+ztr_undelta(unsigned char *in, unsigned long in_len, int size,
+            unsigned char **out, unsigned long *out_len)
+{
+    unsigned long i, num_values, start = (size == 4) ? 4 : 2;
+    unsigned long sum, value;
+    unsigned long mask = (size == 4) ? 0xffffffffUL : (1UL << (8 * size)) - 1;
+    unsigned char *p;
+    int level, k, b;
+
+    if ((in_len < start) || ((in_len - start) % size != 0))
+        return kBadCompressedData;
+    level = in[1];
+    if ((level < 1) || (level > 3))
+        return kBadCompressedData;
+
+   *out_len = in_len - start;
+    if ((*out = (unsigned char *)malloc(*out_len + 1)) == NULL)
+        return kMemoryFull;
+    memcpy(*out, in + start, *out_len);
+    num_values = *out_len / size;
+
+    for (k = 0; k < level; k++)
+    {
+        sum = 0;
+        for (i = 0, p = *out; i < num_values; i++, p += size)
+        {
+            for (b = 0, value = 0; b < size; b++)
+                value = (value << 8) | p[b];
+            sum = (sum + value) & mask;
+            for (b = size - 1, value = sum; b >= 0; b--, value >>= 8)
+                p[b] = (unsigned char)(value & 0xff);
+        }
+    }
+    return kNoError;
+}
+
+/*
+ * Shrinking of 2 or 4 byte big-endian values to signed bytes.  A value
+ * which does not fit is stored as -128 followed by the full value.
+ */
+static ABIError
+ztr_expand(unsigned char *in, unsigned long in_len, int size,
+           unsigned char **out, unsigned long *out_len)
+{
+    unsigned long i, j;
+
+    if ((*out = (unsigned char *)malloc((in_len + 1) * size)) == NULL)
+        return kMemoryFull;
+
+    for (i = 1, j = 0; i < in_len; i++)
+    {
+        if (in[i] != 0x80)
+        {
+            memset(*out + j, (in[i] & 0x80) ? 0xff : 0, size - 1);
+            (*out)[j + size - 1] = in[i];
+        }
+        else
+        {
+            if (i + size >= in_len)
+            {
+                free(*out);
+                return kBadCompressedData;
+            }
+            memcpy(*out + j, in + i + 1, size);
+            i += size;
+        }
+        j += size;
+    }
+   *out_len = j;
+    return kNoError;
+}
+
+/*
+ * Prediction of each byte from the one before.  Bytes 1-256 are the
+ * predicted successor of each byte value, byte 257 is the first byte and
+ * each later byte is stored as the prediction minus the byte.
+ */
+static ABIError
+ztr_unfollow1(unsigned char *in, unsigned long in_len,
+              unsigned char **out, unsigned long *out_len)
+{
+    unsigned char *next = in + 1;
+    unsigned long i;
+
+    if (in_len < 258)
+        return kBadCompressedData;
+
+   *out_len = in_len - 257;
+    if ((*out = (unsigned char *)malloc(*out_len + 1)) == NULL)
+        return kMemoryFull;
+
+    (*out)[0] = in[257];
+    for (i = 1; i < *out_len; i++)
+        (*out)[i] = next[(*out)[i - 1]] - in[257 + i];
+    return kNoError;
+}
+
+/*
+ * This function decodes the data of a chunk until it is raw.  Its
+ * synopsis is:
+ *
+ * error = ztr_decode(in, in_len, out, out_len)
+ *
+ * where
+ *      in          is the address of the encoded data
+ *      in_len      is its length
+ *      out         is the address where a pointer to the malloc'ed
+ *                  decoded data will be put; like raw data in the file
+ *                  it starts with the format byte ZTR_FORM_RAW
+ *      out_len     is the address where the length of *out will be put
+ *
+ *      error       is kNoError on success, kBadCompressedData if the data
+ *                  is corrupt or in a format which is not supported
+ */
+static ABIError
+ztr_decode(unsigned char *in, unsigned long in_len,
+           unsigned char **out, unsigned long *out_len)
+{
+    ABIError error = kNoError;
+    unsigned char *data = in, *decoded = NULL;
+    unsigned long  data_len = in_len, decoded_len = 0;
+    int n;
+
+    for (n = 0; (data_len > 0) && (data[0] != ZTR_FORM_RAW); n++)
+    {
+        if (n == ZTR_MAX_FORMATS)
+        {
+            error = kBadCompressedData;
+            break;
+        }
+        switch (data[0])
+        {
+        case ZTR_FORM_RLE:
+            error = ztr_unrle(data, data_len, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_ZLIB:
+            error = ztr_unzlib(data, data_len, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_DELTA1:
+            error = ztr_undelta(data, data_len, 1, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_DELTA2:
+            error = ztr_undelta(data, data_len, 2, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_DELTA4:
+            error = ztr_undelta(data, data_len, 4, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_16TO8:
+            error = ztr_expand(data, data_len, 2, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_32TO8:
+            error = ztr_expand(data, data_len, 4, &decoded, &decoded_len);
+            break;
+        case ZTR_FORM_FOLLOW1:
+            error = ztr_unfollow1(data, data_len, &decoded, &decoded_len);
+            break;
+        default:
+            error = kBadCompressedData;
+            break;
+        }
+        if (error != kNoError)
+            break;
+        if (data != in)
+            free(data);
+        data = decoded;
+        data_len = decoded_len;
+    }
+
+    if (error == kNoError)
+    {
+        if (data_len == 0)
+            error = kDataNotFound;
+        else if (data == in)
+        {
+            if ((data = (unsigned char *)malloc(data_len)) == NULL)
+                return kMemoryFull;
+            memcpy(data, in, data_len);
+        }
+    }
+    if (error != kNoError)
+    {
+        if (data != in)
+            free(data);
+        return error;
+    }
+   *out = data;
+   *out_len = data_len;
+    return kNoError;
+}
+
+/*
+ * Returns the value of the TYPE key of the meta-data of a chunk, or NULL
+ * if it has none.
+ */
+static char *
+ztr_meta_type(unsigned char *meta, unsigned long meta_len)
+{
+    if ((meta_len > 5) && (memcmp(meta, "TYPE", 5) == 0) &&
+        (memchr(meta + 5, '\0', meta_len - 5) != NULL))
+        return (char *)meta + 5;
+    return NULL;
+}
+
+static int
+ztr_channel(char base)
+{
+    const char *p = strchr("ACGT", base);
+
+    return ((base != '\0') && (p != NULL)) ? (int)(p - "ACGT") : -1;
+}
+
+static void
+ztr_release(ZTRFile *ztr)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        free(ztr->trace_data[i]);
+    free(ztr->bases);
+    free(ztr->positions);
+    free(ztr->confidences);
+    free(ztr->text);
+    memset(ztr, 0, sizeof(ZTRFile));
+}
+
+/*
+ * Decodes one chunk into the handle.  Chunks which are not used, and
+ * second copies of those which are, are skipped without being decoded.
+ */
+static ABIError
+ztr_read_chunk(ZTRFile *ztr, unsigned char *type, unsigned char *meta,
+               unsigned long meta_len, unsigned char *data,
+               unsigned long data_len)
+{
+    ABIError error;
+    unsigned char *decoded;
+    unsigned long  len;
+    char *value;
+    int   i, channel = -1;
+
+    if (memcmp(type, "SMP4", 4) == 0)
+    {
+        /* v1.3 files may hold raw traces as well as processed ones */
+        value = ztr_meta_type(meta, meta_len);
+        if ((ztr->trace[0] != NULL) ||
+            ((value != NULL) && (strcmp(value, "PROC") != 0)))
+            return kNoError;
+    }
+    else if (memcmp(type, "SAMP", 4) == 0)
+    {
+        value = ztr_meta_type(meta, meta_len);
+        if (value == NULL)
+            value = (meta_len > 0) ? (char *)meta : "";
+        if (((channel = ztr_channel(value[0])) < 0) ||
+            (ztr->trace[channel] != NULL))
+            return kNoError;
+    }
+    else if (((memcmp(type, "BASE", 4) != 0) || (ztr->bases != NULL)) &&
+             ((memcmp(type, "BPOS", 4) != 0) || (ztr->positions != NULL)) &&
+             ((memcmp(type, "CNF4", 4) != 0) || (ztr->confidences != NULL)) &&
+             ((memcmp(type, "CNF1", 4) != 0) || (ztr->confidences != NULL)) &&
+             ((memcmp(type, "TEXT", 4) != 0) || (ztr->text != NULL)))
+    {
+        return kNoError;
+    }
+
+    if ((error = ztr_decode(data, data_len, &decoded, &len)) != kNoError)
+        return error;
+    if (((channel >= 0) || (memcmp(type, "SMP4", 4) == 0)) && (len < 2))
+    {
+        free(decoded);
+        return kBadCompressedData;
+    }
+
+    if (memcmp(type, "SMP4", 4) == 0)
+    {
+        /* format byte and a padding byte, then A, C, G and T in turn */
+        ztr->num_samples = (len - 2) / 8;
+        ztr->trace_data[0] = decoded;
+        for (i = 0; i < 4; i++)
+            ztr->trace[i] = decoded + 2 + i * 2 * ztr->num_samples;
+    }
+    else if (channel >= 0)
+    {
+        if ((ztr->trace[0] == NULL && ztr->trace[1] == NULL &&
+             ztr->trace[2] == NULL && ztr->trace[3] == NULL) ||
+            ((long)((len - 2) / 2) < ztr->num_samples))
+            ztr->num_samples = (len - 2) / 2;
+        ztr->trace_data[channel] = decoded;
+        ztr->trace[channel] = decoded + 2;
+    }
+    else if (memcmp(type, "BASE", 4) == 0)
+    {
+        ztr->bases = decoded;
+        ztr->num_bases = len - 1;
+    }
+    else if (memcmp(type, "BPOS", 4) == 0)
+    {
+        ztr->positions = decoded;
+        ztr->num_positions = (len < 4) ? 0 : (len - 4) / 4;
+    }
+    else if (memcmp(type, "CNF4", 4) == 0)
+    {
+        ztr->confidences = decoded;
+        ztr->num_confidences = (len - 1) / 4;
+    }
+    else if (memcmp(type, "CNF1", 4) == 0)
+    {
+        ztr->confidences = decoded;
+        ztr->num_confidences = len - 1;
+    }
+    else
+    {
+        ztr->text = decoded;
+        ztr->text_size = len;
+    }
+    return kNoError;
+}
+
+/*
+ * This function opens a ZTR file which has been read into memory and
+ * decodes the chunks holding the traces, bases, peak locations,
+ * confidences and text.  Its synopsis is:
+ *
+ * error = ZTR_Open(ztr, file, size)
+ *
+ * where
+ *      ztr         is the address of the handle, which must not be open
+ *      file        is the address of the contents of the file
+ *      size        is the size of the file in bytes
+ *
+ *      error       is kNoError on success
+ */
+ABIError ZTR_Open(ZTRFile *ztr, void *file, size_t size)
+{
+    ABIError error = kNoError;
+    unsigned char *p = (unsigned char *)file;
+    unsigned char *type, *meta;
+    unsigned long  pos, meta_len, data_len;
+
+    if (ztr->file != NULL)
+        return kFileAlreadyOpen;
+    if ((size < ZTR_HEADER_SIZE) || (memcmp(p, ztr_magic, 8) != 0))
+        return kWrongFileType;
+
+    memset(ztr, 0, sizeof(ZTRFile));
+    for (pos = ZTR_HEADER_SIZE; (error == kNoError) && (pos < size); )
+    {
+        if (size - pos < 8)
+            break;
+        type = p + pos;
+        meta_len = get_offset(p + pos + 4);
+        pos += 8;
+        if ((meta_len > size - pos) || (size - pos - meta_len < 4))
+            break;
+        meta = p + pos;
+        pos += meta_len;
+        data_len = get_offset(p + pos);
+        pos += 4;
+        if (data_len > size - pos)
+            break;
+        error = ztr_read_chunk(ztr, type, meta, meta_len, p + pos, data_len);
+        pos += data_len;
+    }
+    if ((error == kNoError) && (pos < size))
+        error = kBadCompressedData;     /* truncated chunk */
+
+    if (error != kNoError)
+    {
+        ztr_release(ztr);
+        return error;
+    }
+    ztr->file = (char *)file;
+    return kNoError;
+}
+
+ABIError ZTR_Close(ZTRFile *ztr, void *file)
+{
+    if (ztr->file != file)
+        return kFileNotOpen;
+    ztr_release(ztr);
+    return kNoError;
+}
+
+ABIError ZTR_NumAnalyzedData(ZTRFile *ztr, long *num_data_points)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+        if (ztr->trace[i] == NULL)
+            return kDataNotFound;
+   *num_data_points = ztr->num_samples;
+    return kNoError;
+}
+
+/*
+ * Reads the trace of dye 0-3, i.e. of A, C, G or T.
+ */
+ABIError ZTR_AnalyzedData(ZTRFile *ztr, short dye, int *analyzed_array)
+{
+    unsigned char *p;
+    long i;
+
+    if ((dye < 0) || (dye > 3) || ((p = ztr->trace[dye]) == NULL))
+        return kDataNotFound;
+    for (i = 0; i < ztr->num_samples; i++, p += 2)
+        analyzed_array[i] = (p[0] << 8) | p[1];
+    return kNoError;
+}
+
+ABIError ZTR_NumBases(ZTRFile *ztr, long *num_bases)
+{
+    if (ztr->bases == NULL)
+        return kDataNotFound;
+   *num_bases = ztr->num_bases;
+    return kNoError;
+}
+
+ABIError ZTR_Bases(ZTRFile *ztr, char *bases)
+{
+    if (ztr->bases == NULL)
+        return kDataNotFound;
+    memcpy(bases, ztr->bases + 1, ztr->num_bases);
+    return kNoError;
+}
+
+ABIError ZTR_PeakLocations(ZTRFile *ztr, int *locs)
+{
+    long i;
+
+    if ((ztr->positions == NULL) || (ztr->num_positions < ztr->num_bases))
+        return kDataNotFound;
+    for (i = 0; i < ztr->num_bases; i++)
+        locs[i] = (int)get_offset(ztr->positions + 4 + i * 4);
+    return kNoError;
+}
+
+/*
+ * Reads the confidence of each called base; negative confidences are
+ * read as 0.
+ */
+ABIError ZTR_QualityValues(ZTRFile *ztr, unsigned char *quality_values)
+{
+    long i;
+
+    if ((ztr->confidences == NULL) || (ztr->num_confidences < ztr->num_bases))
+        return kDataNotFound;
+    for (i = 0; i < ztr->num_bases; i++)
+        quality_values[i] = ((signed char)ztr->confidences[1 + i] < 0) ?
+            0 : ztr->confidences[1 + i];
+    return kNoError;
+}
+
+/*
+ * This function reads the value of one identifier of the TEXT chunk, e.g.
+ * "DYEP" for the dye primer (mobility) file.  Its synopsis is:
+ *
+ * error = ZTR_TextValue(ztr, ident, buffer_size, value, data_size)
+ *
+ * where
+ *      value       is the buffer of buffer_size bytes to copy the value to
+ *      data_size   is the address where the length of the value, which is
+ *                  truncated to buffer_size - 1 bytes, will be put
+ */
+ABIError ZTR_TextValue(ZTRFile *ztr, char *ident, long buffer_size,
+                       char *value, long *data_size)
+{
+    char *p, *end;
+    long  n;
+
+    if (ztr->text == NULL)
+        return kDataNotFound;
+
+    p = (char *)ztr->text + 1;
+    end = (char *)ztr->text + ztr->text_size;
+    while ((p < end) && (*p != '\0'))
+    {
+        n = strnlen(p, end - p);
+        if (p + n + 1 >= end)
+            break;
+        if (strcmp(p, ident) == 0)
+        {
+            p += n + 1;
+            n = strnlen(p, end - p);
+            if (n > buffer_size - 1)
+                n = buffer_size - 1;
+            memcpy(value, p, n);
+           *data_size = n;
+            return kNoError;
+        }
+        p += n + 1;
+        p += strnlen(p, end - p) + 1;
+    }
+    return kDataNotFound;
+}
@@ -0,0 +1,53 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  ZTR_Toolkit.h
+ */
+
+/*
+ * Handle for one open ZTR file; see ABIFile in ABI_Toolkit.h.  The chunks
+ * which are used are decoded by ZTR_Open, and the decoded data is kept in
+ * the raw ZTR layout (leading format byte and padding included).
+ */
+typedef struct {
+    char          *file;            /* contents of the file, NULL if not open */
+    unsigned char *trace[4];        /* 16-bit big-endian A, C, G, T samples */
+    unsigned char *trace_data[4];   /* decoded SMP4/SAMP chunks owning trace */
+    long           num_samples;     /* number of samples in each trace */
+    unsigned char *bases;           /* decoded BASE chunk */
+    long           num_bases;
+    unsigned char *positions;       /* decoded BPOS chunk */
+    long           num_positions;
+    unsigned char *confidences;     /* decoded CNF4 or CNF1 chunk */
+    long           num_confidences; /* number of called base confidences */
+    unsigned char *text;            /* decoded TEXT chunk */
+    long           text_size;
+} ZTRFile;
+
+ABIError ZTR_Open(ZTRFile *, void *, size_t);
+ABIError ZTR_Close(ZTRFile *, void *);
+
+ABIError ZTR_NumAnalyzedData(ZTRFile *, long *);
+ABIError ZTR_AnalyzedData(ZTRFile *, short, int *);
+ABIError ZTR_NumBases(ZTRFile *, long *);
+ABIError ZTR_Bases(ZTRFile *, char *);
+ABIError ZTR_PeakLocations(ZTRFile *, int *);
+ABIError ZTR_QualityValues(ZTRFile *, unsigned char *);
+ABIError ZTR_TextValue(ZTRFile *, char *, long, char *, long *);
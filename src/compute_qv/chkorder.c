@@ -113,6 +113,7 @@ callbases(
 {
     int *tmpvals[4], r, basesdiff, i;
     Results results;
+    BtkReadContext context;
 
     /* set up the trace arrays */
     switch(colororder[0]) {
@@ -193,9 +194,10 @@ callbases(
 
     (void)fprintf(stderr, "%s.%s: ", filename, colororder);
     (void)fflush(stderr);
+    Btk_init_read_context(&context);
     if ((r = Btk_compute_qv(callednbases, calledbases, calledlocations, &nvals,
-			    tmpvals, colororder, table, qv, options, msg,
-             &results))
+			    tmpvals, colororder, table, qv, options, &context,
+             msg, &results))
 	!= 0)
     {
 	(void)fprintf(stderr, "%s\n", msg->text);
@@ -237,7 +239,8 @@ main(int argc, char *argv[])
     int i, n;
     char *lookup_table, *smp, *smptail;
     BtkLookupTable *table;
-    char *chemistry = "", status_code[100];
+    char *chemistry = "";
+    BtkReadContext context;
     int nvals, *vals[4], filetype = -1;
     uint8_t *quality_values = NULL;
     BtkMessage  msg;
@@ -346,9 +349,10 @@ main(int argc, char *argv[])
         options.file_name[0]   = '\0';
         options.lut_type       = ABI3730pop7;
 
+        Btk_init_read_context(&context);
         if (Btk_read_sample_file(smp, &orignbases, &origbases, 0,
 		    &origlocations, &quality_values, &nvals, &vals[0], &vals[1],
-		    &vals[2], &vals[3], NULL, &chemistry, status_code, &filetype, 
+		    &vals[2], &vals[3], NULL, &chemistry, &context, &filetype, 
                     options, &msg)
 	    != 0)
         {
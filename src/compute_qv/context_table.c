@@ -30,12 +30,14 @@
 #include <float.h>
 
 #include "Btk_qv.h"
+#include "util.h"
 #include "Btk_atod.h"
 #include "context_table.h"
 
 #define CONTEXT_DEBUG 0
 #define MAXLINE       (1000)
 #define CHUNK         (1000)
+#define MAX_CACHED_CONTEXTS (1 << 20) /* 15^5; the cache takes 8 bytes each */
 
 #if 0
 #define CONTEXT_DRIVER 1  /* or -DCONTEXT_DRIVER in Makefile */
@@ -783,6 +785,12 @@ NucleicAcidCode NucleicAcidCode_to_ACGT[256];
 
 static int  ACGT_to_int[256];
 
+/* The codes of a context in the cache of a table, and their numbers */
+static const char IUB_codes[] = "ACGTRYKMSWBDHVN";
+#define NUM_IUB_CODES ((int)sizeof(IUB_codes) - 1)
+
+static int  IUB_to_int[256];
+
 
 /*******************************************************************************
  * Initialize the global variable "ACGT_to_int"
@@ -808,6 +816,23 @@ set_ACGT_to_int(void)
 }
 
 
+/*******************************************************************************
+ * Initialize the global variable "IUB_to_int"
+ ******************************************************************************/
+
+static void 
+set_IUB_to_int(void)
+{
+    int i;
+    for( i=0; i<256; i++ ) {
+        IUB_to_int[i] = -1;
+    }
+    for( i=0; i<NUM_IUB_CODES; i++ ) {
+        IUB_to_int[(int)IUB_codes[i]] = i;
+    }
+}
+
+
 
 /*******************************************************************************
  * Initialize the global variable "NucleicAcidCode_to_ACGT"
@@ -1046,37 +1071,28 @@ contextIterIncrement( ContextIter* ci )
 }
 
 /*******************************************************************************
- * Weight_from_reverse_context()
- * Inputs:
- *     base_code[0]   = current base
- *     base_code[1]   = previous base
- *          .
- *        (etc.)
- *          .
- *     base_code[n-1] = "oldest" base
- * where "base" may be any one of: A,C,G,T, R,Y,K,M,S,W, B,D,H,V, N
+ * Average of the weights of all the ACGT contexts which a context of IUB
+ * codes stands for.  Missing entries of the table count as 1.0, and their
+ * number is put in *num_missing.
  ******************************************************************************/
-double 
-weight_from_reverse_context( const char base_code[], ContextTable *ctable )
+static double 
+average_weight( const char base_code[], ContextTable *ctable, 
+                int *num_missing )
 {
-    static int initialized = 0;
-    static Hcube hcube;
+    Hcube hcube;
     int dim = ctable->dimension;
     const int max_dim = 32; /* should be OK; 4^32 is a big number!! */
     typedef double EntryType;
     double sum;
 
-    if( !initialized ) {
-        /* initialize global variables */
-        set_ACGT_to_int();
-        set_NucleicAcidCode_to_ACGT();
-
-        /* Initialize static variables */
-        HCUBE_INIT( &hcube, EntryType, 4 /* 4 bases: ACGT */, dim, 
-            ctable->weights );
-        assert( hcubeNumDim( &hcube ) <= max_dim );
-        initialized = 1;
-    }
+    /* The hypercube only wraps the table's weights, so it is cheap to
+     * set up on every call; the global code tables have been initialized
+     * by read_context_table()
+     */
+    HCUBE_INIT( &hcube, EntryType, 4 /* 4 bases: ACGT */, dim, 
+        ctable->weights );
+    assert( hcubeNumDim( &hcube ) <= max_dim );
+    *num_missing = 0;
     {
         int count = 0;
         ContextIter ci;
@@ -1091,9 +1107,7 @@ weight_from_reverse_context( const char base_code[], ContextTable *ctable )
             double val = *(EntryType*)hcubeRef( &hcube, i_indices );
             if( val < 0 ) {
                 val = 1.0;
-                fprintf( stderr, 
-            "Missing entry in context table (assume 1.0 for now)\n"
-            "Better Solution: More training data or smaller context length\n" );
+                (*num_missing)++;
             }
                 sum += val;
                 count++;
@@ -1108,6 +1122,137 @@ weight_from_reverse_context( const char base_code[], ContextTable *ctable )
 }
 
 
+/*******************************************************************************
+ * Add the weights of the ACGT contexts which base_code[d..dim-1] stands for,
+ * after those of base_code[0..d-1] at the specified offset, to *sum.  This
+ * is average_weight() without the iterator: the weights are added in the
+ * same order, so that the sums are the same to the last bit.
+ ******************************************************************************/
+static void
+sum_weights( const char base_code[], int d, int dim, const double *weights,
+             long offset, double *sum, int *count, int *num_missing )
+{
+    NucleicAcidCode *nac = &NucleicAcidCode_to_ACGT[(int)base_code[d]];
+    int j;
+
+    for( j=0; j<nac->num; j++ ) {
+        long o = offset*4 + ACGT_to_int[(int)nac->map[j]];
+        if( d < dim-1 ) {
+            sum_weights( base_code, d+1, dim, weights, o, sum, count,
+                num_missing );
+        }
+        else {
+            double val = weights[o];
+            if( val < 0 ) {
+                val = 1.0;
+                (*num_missing)++;
+            }
+            *sum += val;
+            (*count)++;
+        }
+    }
+}
+
+
+/*******************************************************************************
+ * Fill in the cache of a table with the weight of every context of IUB
+ * codes, unless there are more than MAX_CACHED_CONTEXTS of them.  The
+ * contexts are numbered like the elements of a hypercube with NUM_IUB_CODES
+ * elements along each dimension, in the order of IUB_codes.
+ * Returns SUCCESS, or ERROR if out of memory.
+ ******************************************************************************/
+static int
+build_context_cache( ContextTable *ctable )
+{
+    HcubeIter hci;
+    int d, dim = ctable->dimension, count, num_missing;
+    long c, num_contexts = 1;
+    double sum;
+    char context[32];
+
+    for( d=0; d<dim; d++ ) {
+        if( num_contexts > MAX_CACHED_CONTEXTS/NUM_IUB_CODES ) {
+            return SUCCESS;
+        }
+        num_contexts *= NUM_IUB_CODES;
+    }
+    if( (ctable->cache = CALLOC(double, num_contexts)) == NULL ) {
+        return ERROR;
+    }
+
+    hcubeIterInitElemDim( &hci, NUM_IUB_CODES, dim );
+    c = 0;
+    do {
+        for( d=0; d<dim; d++ ) {
+            context[d] = IUB_codes[hcubeIterIndices(&hci)[d]];
+        }
+        sum = 0.0;
+        count = num_missing = 0;
+        sum_weights( context, 0, dim, ctable->weights, 0, &sum, &count,
+            &num_missing );
+        ctable->cache[c] = sum / count;
+        if( (num_missing > 0) && (ctable->num_missing == NULL) &&
+            ((ctable->num_missing = CALLOC(unsigned short, num_contexts))
+             == NULL) )
+        {
+            FREE(ctable->cache);
+            return ERROR;
+        }
+        if( num_missing > 0 ) {
+            ctable->num_missing[c] = (unsigned short)num_missing;
+        }
+        c++;
+    } while( hcubeIterIncrement(&hci) );
+
+    return SUCCESS;
+}
+
+
+/*******************************************************************************
+ * Weight_from_reverse_context()
+ * Inputs:
+ *     base_code[0]   = current base
+ *     base_code[1]   = previous base
+ *          .
+ *        (etc.)
+ *          .
+ *     base_code[n-1] = "oldest" base
+ * where "base" may be any one of: A,C,G,T, R,Y,K,M,S,W, B,D,H,V, N
+ ******************************************************************************/
+double 
+weight_from_reverse_context( const char base_code[], ContextTable *ctable )
+{
+    int d, dim = ctable->dimension, num_missing = 0;
+    long c = 0;
+    double weight;
+
+    /* Look the context up in the cache, if it has one of IUB codes only */
+    for( d=0; (ctable->cache != NULL) && (d<dim); d++ ) {
+        int code = IUB_to_int[(unsigned char)base_code[d]];
+        if( code < 0 ) {
+            break;
+        }
+        c = c*NUM_IUB_CODES + code;
+    }
+    if( (ctable->cache != NULL) && (d == dim) ) {
+        weight = ctable->cache[c];
+        if( ctable->num_missing != NULL ) {
+            num_missing = ctable->num_missing[c];
+        }
+    }
+    else {
+        weight = average_weight( base_code, ctable, &num_missing );
+    }
+
+    for( ; num_missing > 0; num_missing-- ) {
+        fprintf( stderr, 
+            "Missing entry in context table (assume 1.0 for now)\n"
+            "Better Solution: More training data or smaller context length\n" );
+    }
+    return weight;
+}
+
+
 /*******************************************************************************
  * Weight_from_context()
  * Inputs:
@@ -1145,6 +1290,8 @@ weight_from_context( const char base_code[], ContextTable *ctable )
  *
  * If this function returns a table, then the caller should free up the
  * resources (when through with it) by calling destroy_context_table().
+ * The weights of the contexts of IUB codes are averaged here once, so that
+ * weight_from_context() only looks them up.
  * 
  * Each line in the ctable should consist of 16 float numbers
  ******************************************************************************/
@@ -1215,6 +1362,19 @@ read_context_table(char *path)
     }
     ctable->dimension = j;
 
+    /* initialize global variables used when looking up the weights */
+    set_ACGT_to_int();
+    set_NucleicAcidCode_to_ACGT();
+    set_IUB_to_int();
+
+    /* so that the weight of any context is found in one lookup */
+    if (build_context_cache(ctable) != SUCCESS) {
+        fprintf(stderr, "Out of memory caching the context table\n");
+        FREE(ctable->weights);
+        FREE(ctable);
+        return(NULL);
+    }
+
     return(ctable);
 
 error_return:
@@ -1242,5 +1402,8 @@ destroy_context_table(ContextTable *ctable)
     if (ctable == NULL) {
         return;
     }
+    FREE(ctable->num_missing);
+    FREE(ctable->cache);
     FREE(ctable->weights);
+    FREE(ctable);
 }
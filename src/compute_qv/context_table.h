@@ -29,6 +29,10 @@
 typedef struct _context_table {
         int     dimension;
         double *weights;
+        double *cache;          /* weight of every context of IUB codes,
+                                 * if there are not too many */
+        unsigned short *num_missing; /* missing entries averaged into each
+                                 * weight of the cache, if any */
 }  ContextTable;  
 
 extern double         weight_from_reverse_context( const char *, ContextTable * );
@@ -50,7 +50,7 @@ main(int argc, char *argv[])
     BtkLookupTable *table;
     int nbases, nvals, filetype = -1;
     char *bases, *chemistry = "";
-    char status_code[100];
+    BtkReadContext context;
     int *locations, *vals[4]; 
     uint8_t *qv = NULL;
 
@@ -117,9 +117,10 @@ main(int argc, char *argv[])
         options.lut_type       = ABI3730pop7;
        
       
+        Btk_init_read_context(&context);
         if (Btk_read_sample_file(smp, &nbases, &bases, 0, &locations, 
             &qv, &nvals, &vals[0], &vals[1], &vals[2], &vals[3],
-            NULL, &chemistry, status_code, &filetype, options, &msg) != 0) 
+            NULL, &chemistry, &context, &filetype, options, &msg) != 0) 
         {
             fprintf(stderr, "%s: couldn't read sample file\n", smptail);
             continue;
@@ -150,7 +151,8 @@ main(int argc, char *argv[])
         }
 
         if ( Btk_compute_qv(&nbases, &bases, &locations, &nvals, vals, 
-                     "ACGT", table, &qv, options, &msg, &results) != 0) {
+                     "ACGT", table, &qv, options, &context, &msg,
+                     &results) != 0) {
             fprintf(stderr, "%s: %s\n", smptail, msg.text);
             goto cleanup_a_file;
         }
@@ -42,20 +42,32 @@
 #else
 #include <dirent.h>
 #endif
+#ifndef __WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <float.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
 
 #include "Btk_qv.h"
 #include "util.h"
 #include "Btk_qv_data.h"
 #include "Btk_lookup_table.h"
 #include "context_table.h"
+#include "Btk_table_registry.h"
 #include "train.h"
 #include "Btk_compute_qv.h"
 #include "Btk_match_data.h"
 #include "Btk_qv_io.h"
+#include "Btk_archive.h"
+#include "Btk_columns.h"
 #include "Btk_default_table.h"
 #include "Btk_process_raw_data.h"
 #include "SFF_Toolkit.h"
@@ -66,6 +78,7 @@
 #define MAX_NAME_LEN 1000
 #define MAX_LENGTH_FLOWGRAM 10000
 #define SUP(a) (((a)>0) ? (1) : (0))
+#define FILE_LIST_CHUNK 1000
 typedef enum {
     TEXT_MODE = 0,FASTA_MODE, QUAL_MODE, FLOWGRAM_MODE, MANIFEST_MODE, 
     ACCNO_MODE, PHD_MODE 
@@ -77,6 +90,9 @@ static int Verbose;	/* Whether and how much status info to print */
 static char InputName[BUFLEN];	/* path of dir or file-of-files */
 static int InputType;
 
+static int Serve;               /* whether to run as a service */
+static char ServeName[BUFLEN];  /* path of socket, or "-" for stdin */
+
 static int ConsensusSpecified;		/* whether consensus is specified */
 static char ConsensusName[BUFLEN];	/* path of consensus file */
 
@@ -97,11 +113,10 @@ static char multifastqFileName[BUFLEN];
 static char multiqualFileName[BUFLEN];
 static char multilocsFileName[BUFLEN];
 static char multistatFileName[BUFLEN];
-static char status_code[BUFLEN];
 
 static int dev = 0;
 static int opts = 0;
-static int file_type = -1;
+static TT_THREAD_LOCAL int file_type = -1;
 
 static int OutputSCF;		/* whether to write Staden SCF files */
 static char SCFDirName[BUFLEN];
@@ -133,7 +148,6 @@ static int trim_window = 10;      /* width of trimming window */
 static float trim_threshold = 20; /* when average of trim window goes above
                                    * this, trimming stops 
                                    */
-static int left_trim_point, right_trim_point;
 
 /* Any sequence whose score >= RepeatFraction*HighScore is considered a repeat*/
 static double RepeatFraction;
@@ -144,6 +158,76 @@ static int MisMatch;
 static int Insertion;
 static int Deletion;
 
+/* Consensus contigs, lookup tables and scoring matrices of the .tal
+ * alignments, built once per run from the -C consensus
+ */
+static BtkTalIndex TalIndex;
+
+/* Selection of the -id and -if inputs for a shard (-shard K/N) of a run
+ * spread over several nodes, and merging of the per-shard results (-merge)
+ */
+static int ShardIndex;          /* K, from 1 to NumShards */
+static int NumShards;           /* N, 0 if the run is not sharded */
+static int Merge;
+static char MergeDirName[BUFLEN];
+
+/* Journal of the sample files completed by the -id and -if drivers,
+ * used to skip them when a run is resumed (-resume)
+ */
+static char JournalName[BUFLEN];
+static FILE *Journal;
+static int Resume;
+static uint64_t OptionsHash;    /* hash of the options affecting output */
+static uint64_t *Journaled;     /* sorted hashes of the journaled files */
+static int NumJournaled;
+
+/* Archive which receives the per-read output files (-archive) */
+static char ArchiveName[BUFLEN];
+
+/* Columnar binary file of the per-base results of the run (-bin) */
+static char ColumnsName[BUFLEN];
+
+/* Multi-threaded processing of the -id and -if inputs */
+static int NumThreads;          /* number of worker threads */
+static int PrefetchDepth;       /* files read ahead of the workers */
+
+typedef struct {
+    char          **paths;      /* sample files, in input order */
+    uint64_t       *hashes;     /* their journal hashes */
+    int             num_paths;
+    int             next_path;  /* index of the next file to be processed */
+    BtkLookupTable *table;
+    ContextTable   *ctable;
+    char           *ConsensusName;
+    char           *ConsensusSeq;
+    Options        *options;
+    pthread_mutex_t lock;       /* protects next_path */
+    pthread_cond_t  path_taken; /* signalled when next_path changes */
+} FileList;
+
+static pthread_mutex_t OutputLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  OutputTurnChanged = PTHREAD_COND_INITIALIZER;
+static int OutputTurn;          /* index of the file allowed to write output */
+static TT_THREAD_LOCAL int CurrentFile = -1;
+static TT_THREAD_LOCAL int HaveOutputTurn;
+
+/* Multi-threaded processing of the reads of one SFF file */
+#define SFF_READS_PER_BLOCK 256
+#define SFF_NOT_LOCATED     1   /* the reads couldn't be located */
+
+typedef struct {
+    char           *path;       /* SFF file */
+    sffHeader      *h;
+    uint64_t       *offsets;    /* file offset of each read */
+    int             num_blocks; /* blocks of SFF_READS_PER_BLOCK reads */
+    int             next_block; /* index of the next block to be processed */
+    int             next_output;/* index of the next block to be written */
+    int             num_failed; /* reads which couldn't be read */
+    Options        *options;
+    pthread_mutex_t lock;       /* protects the above indexes and count */
+    pthread_cond_t  output_changed;
+} SffBlockList;
+
 clock_t start_clock, curr_clock;
 
 static void
@@ -163,9 +247,14 @@ usage(int argc, char *argv[])
     "    [ -q   | -qd   <dir> ][ -f | -fd <dir> ][ -c   | -cd   <dir> ]\n" 
     "    [ -tab | -tabd <dir> ][ -d | -dd <dir> ][ -qr         <file> ]\n"
     "    [ -hpr | -hprd <dir> ][ -sa     <file> ][ -qa     <file> ]\n"
-    "    [ -fa         <file> ][ -o       <dir> ]\n"
-    "    { <sample_file(s)>    | -id     <dir>  | -if  <fileoffiles> }\n"
-             , TT_VERSION, argv[0] );
+    "    [ -fa         <file> ][ -o       <dir> ][ -threads <num> ]\n"
+    "    [ -prefetch     <num> ][ -shard       K/N ][ -share_tables ]\n"
+    "    [ -journal     <file> ][ -resume ]\n"
+    "    [ -archive     <file> ][ -bin     <file> ]\n"
+    "    { <sample_file(s)>    | -id     <dir>  | -if  <fileoffiles> |\n"
+    "      -serve <socket> | -serve - }\n"
+    "usage: %s [ -if <fileoffiles> ] -merge <dir> <shard_dir(s)>\n"
+             , TT_VERSION, argv[0], argv[0] );
 }
 
 static void
@@ -189,9 +278,14 @@ usage_dev(int argc, char *argv[])
     "    [ -tal | -tald <dir> ] [ -d | -dd <dir> ] [ -qr         <file> ]\n"
     "    [ -tab | -tabd <dir> ] [ -ipd     <dir> ] [ -hpr | -hprd <dir> ]\n"
     "    [ -sa         <file> ] [ -qa     <file> ] [ -fa         <file> ]\n"
-    "    [ -o           <dir> ]\n"
-    "    { <sample_file(s)>   | -id     <dir>    | -if  <fileoffiles> }\n"
-             , TT_VERSION, argv[0] );
+    "    [ -o           <dir> ] [ -threads <num> ] [ -shard K/N ]\n"
+    "    [ -prefetch     <num> ] [ -share_tables ]\n"
+    "    [ -journal    <file> ] [ -resume ] [ -archive <file> ]\n"
+    "    [ -bin        <file> ]\n"
+    "    { <sample_file(s)>   | -id     <dir>    | -if  <fileoffiles> |\n"
+    "      -serve <socket> | -serve - }\n"
+    "usage: %s [ -if <fileoffiles> ] -merge <dir> <shard_dir(s)>\n"
+             , TT_VERSION, argv[0], argv[0] );
 }
 
 static void
@@ -222,7 +316,9 @@ help_message(int argc, char *argv[])
 "                         the default (automatic choice of the lookup table)\n"
 "                         as well as the options -3700pop5, -3700pop6, -3100,\n"
 "                         and -mbace. To get a message showing \n"
-"                         which table was used, specify -V option\n"
+"                         which table was used, specify -V option.\n"
+"                         The table may be a text table written by lut or\n"
+"                         a binary table converted from it by lutbin\n"
 "    -indel_detect        (For Sanger data only) Detect heterozygous indels\n"
 "                         and report their location, size and string to stderr\n"
 "    -indel_resolve       (For Sanger data only) Detect heterozygous indels\n"
@@ -272,6 +368,54 @@ help_message(int argc, char *argv[])
 "    -if <file>           Read the input sample filenames from the specified\n"
 "                         file\n"
 "    -id <dir>            Read the input sample files from specified directory\n"
+"    -threads <num>       Process the sample files read with -id or -if\n"
+"                         using <num> worker threads. The output is the same\n"
+"                         as for a single-threaded run. The default is 1\n"
+"    -prefetch <num>      Read up to <num> of the sample files read with -id\n"
+"                         or -if ahead of those being processed, in the\n"
+"                         background, to hide the latency of slow or remote\n"
+"                         file systems. The default is 0, i.e. no read-ahead\n"
+"    -shard K/N           Process only the K-th of N disjoint subsets of the\n"
+"                         sample files read with -id or -if. The files are\n"
+"                         assigned to the subsets by a hash of their names,\n"
+"                         so that N runs on separate nodes process each file\n"
+"                         exactly once. Each run should write its results\n"
+"                         with -o <shard_dir> and -qr <shard_dir>/tt.qr\n"
+"    -share_tables        Share the lookup tables with the other ttuner\n"
+"                         processes of this host run with -share_tables, in\n"
+"                         shared memory, rather than load them in each one.\n"
+"                         The tables stay in /dev/shm/ttuner-* until removed\n"
+"    -merge <dir>         Merge the tt.seq, tt.qual, tt.pos, tt.status and\n"
+"                         tt.qr files of the specified shard directories into\n"
+"                         <dir>. The reads are ordered as in the -if file,\n"
+"                         if specified, and by name otherwise\n"
+"    -journal <file>      Append a record of each sample file read with -id or\n"
+"                         -if to <file> as soon as it has been processed\n"
+"                         successfully\n"
+"    -resume              Skip the sample files which the journal records as\n"
+"                         processed with the same options, and append to the\n"
+"                         multi-FASTA files of -o instead of replacing them,\n"
+"                         after discarding the output of the files which it\n"
+"                         doesn't record. Requires -journal\n"
+"    -archive <file>      Write the per-read output files (.phd.1, .qual, .scf,\n"
+"                         .seq, .tab, .tip, ...) into the single indexed file\n"
+"                         <file> instead of one file each. A resumed run\n"
+"                         appends to it. Files are retrieved with ttextract\n"
+"    -bin <file>          (For Sanger data only) Output the bases, quality\n"
+"                         values, peak locations and trace parameters of all\n"
+"                         the reads to <file>, as one binary array each,\n"
+"                         plus a table of the reads; see Btk_columns.h.\n"
+"                         Can't be used with -resume\n"
+"    -serve <socket>      Run as a service which keeps the lookup and context\n"
+"                         tables loaded and processes requests read from the\n"
+"                         clients of the local Unix socket <socket>, or from\n"
+"                         stdin if <socket> is '-'. Each request is a line\n"
+"                         <sample_file> [ -pd|-qd|-sd|-fd|-cd <dir> ]... and\n"
+"                         is answered with a line\n"
+"                         <sample_file> OK|ERROR <seconds> [<message>].\n"
+"                         A request 'quit' stops the service. The reads of\n"
+"                         SFF files go to stdout, so they are rejected with\n"
+"                         -serve -\n"
 "    -tab                 (For Sanger data only) Call heterozygotes or mixed \n"
 "                         bases and output .tab file(s) in the  current directory\n"
 "    -tabd <dir>          (For Sanger data only) Call mixed bases and output \n"
@@ -424,6 +568,9 @@ void output_qual_report(struct Qual_data_struct *qual_data,
   }
   fprintf(f,"\nAverage           %8d\n",
 	  qual_data->sum_number / num_of_files);
+  /* The exact sum lets -merge compute the average of all the shards */
+  if (NumShards > 1)
+    fprintf(f,"Total             %8d\n", qual_data->sum_number);
   fclose(f);
 }
 
@@ -459,6 +606,50 @@ error(char *label, char *msg, int err)
     }
 }
 
+/*
+ * This function blocks the calling worker thread until the files which
+ * precede its current file in the input have written their output to the
+ * destinations shared by all the files (multi-FASTA files, quality report,
+ * stdout).  Its synopsis is:
+ *
+ * acquire_output_turn()
+ *
+ * The function does nothing in a single-threaded run or if the thread
+ * already has the turn.
+ */
+static void
+acquire_output_turn(void)
+{
+    if ((CurrentFile < 0) || HaveOutputTurn) {
+        return;
+    }
+    pthread_mutex_lock(&OutputLock);
+    while (OutputTurn != CurrentFile) {
+        pthread_cond_wait(&OutputTurnChanged, &OutputLock);
+    }
+    pthread_mutex_unlock(&OutputLock);
+    HaveOutputTurn = 1;
+}
+
+/*
+ * This function passes the output turn to the next file of the input.
+ * It must be called once for each file processed by a worker thread,
+ * whether or not the file has produced any output.
+ */
+static void
+release_output_turn(void)
+{
+    if (CurrentFile < 0) {
+        return;
+    }
+    acquire_output_turn();
+    pthread_mutex_lock(&OutputLock);
+    OutputTurn++;
+    pthread_cond_broadcast(&OutputTurnChanged);
+    pthread_mutex_unlock(&OutputLock);
+    HaveOutputTurn = 0;
+}
+
 
 /*
  * This function parses the specified mobility file name and finds the
@@ -479,13 +670,13 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
 {
     BtkLookupTable* lookup_table = table;
     if (query == NULL)
-        return Btk_get_3730pop7_table();
+        return Btk_registry_builtin_table(ABI3730pop7);
     if (strstr(query, "Mega") || strstr(query, "BACE")) {
         /* the sample file was generated from MegaBACE or LI-COR sequencing
            machine. */
         options->lut_type = MegaBACE;    
         if (table == NULL) {
-            lookup_table = Btk_get_mbace_table();
+            lookup_table = Btk_registry_builtin_table(MegaBACE);
             (void)fprintf(stderr,
                 "Using a default built-in MegaBACE table.\n");
         }
@@ -495,7 +686,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
            machine. */
         options->lut_type = ABI3730pop7;
         if (table == NULL) {
-            lookup_table = Btk_get_3730pop7_table();
+            lookup_table = Btk_registry_builtin_table(ABI3730pop7);
             (void)fprintf(stderr,
                 "Can't select the lookup table automatically.\n");
             (void)fprintf(stderr,
@@ -505,7 +696,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     } else if (strstr(query, "POP5")) {
         options->lut_type = ABI3700pop5;
         if (table == NULL) {
-            lookup_table = Btk_get_3700pop5_table();
+            lookup_table = Btk_registry_builtin_table(ABI3700pop5);
             if (options->Verbose > 1) {
                 (void)fprintf(stderr,
                     "Using a built-in ABI3700 Pop-5 table.\n");
@@ -515,7 +706,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     } else if (strstr(query, "3700") && strstr(query,"POP6")) {
         options->lut_type = ABI3700pop6;
         if (table == NULL) {
-            lookup_table = Btk_get_3700pop6_table();
+            lookup_table = Btk_registry_builtin_table(ABI3700pop6);
             if (options->Verbose > 1) {
                 (void)fprintf(stderr,
                     "Using a built-in ABI3700 Pop-6 table.\n");
@@ -525,7 +716,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     } else if (strstr(query, "3100") && strstr(query, "POP6")) {
         options->lut_type = ABI3100;
         if (table == NULL) {
-            lookup_table = Btk_get_3100pop6_table();
+            lookup_table = Btk_registry_builtin_table(ABI3100);
             if (options->Verbose > 1)
                 (void)fprintf(stderr,
                 "Using a built-in ABI3100 Pop-6 table.\n");
@@ -537,7 +728,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     {
         options->lut_type = ABI3730pop7;
         if (table == NULL) {
-            lookup_table = Btk_get_3730pop7_table();
+            lookup_table = Btk_registry_builtin_table(ABI3730pop7);
             if (options->Verbose > 1)
                 (void)fprintf(stderr,
                 "Using a built-in ABI3730 Pop-7 table.\n");
@@ -549,7 +740,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
                generated from MolDyn_MegaBACE machine. */
             options->lut_type = ABI3730pop7;
             if (table == NULL) {
-                lookup_table = Btk_get_3700pop5_table();
+                lookup_table = Btk_registry_builtin_table(ABI3700pop5);
                 (void)fprintf(stderr,
                     "Can't select the lookup table automatically.\n");
                 (void)fprintf(stderr,
@@ -560,7 +751,7 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     } else {
         options->lut_type = ABI3730pop7;
         if (table == NULL) {
-            lookup_table = Btk_get_3700pop5_table();
+            lookup_table = Btk_registry_builtin_table(ABI3700pop5);
             (void)fprintf(stderr,
                 "Can't select the lookup table automatically.\n");
             (void)fprintf(stderr,
@@ -571,19 +762,404 @@ parse_mobility_file_name(char* query, Options* options, BtkMessage* message,
     return lookup_table;
 }
 
+/* Output stage of the multi-threaded runs: the worker threads hand the
+ * finished reads to a writer thread through a bounded queue, in input
+ * order, so that the computation overlaps the writing of the output.
+ */
+#define OUTPUT_READ     0   /* all the outputs of a processed read */
+#define OUTPUT_STATUS   1   /* only the -o status of a failed read */
+#define OUTPUT_JOURNAL  2   /* the journal record of a completed file */
+#define OUTPUT_RECORDS_PER_THREAD 2   /* queue length per worker thread */
+
+typedef struct _output_record {
+    int       kind;
+    int       file;                     /* index of the file in the input */
+    char     *path;
+    uint64_t  hash;                     /* OUTPUT_JOURNAL only */
+    char     *ConsensusName;
+    char     *called_bases;
+    int      *called_peak_locs;
+    uint8_t  *quality_values;
+    int      *chromatogram[NUM_COLORS];
+    char     *call_method;
+    int       num_called_bases;
+    int       num_datapoints;
+    int       trimmed_read_length;
+    double    frac_QV20_with_shoulders;
+    BtkReadContext context;
+    Options   options;                  /* owns options.chemistry */
+    struct _output_record *next;
+} OutputRecord;
+
+static pthread_mutex_t OutputQueueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  OutputQueueChanged = PTHREAD_COND_INITIALIZER;
+static OutputRecord   *OutputQueueHead;
+static OutputRecord   *OutputQueueTail;
+static int             OutputQueueLength;
+static int             OutputQueueMax;  /* records queued before blocking */
+static int             OutputQueueClosed;
+static int             OutputWriterRunning;
+static pthread_t       OutputWriter;
+
+static void journal_file(char *path, uint64_t hash);
+
+/*
+ * This function allocates an output record of the specified kind for the
+ * specified sample file.  Its synopsis is:
+ *
+ * rec = new_output_record(kind, path)
+ *
+ *	rec		is the record, or NULL if there is not enough memory
+ */
+static OutputRecord *
+new_output_record(int kind, char *path)
+{
+    OutputRecord *rec;
+
+    if ((rec = CALLOC(OutputRecord, 1)) == NULL) {
+        return NULL;
+    }
+    if ((rec->path = CALLOC(char, strlen(path) + 1)) == NULL) {
+        FREE(rec);
+        return NULL;
+    }
+    strcpy(rec->path, path);
+    rec->kind = kind;
+    rec->file = CurrentFile;
+    return rec;
+}
+
+static void
+release_trace_params(TraceParameters *params)
+{
+    FREE(params->phr3);
+    FREE(params->phr7);
+    FREE(params->psr7);
+    FREE(params->pres);
+    params->length = 0;
+}
+
+static void
+release_output_record(OutputRecord *rec)
+{
+    if (rec->kind == OUTPUT_READ) {
+        Btk_release_file_data(rec->called_bases, rec->called_peak_locs,
+            rec->quality_values, rec->chromatogram, &rec->call_method,
+            &rec->options.chemistry);
+        release_trace_params(&rec->context.trace_params);
+    }
+    FREE(rec->path);
+    FREE(rec);
+}
+
+/*
+ * This function writes the output held by the specified record.  In a
+ * multi-threaded run without a writer thread, the calling thread must be
+ * processing the file of the record.  Its synopsis is:
+ *
+ * result = write_output_record(rec)
+ *
+ *	result		is SUCCESS or ERROR
+ */
+static int
+write_output_record(OutputRecord *rec)
+{
+    if (rec->kind == OUTPUT_JOURNAL) {
+        acquire_output_turn();
+        journal_file(rec->path, rec->hash);
+        return SUCCESS;
+    }
+
+    if (rec->kind == OUTPUT_STATUS) {
+        acquire_output_turn();
+        output_four_multi_fasta_files(multiseqsFileName, multiqualFileName,
+            multilocsFileName, multistatFileName, 0, NULL, NULL, NULL,
+            rec->frac_QV20_with_shoulders, rec->context.status_code,
+            rec->options);
+        return SUCCESS;
+    }
+
+    if ((rec->options.tal_dir[0] != '\0') && !rec->options.indel_resolve) {
+        if (Btk_output_tal_file(rec->path,
+            AlnType == NAME_DIR ? rec->options.tal_dir : NULL,
+            rec->ConsensusName, &TalIndex,
+            rec->called_bases, rec->num_called_bases, (float)RepeatFraction,
+            Verbose) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if ((rec->options.hpr_dir[0] != '\0') && !rec->options.indel_resolve) {
+        if (Btk_output_hpr_file(rec->path,
+            HprType == NAME_DIR ? rec->options.hpr_dir : NULL,
+            rec->called_bases, rec->called_peak_locs, rec->quality_values,
+            rec->num_called_bases, rec->num_datapoints, Verbose)
+            == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if (OutputPhd && !rec->options.indel_resolve) {
+        if (Btk_output_phd_file(rec->path,
+            PhdType == NAME_DIR ? PhdDirName : NULL,
+            rec->called_bases, rec->called_peak_locs, rec->quality_values,
+            rec->num_called_bases, rec->num_datapoints, rec->options.nocall,
+            rec->options.chemistry, rec->context.left_trim_point,
+            rec->context.right_trim_point, trim_threshold, Verbose)
+            == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if (OutputQual && !rec->options.indel_resolve) {
+        if (QualType & NAME_MULTI)
+            acquire_output_turn();
+        if (Btk_output_quality_values(QualType, rec->path,
+            QualDirName, multiqualFileName,
+            rec->quality_values, rec->num_called_bases,
+            rec->context.left_trim_point, rec->context.right_trim_point,
+            Verbose) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if (OutputFastq && !rec->options.indel_resolve) {
+       if (FastqType & NAME_MULTI)
+           acquire_output_turn();
+       if (Btk_output_fastq_file(FastqType, rec->path,
+           FastqDirName, multifastqFileName,
+           rec->called_bases, rec->quality_values,
+           rec->num_called_bases,
+           rec->context.left_trim_point, rec->context.right_trim_point,
+           Verbose) == ERROR)
+        {
+               return ERROR;
+        }
+    }
+
+    if (OutputFasta && !rec->options.indel_resolve) {
+        if (FastaType & NAME_MULTI)
+            acquire_output_turn();
+        if (Btk_output_fasta_file(FastaType, rec->path,
+            FastaDirName, multiseqFileName,
+            rec->called_bases, rec->num_called_bases,
+            rec->context.left_trim_point, rec->context.right_trim_point,
+            Verbose) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if ((ColumnsName[0] != '\0') && !rec->options.indel_resolve) {
+        acquire_output_turn();
+        if (Btk_output_columns(rec->options.file_name, rec->num_called_bases,
+            rec->called_bases, rec->quality_values, rec->called_peak_locs,
+            &rec->context.trace_params) == ERROR)
+        {
+            fprintf(stderr, "%s: couldn't write: %s\n", ColumnsName,
+                strerror(errno));
+            return ERROR;
+        }
+    }
+
+    if (OutputSCF && !rec->options.indel_resolve) {
+        if (output_scf_file(rec->path,
+            SCFType == NAME_DIR ? SCFDirName : ".",
+            rec->called_bases, rec->called_peak_locs, rec->quality_values,
+            rec->num_called_bases, rec->num_datapoints,
+            rec->chromatogram[0], rec->chromatogram[1],
+            rec->chromatogram[2], rec->chromatogram[3],
+            "ACGT", rec->options.chemistry, &rec->context) == ERROR)
+        {
+            return ERROR;
+        }
+    }
+
+    if (OutputQualRpt && !rec->options.indel_resolve) {
+        acquire_output_turn();
+        accum_qual_report(&Qual_data, rec->quality_values,
+            rec->num_called_bases, rec->trimmed_read_length);
+    }
+
+    if (OutputFourMultiFastaFiles)
+    {
+        sprintf(rec->context.status_code, "%s", "TT_SUCCESS");
+        acquire_output_turn();
+
+        output_four_multi_fasta_files(multiseqsFileName,
+            multiqualFileName, multilocsFileName, multistatFileName,
+            rec->num_called_bases,
+            rec->called_bases, rec->quality_values, rec->called_peak_locs,
+            rec->frac_QV20_with_shoulders, rec->context.status_code,
+            rec->options);
+        rec->context.status_code[0] = '\0';
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * This function passes the specified record to the writer thread, if it
+ * is running, or else writes and releases it at once.  The calling thread
+ * blocks while the queue is full.  The record is owned by the output
+ * stage from now on.  Its synopsis is:
+ *
+ * result = emit_output_record(rec)
+ *
+ *	result		is SUCCESS or ERROR, if the output couldn't be written
+ *			at once
+ */
+static int
+emit_output_record(OutputRecord *rec)
+{
+    int r;
+
+    /* The records are queued in input order */
+    acquire_output_turn();
+
+    if (!OutputWriterRunning) {
+        r = write_output_record(rec);
+        release_output_record(rec);
+        return r;
+    }
+
+    pthread_mutex_lock(&OutputQueueLock);
+    while (OutputQueueLength >= OutputQueueMax) {
+        pthread_cond_wait(&OutputQueueChanged, &OutputQueueLock);
+    }
+    rec->next = NULL;
+    if (OutputQueueTail != NULL) {
+        OutputQueueTail->next = rec;
+    }
+    else {
+        OutputQueueHead = rec;
+    }
+    OutputQueueTail = rec;
+    OutputQueueLength++;
+    pthread_cond_broadcast(&OutputQueueChanged);
+    pthread_mutex_unlock(&OutputQueueLock);
+
+    return SUCCESS;
+}
+
+/*
+ * This function emits the -o status of a sample file which couldn't be
+ * processed.
+ */
+static void
+emit_status_record(char *path, char *status_code,
+    double frac_QV20_with_shoulders, Options *options)
+{
+    OutputRecord *rec;
+
+    if ((rec = new_output_record(OUTPUT_STATUS, path)) == NULL) {
+        error(path, "insufficient memory", 0);
+        return;
+    }
+    strcpy(rec->context.status_code, status_code);
+    rec->frac_QV20_with_shoulders = frac_QV20_with_shoulders;
+    rec->options = *options;
+    rec->options.chemistry = NULL;
+    (void)emit_output_record(rec);
+}
+
+/*
+ * This is the body of the writer thread.  It writes the records in the
+ * order of the queue until the queue is closed and empty.  The errors
+ * are reported by the output functions themselves; a file some output
+ * of which couldn't be written is not journaled, as in a single-threaded
+ * run, so that a resumed run processes it again.
+ */
+static void *
+output_writer(void *arg)
+{
+    OutputRecord *rec;
+    int           failed_file = -1;   /* last file with a failed record */
+
+    for (;;) {
+        pthread_mutex_lock(&OutputQueueLock);
+        while ((OutputQueueHead == NULL) && !OutputQueueClosed) {
+            pthread_cond_wait(&OutputQueueChanged, &OutputQueueLock);
+        }
+        if ((rec = OutputQueueHead) == NULL) {
+            pthread_mutex_unlock(&OutputQueueLock);
+            break;
+        }
+        if ((OutputQueueHead = rec->next) == NULL) {
+            OutputQueueTail = NULL;
+        }
+        OutputQueueLength--;
+        pthread_cond_broadcast(&OutputQueueChanged);
+        pthread_mutex_unlock(&OutputQueueLock);
+
+        if ((rec->kind != OUTPUT_JOURNAL) || (rec->file != failed_file)) {
+            if (write_output_record(rec) != SUCCESS) {
+                failed_file = rec->file;
+            }
+        }
+        release_output_record(rec);
+    }
+
+    return NULL;
+}
+
+/*
+ * This function starts the writer thread, with a queue of at most
+ * max_records records.  If the thread can't be started, the output is
+ * written by the worker threads themselves.
+ */
+static void
+start_output_writer(int max_records)
+{
+    OutputQueueHead   = NULL;
+    OutputQueueTail   = NULL;
+    OutputQueueLength = 0;
+    OutputQueueMax    = max_records;
+    OutputQueueClosed = 0;
+    if (pthread_create(&OutputWriter, NULL, output_writer, NULL) != 0) {
+        error("start_output_writer", "can't create thread", errno);
+        return;
+    }
+    OutputWriterRunning = 1;
+}
+
+/*
+ * This function waits until the writer thread has written all the queued
+ * records, and stops it.
+ */
+static void
+stop_output_writer(void)
+{
+    if (!OutputWriterRunning) {
+        return;
+    }
+    pthread_mutex_lock(&OutputQueueLock);
+    OutputQueueClosed = 1;
+    pthread_cond_broadcast(&OutputQueueChanged);
+    pthread_mutex_unlock(&OutputQueueLock);
+    pthread_join(OutputWriter, NULL);
+    OutputWriterRunning = 0;
+}
+
 static int
 process_sample_file(BtkLookupTable *table, ContextTable *ctable,
     char *path, char *ConsensusName, char *ConsensusSeq,
     Options *options, BtkMessage *message)
 {
     char *seq_name, *called_bases, *call_method;
-    int   r, j, num_called_bases=0, *called_peak_locs, num_datapoints;
+    int   j, num_called_bases=0, *called_peak_locs, num_datapoints;
     int   trimmed_read_length, file_type = -1;
     int  *chromatogram[NUM_COLORS]; 
     uint8_t *quality_values;
     int   consFromSample = 0; // whether consensus sequence is from
                               // the sample file
     Results results;
+    BtkReadContext context;
+    OutputRecord *rec;
 
     if (path[0] == '\0') {
         return SUCCESS;
@@ -611,6 +1187,9 @@ process_sample_file(BtkLookupTable *table, ContextTable *ctable,
     call_method      = NULL;
     quality_values   = NULL;
 
+    Btk_init_read_context(&context);
+    context.keep_trace_params = (ColumnsName[0] != '\0');
+
     if ((!ConsensusSpecified) || ConsensusSeq == NULL) {
         consFromSample = 1;
     }
@@ -619,26 +1198,26 @@ process_sample_file(BtkLookupTable *table, ContextTable *ctable,
         options->edited_bases, &called_peak_locs, &quality_values,
         &num_datapoints, &chromatogram[0], &chromatogram[1],
         &chromatogram[2], &chromatogram[3], &call_method, &(options->chemistry),
-        status_code, &file_type, *options, message) != SUCCESS)
+        &context, &file_type, *options, message) != SUCCESS)
     {
-        if (file_type != ABI && file_type != SCF)
+        if (file_type != ABI && file_type != SCF && file_type != ZTR)
         {
             return kWrongFileType;
         }
-        else if (status_code[0] == '\0')
+        else if (context.status_code[0] == '\0')
         {
-            strcpy(status_code, "ABIFILE_FAILURE");
+            strcpy(context.status_code, "ABIFILE_FAILURE");
         }
         else
         {
             /* status_code == "PHREDFILE_FAILURE */
             ;
         }
-        output_four_multi_fasta_files(multiseqsFileName, multiqualFileName,
-            multilocsFileName, multistatFileName, num_called_bases,
-            called_bases, quality_values, called_peak_locs,
-            results.frac_QV20_with_shoulders, status_code, *options);
-        status_code[0] = '\0';
+        if (OutputFourMultiFastaFiles) {
+            emit_status_record(path, context.status_code,
+                results.frac_QV20_with_shoulders, options);
+        }
+        context.status_code[0] = '\0';
         goto error;
     }
     message->text[0] = '\0';  /* message may have been set with no error */
@@ -738,7 +1317,7 @@ process_sample_file(BtkLookupTable *table, ContextTable *ctable,
 
         if (table == 0)
         {
-            table = Btk_get_3730pop7_table();
+            table = Btk_registry_builtin_table(ABI3730pop7);
             options->lut_type = ABI3730pop7;
             (void)fprintf(stderr,
             "Can't select the lookup table automatically. \n");
@@ -766,17 +1345,17 @@ process_sample_file(BtkLookupTable *table, ContextTable *ctable,
 #if USE_CONTEXT_TABLE
                         ctable,
 #endif
-                        &quality_values, *options, message, &results ) == ERROR)
+                        &quality_values, *options, &context, message,
+                        &results ) == ERROR)
         {
-            sprintf(status_code, "%s", "TT_TRASH");
-            if (OutputFourMultiFastaFiles)
-                output_four_multi_fasta_files(multiseqsFileName, multiqualFileName,
-                multilocsFileName, multistatFileName, num_called_bases,
-                called_bases, quality_values, called_peak_locs,
-                results.frac_QV20_with_shoulders, status_code, *options);
+            sprintf(context.status_code, "%s", "TT_TRASH");
+            if (OutputFourMultiFastaFiles) {
+                emit_status_record(path, context.status_code,
+                    results.frac_QV20_with_shoulders, options);
+            }
             if (Verbose > 1)
                 fprintf(stderr, "0 bases finally\n");
-            status_code[0] = '\0';
+            context.status_code[0] = '\0';
             goto error;
         }
     }
@@ -799,104 +1378,38 @@ process_sample_file(BtkLookupTable *table, ContextTable *ctable,
     }
 
     trimmed_read_length = find_trim_points(num_called_bases, quality_values,
-        trim_window, trim_threshold, &left_trim_point, &right_trim_point);
-
-    if ((options->tal_dir[0] != '\0') && !options->indel_resolve) {
-        if (Btk_output_tal_file(path     ,
-            AlnType == NAME_DIR ? options->tal_dir : NULL,
-            ConsensusName, ConsensusSeq,
-            called_bases, num_called_bases,
-            Match, MisMatch, Insertion, Deletion, (float)RepeatFraction,
-            Verbose) == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if ((options->hpr_dir[0] != '\0') && !options->indel_resolve) {
-        if ((r = Btk_output_hpr_file(path,
-            HprType == NAME_DIR ? options->hpr_dir : NULL,
-            called_bases, called_peak_locs, quality_values, num_called_bases,
-            num_datapoints, Verbose))
-            == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if (OutputPhd && !options->indel_resolve) {
-        if ((r = Btk_output_phd_file(path     ,
-            PhdType == NAME_DIR ? PhdDirName : NULL,
-            called_bases, called_peak_locs, quality_values, num_called_bases,
-            num_datapoints, options->nocall, options->chemistry,
-            left_trim_point, right_trim_point, trim_threshold, Verbose))
-            == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if (OutputQual && !options->indel_resolve) {
-        if ((r = Btk_output_quality_values(QualType, path,
-            QualDirName, multiqualFileName,
-            quality_values, num_called_bases, left_trim_point, right_trim_point,
-            Verbose)) == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if (OutputFastq && !options->indel_resolve) {
-       if ((r = Btk_output_fastq_file(FastqType, path,
-           FastqDirName, multifastqFileName,
-           called_bases, quality_values,
-           num_called_bases, left_trim_point, right_trim_point,
-           Verbose)) == ERROR)
-        {
-               goto error;
-        }
-    }
-
-    if (OutputFasta && !options->indel_resolve) {
-        if ((r = Btk_output_fasta_file(FastaType, path     ,
-            FastaDirName, multiseqFileName,
-            called_bases, num_called_bases, left_trim_point, right_trim_point,
-            Verbose)) == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if (OutputSCF && !options->indel_resolve) {
-        if (output_scf_file(path, SCFType == NAME_DIR ? SCFDirName : ".",
-            called_bases, called_peak_locs, quality_values,
-            num_called_bases, num_datapoints, chromatogram[0],
-            chromatogram[1], chromatogram[2], chromatogram[3],
-            "ACGT", options->chemistry) == ERROR)
-        {
-            goto error;
-        }
-    }
-
-    if (OutputQualRpt && !options->indel_resolve) {
-        accum_qual_report(&Qual_data, quality_values, num_called_bases,
-                        trimmed_read_length);
+        trim_window, trim_threshold, &context.left_trim_point,
+        &context.right_trim_point);
+
+    /* Hand the read over to the output stage */
+    rec = new_output_record(OUTPUT_READ, path);
+    MEM_ERROR(rec);
+    rec->ConsensusName       = ConsensusName;
+    rec->called_bases        = called_bases;
+    rec->called_peak_locs    = called_peak_locs;
+    rec->quality_values      = quality_values;
+    rec->call_method         = call_method;
+    rec->num_called_bases    = num_called_bases;
+    rec->num_datapoints      = num_datapoints;
+    rec->trimmed_read_length = trimmed_read_length;
+    rec->frac_QV20_with_shoulders = results.frac_QV20_with_shoulders;
+    rec->context             = context;
+    rec->options             = *options;
+    (void)memset(&context.trace_params, 0, sizeof(TraceParameters));
+    for (j = 0; j < NUM_COLORS; j++) {
+        rec->chromatogram[j] = chromatogram[j];
+        chromatogram[j] = NULL;
     }
+    called_bases     = NULL;
+    called_peak_locs = NULL;
+    quality_values   = NULL;
+    call_method      = NULL;
+    options->chemistry = NULL;
 
-    if (OutputFourMultiFastaFiles)
-    {
-        sprintf(status_code, "%s", "TT_SUCCESS");
-
-        output_four_multi_fasta_files(multiseqsFileName, multiqualFileName,
-            multilocsFileName, multistatFileName, num_called_bases,
-            called_bases, quality_values, called_peak_locs,
-            results.frac_QV20_with_shoulders, status_code, *options);
-        status_code[0] = '\0';
+    if (emit_output_record(rec) == ERROR) {
+        goto error;
     }
 
-    Btk_release_file_data(called_bases, called_peak_locs, quality_values,
-        chromatogram, &call_method, &(options->chemistry));
-
     if (options->time > 0) {
         curr_clock = clock();
         fprintf(stderr,
@@ -916,6 +1429,7 @@ error:
         Btk_release_file_data(called_bases, called_peak_locs, quality_values,
             chromatogram, &call_method, &options->chemistry);
     }
+    release_trace_params(&context.trace_params);
 
     if (consFromSample) {
         FREE(ConsensusSeq);
@@ -925,65 +1439,65 @@ error:
 }
 
 static void
-process_sffRead(sffHeader *h, sffRead *r,  Options *options)
+process_sffRead(sffHeader *h, sffRead *r,  Options *options, FILE *out)
 {
-    int i, j;
+    int i, j = 0;
     int left, right;
     float leftCut, rightCut, sig;
 
     if (OutputFasta)
     {
         int length = r->clip_quality_right-r->clip_quality_left+1;
-        printf(">%s length=%d\n", r->name, length); 
+        fprintf(out, ">%s length=%d\n", r->name, length); 
   
 #if 0 
         for (i=r->clip_quality_left,j=0; i <= r->clip_quality_right; i++) {
             fputc(( i >= r->clip_quality_left && i <= r->clip_quality_right
-               ? toupper(r->bases[i-1]) : tolower(r->bases[i-1]) ), stdout);
+               ? toupper(r->bases[i-1]) : tolower(r->bases[i-1]) ), out);
             if (++j == 60) {
-                fputc('\n', stdout);
+                fputc('\n', out);
                 j = 0;
             }
         }
         if (length % 60 != 0)
-            fputc('\n', stdout);
+            fputc('\n', out);
 #else
         for (i=0; i<r->number_of_bases; i++)
         {
-            fputc(toupper(r->bases[i]), stdout);
+            fputc(toupper(r->bases[i]), out);
             if (++j == 60) {
-                fputc('\n', stdout);
+                fputc('\n', out);
                 j = 0;
             }
         }
-        if (length % 60 != 0) {
-            fputc('\n', stdout); 
+        if (r->number_of_bases % 60 != 0) {
+            fputc('\n', out); 
         }
 #endif
     }
     else if (OutputQual)
     {
         int length = 0;
-        printf(">%s\n", r->name);
+        fprintf(out, ">%s\n", r->name);
         
         for (i=r->clip_quality_left,j=0; i <= r->clip_quality_right; i++) {
-            printf("%2d", r->quality_values[i-1]);
+            fprintf(out, "%2d", r->quality_values[i-1]);
             if (++j == 20) {
-                fputc('\n', stdout);
+                fputc('\n', out);
                 j = 0;
                 length = 0;
             } else if (i < r->clip_quality_right) {
-                fputc(' ', stdout);
+                fputc(' ', out);
                 length += 3;
             }
         }
         if ((length+3)%60 > 3) 
-            fputc('\n', stdout);
+            fputc('\n', out);
     }
     else if (OutputFlow)
     {
         int *flowIndex = CALLOC(int, r->number_of_bases);
-        printf(">%s\n", r->name);
+        fprintf(out, ">%s\n", r->name);
 
 //      printf("Number of bases= %d Flow index per base:\n", r->number_of_bases);
         for (i=0; i<r->number_of_bases; i++)
@@ -1025,116 +1539,331 @@ process_sffRead(sffHeader *h, sffRead *r,  Options *options)
         {
             sig = (float)r->flowgram_values[i]/100.0 
                 - (i == left ? leftCut : (i == right ? rightCut : 0.0));
-            printf("%c,%.2f", h->flow_chars[i], sig); 
+            fprintf(out, "%c,%.2f", h->flow_chars[i], sig); 
             if (++j == 10) {
-                printf("\n");
+                fprintf(out, "\n");
                 j = 0;
             } else if (i < h->number_of_flows_per_read) {
-                printf(" ");
+                fprintf(out, " ");
             }
         }  
-        printf("\n");
+        fprintf(out, "\n");
     }
 }
 
-static int
-process_sff_file(char *sfffile, Options *options, BtkMessage *message)
+/*
+ * This is the body of a worker thread for an SFF file.  It takes the
+ * blocks of reads one at a time, in file order, formats the reads of each
+ * block in memory and writes them to stdout once the preceding blocks
+ * have been written.
+ */
+static void *
+process_sff_blocks_worker(void *arg)
 {
-    int i;
-    char *sff_name;
-    FILE *sff;
-    sffHeader   *h   = CALLOC(sffHeader,   1);
-    sffManifest *m   = CALLOC(sffManifest, 1);
-    sffRead     *r   = CALLOC(sffRead,     1);
+    SffBlockList *list = (SffBlockList *)arg;
+    Options  options = *list->options;
+    sffRead *r = CALLOC(sffRead, 1);
+    FILE    *sff = fopen(list->path, "rb");
+    FILE    *out;
+    char    *text;
+    size_t   text_size;
+    int      i, k, last;
+
+    for (;;) {
+        pthread_mutex_lock(&list->lock);
+        k = list->next_block++;
+        pthread_mutex_unlock(&list->lock);
+        if (k >= list->num_blocks) {
+            break;
+        }
 
-    if (sfffile[0] == '\0') {
-        return SUCCESS;
-    }
-    message->text[0] = '\0';
+        text = NULL;
+        text_size = 0;
+        out = open_memstream(&text, &text_size);
+        last = MIN2((k + 1) * SFF_READS_PER_BLOCK,
+            (int)list->h->number_of_reads);
+        if ((r != NULL) && (sff != NULL) && (out != NULL)) {
+            for (i = k * SFF_READS_PER_BLOCK; i < last; i++) {
+                TT_fseek(sff, list->offsets[i], SEEK_SET);
+                readsff_read(sff, list->h, r);
+                process_sffRead(list->h, r, &options, out);
+            }
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
 
-#ifdef __WIN32
-    if ((sff_name = strrchr(sfffile, '\\')) != NULL) {
-#else
-    if ((sff_name = strrchr(sfffile, '/')) != NULL) {
-#endif
-        sff_name++;
+        pthread_mutex_lock(&list->lock);
+        while (list->next_output != k) {
+            pthread_cond_wait(&list->output_changed, &list->lock);
+        }
+        if ((r == NULL) || (sff == NULL) || (out == NULL)) {
+            list->num_failed += last - k * SFF_READS_PER_BLOCK;
+        }
+        pthread_mutex_unlock(&list->lock);
 
-    }
-    else {
-        sff_name = sfffile;
-    }
+        if ((r == NULL) || (sff == NULL) || (out == NULL)) {
+            fprintf(stderr, "%s: can't read reads %d to %d\n", list->path,
+                k * SFF_READS_PER_BLOCK + 1, last);
+        }
+        else {
+            fwrite(text, 1, text_size, stdout);
+        }
+        free(text);
 
-    strcpy(options->file_name, sff_name);
+        pthread_mutex_lock(&list->lock);
+        list->next_output++;
+        pthread_cond_broadcast(&list->output_changed);
+        pthread_mutex_unlock(&list->lock);
+    }
 
-    if ((sff = fopen(sfffile, "rb")) == NULL) {
-        fprintf(stderr, "Error:  Unable to open SFF file:  %s\n", sfffile);
-        goto error;
+    if (sff != NULL) {
+        fclose(sff);
     }
+    if (r != NULL) {
+        FREE(r->data_block);
+        FREE(r);
+    }
+    return NULL;
+}
 
-    message->text[0] = '\0';  /* message may have been set with no error */
+/*
+ * This function processes the reads of an SFF file using NumThreads
+ * worker threads, and writes them to stdout in file order.  The reads are
+ * located with the index of the file or, if it has none, with a pass over
+ * the read headers.  Its synopsis is:
+ *
+ * result = process_sff_blocks(sff, sfffile, h, options, message)
+ *
+ * where
+ *	sff		is the open SFF file, whose header has been read
+ *	sfffile		is the name (path) of the SFF file
+ *	h		is the address of its header
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is SUCCESS, ERROR if some of the reads couldn't be
+ *			read, or SFF_NOT_LOCATED if the reads could not be
+ *			located, in which case none of them has been written
+ */
+static int
+process_sff_blocks(FILE *sff, char *sfffile, sffHeader *h, Options *options,
+    BtkMessage *message)
+{
+    SffBlockList list;
+    pthread_t   *threads;
+    int          i, num_threads = NumThreads;
+
+    memset(&list, 0, sizeof(list));
+    list.path    = sfffile;
+    list.h       = h;
+    list.options = options;
+    list.num_blocks = (h->number_of_reads + SFF_READS_PER_BLOCK - 1)
+        / SFF_READS_PER_BLOCK;
+    if (num_threads > list.num_blocks) {
+        num_threads = list.num_blocks;
+    }
 
-    if (readsff_header(sff, h, m) == kWrongFileType)
+    list.offsets = CALLOC(uint64_t, h->number_of_reads);
+    threads = CALLOC(pthread_t, num_threads);
+    if ((list.offsets == NULL) || (threads == NULL) ||
+        (readsff_read_offsets(sff, h, list.offsets) != SUCCESS))
     {
-        FREE(h);
-        FREE(m);
-        FREE(r);
-        fclose(sff);
-        return kWrongFileType;
+        FREE(list.offsets);
+        FREE(threads);
+        return SFF_NOT_LOCATED;
+    }
+
+    pthread_mutex_init(&list.lock, NULL);
+    pthread_cond_init(&list.output_changed, NULL);
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, process_sff_blocks_worker,
+            &list) != 0)
+        {
+            error("process_sff_blocks", "can't create thread", errno);
+            break;
+        }
+    }
+    if (i == 0) {
+        process_sff_blocks_worker(&list);
     }
+    num_threads = i;
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&list.output_changed);
+    pthread_mutex_destroy(&list.lock);
+    FREE(list.offsets);
+    FREE(threads);
+
+    if (list.num_failed > 0) {
+        sprintf(message->text, "%d of the %d reads couldn't be read",
+            list.num_failed, (int)h->number_of_reads);
+        return ERROR;
+    }
+    return SUCCESS;
+}
 
-    /* Exclude invalid command line options for 454 data */
+/*
+ * This function checks that none of the options which can't be used with
+ * 454 data is set.  Its synopsis is:
+ *
+ * result = check_sff_options(options, message)
+ *
+ * where
+ *	options		is the address of the Options
+ *	message		is the address of a BtkMessage where the option
+ *			which can't be used is put, if any
+ *
+ *	result		is SUCCESS, or ERROR if such an option is set
+ */
+static int
+check_sff_options(Options *options, BtkMessage *message)
+{
     if (options->het || options->mix)
     {
-        fprintf(stderr, "\nCan not use option -het or -mix with 454 data\n");
-        exit(2);
+        sprintf(message->text, "Can not use option -het or -mix with 454 data");
+        return ERROR;
     }
     if (options->edited_bases)
     {
-        fprintf(stderr, "\nCan not use option -edited_bases with 454 data\n");
-        exit(2);
+        sprintf(message->text,
+            "Can not use option -edited_bases with 454 data");
+        return ERROR;
     }
     if (options->indel_detect || options->indel_resolve)
     {
-        fprintf(stderr, "\nCan not use option -indel_detect or -indel_resolve with 454 data\n");
-        exit(2);
+        sprintf(message->text,
+            "Can not use option -indel_detect or -indel_resolve with 454 data");
+        return ERROR;
     }
     if (OutputSCF)           
     {
-        fprintf(stderr, "\nCan not use option -c or -cd <dir> with 454 data\n");
-        exit(2);
-    } 
+        sprintf(message->text, "Can not use option -c or -cd <dir> with 454 data");
+        return ERROR;
+    }
     if (options->tab_dir[0] != '\0')
     {
-        fprintf(stderr, "\nCan not use option -tab or -tabd <dir> with 454 data\n");
-        exit(2);
+        sprintf(message->text,
+            "Can not use option -tab or -tabd <dir> with 454 data");
+        return ERROR;
     }
     if (options->tal_dir[0] != '\0')
     {
-        fprintf(stderr, "\nCan not use option -tal or -tald <dir> with 454 data\n");
-        exit(2);
+        sprintf(message->text,
+            "Can not use option -tal or -tald <dir> with 454 data");
+        return ERROR;
     }
     if (options->tip_dir[0] != '\0')
     {
-        fprintf(stderr, "\nCan not use option -tip or -tipd <dir> with 454 data\n");
-        exit(2);
+        sprintf(message->text,
+            "Can not use option -tip or -tipd <dir> with 454 data");
+        return ERROR;
     }
     if (options->poly || options->poly_dir[0] != '\0')
     {
-        fprintf(stderr, "\nCan not use option -d or -dd <dir> with 454 data\n");
-        exit(2);
+        sprintf(message->text, "Can not use option -d or -dd <dir> with 454 data");
+        return ERROR;
     }
     if (options->lut_type == ABI3730pop7 || options->lut_type == ABI3700pop5 ||
         options->lut_type == ABI3700pop6 || options->lut_type == ABI3100     ||
         options->lut_type == MegaBACE)
     {
-        fprintf(stderr, "\nCan not use the specified Sanger lookup table with 454 data\n");
-        exit(2);
-    } 
- 
-    for (i=0; i < h->number_of_reads; i++) {
-        readsff_read(sff, h, r);
+        sprintf(message->text,
+            "Can not use the specified Sanger lookup table with 454 data");
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+static int
+process_sff_file(char *sfffile, Options *options, BtkMessage *message)
+{
+    int i, result = SFF_NOT_LOCATED;
+    char *sff_name;
+    FILE *sff;
+    off_t first_read;
+    sffHeader   *h   = CALLOC(sffHeader,   1);
+    sffManifest *m   = CALLOC(sffManifest, 1);
+    sffRead     *r   = CALLOC(sffRead,     1);
+
+    if (sfffile[0] == '\0') {
+        return SUCCESS;
+    }
+    message->text[0] = '\0';
+
+#ifdef __WIN32
+    if ((sff_name = strrchr(sfffile, '\\')) != NULL) {
+#else
+    if ((sff_name = strrchr(sfffile, '/')) != NULL) {
+#endif
+        sff_name++;
+
+    }
+    else {
+        sff_name = sfffile;
+    }
+
+    strcpy(options->file_name, sff_name);
+
+    if ((sff = fopen(sfffile, "rb")) == NULL) {
+        fprintf(stderr, "Error:  Unable to open SFF file:  %s\n", sfffile);
+        goto error;
+    }
+
+    message->text[0] = '\0';  /* message may have been set with no error */
+
+    if (readsff_header(sff, h, m) == kWrongFileType)
+    {
+        FREE(h);
+        FREE(m);
+        FREE(r);
+        fclose(sff);
+        return kWrongFileType;
+    }
+
+    /* Exclude invalid command line options for 454 data.  They are fatal,
+     * except for the requests of the service mode, which report them
+     */
+    if (check_sff_options(options, message) != SUCCESS) {
+        fclose(sff);
+        if (!Serve) {
+            fprintf(stderr, "\n%s\n", message->text);
+            exit(2);
+        }
+        goto error;
+    }
+
+    /* The reads would be mixed with the replies of -serve - on stdout */
+    if (Serve && (strcmp(ServeName, "-") == 0)) {
+        sprintf(message->text,
+            "SFF files are written to stdout, which -serve - uses for replies");
+        fclose(sff);
+        goto error;
+    }
+
+    /* The reads are written to stdout */
+    acquire_output_turn();
+
+    first_read = TT_ftell(sff);
+    if ((NumThreads > 1) && (h->number_of_reads > SFF_READS_PER_BLOCK)) {
+        result = process_sff_blocks(sff, sfffile, h, options, message);
+    }
+    if (result != SFF_NOT_LOCATED) {
+        /* Leave the file where the sequential reading would */
+        if (h->index_length > 0) {
+            TT_fseek(sff, h->index_offset, SEEK_SET);
+        }
+    }
+    else {
+        TT_fseek(sff, first_read, SEEK_SET);
+        for (i=0; i < h->number_of_reads; i++) {
+            readsff_read(sff, h, r);
 
-        process_sffRead(h, r, options);
+            process_sffRead(h, r, options, stdout);
+        }
     }
 
     //  Read the manifest?
@@ -1168,7 +1897,8 @@ process_sff_file(char *sfffile, Options *options, BtkMessage *message)
     FREE(m);
     FREE(r->data_block);
     FREE(r);
-    return SUCCESS;
+    /* The reads which could be read have been written all the same */
+    return (result == ERROR) ? ERROR : SUCCESS;
 
 error:
     FREE(h->data_block);
@@ -1200,6 +1930,7 @@ process_file(BtkLookupTable *table, ContextTable *ctable,
     Options *options, BtkMessage *message)
 {
     char *seq_name;
+    int   r;
 
     file_type = -1;
 
@@ -1221,209 +1952,1436 @@ process_file(BtkLookupTable *table, ContextTable *ctable,
  
     strcpy(options->file_name, seq_name);
 
-    if (process_sff_file(path, options, message) !=
+    if ((r = process_sff_file(path, options, message)) !=
         kWrongFileType)
     {
         // this is SFF file
     }
-    else if (process_sample_file(table, ctable, path, ConsensusName,
-            ConsensusSeq, options, message) != kWrongFileType) 
+    else if ((r = process_sample_file(table, ctable, path, ConsensusName,
+            ConsensusSeq, options, message)) != kWrongFileType) 
     {
         // this is either ABI or SCF file
     }
     else { 
-       fprintf(stderr, "%s: not an ABI, SCF or SFF file\n", path);
+       sprintf(message->text, "not an ABI, SCF or SFF file");
+       r = ERROR;
     }
 
-    return SUCCESS;
+    return (r == SUCCESS) ? SUCCESS : ERROR;
 }
 
-
 /*
- * This function processes all sample files listed in the specified file.
+ * This function adds the specified bytes to a 64-bit FNV-1a hash.
  * Its synopsis is:
  *
- * result = process_fileoffiles(table, ctable, ..., message)
+ * hash = journal_hash(hash, data, len)
+ */
+static uint64_t
+journal_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * This function computes the hash by which a sample file is recorded in
+ * the journal.  It is computed from the name, size and modification time
+ * of the file, so that the file need not be opened.  Its synopsis is:
  *
- * where
- *	table		is the address of a BtkLookupTable returned by
- *			Btk_read_lookup_table()
- *      ctable          is the address of a CntaxtTable returned by
- *                      read_context_table()
- *	fileoffiles	is the name (path) of a file with one sample file
- *			per line
- *	message		is the address of a BtkMessage where information about
- *			an error will be put, if any
+ * hash = input_hash(path, size, mtime)
+ */
+static uint64_t
+input_hash(char *path, long size, long mtime)
+{
+    uint64_t hash = journal_hash(OptionsHash, path, strlen(path));
+
+    hash = journal_hash(hash, &size, sizeof(size));
+    return journal_hash(hash, &mtime, sizeof(mtime));
+}
+
+/* Outputs whose sizes are recorded with each file in the journal: those
+ * of the multi-files and of the archive, which are written through large
+ * buffers and so may be ahead of the journal when a run is killed
+ */
+#define NUM_JOURNAL_OUTPUTS 7
+
+static char *JournalOutputs[NUM_JOURNAL_OUTPUTS] = {
+    multiseqsFileName, multiqualFileName, multilocsFileName,
+    multistatFileName, multiseqFileName, multifastqFileName, ArchiveName
+};
+
+/*
+ * This function gets the current sizes of the outputs recorded in the
+ * journal; that of an output which isn't written by the run, or doesn't
+ * exist yet, is 0.
+ */
+static void
+get_output_sizes(uint64_t *sizes)
+{
+    struct stat statbuf;
+    int         i;
+
+    for (i = 0; i < NUM_JOURNAL_OUTPUTS; i++) {
+        sizes[i] = 0;
+        if ((JournalOutputs[i][0] != '\0') &&
+            (stat(JournalOutputs[i], &statbuf) == 0))
+        {
+            sizes[i] = (uint64_t)statbuf.st_size;
+        }
+    }
+}
+
+/*
+ * This function truncates the outputs to the sizes recorded by the last
+ * record of the journal, discarding the output of the files which were
+ * processed after it, and so will be processed again.  Its synopsis is:
+ *
+ * result = truncate_outputs(sizes, message)
  *
  *	result		is 0 on success, !0 if an error occurs
  */
 static int
-process_fileoffiles(BtkLookupTable *table, ContextTable *ctable, 
-    char *fileoffiles, char *ConsensusName, char *ConsensusSeq,
-    Options *options, BtkMessage *message)
+truncate_outputs(uint64_t *sizes, BtkMessage *message)
 {
-    FILE *fp;
-    char line[BUFLEN], *s;
-    int r;
+#ifndef __WIN32
     struct stat statbuf;
+    int         i;
 
+    for (i = 0; i < NUM_JOURNAL_OUTPUTS; i++) {
+        if ((JournalOutputs[i][0] == '\0') ||
+            (stat(JournalOutputs[i], &statbuf) != 0) ||
+            ((uint64_t)statbuf.st_size <= sizes[i]))
+        {
+            continue;
+        }
+        if (truncate(JournalOutputs[i], (off_t)sizes[i]) != 0) {
+            sprintf(message->text, "%.200s: couldn't truncate: %s",
+                JournalOutputs[i], strerror(errno));
+            return ERROR;
+        }
+        if (Verbose > 1) {
+            fprintf(stderr, "%s: output of the unjournaled files discarded\n",
+                JournalOutputs[i]);
+        }
+    }
+#endif
+    return SUCCESS;
+}
 
-    if (Verbose > 1) {
-	(void)fprintf(stderr, "%s: opening file-of-files\n", fileoffiles);
+static int
+compare_hashes(const void *a, const void *b)
+{
+    uint64_t h1 = *(const uint64_t *)a, h2 = *(const uint64_t *)b;
+
+    return (h1 < h2) ? -1 : (h1 > h2);
+}
+
+/*
+ * This function opens the journal of the run for appending.  With -resume,
+ * it first reads the hashes of the files recorded by the previous runs
+ * with the same options; an incomplete last line, left by a run which
+ * was killed, is ignored.  If the last record is of the same options,
+ * the outputs are then truncated to the sizes which it records, so that
+ * they hold the output of the journaled files only.  The outputs must not
+ * have been opened yet.  Its synopsis is:
+ *
+ * result = open_journal(message)
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+open_journal(BtkMessage *message)
+{
+    FILE     *fp;
+    char      line[BUFLEN], *s;
+    uint64_t  options_hash, hash, *hashes, sizes[NUM_JOURNAL_OUTPUTS];
+    int       max_journaled = 0, have_sizes = 0;
+
+    if (Resume && ((fp = fopen(JournalName, "r")) != NULL)) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if ((strchr(line, '\n') == NULL) ||
+                (sscanf(line, "%" SCNx64 " %" SCNx64, &options_hash, &hash)
+                 != 2))
+            {
+                continue;
+            }
+            /* The sizes follow the path, after a tab; older journals
+             * don't have them
+             */
+            have_sizes = (options_hash == OptionsHash) &&
+                ((s = strrchr(line, '\t')) != NULL) &&
+                (sscanf(s, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                    " %" SCNu64 " %" SCNu64 " %" SCNu64, &sizes[0], &sizes[1],
+                    &sizes[2], &sizes[3], &sizes[4], &sizes[5], &sizes[6])
+                 == NUM_JOURNAL_OUTPUTS);
+            if (options_hash != OptionsHash) {
+                continue;
+            }
+            if (NumJournaled == max_journaled) {
+                max_journaled += FILE_LIST_CHUNK;
+                hashes = REALLOC(Journaled, uint64_t, max_journaled);
+                MEM_ERROR(hashes);
+                Journaled = hashes;
+            }
+            Journaled[NumJournaled++] = hash;
+        }
+        (void)fclose(fp);
+        qsort(Journaled, NumJournaled, sizeof(uint64_t), compare_hashes);
+        if (Verbose > 1) {
+            fprintf(stderr, "%s: %d files already processed\n", JournalName,
+                NumJournaled);
+        }
+        if (have_sizes && (truncate_outputs(sizes, message) != SUCCESS)) {
+            return ERROR;
+        }
     }
-    message->text[0] = '\0';
-    if ((fp = fopen(fileoffiles, "r")) == NULL) {
-	error(fileoffiles, "couldn't open", errno);
-	return ERROR;
+
+    if ((Journal = fopen(JournalName, "a")) == NULL) {
+        sprintf(message->text, "%.200s: couldn't open: %s", JournalName,
+            strerror(errno));
+        return ERROR;
     }
+    return SUCCESS;
 
-    /* Read one line of the file at a time */
-    while (fgets(line, sizeof(line), fp) != NULL) {
-	/* Trim the newline, if any */
-	if ((s = strchr(line, '\n')) != NULL) {
-	    *s = '\0';
-	}
+error:
+    return ERROR;
+}
 
-	if (stat(line, &statbuf) != 0) {
-	    error(line, "can't stat", errno);
-	    continue;
-	}
-	if (statbuf.st_mode & S_IFDIR) {
-	    /* skip subdirectories */
-	    fprintf(stderr, "%s: skipping subdirectory\n", line);
-	    continue;
-	}
+/*
+ * This function tells whether the file of the specified hash has been
+ * recorded in the journal by a previous run.
+ */
+static int
+is_journaled(uint64_t hash)
+{
+    return (NumJournaled > 0) && (bsearch(&hash, Journaled, NumJournaled,
+        sizeof(uint64_t), compare_hashes) != NULL);
+}
+
+/*
+ * This function records the specified sample file as completed in the
+ * journal, if any.  The record is flushed to disk at once, so that the
+ * journal survives the failure of the node; the buffered output of the
+ * multi-files and of the archive is flushed first, so that they are never
+ * behind the journal, and their sizes are recorded with the file, so that
+ * a resumed run can discard what they hold beyond it.
+ * In a multi-threaded run, the calling thread must have the output turn.
+ */
+static void
+journal_file(char *path, uint64_t hash)
+{
+    uint64_t sizes[NUM_JOURNAL_OUTPUTS];
+    int      i;
+
+    if (Journal == NULL) {
+        return;
+    }
+    (void)Btk_flush_multi_files();
+    (void)Btk_flush_output_archive();
+    get_output_sizes(sizes);
+    fprintf(Journal, "%016" PRIx64 " %016" PRIx64 " %s\t", OptionsHash, hash,
+        path);
+    for (i = 0; i < NUM_JOURNAL_OUTPUTS; i++) {
+        fprintf(Journal, i == 0 ? "%" PRIu64 : " %" PRIu64, sizes[i]);
+    }
+    fputc('\n', Journal);
+    if (fflush(Journal) == EOF) {
+        error(JournalName, "couldn't write", errno);
+    }
+#ifndef __WIN32
+    (void)fsync(fileno(Journal));
+#endif
+}
+
+/*
+ * This function initializes a list of sample files to be processed by
+ * the worker threads.
+ */
+static void
+init_file_list(FileList *list, BtkLookupTable *table, ContextTable *ctable,
+    char *ConsensusName, char *ConsensusSeq, Options *options)
+{
+    list->paths         = NULL;
+    list->hashes        = NULL;
+    list->num_paths     = 0;
+    list->next_path     = 0;
+    list->table         = table;
+    list->ctable        = ctable;
+    list->ConsensusName = ConsensusName;
+    list->ConsensusSeq  = ConsensusSeq;
+    list->options       = options;
+}
+
+/*
+ * This function appends a copy of the specified path, and the journal
+ * hash of the file, to the list.  Its synopsis is:
+ *
+ * result = add_to_file_list(list, path, hash, message)
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+add_to_file_list(FileList *list, char *path, uint64_t hash,
+    BtkMessage *message)
+{
+    char    **paths;
+    uint64_t *hashes;
+
+    if (list->num_paths % FILE_LIST_CHUNK == 0) {
+        paths = REALLOC(list->paths, char *,
+            list->num_paths + FILE_LIST_CHUNK);
+        MEM_ERROR(paths);
+        list->paths = paths;
+        hashes = REALLOC(list->hashes, uint64_t,
+            list->num_paths + FILE_LIST_CHUNK);
+        MEM_ERROR(hashes);
+        list->hashes = hashes;
+    }
+    list->hashes[list->num_paths] = hash;
+    list->paths[list->num_paths] = CALLOC(char, strlen(path) + 1);
+    MEM_ERROR(list->paths[list->num_paths]);
+    strcpy(list->paths[list->num_paths], path);
+    list->num_paths++;
+
+    return SUCCESS;
+
+error:
+    return ERROR;
+}
+
+static void
+release_file_list(FileList *list)
+{
+    int i;
+
+    for (i = 0; i < list->num_paths; i++) {
+        FREE(list->paths[i]);
+    }
+    FREE(list->paths);
+    FREE(list->hashes);
+    list->num_paths = 0;
+}
+
+/*
+ * This is the body of a worker thread.  It takes the files from the list
+ * one at a time, in input order, and processes each of them with its own
+ * copy of the options.
+ */
+static void *
+process_file_list_worker(void *arg)
+{
+    FileList  *list = (FileList *)arg;
+    Options    options = *list->options;
+    BtkMessage message;
+    OutputRecord *rec;
+    int        i, r;
+
+    for (;;) {
+        pthread_mutex_lock(&list->lock);
+        i = list->next_path++;
+        pthread_cond_broadcast(&list->path_taken);
+        pthread_mutex_unlock(&list->lock);
+        if (i >= list->num_paths) {
+            break;
+        }
+
+        CurrentFile = i;
+        if ((r = process_file(list->table, list->ctable, list->paths[i], -1,
+            -1, list->ConsensusName, list->ConsensusSeq, &options, &message))
+            != SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n", list->paths[i], message.text);
+        }
+        if ((r == SUCCESS) && (Journal != NULL)) {
+            /* Journaled after all the output of the file is written */
+            if ((rec = new_output_record(OUTPUT_JOURNAL, list->paths[i]))
+                != NULL)
+            {
+                rec->hash = list->hashes[i];
+                (void)emit_output_record(rec);
+            }
+            else {
+                error(list->paths[i], "insufficient memory", 0);
+            }
+        }
+        release_output_turn();
+    }
+    CurrentFile = -1;
+
+    return NULL;
+}
+
+/*
+ * This function asks the system to read the specified file into the page
+ * cache, in the background.  The trace files are mapped rather than read
+ * (see F_Open), so the workers then parse the cached pages without
+ * waiting for the disk or the network.
+ */
+static void
+prefetch_file(char *path)
+{
+#if !defined(__WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+        (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        (void)close(fd);
+    }
+#endif
+}
+
+/*
+ * This is the body of the prefetch thread of -prefetch <num>.  It opens
+ * the files of the list in order, keeping up to PrefetchDepth files ahead
+ * of those taken by the worker threads, so that the latency of opening
+ * and reading each file is hidden behind the processing of the previous
+ * ones.
+ */
+static void *
+prefetch_worker(void *arg)
+{
+    FileList *list = (FileList *)arg;
+    int       i, taken;
+
+    for (i = 0; i < list->num_paths; i++) {
+        pthread_mutex_lock(&list->lock);
+        while (i >= list->next_path + PrefetchDepth) {
+            pthread_cond_wait(&list->path_taken, &list->lock);
+        }
+        taken = (i < list->next_path);
+        pthread_mutex_unlock(&list->lock);
+        if (!taken) {
+            prefetch_file(list->paths[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * This function processes all the files of the list using NumThreads
+ * worker threads.  The files are processed concurrently, but their output
+ * to the shared destinations is written in the order of the list, so that
+ * the results are the same as those of a single-threaded run.
+ * Its synopsis is:
+ *
+ * result = process_file_list(list, message)
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+process_file_list(FileList *list, BtkMessage *message)
+{
+    pthread_t *threads, prefetcher;
+    int        i, num_threads = NumThreads, prefetching = 0;
+
+    if (num_threads > list->num_paths) {
+        num_threads = list->num_paths;
+    }
+    if (num_threads <= 0) {
+        return SUCCESS;
+    }
+    threads = CALLOC(pthread_t, num_threads);
+    MEM_ERROR(threads);
+
+    list->next_path = 0;
+    OutputTurn = 0;
+    pthread_mutex_init(&list->lock, NULL);
+    pthread_cond_init(&list->path_taken, NULL);
+    start_output_writer(OUTPUT_RECORDS_PER_THREAD * num_threads);
+
+    if (PrefetchDepth > 0) {
+        prefetching = (pthread_create(&prefetcher, NULL, prefetch_worker,
+            list) == 0);
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, process_file_list_worker,
+            list) != 0)
+        {
+            error("process_file_list", "can't create thread", errno);
+            break;
+        }
+    }
+    if (i == 0) {
+        /* No threads could be started; process the files in this one */
+        process_file_list_worker(list);
+    }
+    num_threads = i;
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (prefetching) {
+        /* Past the end of the list, so that it can't be waiting */
+        pthread_mutex_lock(&list->lock);
+        list->next_path = list->num_paths;
+        pthread_cond_broadcast(&list->path_taken);
+        pthread_mutex_unlock(&list->lock);
+        pthread_join(prefetcher, NULL);
+    }
+    stop_output_writer();
+
+    pthread_cond_destroy(&list->path_taken);
+    pthread_mutex_destroy(&list->lock);
+    FREE(threads);
+    return SUCCESS;
+
+error:
+    return ERROR;
+}
+
+
+/*
+ * This function tells whether the specified sample file belongs to the
+ * shard of this run (-shard K/N).  The files are partitioned by a hash of
+ * their names, sans path, so that every node selects the same subset
+ * whatever the order of the input and wherever the files are mounted.
+ * Its synopsis is:
+ *
+ * result = in_shard(path)
+ *
+ *	result		is 1 if the file is to be processed by this run,
+ *			0 otherwise
+ */
+static int
+in_shard(char *path)
+{
+    char         *name;
+    unsigned int  hash = 2166136261U;   /* FNV-1a */
+
+    if (NumShards <= 1) {
+        return 1;
+    }
+#ifdef __WIN32
+    if ((name = strrchr(path, '\\')) != NULL) {
+#else
+    if ((name = strrchr(path, '/')) != NULL) {
+#endif
+        name++;
+    }
+    else {
+        name = path;
+    }
+    for (; *name != '\0'; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619U;
+    }
+    return (int)(hash % (unsigned int)NumShards) == ShardIndex - 1;
+}
+
+/*
+ * This function processes all sample files listed in the specified file.
+ * Its synopsis is:
+ *
+ * result = process_fileoffiles(table, ctable, ..., message)
+ *
+ * where
+ *	table		is the address of a BtkLookupTable returned by
+ *			Btk_read_lookup_table()
+ *      ctable          is the address of a CntaxtTable returned by
+ *                      read_context_table()
+ *	fileoffiles	is the name (path) of a file with one sample file
+ *			per line
+ *	message		is the address of a BtkMessage where information about
+ *			an error will be put, if any
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+process_fileoffiles(BtkLookupTable *table, ContextTable *ctable, 
+    char *fileoffiles, char *ConsensusName, char *ConsensusSeq,
+    Options *options, BtkMessage *message)
+{
+    FILE *fp;
+    char line[BUFLEN], *s;
+    int r;
+    struct stat statbuf;
+    FileList list;
+    uint64_t hash;
+
+
+    if (Verbose > 1) {
+	(void)fprintf(stderr, "%s: opening file-of-files\n", fileoffiles);
+    }
+    message->text[0] = '\0';
+    if ((fp = fopen(fileoffiles, "r")) == NULL) {
+	error(fileoffiles, "couldn't open", errno);
+	return ERROR;
+    }
+    init_file_list(&list, table, ctable, ConsensusName, ConsensusSeq, options);
+
+    /* Read one line of the file at a time */
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	/* Trim the newline, if any */
+	if ((s = strchr(line, '\n')) != NULL) {
+	    *s = '\0';
+	}
+	if (!in_shard(line)) {
+	    continue;
+	}
+
+	if (stat(line, &statbuf) != 0) {
+	    error(line, "can't stat", errno);
+	    continue;
+	}
+	if (statbuf.st_mode & S_IFDIR) {
+	    /* skip subdirectories */
+	    fprintf(stderr, "%s: skipping subdirectory\n", line);
+	    continue;
+	}
+	hash = input_hash(line, (long)statbuf.st_size, (long)statbuf.st_mtime);
+	if (is_journaled(hash)) {
+	    continue;
+	}
+
+	if ((NumThreads > 1) || (PrefetchDepth > 0)) {
+	    if (add_to_file_list(&list, line, hash, message) != SUCCESS) {
+		r = ERROR;
+		goto error;
+	    }
+	    continue;
+	}
+
+	if (process_file(table, ctable, line, -1, -1, ConsensusName, 
+            ConsensusSeq, options, message) != SUCCESS) 
+        {
+	    fprintf(stderr, "%s: %s\n", line, message->text);
+	}
+	else {
+	    journal_file(line, hash);
+	}
+	fprintf(stderr,"\n");
+    }
+    if (ferror(fp)) {
+	error(fileoffiles, "couldn't read", errno);
+	r = ERROR;
+	goto error;
+    }
+
+    (void)fclose(fp);
+    if (Verbose > 1) {
+	(void)fprintf(stderr, "%s: closed file-of-files\n", fileoffiles);
+    }
+    if ((NumThreads > 1) || (PrefetchDepth > 0)) {
+	r = process_file_list(&list, message);
+	release_file_list(&list);
+	return r;
+    }
+    return SUCCESS;
+
+error:
+    (void)fclose(fp);
+    release_file_list(&list);
+    return r;
+}
+
+/*
+ * This function processes all files contained in the specified directory.
+ * Its synopsis is:
+ *
+ * result = process_dir(table, ctable, dir, ...)
+ *
+ * where
+ *	table		is the address of a BtkLookupTable returned by
+ *			Btk_read_lookup_table()
+ *      ctable          is the address of a ContextTable returned by
+ *                      read_context_table()
+ *	dir		is the name (path) of a directory
+ *
+ *	Routine prints out its own error messages as needed.
+ */
+static void
+process_dir(BtkLookupTable *table, ContextTable *ctable,
+    char *dir, char *ConsensusName, char *ConsensusSeq,
+    Options *options, BtkMessage *message)
+{
+#ifndef __DEVSTUDIO
+    DIR *d;
+    struct dirent *de;
+    struct stat statbuf;
+#else
+    long handle;
+    char filespec[MAXPATHLEN];
+    struct _finddata_t fileinfo;
+    struct _stat buffer;
+#endif
+    char path_and_name[MAXPATHLEN];
+    FileList list;
+    uint64_t hash;
+
+    init_file_list(&list, table, ctable, ConsensusName, ConsensusSeq, options);
+
+#ifdef __DEVSTUDIO
+    sprintf(filespec, "%s\\*.*", dir);
+    handle = _findfirst(filespec, &fileinfo);
+
+    do {
+        sprintf(path_and_name, "%s\\%s", dir, fileinfo.name);
+        if (!in_shard(path_and_name)) {
+            continue;
+        }
+
+        if (_stat(path_and_name, &buffer) != 0) {
+            error(path_and_name, "can't stat", errno);
+            continue;
+        }
+
+        if (buffer.st_mode & _S_IFDIR) {    /* skip subdirectories */
+            if (Verbose > 2) {
+                fprintf(stderr, "%s: skipping subdirectory\n", path_and_name);
+            }
+            continue;
+        }
+        hash = input_hash(path_and_name, (long)buffer.st_size,
+            (long)buffer.st_mtime);
+        if (is_journaled(hash)) {
+            continue;
+        }
+
+        if (process_file(table, ctable, path_and_name, -1, -1, ConsensusName, 
+            ConsensusSeq, options, message) != SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n\n", path_and_name, message->text);
+        }
+        else {
+            journal_file(path_and_name, hash);
+        }
+
+        fprintf(stderr, "\n");
+    } while ((_findnext(handle, &fileinfo)) == 0);
+
+    _findclose(handle);
+#else
+    if (Verbose > 1) {
+        fprintf(stderr, "%s: opening dir\n", dir);
+    }
+
+    if ((d = opendir(dir)) == NULL) {
+        error(dir, "couldn't open dir", errno);
+        return;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+#ifdef __WIN32
+        sprintf(path_and_name, "%s\\%s", dir, de->d_name);
+#else
+        sprintf(path_and_name, "%s/%s", dir, de->d_name);
+#endif
+        if (!in_shard(path_and_name)) {
+            continue;
+        }
+
+        if (stat(path_and_name, &statbuf) != 0) {
+            error(path_and_name, "can't stat", errno);
+            continue;
+        }
+
+        if (statbuf.st_mode & S_IFDIR) {    /* skip subdirectories */
+            if (Verbose > 2) {
+                fprintf(stderr, "%s: skipping subdirectory\n", path_and_name);
+            }
+            continue;
+        }
+        hash = input_hash(path_and_name, (long)statbuf.st_size,
+            (long)statbuf.st_mtime);
+        if (is_journaled(hash)) {
+            continue;
+        }
+
+        if ((NumThreads > 1) || (PrefetchDepth > 0)) {
+            if (add_to_file_list(&list, path_and_name, hash, message)
+                != SUCCESS)
+            {
+                fprintf(stderr, "%s: %s\n\n", path_and_name, message->text);
+                break;
+            }
+            continue;
+        }
+
+        if (process_file(table, ctable, path_and_name, -1, -1, ConsensusName, 
+            ConsensusSeq, options, message) != SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n\n", path_and_name, message->text);
+        }
+        else {
+            journal_file(path_and_name, hash);
+        }
+    }
+
+    closedir(d);
+
+    if (Verbose > 1) {
+        fprintf(stderr, "%s: closed dir\n", dir);
+    }
+#endif
+
+    if ((NumThreads > 1) || (PrefetchDepth > 0)) {
+        if (process_file_list(&list, message) != SUCCESS) {
+            fprintf(stderr, "%s: %s\n\n", dir, message->text);
+        }
+        release_file_list(&list);
+    }
+
+    return;
+}
+
+/*
+ * The output destinations which can be set separately for each request
+ * of the service mode (-serve).  Any other output goes where the command
+ * line options say.
+ */
+typedef struct {
+    char *flag;
+    int  *output;       /* whether to write the output */
+    int  *type;
+    char *dir;
+    int   multi_type;   /* whether type is a mask of NAME_* values */
+} ServeDest;
+
+static ServeDest ServeDests[] = {
+    { "-pd", &OutputPhd,   &PhdType,   PhdDirName,   0 },
+    { "-qd", &OutputQual,  &QualType,  QualDirName,  1 },
+    { "-sd", &OutputFasta, &FastaType, FastaDirName, 1 },
+    { "-fd", &OutputFastq, &FastqType, FastqDirName, 1 },
+    { "-cd", &OutputSCF,   &SCFType,   SCFDirName,   0 },
+};
+#define NUM_SERVE_DESTS (int)(sizeof(ServeDests) / sizeof(ServeDests[0]))
+
+/*
+ * This function returns the elapsed (wall clock) time in seconds since an
+ * arbitrary origin, to time the requests of the service mode.  Unlike
+ * clock(), it doesn't count the CPU time of the other threads.
+ */
+static double
+wall_seconds(void)
+{
+#ifdef __WIN32
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+#else
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/*
+ * This function processes one request of the service mode and writes its
+ * completion record.  Its synopsis is:
+ *
+ * result = serve_request(table, ctable, request, ..., out)
+ *
+ * where
+ *	request		is a line of the form
+ *			<sample_file> [ -pd|-qd|-sd|-fd|-cd <dir> ]...
+ *			The directories override those of the command line
+ *			for this request only
+ *	out		is the stream the completion record is written to.
+ *			The record is one line of the form
+ *			<sample_file> OK|ERROR <seconds> [<message>]
+ *
+ *	result		is 0 if the record was written, !0 otherwise
+ */
+static int
+serve_request(BtkLookupTable *table, ContextTable *ctable, char *request,
+    char *ConsensusName, char *ConsensusSeq, Options *defaults, FILE *out)
+{
+    char       *path, *flag, *dir, *last;
+    char        input[BUFLEN];
+    int         i, r, saved_output[NUM_SERVE_DESTS], saved_type[NUM_SERVE_DESTS];
+    char        saved_dir[NUM_SERVE_DESTS][BUFLEN];
+    Options     options = *defaults;
+    BtkMessage  message;
+    struct stat statbuf;
+    double      start = wall_seconds();
+
+    message.text[0] = '\0';
+    if ((path = strtok_r(request, " \t", &last)) == NULL) {
+        return SUCCESS;
+    }
+    for (i = 0; i < NUM_SERVE_DESTS; i++) {
+        saved_output[i] = *ServeDests[i].output;
+        saved_type[i]   = *ServeDests[i].type;
+        strcpy(saved_dir[i], ServeDests[i].dir);
+    }
+
+    r = SUCCESS;
+    while ((r == SUCCESS) && ((flag = strtok_r(NULL, " \t", &last)) != NULL))
+    {
+        for (i = 0; i < NUM_SERVE_DESTS; i++) {
+            if (strcmp(flag, ServeDests[i].flag) == 0) {
+                break;
+            }
+        }
+        if ((i == NUM_SERVE_DESTS) ||
+            ((dir = strtok_r(NULL, " \t", &last)) == NULL))
+        {
+            sprintf(message.text, "invalid option %.200s", flag);
+            r = ERROR;
+        }
+        else if ((stat(dir, &statbuf) != 0) || !(statbuf.st_mode & S_IFDIR))
+        {
+            sprintf(message.text, "%.200s is not a directory", dir);
+            r = ERROR;
+        }
+        else {
+            (*ServeDests[i].output)++;
+            *ServeDests[i].type = ServeDests[i].multi_type ?
+                (*ServeDests[i].type | NAME_DIR) : NAME_DIR;
+            (void)strncpy(ServeDests[i].dir, dir, BUFLEN - 1);
+            options.process_bases = 1;
+        }
+    }
+
+    if (r == SUCCESS) {
+        if (stat(path, &statbuf) != 0) {
+            sprintf(message.text, "can't stat: %s", strerror(errno));
+            r = ERROR;
+        }
+        else if (statbuf.st_mode & S_IFDIR) {
+            sprintf(message.text, "is a directory");
+            r = ERROR;
+        }
+    }
+
+    if (r == SUCCESS) {
+        /* The path may be changed by the processing, so use a copy */
+        (void)strncpy(input, path, sizeof(input) - 1);
+        input[sizeof(input) - 1] = '\0';
+        strcpy(options.path, input);
+        file_type = -1;
+        if ((r = process_sff_file(input, &options, &message))
+            == kWrongFileType)
+        {
+            r = process_sample_file(table, ctable, input, ConsensusName,
+                ConsensusSeq, &options, &message);
+        }
+        if (r == kWrongFileType) {
+            sprintf(message.text, "not an ABI, SCF or SFF file");
+        }
+        if ((r != SUCCESS) && (message.text[0] == '\0')) {
+            sprintf(message.text, "processing failed");
+        }
+    }
+
+    for (i = 0; i < NUM_SERVE_DESTS; i++) {
+        *ServeDests[i].output = saved_output[i];
+        *ServeDests[i].type   = saved_type[i];
+        strcpy(ServeDests[i].dir, saved_dir[i]);
+    }
+
+    /* The client may read the multi-files and the archive once the reply
+     * is sent
+     */
+    (void)Btk_flush_multi_files();
+    (void)Btk_flush_output_archive();
+
+    /* Trim the trailing newline of the message, if any */
+    if ((dir = strchr(message.text, '\n')) != NULL) {
+        *dir = '\0';
+    }
+    fprintf(out, "%s %s %.3f%s%s\n", path, (r == SUCCESS) ? "OK" : "ERROR",
+        wall_seconds() - start,
+        (r == SUCCESS) ? "" : " ", (r == SUCCESS) ? "" : message.text);
+    if (fflush(out) == EOF) {
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+/*
+ * This function reads newline-delimited requests from the specified stream
+ * and processes them until the end of the stream or a "quit" request.
+ * Its synopsis is:
+ *
+ * result = serve_stream(table, ctable, in, out, ...)
+ *
+ *	result		is 1 if a "quit" request was read, 0 otherwise
+ */
+static int
+serve_stream(BtkLookupTable *table, ContextTable *ctable, FILE *in, FILE *out,
+    char *ConsensusName, char *ConsensusSeq, Options *options)
+{
+    char line[BUFLEN], *s;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if ((s = strpbrk(line, "\r\n")) != NULL) {
+            *s = '\0';
+        }
+        if (strcmp(line, "quit") == 0) {
+            return 1;
+        }
+        if (serve_request(table, ctable, line, ConsensusName, ConsensusSeq,
+            options, out) != SUCCESS)
+        {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function runs the service mode: the lookup and context tables are
+ * loaded once and stay resident while the requests are processed one at
+ * a time, either from stdin (name is "-") or from the clients of a local
+ * Unix socket which is created with the specified name.  Its synopsis is:
+ *
+ * result = serve(table, ctable, name, ..., message)
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+serve(BtkLookupTable *table, ContextTable *ctable, char *name,
+    char *ConsensusName, char *ConsensusSeq, Options *options,
+    BtkMessage *message)
+{
+#ifndef __WIN32
+    struct sockaddr_un addr;
+    int   sock, conn, quit = 0;
+    FILE *in, *out;
+#endif
+
+    if (strcmp(name, "-") == 0) {
+        (void)serve_stream(table, ctable, stdin, stdout, ConsensusName,
+            ConsensusSeq, options);
+        return SUCCESS;
+    }
+#ifdef __WIN32
+    sprintf(message->text, "Unix sockets are not supported, use -serve -");
+    return ERROR;
+#else
+    if (strlen(name) >= sizeof(addr.sun_path)) {
+        sprintf(message->text, "socket name %.200s is too long", name);
+        return ERROR;
+    }
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        sprintf(message->text, "can't create socket: %s", strerror(errno));
+        return ERROR;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, name);
+    unlink(name);
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(sock, 5) != 0))
+    {
+        sprintf(message->text, "can't listen on %.200s: %s", name,
+            strerror(errno));
+        close(sock);
+        return ERROR;
+    }
+
+    /* A client going away must not terminate the service */
+    signal(SIGPIPE, SIG_IGN);
+    if (Verbose > 1) {
+        fprintf(stderr, "%s: waiting for requests\n", name);
+    }
+
+    while (!quit) {
+        if ((conn = accept(sock, NULL, NULL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sprintf(message->text, "can't accept: %s", strerror(errno));
+            break;
+        }
+        in  = fdopen(conn, "r");
+        out = fdopen(dup(conn), "w");
+        if ((in == NULL) || (out == NULL)) {
+            error(name, "can't open connection", errno);
+        }
+        else {
+            quit = serve_stream(table, ctable, in, out, ConsensusName,
+                ConsensusSeq, options);
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
+        if (in != NULL) {
+            fclose(in);
+        }
+        else {
+            close(conn);
+        }
+    }
+
+    close(sock);
+    unlink(name);
+    return quit ? SUCCESS : ERROR;
+#endif
+}
+
+/*
+ * A record of a per-shard multi-FASTA file: its ">name" line and all the
+ * lines up to the next record
+ */
+typedef struct {
+    char *name;     /* name of the sample file */
+    int   rank;     /* position of the sample file in the -if list */
+    int   seq;      /* position of the record in the shard files */
+    char *start;
+    long  len;
+} ShardRecord;
+
+typedef struct {
+    char *name;
+    int   rank;
+} RankedName;
+
+static int
+compare_ranked_names(const void *a, const void *b)
+{
+    return strcmp(((RankedName *)a)->name, ((RankedName *)b)->name);
+}
+
+static int
+compare_shard_records(const void *a, const void *b)
+{
+    ShardRecord *r1 = (ShardRecord *)a, *r2 = (ShardRecord *)b;
+    int          c;
+
+    if (r1->rank != r2->rank) {
+        return (r1->rank < r2->rank) ? -1 : 1;
+    }
+    if ((c = strcmp(r1->name, r2->name)) != 0) {
+        return c;
+    }
+    return r1->seq - r2->seq;
+}
+
+/*
+ * This function reads the whole of the specified file into a buffer.
+ * A missing file is read as an empty one, because a shard which has not
+ * produced any output has not created its output files.  Its synopsis is:
+ *
+ * result = read_whole_file(path, &buf, &size, message)
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+read_whole_file(char *path, char **buf, long *size, BtkMessage *message)
+{
+    FILE *fp;
+
+    *buf  = NULL;
+    *size = 0;
+    if ((fp = fopen(path, "rb")) == NULL) {
+        return (errno == ENOENT) ? SUCCESS : ERROR;
+    }
+    if ((fseek(fp, 0L, SEEK_END) != 0) || ((*size = ftell(fp)) < 0) ||
+        (fseek(fp, 0L, SEEK_SET) != 0))
+    {
+        sprintf(message->text, "%.200s: can't get the size", path);
+        goto error;
+    }
+    *buf = CALLOC(char, *size + 1);
+    MEM_ERROR(*buf);
+    if ((long)fread(*buf, 1, *size, fp) != *size) {
+        sprintf(message->text, "%.200s: couldn't read", path);
+        goto error;
+    }
+    (void)fclose(fp);
+    return SUCCESS;
+
+error:
+    (void)fclose(fp);
+    FREE(*buf);
+    *size = 0;
+    return ERROR;
+}
+
+/*
+ * This function merges the multi-FASTA files of the specified name from
+ * all the shard directories into one file of that name in MergeDirName.
+ * The records are written in the order of the -if list, if any, and in
+ * the order of the sample file names otherwise.  Its synopsis is:
+ *
+ * result = merge_multi_fasta_files(file_name, dirs, num_dirs, order,
+ *                                  num_order, message)
+ *
+ * where
+ *	file_name	is the name of the file, sans path
+ *	dirs		is an array of the shard directories
+ *	order		is an array of the names of the sample files of the
+ *			-if list, sorted by name, or NULL
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+merge_multi_fasta_files(char *file_name, char **dirs, int num_dirs,
+    RankedName *order, int num_order, BtkMessage *message)
+{
+    char       **bufs = NULL, *s, *e, path[MAXPATHLEN];
+    long         size;
+    int          i, len, num_records = 0, max_records = 0;
+    ShardRecord *records = NULL, *r;
+    RankedName   key, *found;
+    FILE        *out = NULL;
+
+    bufs = CALLOC(char *, num_dirs);
+    MEM_ERROR(bufs);
+
+    for (i = 0; i < num_dirs; i++) {
+        sprintf(path, "%s/%s", dirs[i], file_name);
+        if (read_whole_file(path, &bufs[i], &size, message) != SUCCESS) {
+            if (message->text[0] == '\0') {
+                sprintf(message->text, "%.200s: couldn't open: %s", path,
+                    strerror(errno));
+            }
+            goto error;
+        }
+
+        /* Split the file into records */
+        for (s = bufs[i]; (s != NULL) && (s < bufs[i] + size); s = e) {
+            for (e = s + 1; e < bufs[i] + size; e++) {
+                if ((e[-1] == '\n') && (e[0] == '>')) {
+                    break;
+                }
+            }
+            if (*s != '>') {
+                sprintf(message->text, "%.200s: not a multi-FASTA file", path);
+                goto error;
+            }
+            if (num_records == max_records) {
+                max_records += FILE_LIST_CHUNK;
+                r = REALLOC(records, ShardRecord, max_records);
+                MEM_ERROR(r);
+                records = r;
+            }
+            r = &records[num_records];
+            len = strcspn(s + 1, " \t\r\n");
+            r->name = CALLOC(char, len + 1);
+            MEM_ERROR(r->name);
+            strncpy(r->name, s + 1, len);
+            r->rank = INT_MAX;
+            if (order != NULL) {
+                key.name = r->name;
+                if ((found = bsearch(&key, order, num_order,
+                    sizeof(RankedName), compare_ranked_names)) != NULL)
+                {
+                    r->rank = found->rank;
+                }
+            }
+            r->seq   = num_records;
+            r->start = s;
+            r->len   = e - s;
+            num_records++;
+        }
+    }
 
-	if (process_file(table, ctable, line, -1, -1, ConsensusName, 
-            ConsensusSeq, options, message) != SUCCESS) 
-        {
-	    fprintf(stderr, "%s: %s\n", line, message->text);
-	}
-	fprintf(stderr,"\n");
+    qsort(records, num_records, sizeof(ShardRecord), compare_shard_records);
+
+    sprintf(path, "%s/%s", MergeDirName, file_name);
+    if (num_records > 0) {
+        if ((out = fopen(path, "w")) == NULL) {
+            sprintf(message->text, "%.200s: couldn't open: %s", path,
+                strerror(errno));
+            goto error;
+        }
+        for (i = 0; i < num_records; i++) {
+            (void)fwrite(records[i].start, 1, records[i].len, out);
+        }
+        if (fclose(out) != 0) {
+            out = NULL;
+            sprintf(message->text, "%.200s: couldn't write", path);
+            goto error;
+        }
+        out = NULL;
     }
-    if (ferror(fp)) {
-	error(fileoffiles, "couldn't read", errno);
-	r = ERROR;
-	goto error;
+    else {
+        unlink(path);
     }
-
-    (void)fclose(fp);
     if (Verbose > 1) {
-	(void)fprintf(stderr, "%s: closed file-of-files\n", fileoffiles);
+        fprintf(stderr, "%s: merged %d records\n", path, num_records);
+    }
+
+    for (i = 0; i < num_records; i++) {
+        FREE(records[i].name);
+    }
+    FREE(records);
+    for (i = 0; i < num_dirs; i++) {
+        FREE(bufs[i]);
     }
+    FREE(bufs);
     return SUCCESS;
 
 error:
-    (void)fclose(fp);
-    return r;
+    if (out != NULL) {
+        (void)fclose(out);
+    }
+    for (i = 0; i < num_records; i++) {
+        FREE(records[i].name);
+    }
+    FREE(records);
+    if (bufs != NULL) {
+        for (i = 0; i < num_dirs; i++) {
+            FREE(bufs[i]);
+        }
+    }
+    FREE(bufs);
+    return ERROR;
 }
 
 /*
- * This function processes all files contained in the specified directory.
- * Its synopsis is:
- *
- * result = process_dir(table, ctable, dir, ...)
+ * This function adds the data of the quality report written by a shard
+ * to the specified quality report data.  The average of the report is
+ * used in place of the exact sum if the report was not written by a
+ * sharded run.  Its synopsis is:
  *
- * where
- *	table		is the address of a BtkLookupTable returned by
- *			Btk_read_lookup_table()
- *      ctable          is the address of a ContextTable returned by
- *                      read_context_table()
- *	dir		is the name (path) of a directory
+ * result = read_qual_report(path, qual_data, message)
  *
- *	Routine prints out its own error messages as needed.
+ *	result		is 0 on success, !0 if an error occurs
  */
-static void
-process_dir(BtkLookupTable *table, ContextTable *ctable,
-    char *dir, char *ConsensusName, char *ConsensusSeq,
-    Options *options, BtkMessage *message)
+static int
+read_qual_report(char *path, struct Qual_data_struct *qual_data,
+    BtkMessage *message)
 {
-#ifndef __DEVSTUDIO
-    DIR *d;
-    struct dirent *de;
-    struct stat statbuf;
-#else
-    long handle;
-    char filespec[MAXPATHLEN];
-    struct _finddata_t fileinfo;
-    struct _stat buffer;
-#endif
-    char path_and_name[MAXPATHLEN];
-
-#ifdef __DEVSTUDIO
-    sprintf(filespec, "%s\\*.*", dir);
-    handle = _findfirst(filespec, &fileinfo);
-
-    do {
-        sprintf(path_and_name, "%s\\%s", dir, fileinfo.name);
+    FILE *fp;
+    char  line[BUFLEN];
+    int   lo, hi, number_over_20, trimmed_lengths, average = 0, total = -1;
+    int   num_of_files = 0, in_table = 0;
 
-        if (_stat(path_and_name, &buffer) != 0) {
-            error(path_and_name, "can't stat", errno);
-            continue;
+    if ((fp = fopen(path, "r")) == NULL) {
+        return (errno == ENOENT) ? SUCCESS : ERROR;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "---------", 9) == 0) {
+            in_table = 1;
         }
-
-        if (buffer.st_mode & _S_IFDIR) {    /* skip subdirectories */
-            if (Verbose > 2) {
-                fprintf(stderr, "%s: skipping subdirectory\n", path_and_name);
-            }
-            continue;
+        else if (sscanf(line, "Average %d", &average) == 1) {
+            in_table = 0;
         }
-
-        if (process_file(table, ctable, path_and_name, -1, -1, ConsensusName, 
-            ConsensusSeq, options, message) != SUCCESS)
+        else if (sscanf(line, "Total %d", &total) == 1) {
+            ;
+        }
+        else if (in_table && (sscanf(line, "%d-%d %d %d", &lo, &hi,
+            &number_over_20, &trimmed_lengths) == 4))
         {
-            fprintf(stderr, "%s: %s\n\n", path_and_name, message->text);
+            if ((lo < 0) || (lo / 10 >= MAXBIN)) {
+                sprintf(message->text, "%.200s: invalid bucket %d-%d", path,
+                    lo, hi);
+                (void)fclose(fp);
+                return ERROR;
+            }
+            qual_data->number_over_20[lo / 10]  += number_over_20;
+            qual_data->trimmed_lengths[lo / 10] += trimmed_lengths;
+            num_of_files += number_over_20;
         }
+    }
+    (void)fclose(fp);
 
-        fprintf(stderr, "\n");
-    } while ((_findnext(handle, &fileinfo)) == 0);
+    qual_data->sum_number += (total >= 0) ? total : average * num_of_files;
+    return SUCCESS;
+}
 
-    _findclose(handle);
-#else
-    if (Verbose > 1) {
-        fprintf(stderr, "%s: opening dir\n", dir);
-    }
+/*
+ * This function merges the results of the shards of a sharded run
+ * (-shard K/N): the four multi-FASTA files written with -o and the
+ * quality report, which the shards are expected to write with
+ * -qr <dir>/tt.qr.  The merged files are written to MergeDirName.
+ * Its synopsis is:
+ *
+ * result = merge_shards(dirs, num_dirs, fileoffiles, message)
+ *
+ * where
+ *	dirs		is an array of the shard directories
+ *	fileoffiles	is the name of the -if list of the run, or NULL
+ *
+ *	result		is 0 on success, !0 if an error occurs
+ */
+static int
+merge_shards(char **dirs, int num_dirs, char *fileoffiles,
+    BtkMessage *message)
+{
+    static char *file_names[] = { "tt.seq", "tt.qual", "tt.pos", "tt.status" };
+    char         line[BUFLEN], path[MAXPATHLEN], *s, *name;
+    int          i, r = ERROR, num_order = 0;
+    RankedName  *order = NULL, *ranked;
+    struct Qual_data_struct *qual_data = NULL;
+    FILE        *fp = NULL;
 
-    if ((d = opendir(dir)) == NULL) {
-        error(dir, "couldn't open dir", errno);
-        return;
+    message->text[0] = '\0';
+    if (num_dirs <= 0) {
+        sprintf(message->text, "no shard directories are specified");
+        return ERROR;
     }
 
-    while ((de = readdir(d)) != NULL) {
+    if (fileoffiles != NULL) {
+        if ((fp = fopen(fileoffiles, "r")) == NULL) {
+            sprintf(message->text, "%.200s: couldn't open: %s", fileoffiles,
+                strerror(errno));
+            return ERROR;
+        }
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if ((s = strchr(line, '\n')) != NULL) {
+                *s = '\0';
+            }
 #ifdef __WIN32
-        sprintf(path_and_name, "%s\\%s", dir, de->d_name);
+            if ((name = strrchr(line, '\\')) != NULL) {
 #else
-        sprintf(path_and_name, "%s/%s", dir, de->d_name);
+            if ((name = strrchr(line, '/')) != NULL) {
 #endif
-
-        if (stat(path_and_name, &statbuf) != 0) {
-            error(path_and_name, "can't stat", errno);
-            continue;
-        }
-
-        if (statbuf.st_mode & S_IFDIR) {    /* skip subdirectories */
-            if (Verbose > 2) {
-                fprintf(stderr, "%s: skipping subdirectory\n", path_and_name);
+                name++;
             }
-            continue;
+            else {
+                name = line;
+            }
+            if (num_order % FILE_LIST_CHUNK == 0) {
+                ranked = REALLOC(order, RankedName,
+                    num_order + FILE_LIST_CHUNK);
+                MEM_ERROR(ranked);
+                order = ranked;
+            }
+            order[num_order].name = CALLOC(char, strlen(name) + 1);
+            MEM_ERROR(order[num_order].name);
+            strcpy(order[num_order].name, name);
+            order[num_order].rank = num_order;
+            num_order++;
         }
+        (void)fclose(fp);
+        fp = NULL;
+        qsort(order, num_order, sizeof(RankedName), compare_ranked_names);
+    }
 
-        if (process_file(table, ctable, path_and_name, -1, -1, ConsensusName, 
-            ConsensusSeq, options, message) != SUCCESS)
+    for (i = 0; i < 4; i++) {
+        if (merge_multi_fasta_files(file_names[i], dirs, num_dirs, order,
+            num_order, message) != SUCCESS)
         {
-            fprintf(stderr, "%s: %s\n\n", path_and_name, message->text);
+            goto error;
         }
-
     }
 
-    closedir(d);
-
-    if (Verbose > 1) {
-        fprintf(stderr, "%s: closed dir\n", dir);
+    qual_data = CALLOC(struct Qual_data_struct, 1);
+    MEM_ERROR(qual_data);
+    for (i = 0; i < num_dirs; i++) {
+        sprintf(path, "%s/tt.qr", dirs[i]);
+        if (read_qual_report(path, qual_data, message) != SUCCESS) {
+            if (message->text[0] == '\0') {
+                sprintf(message->text, "%.200s: couldn't open: %s", path,
+                    strerror(errno));
+            }
+            goto error;
+        }
     }
-#endif
+    sprintf(path, "%s/tt.qr", MergeDirName);
+    output_qual_report(qual_data, path);
+    r = SUCCESS;
 
-    return;
+error:
+    if (fp != NULL) {
+        (void)fclose(fp);
+    }
+    FREE(qual_data);
+    for (i = 0; i < num_order; i++) {
+        FREE(order[i].name);
+    }
+    FREE(order);
+    return r;
 }
 
 /*******************************************************************************
@@ -1488,7 +3446,7 @@ int
 main(int argc, char *argv[])
 {
     char           *args, *lut_name = NULL, *context_table = NULL;
-    int             i, j, optind, listtype=0;
+    int             i, j, optind, listtype=0, no_arg;
     struct stat     statbuf;
     BtkMessage      message;
     BtkLookupTable *table = NULL;
@@ -1512,6 +3470,15 @@ main(int argc, char *argv[])
     options.process_bases = 0;
     InputName[0]    = '\0';
     InputType       = NAME_FILES;
+    JournalName[0]  = '\0';
+    Journal         = NULL;
+    Resume          = 0;
+    ShardIndex      = 0;
+    NumShards       = 0;
+    Merge           = 0;
+    MergeDirName[0] = '\0';
+    Serve           = 0;
+    ServeName[0]    = '\0';
     options.inp_phd = 0;
     options.inp_phd_dir[0]='\0';
     ConsensusSpecified = 0;
@@ -1575,8 +3542,9 @@ main(int argc, char *argv[])
     multiseqFileName[0]  = '\0';
     multifastqFileName[0]	= '\0';
     MultiFastaFilesDirName[0] = '\0';
-    status_code[0]            = '\0';
     OutputFourMultiFastaFiles = 0;
+    NumThreads                = 1;
+    PrefetchDepth             = 0;
 
 
     /*
@@ -1589,22 +3557,33 @@ main(int argc, char *argv[])
             break;
         }
 
+        /* Whether the next argument is missing or is an option; a lone
+         * "-" (stdin) is an argument
+         */
+        no_arg = (optind == argc - 1) || ((argv[optind + 1][0] == '-') &&
+                 (argv[optind + 1][1] != '\0'));
+
         /* Make sure there is an option argument for those options which are
          * supposed to have an argument
          */
-        if (((optind == argc - 1) || (argv[optind + 1][0] == '-')) &&
+        if (no_arg &&
             ((strcmp(argv[optind], "-C" )             == 0) ||
              (strcmp(argv[optind], "-cd")             == 0) ||
+             (strcmp(argv[optind], "-archive")        == 0) ||
+             (strcmp(argv[optind], "-bin")            == 0) ||
              (strcmp(argv[optind], "-ct")             == 0) ||
              (strcmp(argv[optind], "-dd"  )           == 0) ||
              (strcmp(argv[optind], "-ipd")            == 0) ||
+             (strcmp(argv[optind], "-journal")        == 0) ||
              (strcmp(argv[optind], "-id")             == 0) || 
              (strcmp(argv[optind], "-if")             == 0) ||
              (strcmp(argv[optind], "-indloc")         == 0) ||
              (strcmp(argv[optind], "-indsize")        == 0) ||
              (strcmp(argv[optind], "-min_ratio")      == 0)  ||
+             (strcmp(argv[optind], "-merge")          == 0) ||
              (strcmp(argv[optind],  "-o")             == 0) ||
              (strcmp(argv[optind], "-pd")             == 0) ||
+             (strcmp(argv[optind], "-prefetch")       == 0) ||
              (strcmp(argv[optind], "-qd")             == 0) ||
              (strcmp(argv[optind], "-qa")             == 0) ||
              (strcmp(argv[optind], "-qr")             == 0) ||
@@ -1612,11 +3591,14 @@ main(int argc, char *argv[])
              (strcmp(argv[optind], "-fa")             == 0) ||
              (strcmp(argv[optind], "-sd")             == 0) ||
              (strcmp(argv[optind], "-sa")             == 0) ||
+             (strcmp(argv[optind], "-serve")          == 0) ||
+             (strcmp(argv[optind], "-shard")          == 0) ||
              (strcmp(argv[optind], "-t" )             == 0) ||
              (strcmp(argv[optind], "-tipd")           == 0) ||
              (strcmp(argv[optind], "-tabd")           == 0) ||
              (strcmp(argv[optind], "-tald")           == 0) ||
              (strcmp(argv[optind], "-hprd")           == 0) ||
+             (strcmp(argv[optind], "-threads")        == 0) ||
              (strcmp(argv[optind], "-trim_window")    == 0) ||
              (strcmp(argv[optind], "-trim_threshold") == 0)))
         {
@@ -1627,7 +3609,7 @@ main(int argc, char *argv[])
 
         /* Make sure that all the flags are from alowed list
          */
-        if (((optind == argc-1) || (argv[optind + 1][0] == '-')) &&
+        if (no_arg &&
             ((strcmp(argv[optind], "-h")            != 0) &&
              (strcmp(argv[optind], "-dev")          != 0) && 
              (strcmp(argv[optind], "-opts")         != 0) &&
@@ -1641,6 +3623,8 @@ main(int argc, char *argv[])
              (strcmp(argv[optind], "-ladder")       != 0) &&
              (strcmp(argv[optind], "-edited_bases") != 0) &&
              (strcmp(argv[optind], "-raw")          != 0) &&
+             (strcmp(argv[optind], "-resume")       != 0) &&
+             (strcmp(argv[optind], "-share_tables") != 0) &&
              (strcmp(argv[optind], "-indel_detect") != 0) &&
              (strcmp(argv[optind], "-indel_resolve")!= 0) &&
              (strcmp(argv[optind], "-mc")           != 0) &&
@@ -1709,6 +3693,30 @@ main(int argc, char *argv[])
                     fprintf(stderr, "\nInvalid option specified.\n");
                     exit(2);
                 }
+            case 'a':
+                if (strcmp(args, "-archive") == 0) {
+                    (void)strncpy(ArchiveName, argv[++optind],
+                                  sizeof(ArchiveName));
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
+                else {
+                    usage(argc, argv);
+                    fprintf(stderr, "\nInvalid option specified.\n");
+                    exit(2);
+                }
+            case 'b':
+                if (strcmp(args, "-bin") == 0) {
+                    (void)strncpy(ColumnsName, argv[++optind],
+                                  sizeof(ColumnsName));
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
+                else {
+                    usage(argc, argv);
+                    fprintf(stderr, "\nInvalid option specified.\n");
+                    exit(2);
+                }
             case 'C':
                 if (strcmp(args, "-C") == 0) {
                     ConsensusSpecified++;
@@ -1882,6 +3890,18 @@ main(int argc, char *argv[])
                 listtype = i;
                 break;
 
+            case 'j':
+                if (strcmp(args, "-journal") == 0) {
+                    (void)strncpy(JournalName, argv[++optind],
+                                  sizeof(JournalName));
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
+                else {
+                    usage(argc, argv);
+                    exit(2);
+                }
+
             case 'l':
                 if (strcmp(args, "-ladder") == 0)
                     options.ladder++;
@@ -1896,6 +3916,12 @@ main(int argc, char *argv[])
                 if (strcmp(args, "-mix") == 0) {
                     options.mix++;
                 }
+                else if (strcmp(args, "-merge") == 0) {
+                    Merge++;
+                    (void)strncpy(MergeDirName, argv[++optind],
+                                  sizeof(MergeDirName));
+                    validateDirectory(MergeDirName, &options);
+                }
                 else if (strcmp(args, "-min_ratio") == 0) {
                     options.min_ratio = (float)atof(argv[++optind]);   
                 }
@@ -1947,6 +3973,15 @@ main(int argc, char *argv[])
                 break;
 
             case 'p':
+                if (strcmp(args, "-prefetch") == 0) {
+                    PrefetchDepth = atoi(argv[++optind]);
+                    j = strlen(args) - 1;  /* break out of inner loop */
+                    if (PrefetchDepth < 0) {
+                        usage(argc, argv);
+                        exit(2);
+                    }
+                    break;
+                }
                 listtype = i;
                 OutputPhd++;
                 break;
@@ -1998,6 +4033,8 @@ main(int argc, char *argv[])
                     options.recallndb++;
                 else if (strcmp(args, "-raw") == 0) 
                     options.raw_data++;         
+                else if (strcmp(args, "-resume") == 0)
+                    Resume++;
                 else {
                     usage(argc, argv);
                     exit(2);
@@ -2030,6 +4067,30 @@ main(int argc, char *argv[])
                     j = strlen(args) - 1;   /* break out of inner loop */
                     break;
                 }
+                else if (strcmp(args, "-shard") == 0) {
+                    if ((sscanf(argv[++optind], "%d/%d", &ShardIndex,
+                        &NumShards) != 2) || (NumShards <= 0) ||
+                        (ShardIndex <= 0) || (ShardIndex > NumShards))
+                    {
+                        usage(argc, argv);
+                        fprintf(stderr, "\nInvalid shard specified.\n");
+                        exit(2);
+                    }
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
+                else if (strcmp(args, "-share_tables") == 0) {
+                    Btk_share_tables(1);
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
+                else if (strcmp(args, "-serve") == 0) {
+                    Serve++;
+                    (void)strncpy(ServeName, argv[++optind],
+                                  sizeof(ServeName));
+                    j = strlen(args) - 1;   /* break out of inner loop */
+                    break;
+                }
                 else if (strcmp(args, "-sd") == 0) {
                     OutputFasta++;
                     FastaType |= NAME_DIR;
@@ -2087,6 +4148,15 @@ main(int argc, char *argv[])
                     j = strlen(args) - 1;   /* break out of inner loop */
                     break;
                 }
+                else if (strcmp(args, "-threads") == 0) {
+                    NumThreads = atoi(argv[++optind]);
+                    j = strlen(args) - 1;  /* break out of inner loop */
+                    if (NumThreads <= 0) {
+                        usage(argc, argv);
+                        exit(2);
+                    }
+                    break;
+                }
                 else if (strcmp(args, "-trim_window") == 0) {
                     trim_window = atoi(argv[++optind]);
                     j = strlen(args) - 1;  /* break out of inner loop */
@@ -2184,6 +4254,54 @@ main(int argc, char *argv[])
         }
     }
 
+    /* The journal matches the files processed with the same options, except
+     * for those which do not affect the results, such as the verbosity.
+     * The sample files are matched by themselves (see input_hash), so the
+     * -id and -if arguments which name them are left out too.
+     */
+    OptionsHash = 14695981039346656037ULL;
+    for (i = 1; i < optind; i++) {
+        if ((strcmp(argv[i], "-journal") == 0) ||
+            (strcmp(argv[i], "-threads") == 0) ||
+            (strcmp(argv[i], "-prefetch") == 0) ||
+            (strcmp(argv[i], "-id") == 0) ||
+            (strcmp(argv[i], "-if") == 0))
+        {
+            i++;
+        }
+        else if ((strcmp(argv[i], "-resume") != 0) &&
+                 (strcmp(argv[i], "-share_tables") != 0) &&
+                 (strcmp(argv[i], "-time") != 0) &&
+                 (strcmp(argv[i], "-opts") != 0) &&
+                 ((argv[i][1] == '\0') ||
+                  (strspn(argv[i] + 1, "QV") != strlen(argv[i] + 1))))
+        {
+            OptionsHash = journal_hash(OptionsHash, argv[i],
+                strlen(argv[i]) + 1);
+        }
+    }
+    if (Resume && (JournalName[0] == '\0')) {
+        usage(argc, argv);
+        fprintf(stderr, "\nOption -resume requires -journal <file>\n");
+        exit(2);
+    }
+    if (Resume && (ColumnsName[0] != '\0')) {
+        usage(argc, argv);
+        fprintf(stderr, "\nOption -bin can't be used with -resume\n");
+        exit(2);
+    }
+
+    if (Merge) {
+        if (merge_shards(&argv[optind], argc - optind,
+            (InputType == NAME_FILEOFFILES) ? InputName : NULL, &message)
+            != SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0], message.text);
+            exit_message(&options, 1);
+        }
+        return SUCCESS;
+    }
+
     if ((dev == 0) &&
         (options.shift || options.renorm || options.respace ||
          options.raw_data || options.xgr || options.multicomp ||
@@ -2196,6 +4314,7 @@ main(int argc, char *argv[])
 
     if (OutputPhd || OutputQual || OutputFasta || OutputFastq ||
         OutputQualRpt || OutputSCF || OutputFourMultiFastaFiles ||
+        (ColumnsName[0] != '\0') ||
         (options.tal_dir[0] != '\0') || (options.tip_dir[0] != '\0') ||
         (options.tab_dir[0] != '\0') || (options.hpr_dir[0] != '\0') || 
         options.mix || options.poly || options.indel_detect || 
@@ -2225,7 +4344,8 @@ main(int argc, char *argv[])
          (options.tip_dir[0] == '\0')  && (options.tab_dir[0] == '\0') && 
          (options.hpr_dir[0] == '\0') && !options.poly && 
          !options.indel_detect && !options.indel_resolve &&
-        !options.raw_data && !options.xgr && !OutputFourMultiFastaFiles) 
+        !options.raw_data && !options.xgr && !OutputFourMultiFastaFiles &&
+        (ColumnsName[0] == '\0') && !Serve)
     {
         usage(argc, argv);
 	(void)fprintf(stderr, "%s: no output type specified\n", argv[0]);
@@ -2238,16 +4358,17 @@ main(int argc, char *argv[])
         exit(2);
     }
 
-    if (multiqualFileName[0] != '\0') {
-        unlink(multiqualFileName);
-    }
-
-    if (multiseqFileName[0] != '\0') {
-        unlink(multiseqFileName);
-    }
-
-    if (multifastqFileName[0] != '\0') {
-        unlink(multifastqFileName);
+    /* A resumed run appends to the files of the previous ones */
+    if (!Resume) {
+        if (multiqualFileName[0] != '\0') {
+            unlink(multiqualFileName);
+        }
+        if (multiseqFileName[0] != '\0') {
+            unlink(multiseqFileName);
+        }
+        if (multifastqFileName[0] != '\0') {
+            unlink(multifastqFileName);
+        }
     }
 
     /*
@@ -2282,35 +4403,35 @@ main(int argc, char *argv[])
         if ((lut_name == NULL) && (options.lut_type != 0)) 
         {
             if (options.lut_type == ABI3700pop5) {
-                table = Btk_get_3700pop5_table();
+                table = Btk_registry_builtin_table(ABI3700pop5);
                 if (Verbose > 1) {
                     fprintf(stderr,
                         "Using a built-in 3700 Pop-5 table for this run.\n");
                 }
             }
             else if (options.lut_type == ABI3700pop6) {
-                table = Btk_get_3700pop6_table();
+                table = Btk_registry_builtin_table(ABI3700pop6);
                 if (Verbose > 1) {
                     fprintf(stderr,
                              "Using a built-in 3700 Pop-6 table for this run.\n");
                 }
             }
             else if (options.lut_type == ABI3730pop7) {
-                table = Btk_get_3730pop7_table();
+                table = Btk_registry_builtin_table(ABI3730pop7);
                 if (Verbose > 1) {
                     fprintf(stderr,
                              "Using a built-in 3730 Pop-7 table for this run.\n");
                 }
             }
             else if (options.lut_type == ABI3100) {
-                table = Btk_get_3100pop6_table();
+                table = Btk_registry_builtin_table(ABI3100);
                 if (Verbose > 1) {
                     fprintf(stderr,
                              "Using a built-in 3100 Pop-6 table for this run.\n");
                 }
             }
             else if (options.lut_type == MegaBACE) {
-                table = Btk_get_mbace_table();
+                table = Btk_registry_builtin_table(MegaBACE);
                 if (Verbose > 1) {
                     fprintf(stderr,
                     "Using a built-in MegaBACEtable for this run.\n");
@@ -2355,7 +4476,7 @@ main(int argc, char *argv[])
          */
         if ((lut_name != NULL) && (table == NULL))
         {
-            if ((table = Btk_read_lookup_table(lut_name)) == NULL) {
+            if ((table = Btk_registry_lookup_table(lut_name)) == NULL) {
                 fprintf(stderr, 
                    "Couldn't read lookup table '%s'.\n",
                       lut_name);
@@ -2379,7 +4500,7 @@ main(int argc, char *argv[])
 
     /* Read the context table */
     if (context_table != NULL) {
-        if ((ctable = read_context_table(context_table)) == NULL) {
+        if ((ctable = Btk_registry_context_table(context_table)) == NULL) {
             fprintf(stderr, 
                 "Couldn't read the context table '%s'\n", context_table);
             exit_message(&options, 1);
@@ -2400,6 +4521,14 @@ main(int argc, char *argv[])
 	}
     }
 
+    if ((ConsensusSeq != NULL) && (options.tal_dir[0] != '\0')) {
+        if (Btk_create_tal_index(&TalIndex, ConsensusSeq, Match, MisMatch,
+                Insertion, Deletion, &message) == ERROR) {
+            fprintf(stderr, "%s", message.text);
+            Btk_release_tal_index(&TalIndex);
+        }
+    }
+
     if (OutputFourMultiFastaFiles)
     {
         sprintf(multiseqsFileName, "%s/tt.seq",    MultiFastaFilesDirName);
@@ -2407,16 +4536,62 @@ main(int argc, char *argv[])
         sprintf(multilocsFileName, "%s/tt.pos",    MultiFastaFilesDirName);
         sprintf(multistatFileName, "%s/tt.status", MultiFastaFilesDirName);
 
-        unlink(multiseqsFileName);
-        unlink(multiqualFileName);
-        unlink(multilocsFileName);
-        unlink(multistatFileName);
+        /* A resumed run appends to the files of the previous ones */
+        if (!Resume) {
+            unlink(multiseqsFileName);
+            unlink(multiqualFileName);
+            unlink(multilocsFileName);
+            unlink(multistatFileName);
+        }
+    }
+
+    /* Opened before the outputs, which a resumed run may truncate */
+    if ((JournalName[0] != '\0') &&
+        ((InputType == NAME_DIR) || (InputType == NAME_FILEOFFILES)))
+    {
+        if (open_journal(&message) != SUCCESS) {
+            fprintf(stderr, "%s: %s\n", argv[0], message.text);
+            exit_message(&options, 1);
+        }
+    }
+
+    if (ArchiveName[0] != '\0') {
+        if (Btk_open_output_archive(ArchiveName, Resume, &message)
+            != SUCCESS)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0], message.text);
+            exit_message(&options, 1);
+        }
+    }
+
+    if (ColumnsName[0] != '\0') {
+        if (Btk_open_columns_file(ColumnsName, &message) != SUCCESS) {
+            fprintf(stderr, "%s: %s\n", argv[0], message.text);
+            exit_message(&options, 1);
+        }
     }
 
-    if (optind == argc)
+    if (Serve) {
+        if (optind != argc) {
+            usage(argc, argv);
+            fprintf(stderr, "\nNo input data may be specified with -serve\n");
+            exit_message(&options, 2);
+        }
+        if (serve(table, ctable, ServeName, ConsensusName, ConsensusSeq,
+            &options, &message) != SUCCESS)
+        {
+            if (message.text[0] != '\0') {
+                fprintf(stderr, "%s: %s\n", argv[0], message.text);
+            }
+        }
+        InputType = NAME_NONE;
+    }
+    else if (optind == argc)
         fprintf(stderr, "No input data is specified\n");
 
     switch (InputType) {
+    case NAME_NONE:
+        break;
     case NAME_FILES:
 	for (i = optind; i < argc; i++) 
         {
@@ -2489,10 +4664,20 @@ main(int argc, char *argv[])
     }
 
     /* Clean up. */
-    if (!options.nocall)
-        Btk_destroy_lookup_table(table);
-    destroy_context_table(ctable);
+    Btk_release_tables();
+    Btk_release_tal_index(&TalIndex);
+    (void)Btk_close_multi_files();
+    if (Btk_close_output_archive(&message) != SUCCESS) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], ArchiveName, message.text);
+    }
+    if (Btk_close_columns_file(&message) != SUCCESS) {
+        fprintf(stderr, "%s: %s\n", argv[0], message.text);
+    }
     FREE(ConsensusSeq);
+    if (Journal != NULL) {
+        (void)fclose(Journal);
+    }
+    FREE(Journaled);
 
     return SUCCESS;
 }
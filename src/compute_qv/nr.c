@@ -26,17 +26,18 @@
 // NB: Need permission to include this in any commercial product
 
 #include "nr.h"
+#include "util.h"
 // #include "nrutil.h"
 #include <math.h>
 
-static float sqrarg;
+static TT_THREAD_LOCAL float sqrarg;
 #define SQR(a) ((sqrarg=(a)) == 0.0 ? 0.0 : sqrarg*sqrarg)
 
-static float maxarg1,maxarg2;
+static TT_THREAD_LOCAL float maxarg1,maxarg2;
 #define FMAX(a,b) (maxarg1=(a),maxarg2=(b),(maxarg1) > (maxarg2) ?\
         (maxarg1) : (maxarg2))
 
-static int iminarg1,iminarg2;
+static TT_THREAD_LOCAL int iminarg1,iminarg2;
 #define IMIN(a,b) (iminarg1=(a),iminarg2=(b),(iminarg1) < (iminarg2) ?\
         (iminarg1) : (iminarg2))
 
@@ -39,13 +39,12 @@
 #define SUCCESS 0
 #define ERROR -1
 
-static char status_code[BUFLEN];
-
 int
 main(int argc, char *argv[])
 {
     uint8_t *quality_values;
     int      edited_bases = 0, file_type = -1;
+    BtkReadContext context;
     char     file_name[256];
     char    *called_bases=NULL, *call_method=NULL, *chemistry=NULL;
     int      num_called_bases=0, *called_peak_locs, num_datapoints;
@@ -74,12 +73,13 @@ main(int argc, char *argv[])
     }
     options.inp_phd = 0;
     fprintf(stderr, "File name   = %s\n", file_name);
+    Btk_init_read_context(&context);
   
     if (Btk_read_sample_file(file_name, &num_called_bases, &called_bases,
         edited_bases, &called_peak_locs, &quality_values,
         &num_datapoints, &chromatogram[0], &chromatogram[1],
         &chromatogram[2], &chromatogram[3], &call_method, &chemistry,
-        status_code, &file_type, options, message) != SUCCESS)
+        &context, &file_type, options, message) != SUCCESS)
     {
         goto error;
     }
@@ -0,0 +1,132 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  test_file_handler.c - Checks that F_Open() decompresses gzip'ed trace
+ *                        files, with one member or several, into the
+ *                        contents of the original file.  Run by
+ *                        "make check".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "ABI_Toolkit.h"
+#include "SCF_Toolkit.h"
+#include "ZTR_Toolkit.h"
+#include "FileHandler.h"
+#include "Btk_qv.h"
+
+#define SCF_SIZE    (256 * 1024)
+
+/*
+ * This function writes the specified contents to a gzip file with the
+ * specified number of members, each of them holding an equal part of the
+ * contents.  Its synopsis is:
+ *
+ * result = write_gzip(path, data, size, num_members)
+ *
+ *	result	is 0 on success, -1 otherwise
+ */
+static int
+write_gzip(char *path, unsigned char *data, size_t size, int num_members)
+{
+    gzFile gz;
+    size_t part = size / num_members, start;
+    int    m;
+
+    for (m = 0; m < num_members; m++) {
+        start = m * part;
+        if ((gz = gzopen(path, (m == 0) ? "wb" : "ab")) == NULL) {
+            return -1;
+        }
+        if (gzwrite(gz, data + start, (unsigned)((m == num_members - 1)
+            ? size - start : part)) <= 0)
+        {
+            (void)gzclose(gz);
+            return -1;
+        }
+        if (gzclose(gz) != Z_OK) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * This function checks that F_Open() reads back the contents of an SCF
+ * file written with the specified number of gzip members, and returns
+ * the number of failures.
+ */
+static int
+check_gzip(unsigned char *scf, int num_members)
+{
+    TraceFile tf;
+    char      path[] = "test_file_handler.scf.gz";
+    int       failed = 0;
+
+    if (write_gzip(path, scf, SCF_SIZE, num_members) != 0) {
+        fprintf(stderr, "couldn't write %s\n", path);
+        return 1;
+    }
+    if (F_Open(path, &tf) != kNoError) {
+        fprintf(stderr, "FAILED: %d gzip member(s): F_Open failed\n",
+            num_members);
+        (void)remove(path);
+        return 1;
+    }
+    if ((tf.type != SCF) || (tf.size != SCF_SIZE)
+        || (memcmp(tf.data, scf, SCF_SIZE) != 0))
+    {
+        fprintf(stderr, "FAILED: %d gzip member(s): got %ld bytes rather "
+            "than %d\n", num_members, tf.size, SCF_SIZE);
+        failed = 1;
+    }
+    (void)F_Close(&tf);
+    (void)remove(path);
+    return failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned char *scf;
+    int            i, failed = 0;
+
+    /* An SCF file with no samples or bases, which SCF_Open() accepts */
+    if ((scf = (unsigned char *)calloc(1, SCF_SIZE)) == NULL) {
+        return 1;
+    }
+    (void)memcpy(scf, ".scf", 4);
+    for (i = 128; i < SCF_SIZE; i++) {
+        scf[i] = (unsigned char)((i * 7) ^ (i >> 9));
+    }
+
+    failed += check_gzip(scf, 1);
+    failed += check_gzip(scf, 2);
+    failed += check_gzip(scf, 5);
+    free(scf);
+
+    if (failed == 0) {
+        fprintf(stderr, "%s: passed\n", argv[0]);
+    }
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/*
+ *  test_journal.c - Checks that ttuner doesn't journal a sample file the
+ *                   output of which couldn't be written, whether the
+ *                   output goes through the writer thread (-threads,
+ *                   -prefetch) or not.  Run by "make check", with the
+ *                   path of ttuner as argument.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define DIR         "test_journal.d"
+#define NUM_FILES   6
+#define BAD_FILE    2           /* the file whose .phd.1 can't be written */
+#define NUM_BASES   400
+#define SPACING     12
+#define NUM_SAMPLES (2 * 100 + NUM_BASES * SPACING)
+#define COMMENTS    "MACH=synthetic\nDYEP=KB_3730_POP7_BDTv3.mob\n"
+
+static unsigned long Seed;
+
+static int
+random_int(int lo, int hi)
+{
+    Seed = Seed * 1103515245UL + 12345UL;
+    return lo + (int)((Seed >> 16) % (unsigned long)(hi - lo + 1));
+}
+
+static void
+put_uint(FILE *fp, unsigned long v, int len)
+{
+    while (len-- > 0) {
+        (void)fputc((int)((v >> (8 * len)) & 0xff), fp);
+    }
+}
+
+/*
+ * This function writes a synthetic SCF version 3 file of evenly spaced
+ * peaks.  Its synopsis is:
+ *
+ * result = write_scf(path, seed)
+ *
+ *	result	is 0 on success, -1 otherwise
+ */
+static int
+write_scf(char *path, unsigned long seed)
+{
+    static int  samples[4][NUM_SAMPLES];
+    static char bases[NUM_BASES];
+    int         locs[NUM_BASES], i, j, k, x, prev, pass;
+    double      height;
+    long        bases_offset, comments_offset;
+    FILE       *fp;
+
+    Seed = seed;
+    memset(samples, 0, sizeof(samples));
+    for (i = 0; i < NUM_BASES; i++) {
+        k = random_int(0, 3);
+        bases[i] = "ACGT"[k];
+        locs[i] = 100 + i * SPACING + random_int(-1, 1);
+        height = random_int(600, 1500);
+        for (x = locs[i] - 15; x <= locs[i] + 15; x++) {
+            samples[k][x] += (int)(height
+                * exp(-(x - locs[i]) * (x - locs[i]) / 12.5));
+        }
+    }
+    for (k = 0; k < 4; k++) {
+        for (x = 0; x < NUM_SAMPLES; x++) {
+            samples[k][x] += random_int(0, 10);
+        }
+        /* The samples are stored as second differences */
+        for (pass = 0; pass < 2; pass++) {
+            for (x = 0, prev = 0; x < NUM_SAMPLES; x++) {
+                j = samples[k][x];
+                samples[k][x] = (j - prev) & 0xffff;
+                prev = j;
+            }
+        }
+    }
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        return -1;
+    }
+    bases_offset    = 128 + NUM_SAMPLES * 4 * 2;
+    comments_offset = bases_offset + NUM_BASES * 12;
+    put_uint(fp, 0x2e736366UL, 4);      /* ".scf" */
+    put_uint(fp, NUM_SAMPLES, 4);
+    put_uint(fp, 128, 4);
+    put_uint(fp, NUM_BASES, 4);
+    put_uint(fp, 0, 4);
+    put_uint(fp, 0, 4);
+    put_uint(fp, bases_offset, 4);
+    put_uint(fp, sizeof(COMMENTS), 4);
+    put_uint(fp, comments_offset, 4);
+    (void)fwrite("3.00", 1, 4, fp);
+    put_uint(fp, 2, 4);                 /* sample size */
+    put_uint(fp, 0, 4);
+    put_uint(fp, 0, 4);
+    put_uint(fp, comments_offset + sizeof(COMMENTS), 4);
+    for (i = 0; i < 18; i++) {
+        put_uint(fp, 0, 4);
+    }
+    for (k = 0; k < 4; k++) {
+        for (x = 0; x < NUM_SAMPLES; x++) {
+            put_uint(fp, samples[k][x], 2);
+        }
+    }
+    for (i = 0; i < NUM_BASES; i++) {
+        put_uint(fp, locs[i], 4);
+    }
+    for (k = 0; k < 4; k++) {
+        for (i = 0; i < NUM_BASES; i++) {
+            (void)fputc((bases[i] == "ACGT"[k]) ? random_int(10, 40) : 0, fp);
+        }
+    }
+    (void)fwrite(bases, 1, NUM_BASES, fp);
+    for (i = 0; i < 3 * NUM_BASES; i++) {
+        (void)fputc(0, fp);
+    }
+    (void)fwrite(COMMENTS, 1, sizeof(COMMENTS), fp);
+
+    return (fclose(fp) == 0) ? 0 : -1;
+}
+
+/*
+ * This function runs ttuner with the specified options on the sample
+ * files, the .phd.1 file of one of which is a directory, and returns the
+ * number of failures.
+ */
+static int
+check_journal(char *ttuner, char *opts)
+{
+    char  cmd[1024], line[1024], bad[64];
+    int   num_journaled = 0, failed = 0;
+    FILE *fp;
+
+    sprintf(cmd, "rm -f " DIR "/j && %s -Q -pd " DIR "/p -journal " DIR "/j "
+        "%s -id " DIR "/in >/dev/null 2>&1", ttuner, opts);
+    (void)system(cmd);
+
+    sprintf(bad, "/read%03d.scf\t", BAD_FILE);
+    if ((fp = fopen(DIR "/j", "r")) == NULL) {
+        fprintf(stderr, "FAILED: \"%s\": no journal\n", opts);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        num_journaled++;
+        if (strstr(line, bad) != NULL) {
+            fprintf(stderr, "FAILED: \"%s\": read%03d.scf journaled\n", opts,
+                BAD_FILE);
+            failed = 1;
+        }
+    }
+    (void)fclose(fp);
+    if (num_journaled != NUM_FILES - 1) {
+        fprintf(stderr, "FAILED: \"%s\": %d files journaled rather than %d\n",
+            opts, num_journaled, NUM_FILES - 1);
+        failed = 1;
+    }
+    return failed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char path[256];
+    int  i, failed = 0;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s ttuner\n", argv[0]);
+        return 2;
+    }
+    (void)system("rm -rf " DIR);
+    sprintf(path, "mkdir -p " DIR "/in " DIR "/p/read%03d.scf.phd.1",
+        BAD_FILE);
+    if (system(path) != 0) {
+        return 1;
+    }
+    for (i = 0; i < NUM_FILES; i++) {
+        sprintf(path, DIR "/in/read%03d.scf", i);
+        if (write_scf(path, (unsigned long)i + 1) != 0) {
+            fprintf(stderr, "couldn't write %s\n", path);
+            return 1;
+        }
+    }
+
+    failed += check_journal(argv[1], "");
+    failed += check_journal(argv[1], "-prefetch 2");
+    failed += check_journal(argv[1], "-threads 3");
+    failed += check_journal(argv[1], "-threads 3 -prefetch 2");
+
+    if (failed == 0) {
+        (void)system("rm -rf " DIR);
+        fprintf(stderr, "%s: passed\n", argv[0]);
+    }
+    return (failed == 0) ? 0 : 1;
+}
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 
 #include "Btk_qv.h"
+#include "util.h"
 #include "tracepoly.h"
 
 
@@ -87,7 +88,7 @@ typedef void MyFunc( FuncArgs*, double, double[], int );
 #define MYMIN(A,B)      ( (A)<(B) ? (A) : (B) )
 #define MYMAX(A,B)      ( (A)>(B) ? (A) : (B) )
 
-static double sqrarg;
+static TT_THREAD_LOCAL double sqrarg;
 #define SQR(a) ((sqrarg=(a)) == 0.0 ? 0.0 : sqrarg*sqrarg)
 
 
@@ -253,11 +254,11 @@ free_matrix(double **m, long nrl, long nrh, long ncl, long nch)
  * using the SVD.
  ******************************************************************************/
 
-static double maxarg1,maxarg2;
+static TT_THREAD_LOCAL double maxarg1,maxarg2;
 #define FMAX(a,b) (maxarg1=(a),maxarg2=(b),(maxarg1) > (maxarg2) ?\
         (maxarg1) : (maxarg2))
 
-static int iminarg1,iminarg2;
+static TT_THREAD_LOCAL int iminarg1,iminarg2;
 #define IMIN(a,b) (iminarg1=(a),iminarg2=(b),(iminarg1) < (iminarg2) ?\
         (iminarg1) : (iminarg2))
 
@@ -0,0 +1,135 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/**
+ **  ttcolumns.c - Prints a summary of a columns file written by ttuner -bin,
+ **                or one of its columns as text, one line per read.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_qv_data.h"
+#include "Btk_columns.h"
+
+static const char *ColumnNames[BTK_NUM_COLUMNS] = {
+    "read_offsets", "name_offsets", "names", "bases", "qvs", "locs",
+    "phr3", "phr7", "psr7", "pres"
+};
+
+static void
+usage(char *prog)
+{
+    fprintf(stderr,
+    "usage: %s [ -c <column> ] <columns_file> [ <read_index(es)> ]\n"
+    "    -c <column>  Print the specified column of the reads, one line per\n"
+    "                 read: bases, qvs, locs, phr3, phr7, psr7 or pres.\n"
+    "                 By default, print the number of elements of each\n"
+    "                 column\n", prog);
+}
+
+/*
+ * This function prints the values of one read in the specified column.
+ */
+static void
+print_read(BtkColumns *columns, int column, uint64_t i)
+{
+    const void *data;
+    uint64_t    j, n;
+
+    if ((data = Btk_columns_read(columns, column, i, &n)) == NULL) {
+        return;
+    }
+    printf("%s", (const char *)Btk_columns_read(columns, BTK_COL_NAMES, i,
+        &j));
+    if (column == BTK_COL_BASES) {
+        printf(" %.*s", (int)n, (const char *)data);
+    }
+    for (j = 0; (column != BTK_COL_BASES) && (j < n); j++) {
+        if (column == BTK_COL_QVS) {
+            printf(" %d", ((const uint8_t *)data)[j]);
+        }
+        else if (column == BTK_COL_LOCS) {
+            printf(" %" PRId32, ((const int32_t *)data)[j]);
+        }
+        else {
+            printf(" %g", ((const float *)data)[j]);
+        }
+    }
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    BtkColumns columns;
+    BtkMessage message;
+    uint64_t   i, count;
+    int        c, optind = 1, column = -1;
+
+    if ((optind < argc) && (strcmp(argv[optind], "-c") == 0)) {
+        for (c = BTK_COL_BASES; (optind + 1 < argc) && (c < BTK_NUM_COLUMNS);
+            c++)
+        {
+            if (strcmp(argv[optind + 1], ColumnNames[c]) == 0) {
+                column = c;
+            }
+        }
+        if (column < 0) {
+            usage(argv[0]);
+            exit(2);
+        }
+        optind += 2;
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        exit(2);
+    }
+
+    if (Btk_columns_open(&columns, argv[optind], &message) != SUCCESS) {
+        fprintf(stderr, "%s: %s\n", argv[0], message.text);
+        exit(1);
+    }
+
+    if (column < 0) {
+        printf("reads %" PRIu64 "\nbases %" PRIu64 "\n", columns.num_reads,
+            columns.header->num_bases);
+        for (c = 0; c < BTK_NUM_COLUMNS; c++) {
+            (void)Btk_columns_column(&columns, c, &count);
+            printf("%-12s %12" PRIu64 "\n", ColumnNames[c], count);
+        }
+    }
+    else if (optind == argc - 1) {
+        for (i = 0; i < columns.num_reads; i++) {
+            print_read(&columns, column, i);
+        }
+    }
+    else {
+        for (c = optind + 1; c < argc; c++) {
+            print_read(&columns, column, (uint64_t)strtoull(argv[c], NULL, 10));
+        }
+    }
+
+    Btk_columns_close(&columns);
+    return 0;
+}
@@ -0,0 +1,217 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/**
+ **  ttextract.c - Lists the files of an archive written by ttuner -archive,
+ **                or writes the specified ones out as ordinary files.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_archive.h"
+
+static void
+usage(char *prog)
+{
+    fprintf(stderr,
+    "usage: %s [ -l ] [ -d <dir> ] <archive> [ <name(s)> ]\n"
+    "    -l        List the files of the archive, with their sizes\n"
+    "    -d <dir>  Write the files into <dir> rather than the current\n"
+    "              directory\n"
+    "    <name>    is the name of a file of the archive, e.g. read1.phd.1,\n"
+    "              or the name of a read, e.g. read1, which stands for all\n"
+    "              the files of that read. By default, all the files are\n"
+    "              written\n", prog);
+}
+
+/*
+ * This function tells whether the specified entry name stays within the
+ * directory of the extracted files, i.e. is not absolute and has no ".."
+ * component.  The names written by ttuner have no path at all, but those
+ * of an archive from elsewhere can't be trusted.
+ */
+static int
+is_safe_name(char *name)
+{
+    char *s;
+
+    if ((name[0] == '\0') || (name[0] == '/') || (name[0] == '\\')) {
+        return 0;
+    }
+    for (s = name; *s != '\0'; s += strcspn(s, "/\\")) {
+        if ((*s == '/') || (*s == '\\')) {
+            s++;
+        }
+        if ((s[0] == '.') && (s[1] == '.')
+            && ((s[2] == '\0') || (s[2] == '/') || (s[2] == '\\')))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * This function writes the specified entry of an archive into a file of
+ * the same name in the directory dir.
+ */
+static int
+extract_entry(BtkArchive *archive, int i, char *dir, BtkMessage *message)
+{
+    BtkArchiveEntry *e = &archive->entries[i];
+    char             path[BUFLEN];
+    char            *data;
+    FILE            *fp;
+
+    if (!is_safe_name(e->name)) {
+        sprintf(message->text, "%.200s: not extracted, the name leaves the "
+            "directory", e->name);
+        return ERROR;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s", dir, e->name)
+        >= (int)sizeof(path))
+    {
+        sprintf(message->text, "%.200s: name too long", e->name);
+        return ERROR;
+    }
+    if ((data = CALLOC(char, e->size + 1)) == NULL) {
+        sprintf(message->text, "%.200s: out of memory", e->name);
+        return ERROR;
+    }
+    if (Btk_archive_read(archive, i, data) != SUCCESS) {
+        sprintf(message->text, "%.200s: couldn't read from the archive",
+            e->name);
+        FREE(data);
+        return ERROR;
+    }
+    if (((fp = fopen(path, "wb")) == NULL)
+        || (fwrite(data, 1, e->size, fp) != e->size)
+        || (fclose(fp) != 0))
+    {
+        sprintf(message->text, "%.200s: couldn't write: %s", path,
+            strerror(errno));
+        FREE(data);
+        return ERROR;
+    }
+    FREE(data);
+    return SUCCESS;
+}
+
+/*
+ * This function extracts the files of the specified name, i.e. the file of
+ * that name or, failing that, the files of the read of that name.
+ */
+static int
+extract_name(BtkArchive *archive, char *name, char *dir, BtkMessage *message)
+{
+    int    i, found = 0;
+    size_t len = strlen(name);
+
+    if ((i = Btk_archive_find(archive, name)) >= 0) {
+        return extract_entry(archive, i, dir, message);
+    }
+
+    /* The files of a read are named <read>.<extension>; the last entry of
+     * each name is the one which counts
+     */
+    for (i = 0; i < archive->num_entries; i++) {
+        if ((strncmp(archive->entries[i].name, name, len) == 0)
+            && (archive->entries[i].name[len] == '.')
+            && (Btk_archive_find(archive, archive->entries[i].name) == i))
+        {
+            if (extract_entry(archive, i, dir, message) != SUCCESS) {
+                return ERROR;
+            }
+            found++;
+        }
+    }
+    if (!found) {
+        sprintf(message->text, "%.200s: not in the archive", name);
+        return ERROR;
+    }
+    return SUCCESS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    BtkArchive archive;
+    BtkMessage message;
+    char      *dir = ".";
+    int        i, optind, list = 0, r = SUCCESS;
+
+    for (optind = 1; (optind < argc) && (argv[optind][0] == '-'); optind++) {
+        if (strcmp(argv[optind], "-l") == 0) {
+            list++;
+        }
+        else if ((strcmp(argv[optind], "-d") == 0) && (optind + 1 < argc)) {
+            dir = argv[++optind];
+        }
+        else {
+            usage(argv[0]);
+            exit(2);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        exit(2);
+    }
+
+    if (Btk_archive_open(&archive, argv[optind], BTK_ARCHIVE_READ, &message)
+        != SUCCESS)
+    {
+        fprintf(stderr, "%s: %s\n", argv[0], message.text);
+        exit(1);
+    }
+
+    if (list) {
+        for (i = 0; i < archive.num_entries; i++) {
+            printf("%12" PRIu64 " %s\n", archive.entries[i].size,
+                archive.entries[i].name);
+        }
+    }
+    else if (optind == argc - 1) {
+        /* All the files, the last entry of each name */
+        for (i = 0; i < archive.num_entries; i++) {
+            if ((Btk_archive_find(&archive, archive.entries[i].name) == i)
+                && (extract_entry(&archive, i, dir, &message) != SUCCESS))
+            {
+                fprintf(stderr, "%s: %s\n", argv[0], message.text);
+                r = ERROR;
+            }
+        }
+    }
+    else {
+        for (i = optind + 1; i < argc; i++) {
+            if (extract_name(&archive, argv[i], dir, &message) != SUCCESS) {
+                fprintf(stderr, "%s: %s\n", argv[0], message.text);
+                r = ERROR;
+            }
+        }
+    }
+
+    (void)Btk_archive_close(&archive, &message);
+    return (r == SUCCESS) ? 0 : 1;
+}
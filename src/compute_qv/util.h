@@ -39,6 +39,15 @@
 	goto error; \
     }
 
+/* Storage class for file-scope state which must be private to each
+ * worker thread of a multi-threaded (-threads) run
+ */
+#ifdef __DEVSTUDIO
+#define TT_THREAD_LOCAL __declspec(thread)
+#else
+#define TT_THREAD_LOCAL __thread
+#endif
+
 #define MIN2(a,b)	((a) < (b) ? (a) : (b))
 #define MAX2(a,b)	((a) > (b) ? (a) : (b))
 
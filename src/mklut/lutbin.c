@@ -0,0 +1,99 @@
+/**************************************************************************
+ * This file is part of TraceTuner, the DNA sequencing quality value,
+ * base calling and trace processing software.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received (LICENSE.txt) a copy of the GNU General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *************************************************************************/
+
+/**
+ **  lutbin.c - Converts a text lookup table written by lut, or one of the
+ **             built-in tables of ttuner, to the binary format which
+ **             ttuner -t maps without parsing.
+ **/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "Btk_qv.h"
+#include "util.h"
+#include "Btk_lookup_table.h"
+#include "Btk_default_table.h"
+
+static void
+usage(char *prog)
+{
+    fprintf(stderr,
+    "Version: %s\n"
+    "usage: %s\n"
+    "     [ -3730 | -3700pop5 | -3700pop6 | -3100 | -mbace ]\n"
+    "     [ <text_table> ] <binary_table>\n"
+    "    -3730, -3700pop5, -3700pop6, -3100, -mbace  Convert the built-in\n"
+    "                 table of ttuner for the specified instrument rather\n"
+    "                 than a <text_table> written by lut\n", TT_VERSION, prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+    BtkLookupTable *table = NULL;
+    int             optind = 1;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        exit(2);
+    }
+    if (strcmp(argv[optind], "-3730") == 0) {
+        table = Btk_get_3730pop7_table();
+    }
+    else if (strcmp(argv[optind], "-3700pop5") == 0) {
+        table = Btk_get_3700pop5_table();
+    }
+    else if (strcmp(argv[optind], "-3700pop6") == 0) {
+        table = Btk_get_3700pop6_table();
+    }
+    else if (strcmp(argv[optind], "-3100") == 0) {
+        table = Btk_get_3100pop6_table();
+    }
+    else if (strcmp(argv[optind], "-mbace") == 0) {
+        table = Btk_get_mbace_table();
+    }
+    if (table != NULL) {
+        optind++;
+    }
+    if (argc - optind != ((table != NULL) ? 1 : 2)) {
+        usage(argv[0]);
+        exit(2);
+    }
+
+    if ((table == NULL)
+        && ((table = Btk_read_lookup_table(argv[optind++])) == NULL))
+    {
+        fprintf(stderr, "%s: couldn't read lookup table '%s'\n", argv[0],
+            argv[optind - 1]);
+        exit(1);
+    }
+    if (Btk_write_lookup_table_binary(table, argv[optind]) != SUCCESS) {
+        fprintf(stderr, "%s: couldn't write '%s': %s\n", argv[0],
+            argv[optind], strerror(errno));
+        exit(1);
+    }
+    if (Btk_qv_grid(table) == NULL) {
+        fprintf(stderr, "%s: the table is too large to be compiled into a "
+            "grid; ttuner will search it entry by entry\n", argv[0]);
+    }
+    Btk_destroy_lookup_table(table);
+    return 0;
+}
@@ -1066,10 +1066,13 @@ alignment_parameters_release(Align_params* ap, BtkMessage* message)
 {
     int i;
 
-    for(i=0;i<ap->matrix_row_len;i++) {
-        FREE(ap->matrix[i]); 
+    if (ap->matrix != NULL) {
+        for(i=0;i<ap->matrix_row_len;i++) {
+            FREE(ap->matrix[i]); 
+        }
     }
     FREE(ap->matrix); 
+    ap->matrix_row_len = 0;   /* so that a second release does nothing */
     return SUCCESS;
 }
 
@@ -111,7 +111,6 @@ static double MaxFractionOfErrors; /* If the fraction of errors within
                                     * rejected, that is, will not be used 
                                     * in the training process
                                     */
-static char status_code[BUFLEN];
 static int nocall;                 /* Whether to use ABI base calls */
 static int recalln;                /* Whether to only recall 'N's to the best guess*/
 static int recallndb;              /* Whether to only recall 'N's and dye blobs 
@@ -697,8 +696,10 @@ process_sample_file(Align_params *alp,
     int             alignment_size, interval = MIN_LEN_SWEET_SPOT, min_num_err;
     BtkLookupTable *lookup_tbl=NULL;
     ReadInfo        read_info;
+    BtkReadContext  context;
     char	   *consensus_seq = NULL;
 
+    Btk_init_read_context(&context);
     if (!ConsensusSpecified) {
         contig_init(consensus, message);
         contig_init(consensusrc, message);
@@ -765,10 +766,10 @@ process_sample_file(Align_params *alp,
         edited_bases, &peak_locs, &quality_values, &num_datapoints, 
         &chromatogram[0], &chromatogram[1], 
         &chromatogram[2], &chromatogram[3], 
-      	&call_method, &chemistry, status_code, &filetype, options,  /* global */
+      	&call_method, &chemistry, &context, &filetype, options,
         message)) != SUCCESS)
     {
-        if (filetype != ABI && filetype != SCF)
+        if (filetype != ABI && filetype != SCF && filetype != ZTR)
         {
             Btk_release_file_data(bases, peak_locs, quality_values,
                 chromatogram, &call_method, &chemistry);
@@ -929,7 +930,7 @@ process_sample_file(Align_params *alp,
                 &num_datapoints, chromatogram, "ACGT", NUM_PARAMS, 
                 &params[0], &params[1], &params[2], &params[3], 
                 &iheight, &iheight2, &ave_iheight, &read_info, table, ctable, 
-                options, message, results ) != SUCCESS)
+                options, &context, message, results ) != SUCCESS)
         {
             Count_processing_errors++;
             release1_sanger(bases, peak_locs, chromatogram, quality_values, 
@@ -981,7 +982,7 @@ process_sample_file(Align_params *alp,
                 &num_datapoints, chromatogram, "ACGT", NUM_PARAMS,
                 &params[0], &params[1], &params[2], &params[3],
                 &iheight, &iheight2, &ave_iheight, &read_info, table, ctable, 
-                options, message, results ) != SUCCESS)
+                options, &context, message, results ) != SUCCESS)
         {
             Count_processing_errors++;
             release1_sanger(bases, peak_locs, chromatogram, quality_values, 
@@ -39,6 +39,8 @@
 #include <stdint.h>
 
 #include "ABI_Toolkit.h"
+#include "SCF_Toolkit.h"
+#include "ZTR_Toolkit.h"
 #include "FileHandler.h"
 #include "Btk_qv.h"
 #include "util.h"